@@ -8,191 +8,990 @@
  * Copyright (C) 2011-2013 Idiap Research Institute, Martigny, Switzerland
  */
 
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+#include <stdint.h>
 #include <bob.core/assert.h>
-#include <bob.sp/conv.h>
-#include <bob.sp/extrapolate.h>
 
 #include "HornAndSchunckFlow.h"
+#include "Simd.h"
+#include "Stencil.h"
 
-static const double LAPLACIAN_014_KERNEL_DATA[] = {0,.25,0,.25,0,.25,0,.25,0};
-static const blitz::Array<double,2> LAPLACIAN_014_KERNEL(const_cast<double*>(LAPLACIAN_014_KERNEL_DATA), blitz::shape(3,3), blitz::neverDeleteData);
+using bob::ip::optflow::detail::HSAverage;
+using bob::ip::optflow::detail::OpenCVAverage;
+using bob::ip::optflow::detail::lanes;
+using bob::ip::optflow::detail::load;
+using bob::ip::optflow::detail::store;
+
+/**
+ * Applies one of the averaging operators of Stencil.h to the whole input.
+ * Borders are mirrored inside the loop, so this does not allocate any
+ * padded copy of the input. The input may be strided, but must not overlap
+ * the output. If both have contiguous rows, the inner columns are treated
+ * lanes<V>::value at a time.
+ */
+template <typename V, typename Average, typename T>
+static void laplacian_avg(const blitz::Array<T,2>& input,
+    blitz::Array<T,2>& output) {
+
+  const int height = input.extent(0);
+  const int width = input.extent(1);
+  const int stride = input.stride(1);
+
+  if (lanes<V>::value > 1 && (stride != 1 || output.stride(1) != 1)) {
+    laplacian_avg<T, Average>(input, output);
+    return;
+  }
+
+  for (int i=0; i<height; ++i) {
+    const T* up = &input((i > 0) ? i-1 : 0, 0);
+    const T* mid = &input(i, 0);
+    const T* down = &input((i < height-1) ? i+1 : height-1, 0);
+    int j = 0;
+    if (lanes<V>::value > 1) {
+      T* out = &output(i, 0);
+      out[0] = Average::apply(up, mid, down, 0, 0, (width > 1) ? 1 : 0);
+      for (j=1; j+lanes<V>::value<width; j+=lanes<V>::value) {
+        store(out+j, Average::combine(load<V>(up+j-1), load<V>(up+j),
+              load<V>(up+j+1), load<V>(mid+j-1), load<V>(mid+j+1),
+              load<V>(down+j-1), load<V>(down+j), load<V>(down+j+1)));
+      }
+    }
+    for (; j<width; ++j) {
+      const int l = (j > 0) ? j-1 : 0;
+      const int r = (j < width-1) ? j+1 : width-1;
+      output(i,j) = Average::apply(up, mid, down, l*stride, j*stride,
+          r*stride);
+    }
+  }
+
+}
+
+/**
+ * Runs laplacian_avg() with the instruction set currently selected
+ */
+template <typename Average, typename T>
+struct laplacian_avg_kernel {
+  const blitz::Array<T,2>& input;
+  blitz::Array<T,2>& output;
+  template <typename V> void run() const {
+    laplacian_avg<V, Average>(input, output);
+  }
+};
+
+template <typename T>
+void bob::ip::optflow::laplacian_avg_hs_opencv(const blitz::Array<T,2>& input,
+    blitz::Array<T,2>& output) {
+  bob::core::array::assertSameShape(input, output);
+  bob::ip::optflow::detail::simd_dispatch<T>(
+      laplacian_avg_kernel<OpenCVAverage, T>{input, output});
+}
+
+template <typename T>
+void bob::ip::optflow::laplacian_avg_hs(const blitz::Array<T,2>& input,
+    blitz::Array<T,2>& output) {
+  bob::core::array::assertSameShape(input, output);
+  bob::ip::optflow::detail::simd_dispatch<T>(
+      laplacian_avg_kernel<HSAverage, T>{input, output});
+}
+
+template void bob::ip::optflow::laplacian_avg_hs_opencv<float>
+(const blitz::Array<float,2>&, blitz::Array<float,2>&);
+template void bob::ip::optflow::laplacian_avg_hs_opencv<double>
+(const blitz::Array<double,2>&, blitz::Array<double,2>&);
+template void bob::ip::optflow::laplacian_avg_hs<float>
+(const blitz::Array<float,2>&, blitz::Array<float,2>&);
+template void bob::ip::optflow::laplacian_avg_hs<double>
+(const blitz::Array<double,2>&, blitz::Array<double,2>&);
+
+/**
+ * Updates a single pixel (column c) of the flow, given the rows of the
+ * previous iterate surrounding it.
+ */
+template <typename Average, typename T>
+static inline void hs_pixel(const T* ex, const T* ey, const T* cx,
+    const T* cy, const T* ct, const T* u_up, const T* u_mid,
+    const T* u_down, const T* v_up, const T* v_mid, const T* v_down, T* un,
+    T* vn, int l, int c, int r) {
+  const T ubar = Average::apply(u_up, u_mid, u_down, l, c, r);
+  const T vbar = Average::apply(v_up, v_mid, v_down, l, c, r);
+  const T cterm = cx[c]*ubar + cy[c]*vbar + ct[c];
+  un[c] = ubar - ex[c]*cterm;
+  vn[c] = vbar - ey[c]*cterm;
+}
+
+/**
+ * Updates lanes<V>::value consecutive pixels of the flow, starting at
+ * column j, which must all have both neighbours in the row. This performs
+ * exactly the operations of hs_pixel() on each of them.
+ */
+template <typename V, typename Average, typename T>
+static inline void hs_pixels(const T* ex, const T* ey, const T* cx,
+    const T* cy, const T* ct, const T* u_up, const T* u_mid,
+    const T* u_down, const T* v_up, const T* v_mid, const T* v_down, T* un,
+    T* vn, int j) {
+  const V ubar = Average::combine(load<V>(u_up+j-1), load<V>(u_up+j),
+      load<V>(u_up+j+1), load<V>(u_mid+j-1), load<V>(u_mid+j+1),
+      load<V>(u_down+j-1), load<V>(u_down+j), load<V>(u_down+j+1));
+  const V vbar = Average::combine(load<V>(v_up+j-1), load<V>(v_up+j),
+      load<V>(v_up+j+1), load<V>(v_mid+j-1), load<V>(v_mid+j+1),
+      load<V>(v_down+j-1), load<V>(v_down+j), load<V>(v_down+j+1));
+  const V cterm = load<V>(cx+j)*ubar + load<V>(cy+j)*vbar + load<V>(ct+j);
+  store(un+j, ubar - load<V>(ex+j)*cterm);
+  store(vn+j, vbar - load<V>(ey+j)*cterm);
+}
+
+/**
+ * Updates one row of the flow, given the rows of the previous iterate above
+ * (up), on (mid) and below (down) it, and the matching row of the gradients
+ * and coefficient planes. The inner columns are updated lanes<V>::value at a
+ * time and the borders are mirrored in place.
+ */
+template <typename V, typename Average, typename T>
+static inline void hs_row(const T* ex_i, const T* ey_i, const T* cx_i,
+    const T* cy_i, const T* ct_i, const T* u_up, const T* u_mid,
+    const T* u_down, const T* v_up, const T* v_mid, const T* v_down,
+    T* un_i, T* vn_i, int width) {
+
+  const int last = width - 1;
+
+  if (width == 1) {
+    hs_pixel<Average>(ex_i, ey_i, cx_i, cy_i, ct_i, u_up, u_mid, u_down,
+        v_up, v_mid, v_down, un_i, vn_i, 0, 0, 0);
+    return;
+  }
+
+  hs_pixel<Average>(ex_i, ey_i, cx_i, cy_i, ct_i, u_up, u_mid, u_down,
+      v_up, v_mid, v_down, un_i, vn_i, 0, 0, 1);
+  int j = 1;
+  for (; j+lanes<V>::value<=last; j+=lanes<V>::value) {
+    hs_pixels<V, Average>(ex_i, ey_i, cx_i, cy_i, ct_i, u_up, u_mid,
+        u_down, v_up, v_mid, v_down, un_i, vn_i, j);
+  }
+  for (; j<last; ++j) {
+    hs_pixel<Average>(ex_i, ey_i, cx_i, cy_i, ct_i, u_up, u_mid, u_down,
+        v_up, v_mid, v_down, un_i, vn_i, j-1, j, j+1);
+  }
+  hs_pixel<Average>(ex_i, ey_i, cx_i, cy_i, ct_i, u_up, u_mid, u_down,
+      v_up, v_mid, v_down, un_i, vn_i, last-1, last, last);
+
+}
+
+/**
+ * Stores the squared norm of the update of a row, from (u, v) to (un, vn),
+ * in delta and the squared norm of (un, vn) in norm
+ */
+template <typename T>
+static inline void hs_row_norms(const T* u, const T* v, const T* un,
+    const T* vn, int width, double& delta, double& norm) {
+  double d = 0.;
+  double n = 0.;
+  for (int j=0; j<width; ++j) {
+    const double du = un[j] - u[j];
+    const double dv = vn[j] - v[j];
+    d += du*du + dv*dv;
+    n += un[j]*un[j] + vn[j]*vn[j];
+  }
+  delta = d;
+  norm = n;
+}
+
+/**
+ * A single Jacobi iteration of the Horn & Schunck method over the rows
+ * [start, end). This fuses the Laplacian averaging of u and v with the
+ * flow update, so each pixel of the previous iterate (u, v) and of the
+ * coefficient planes is read once and the next iterate (un, vn) is written
+ * in the same row-major sweep. Borders are mirrored in place, reproducing the
+ * extrapolation used by the Laplacian operators.
+ *
+ * If delta and norm are not null, the squared norm of the update and of the
+ * next iterate on each row i are stored in delta[i] and norm[i], while the
+ * row is still in cache.
+ *
+ * All arrays must share the same shape and have contiguous rows. The flow
+ * buffers must be C-contiguous, while the gradient and coefficient planes
+ * may be the interleaved rows of packed records (see hs_planes()).
+ */
+template <typename V, typename Average, typename T>
+static void hs_sweep(const blitz::Array<T,2>& ex,
+    const blitz::Array<T,2>& ey, const blitz::Array<T,2>& cx,
+    const blitz::Array<T,2>& cy, const blitz::Array<T,2>& ct,
+    const blitz::Array<T,2>& u, const blitz::Array<T,2>& v,
+    blitz::Array<T,2>& un, blitz::Array<T,2>& vn,
+    double* delta, double* norm, int start, int end) {
+
+  const int height = u.extent(0);
+  const int width = u.extent(1);
+
+  for (int i=start; i<end; ++i) {
+    const int up = (i > 0) ? i-1 : 0;
+    const int down = (i < height-1) ? i+1 : height-1;
+    hs_row<V, Average>(&ex(i,0), &ey(i,0), &cx(i,0), &cy(i,0), &ct(i,0),
+        &u(up,0), &u(i,0), &u(down,0), &v(up,0), &v(i,0), &v(down,0),
+        &un(i,0), &vn(i,0), width);
+    if (delta) hs_row_norms(&u(i,0), &v(i,0), &un(i,0), &vn(i,0), width,
+        delta[i], norm[i]);
+  }
 
-void bob::ip::optflow::laplacian_avg_hs_opencv(const blitz::Array<double,2>& input,
-    blitz::Array<double,2>& output) {
-  blitz::Array<double,2> inputExtra(bob::sp::getConvOutputSize(input, LAPLACIAN_014_KERNEL, bob::sp::Conv::Full));
-  bob::sp::extrapolateMirror(input, inputExtra);
-  bob::sp::conv(input, LAPLACIAN_014_KERNEL, output,
-      bob::sp::Conv::Valid);
 }
 
-static const double _12 = 1./12.;
-static const double _6 = 1./6.;
-static const double LAPLACIAN_12_KERNEL_DATA[] = {_12,_6,_12,_6,0,_6,_12,_6,_12};
-static const blitz::Array<double,2> LAPLACIAN_12_KERNEL(const_cast<double*>(LAPLACIAN_12_KERNEL_DATA), blitz::shape(3,3), blitz::neverDeleteData);
+/**
+ * Runs hs_sweep() with the instruction set currently selected
+ */
+template <typename Average, typename T>
+struct hs_sweep_kernel {
+  const blitz::Array<T,2>& ex;
+  const blitz::Array<T,2>& ey;
+  const blitz::Array<T,2>& cx;
+  const blitz::Array<T,2>& cy;
+  const blitz::Array<T,2>& ct;
+  const blitz::Array<T,2>& u;
+  const blitz::Array<T,2>& v;
+  blitz::Array<T,2>& un;
+  blitz::Array<T,2>& vn;
+  double* delta;
+  double* norm;
+  int start;
+  int end;
+  template <typename V> void run() const {
+    hs_sweep<V, Average>(ex, ey, cx, cy, ct, u, v, un, vn, delta, norm,
+        start, end);
+  }
+};
+
+/**
+ * Runs depth Jacobi iterations on each of the tiles [first, end) of rows
+ * rows, from (u, v) to (un, vn), with temporal blocking.
+ *
+ * Tile t covers rows [t*rows, (t+1)*rows) of the frame. Its rows and a halo
+ * of depth rows on each side are copied to the scratch buffer, where the
+ * iterations ping-pong, each one on a range of rows one row narrower on
+ * both sides than the previous one (the neighbours of those rows having
+ * been updated by then). The last iteration is left with the rows of the
+ * tile, which are written to (un, vn). The halo is clipped at the borders
+ * of the frame, where rows are mirrored as in hs_sweep(). Each row goes
+ * through hs_row(), so the results are identical to those of depth calls to
+ * hs_sweep(), while (u, v) and (un, vn) are only touched once.
+ *
+ * The scratch buffer must hold 4*(rows+2*depth)*width values. If delta and
+ * norm are not null, the norms of iteration s (0 to depth-1) on row i of
+ * the tile are stored in delta[s*height+i] and norm[s*height+i].
+ */
+template <typename V, typename Average, typename T>
+static void hs_tiles(const blitz::Array<T,2>& ex,
+    const blitz::Array<T,2>& ey, const blitz::Array<T,2>& cx,
+    const blitz::Array<T,2>& cy, const blitz::Array<T,2>& ct,
+    const blitz::Array<T,2>& u, const blitz::Array<T,2>& v,
+    blitz::Array<T,2>& un, blitz::Array<T,2>& vn, T* scratch, int rows,
+    int depth, double* delta, double* norm, int first, int end) {
+
+  const int height = u.extent(0);
+  const int width = u.extent(1);
+  const size_t plane = static_cast<size_t>(rows+2*depth) * width;
+  T* su[2] = {scratch, scratch + plane};
+  T* sv[2] = {scratch + 2*plane, scratch + 3*plane};
+
+  for (int t=first; t<end; ++t) {
+    const int a = t*rows;
+    const int b = std::min(a+rows, height);
+    const int lo = std::max(a-depth, 0);
+    const int hi = std::min(b+depth, height);
+    std::copy(&u(lo,0), &u(lo,0) + (hi-lo)*width, su[0]);
+    std::copy(&v(lo,0), &v(lo,0) + (hi-lo)*width, sv[0]);
+
+    for (int s=1; s<=depth; ++s) {
+      const T* uc = su[(s-1)&1];
+      const T* vc = sv[(s-1)&1];
+      const int start = std::max(a-depth+s, 0);
+      const int stop = std::min(b+depth-s, height);
+      for (int i=start; i<stop; ++i) {
+        const int up = (i > 0) ? i-1 : 0;
+        const int down = (i < height-1) ? i+1 : height-1;
+        const T* u_mid = uc + (i-lo)*width;
+        const T* v_mid = vc + (i-lo)*width;
+        T* un_i = (s == depth) ? &un(i,0) : su[s&1] + (i-lo)*width;
+        T* vn_i = (s == depth) ? &vn(i,0) : sv[s&1] + (i-lo)*width;
+        hs_row<V, Average>(&ex(i,0), &ey(i,0), &cx(i,0), &cy(i,0),
+            &ct(i,0), uc + (up-lo)*width, u_mid, uc + (down-lo)*width,
+            vc + (up-lo)*width, v_mid, vc + (down-lo)*width, un_i, vn_i,
+            width);
+        if (delta && i >= a && i < b) {
+          const size_t k = static_cast<size_t>(s-1)*height + i;
+          hs_row_norms(u_mid, v_mid, un_i, vn_i, width, delta[k], norm[k]);
+        }
+      }
+    }
+  }
 
-void bob::ip::optflow::laplacian_avg_hs(const blitz::Array<double,2>& input,
-    blitz::Array<double,2>& output) {
-  blitz::Array<double,2> inputExtra(bob::sp::getConvOutputSize(input, LAPLACIAN_12_KERNEL, bob::sp::Conv::Full));
-  bob::sp::extrapolateMirror(input, inputExtra);
-  bob::sp::conv(input, LAPLACIAN_12_KERNEL, output,
-      bob::sp::Conv::Valid);
 }
-bob::ip::optflow::VanillaHornAndSchunckFlow::VanillaHornAndSchunckFlow
+
+/**
+ * Runs hs_tiles() with the instruction set currently selected
+ */
+template <typename Average, typename T>
+struct hs_tiles_kernel {
+  const blitz::Array<T,2>& ex;
+  const blitz::Array<T,2>& ey;
+  const blitz::Array<T,2>& cx;
+  const blitz::Array<T,2>& cy;
+  const blitz::Array<T,2>& ct;
+  const blitz::Array<T,2>& u;
+  const blitz::Array<T,2>& v;
+  blitz::Array<T,2>& un;
+  blitz::Array<T,2>& vn;
+  T* scratch;
+  int rows;
+  int depth;
+  double* delta;
+  double* norm;
+  int first;
+  int end;
+  template <typename V> void run() const {
+    hs_tiles<V, Average>(ex, ey, cx, cy, ct, u, v, un, vn, scratch, rows,
+        depth, delta, norm, first, end);
+  }
+};
+
+/**
+ * A single over-relaxed Gauss-Seidel sweep of the Horn & Schunck method
+ * over the pixels of one colour in rows [start, end). The flow (u, v) is
+ * updated in place: each pixel is first solved for, given the current
+ * values of its neighbours, and then moved by omega times that correction.
+ *
+ * Pixels are coloured by the parity of their coordinates so that no two
+ * pixels of the same colour are neighbours (see Stencil.h): 2 colours
+ * (red-black) suffice for the 4-neighbour stencil, while the 9-point
+ * stencil needs 4. The pixels of one colour therefore do not depend on each
+ * other and may be visited in any order.
+ *
+ * If delta and norm are not null, the squared norm of the updates and of
+ * the new values on each row i are added to delta[i] and norm[i].
+ */
+template <typename Average, typename T>
+static void hs_sor_sweep(double omega, const blitz::Array<T,2>& ex,
+    const blitz::Array<T,2>& ey, const blitz::Array<T,2>& cx,
+    const blitz::Array<T,2>& cy, const blitz::Array<T,2>& ct,
+    blitz::Array<T,2>& u, blitz::Array<T,2>& v, int colour,
+    double* delta, double* norm, int start, int end) {
+
+  const int height = u.extent(0);
+  const int width = u.extent(1);
+  const T w = omega;
+
+  for (int i=start; i<end; ++i) {
+    const int first = bob::ip::optflow::detail::first_of_colour<Average>(
+        colour, i);
+    if (first < 0) continue;
+
+    const int up = (i > 0) ? i-1 : 0;
+    const int down = (i < height-1) ? i+1 : height-1;
+    const T* ex_i = &ex(i,0);
+    const T* ey_i = &ey(i,0);
+    const T* cx_i = &cx(i,0);
+    const T* cy_i = &cy(i,0);
+    const T* ct_i = &ct(i,0);
+    const T* u_up = &u(up,0);
+    T* u_mid = &u(i,0);
+    const T* u_down = &u(down,0);
+    const T* v_up = &v(up,0);
+    T* v_mid = &v(i,0);
+    const T* v_down = &v(down,0);
+
+    double d = 0.;
+    double n = 0.;
+    for (int j=first; j<width; j+=2) {
+      const int l = (j > 0) ? j-1 : 0;
+      const int r = (j < width-1) ? j+1 : width-1;
+      const T ubar = Average::apply(u_up, u_mid, u_down, l, j, r);
+      const T vbar = Average::apply(v_up, v_mid, v_down, l, j, r);
+      const T cterm = cx_i[j]*ubar + cy_i[j]*vbar + ct_i[j];
+      const T ugs = ubar - ex_i[j]*cterm;
+      const T vgs = vbar - ey_i[j]*cterm;
+      const T du = w*(ugs - u_mid[j]);
+      const T dv = w*(vgs - v_mid[j]);
+      u_mid[j] += du;
+      v_mid[j] += dv;
+      if (delta) {
+        d += du*du + dv*dv;
+        n += u_mid[j]*u_mid[j] + v_mid[j]*v_mid[j];
+      }
+    }
+
+    if (delta) {
+      delta[i] += d;
+      norm[i] += n;
+    }
+  }
+
+}
+
+/**
+ * Estimates a good relaxation factor for the SOR solver, given the shape of
+ * the flow field. This is the classical optimum for the Laplacian part of
+ * the system, 2/(1 + sqrt(1 - rho^2)), where rho is the spectral radius of
+ * the Jacobi iteration on a height x width grid. The data term only makes
+ * the system better conditioned.
+ */
+static double hs_relaxation(int height, int width) {
+  static const double pi = 3.14159265358979323846;
+  const double rho = (std::cos(pi/(height+1)) + std::cos(pi/(width+1))) / 2.;
+  return 2. / (1. + std::sqrt(1. - rho*rho));
+}
+
+/**
+ * Tells if the relative norm of the last update, out of the per-row sums
+ * left by the sweeps, is below the tolerance. Rows are summed in order, so
+ * the decision does not depend on the number of threads.
+ */
+static bool hs_converged(const double* delta, const double* norm, int rows,
+    double tolerance) {
+  double d = 0.;
+  double n = 0.;
+  for (int i=0; i<rows; ++i) {
+    d += delta[i];
+    n += norm[i];
+  }
+  return d <= tolerance*tolerance*n;
+}
+
+/**
+ * Runs the requested number of iterations of the selected solver, starting
+ * from (u0, v0). The Jacobi and SOR solvers read the gradients ex and ey
+ * and the coefficient planes, with D = Ex^2 + Ey^2 + a2, cx = Ex/D,
+ * cy = Ey/D and ct = Et/D, which are iteration-invariant and must have been
+ * built along with the gradients (see ForwardGradient::coefficients()). The
+ * multigrid solver reads the raw gradients ex, ey and et instead. The final
+ * estimate is written back to (u0, v0). If the tolerance is positive, the
+ * solver stops as soon as the relative norm of an update falls below it.
+ * Returns the number of iterations that were run.
+ *
+ * The Jacobi solver ping-pongs between the (contiguous) internal buffers
+ * (u, v) and (u2, v2). If tile_depth is larger than 1, it runs blocks of
+ * tile_depth iterations tile by tile (see hs_tiles()). With a tolerance,
+ * the norms of all iterations of a block are kept, and if an iteration
+ * inside the block converges, the block is re-run from its start (still in
+ * (u, v)) up to that iteration. The SOR solver works in place on (u, v),
+ * one colour after the other. The multigrid solver keeps its own buffers,
+ * and runs one cycle per iteration.
+ *
+ * The frame is split in one row band per thread of the pool. The bands of
+ * a Jacobi iteration, or of a colour in SOR, do not depend on each other,
+ * so they are updated independently and the pool joins them before the
+ * next step starts. The result is therefore identical to the serial one.
+ */
+template <typename Average, typename T>
+static size_t hs_solve(bob::ip::optflow::ThreadPool& pool,
+    const bob::ip::optflow::MultigridSolver& multigrid,
+    bob::ip::optflow::Solver::Type solver, double omega, double a2,
+    size_t iterations, double tolerance, size_t tile_rows,
+    size_t tile_depth, const blitz::Array<T,2>& ex,
+    const blitz::Array<T,2>& ey, const blitz::Array<T,2>& et,
+    const blitz::Array<T,2>& cx, const blitz::Array<T,2>& cy,
+    const blitz::Array<T,2>& ct, blitz::Array<T,2>& u,
+    blitz::Array<T,2>& v, blitz::Array<T,2>& u2,
+    blitz::Array<T,2>& v2, blitz::Array<T,2>& u0,
+    blitz::Array<T,2>& v0, blitz::Array<double,1>& delta,
+    blitz::Array<double,1>& norm) {
+
+  if (solver == bob::ip::optflow::Solver::Multigrid) {
+    return multigrid.solve<Average>(pool, a2, iterations, tolerance, ex, ey,
+        et, u0, v0);
+  }
+
+  const int height = u.extent(0);
+  const size_t bands = std::min(pool.getThreads(),
+      static_cast<size_t>(height));
+
+  u = u0;
+  v = v0;
+
+  double* delta_ = (tolerance > 0.) ? delta.data() : 0;
+  double* norm_ = (tolerance > 0.) ? norm.data() : 0;
+  size_t n = 0;
+
+  if (solver == bob::ip::optflow::Solver::SOR) {
+
+    if (omega <= 0.) omega = hs_relaxation(height, u.extent(1));
+    else if (omega >= 2.) throw std::runtime_error("the relaxation factor of the SOR solver must lie in the interval (0, 2)");
+
+    int colour = 0;
+    const std::function<void(size_t)> sweep = [&](size_t b) {
+      hs_sor_sweep<Average>(omega, ex, ey, cx, cy, ct, u, v, colour,
+          delta_, norm_, bob::ip::optflow::band_start(height, bands, b),
+          bob::ip::optflow::band_start(height, bands, b+1));
+    };
+
+    while (n < iterations) {
+      if (delta_) {
+        delta = 0.;
+        norm = 0.;
+      }
+      for (colour=0; colour<Average::colours; ++colour) pool.run(bands, sweep);
+      ++n;
+      if (delta_ && hs_converged(delta_, norm_, height, tolerance)) break;
+    }
+
+    u0 = u;
+    v0 = v;
+    return n;
+
+  }
+
+  blitz::Array<T,2>* cur_u = &u;
+  blitz::Array<T,2>* cur_v = &v;
+  blitz::Array<T,2>* next_u = &u2;
+  blitz::Array<T,2>* next_v = &v2;
+
+  tile_depth = std::min(tile_depth, iterations);
+
+  if (tile_depth > 1) {
+
+    const int width = u.extent(1);
+    const int rows = std::min(tile_rows, static_cast<size_t>(height));
+    const int tiles = (height + rows - 1) / rows;
+    const size_t tile_bands = std::min(pool.getThreads(),
+        static_cast<size_t>(tiles));
+    std::vector<std::vector<T> > scratch(tile_bands,
+        std::vector<T>(4 * (rows+2*tile_depth) * width));
+    std::vector<double> block_delta;
+    std::vector<double> block_norm;
+    if (delta_) {
+      block_delta.resize(tile_depth * height);
+      block_norm.resize(block_delta.size());
+    }
+
+    int depth = 0;
+    const std::function<void(size_t)> block = [&](size_t b) {
+      bob::ip::optflow::detail::simd_dispatch<T>(hs_tiles_kernel<Average, T>{
+          ex, ey, cx, cy, ct, *cur_u, *cur_v, *next_u, *next_v,
+          scratch[b].data(), rows, depth,
+          delta_ ? block_delta.data() : 0, delta_ ? block_norm.data() : 0,
+          bob::ip::optflow::band_start(tiles, tile_bands, b),
+          bob::ip::optflow::band_start(tiles, tile_bands, b+1)});
+    };
+
+    while (n < iterations) {
+      depth = std::min(tile_depth, iterations - n);
+      pool.run(tile_bands, block);
+      if (delta_) {
+        int s = 0;
+        while (s < depth && !hs_converged(&block_delta[s*height],
+              &block_norm[s*height], height, tolerance)) ++s;
+        if (s < depth) {
+          if (s+1 < depth) {
+            depth = s+1;
+            pool.run(tile_bands, block);
+          }
+          std::swap(cur_u, next_u);
+          std::swap(cur_v, next_v);
+          n += depth;
+          break;
+        }
+      }
+      std::swap(cur_u, next_u);
+      std::swap(cur_v, next_v);
+      n += depth;
+    }
+
+    u0 = *cur_u;
+    v0 = *cur_v;
+    return n;
+
+  }
+
+  const std::function<void(size_t)> sweep = [&](size_t b) {
+    bob::ip::optflow::detail::simd_dispatch<T>(hs_sweep_kernel<Average, T>{
+        ex, ey, cx, cy, ct, *cur_u, *cur_v, *next_u, *next_v, delta_, norm_,
+        bob::ip::optflow::band_start(height, bands, b),
+        bob::ip::optflow::band_start(height, bands, b+1)});
+  };
+
+  while (n < iterations) {
+    pool.run(bands, sweep);
+    std::swap(cur_u, next_u);
+    std::swap(cur_v, next_v);
+    ++n;
+    if (delta_ && hs_converged(delta_, norm_, height, tolerance)) break;
+  }
+
+  u0 = *cur_u;
+  v0 = *cur_v;
+  return n;
+
+}
+
+/**
+ * Allocates the gradient and coefficient planes the Jacobi and SOR solvers
+ * read. If packed is set, they are views on the rows of a single records
+ * buffer, in which each image row holds the rows of ex, ey, cx, cy and ct in
+ * turn, so that the sweeps find all they need for a row in one contiguous
+ * stream. Otherwise, the records buffer is released and each plane is
+ * allocated on its own.
+ *
+ * The raw Et plane is released as well: the coefficients are built along
+ * with the gradients, so it is only allocated, by hs_raw_et(), when the
+ * multigrid solver or the brightness error need it.
+ */
+template <typename T>
+static void hs_planes(const blitz::TinyVector<int,2>& shape, bool packed,
+    blitz::Array<T,2>& records, blitz::Array<T,2>& ex,
+    blitz::Array<T,2>& ey, blitz::Array<T,2>& et, blitz::Array<T,2>& cx,
+    blitz::Array<T,2>& cy, blitz::Array<T,2>& ct) {
+
+  blitz::Array<T,2>* const planes[5] = {&ex, &ey, &cx, &cy, &ct};
+  et.reference(blitz::Array<T,2>());
+
+  if (!packed) {
+    records.reference(blitz::Array<T,2>());
+    for (int k=0; k<5; ++k) planes[k]->reference(blitz::Array<T,2>(shape));
+    return;
+  }
+
+  const int width = shape(1);
+  records.reference(blitz::Array<T,2>(shape(0), 5*width));
+  for (int k=0; k<5; ++k)
+    planes[k]->reference(records(blitz::Range::all(),
+          blitz::Range(k*width, (k+1)*width-1)));
+
+}
+
+/**
+ * Sizes the planes of a workspace for images of the given shape, in the
+ * given layout, unless they already are
+ */
+template <typename T>
+static bob::ip::optflow::FlowWorkspace<T>& hs_workspace(
+    bob::ip::optflow::FlowWorkspace<T>& w,
+    const blitz::TinyVector<int,2>& shape, bool packed) {
+  if (w.u.extent(0) == shape(0) && w.u.extent(1) == shape(1) &&
+      w.packed == packed) return w;
+  hs_planes(shape, packed, w.records, w.ex, w.ey, w.et, w.cx, w.cy, w.ct);
+  w.u.resize(shape);
+  w.v.resize(shape);
+  w.u2.resize(shape);
+  w.v2.resize(shape);
+  w.delta.resize(shape(0));
+  w.norm.resize(shape(0));
+  w.packed = packed;
+  return w;
+}
+
+/**
+ * Returns the raw Et plane, allocating it on first use
+ */
+template <typename T>
+static blitz::Array<T,2>& hs_raw_et(blitz::Array<T,2>& et,
+    const blitz::TinyVector<int,2>& shape) {
+  if (et.extent(0) != shape(0) || et.extent(1) != shape(1)) et.resize(shape);
+  return et;
+}
+
+/**
+ * Returns frame k of a stack of gray frames, without copying it
+ */
+template <typename U>
+static blitz::Array<U,2> hs_frame(const blitz::Array<U,3>& frames, int k) {
+  return frames(k, blitz::Range::all(), blitz::Range::all());
+}
+
+/**
+ * Returns frame k of a stack of RGB frames, without copying it
+ */
+template <typename U>
+static blitz::Array<U,3> hs_frame(const blitz::Array<U,4>& frames, int k) {
+  return frames(k, blitz::Range::all(), blitz::Range::all(),
+      blitz::Range::all());
+}
+
+/**
+ * Estimates the flows of a sequence, flow(k, uk, vk) estimating the k-th
+ * one in place, in the slices uk and vk of u and v, from their contents.
+ * With warm starts, the flows are estimated in order, each one starting
+ * from the previous one and the first from 0. Otherwise, all of them start
+ * from 0 and are independent, so the tasks of the pool estimate one each;
+ * the jobs the flows submit to the same pool then run serially within their
+ * task. Returns the total number of iterations run.
+ */
+template <typename T>
+static size_t hs_sequence(bob::ip::optflow::ThreadPool& pool,
+    const blitz::TinyVector<int,2>& shape, int frames, int span, bool warm,
+    blitz::Array<T,3>& u, blitz::Array<T,3>& v,
+    const std::function<size_t(int, blitz::Array<T,2>&,
+      blitz::Array<T,2>&)>& flow) {
+
+  const int flows = frames - span + 1;
+  if (flows < 1) throw std::runtime_error("a sequence needs at least as many frames as the flow estimator takes at once");
+  const blitz::TinyVector<int,3> flows_shape(flows, shape(0), shape(1));
+  bob::core::array::assertSameShape(u, flows_shape);
+  bob::core::array::assertSameShape(v, flows_shape);
+
+  std::vector<size_t> n(flows, 0);
+  const std::function<void(size_t)> estimate = [&](size_t k) {
+    blitz::Array<T,2> uk = u(k, blitz::Range::all(), blitz::Range::all());
+    blitz::Array<T,2> vk = v(k, blitz::Range::all(), blitz::Range::all());
+    if (warm && k > 0) {
+      uk = u(k-1, blitz::Range::all(), blitz::Range::all());
+      vk = v(k-1, blitz::Range::all(), blitz::Range::all());
+    }
+    else {
+      uk = 0;
+      vk = 0;
+    }
+    n[k] = flow(k, uk, vk);
+  };
+
+  if (warm) for (int k=0; k<flows; ++k) estimate(k);
+  else pool.run(flows, estimate);
+  return std::accumulate(n.begin(), n.end(), static_cast<size_t>(0));
+
+}
+
+template <typename T>
+bob::ip::optflow::VanillaHornAndSchunckFlow<T>::VanillaHornAndSchunckFlow
 (const blitz::TinyVector<int,2>& shape) :
   m_gradient(shape),
-  m_ex(shape),
-  m_ey(shape),
-  m_et(shape),
-  m_u(shape),
-  m_v(shape),
-  m_cterm(shape)
+  m_multigrid(shape),
+  m_tile_rows(32),
+  m_tile_depth(1),
+  m_packed(false)
 {
 }
 
-bob::ip::optflow::VanillaHornAndSchunckFlow::~VanillaHornAndSchunckFlow() { }
+template <typename T>
+bob::ip::optflow::VanillaHornAndSchunckFlow<T>::~VanillaHornAndSchunckFlow() { }
 
-void bob::ip::optflow::VanillaHornAndSchunckFlow::setShape
+template <typename T>
+void bob::ip::optflow::VanillaHornAndSchunckFlow<T>::setShape
 (const blitz::TinyVector<int,2>& shape) {
+  m_workspaces.clear();
   m_gradient.setShape(shape);
-  m_ex.resize(shape);
-  m_ey.resize(shape);
-  m_et.resize(shape);
-  m_u.resize(shape);
-  m_v.resize(shape);
-  m_cterm.resize(shape);
+  m_multigrid.setShape(shape);
 }
 
-void bob::ip::optflow::VanillaHornAndSchunckFlow::operator() (double alpha,
-    size_t iterations, const blitz::Array<double,2>& i1,
-    const blitz::Array<double,2>& i2, blitz::Array<double,2>& u0,
-    blitz::Array<double,2>& v0) const {
+template <typename T>
+void bob::ip::optflow::VanillaHornAndSchunckFlow<T>::setThreads
+(size_t threads) {
+  m_pool.setThreads(threads);
+  m_gradient.setThreads(threads);
+}
 
-  bob::core::array::assertSameShape(i1, i2);
-  bob::core::array::assertSameShape(i1, m_ex);
-  bob::core::array::assertSameShape(u0, m_u);
-  bob::core::array::assertSameShape(v0, m_v);
+template <typename T>
+void bob::ip::optflow::VanillaHornAndSchunckFlow<T>::setTileRows(size_t rows) {
+  if (rows == 0) throw std::runtime_error("the tiles of the Jacobi solver must have at least one row");
+  m_tile_rows = rows;
+}
 
-  m_gradient(i1, i2, m_ex, m_ey, m_et);
-  double a2 = std::pow(alpha, 2);
-  for (size_t i=0; i<iterations; ++i) {
-    bob::ip::optflow::laplacian_avg_hs(u0, m_u);
-    bob::ip::optflow::laplacian_avg_hs(v0, m_v);
-    m_cterm = (m_ex*m_u + m_ey*m_v + m_et) /
-      (blitz::pow2(m_ex) + blitz::pow2(m_ey) + a2);
-    u0 = m_u - m_ex*m_cterm;
-    v0 = m_v - m_ey*m_cterm;
-  }
+template <typename T>
+void bob::ip::optflow::VanillaHornAndSchunckFlow<T>::setTileDepth(size_t depth) {
+  if (depth == 0) throw std::runtime_error("the Jacobi solver must run at least one iteration per tile");
+  m_tile_depth = depth;
+}
+
+template <typename T>
+void bob::ip::optflow::VanillaHornAndSchunckFlow<T>::setPacked(bool packed) {
+  // the planes of the workspaces are laid out again when they are next taken
+  m_packed = packed;
+}
+
+template <typename T> template <typename U, int N>
+size_t bob::ip::optflow::VanillaHornAndSchunckFlow<T>::operator()
+(double alpha, size_t iterations, const blitz::Array<U,N>& i1,
+    const blitz::Array<U,N>& i2, blitz::Array<T,2>& u0,
+    blitz::Array<T,2>& v0, Solver::Type solver, double omega,
+    double tolerance) const {
+
+  // the gradient checks the images against its own shape
+  const blitz::TinyVector<int,2>& shape = getShape();
+  bob::core::array::assertSameShape(u0, shape);
+  bob::core::array::assertSameShape(v0, shape);
+
+  typename Workspaces<FlowWorkspace<T> >::Lease lease = m_workspaces.take();
+  FlowWorkspace<T>& w = hs_workspace(*lease, shape, m_packed);
+  const double a2 = std::pow(alpha, 2);
+  if (solver == Solver::Multigrid)
+    m_gradient(i1, i2, w.ex, w.ey, hs_raw_et(w.et, shape));
+  else
+    m_gradient.coefficients(a2, i1, i2, w.ex, w.ey, w.cx, w.cy, w.ct);
+  return hs_solve<HSAverage>(m_pool, m_multigrid, solver, omega, a2,
+      iterations, tolerance, m_tile_rows, m_tile_depth, w.ex, w.ey, w.et,
+      w.cx, w.cy, w.ct, w.u, w.v, w.u2, w.v2, u0, v0, w.delta, w.norm);
+}
+
+template <typename T> template <typename U, int N>
+size_t bob::ip::optflow::VanillaHornAndSchunckFlow<T>::estimateSequence
+(double alpha, size_t iterations, const blitz::Array<U,N>& frames,
+    blitz::Array<T,3>& u, blitz::Array<T,3>& v, bool warm,
+    Solver::Type solver, double omega, double tolerance) const {
+  return hs_sequence<T>(m_pool, getShape(), frames.extent(0), 2, warm, u, v,
+      [&](int k, blitz::Array<T,2>& uk, blitz::Array<T,2>& vk) {
+        return (*this)(alpha, iterations, hs_frame(frames, k),
+            hs_frame(frames, k+1), uk, vk, solver, omega, tolerance);
+      });
 }
 
-void bob::ip::optflow::VanillaHornAndSchunckFlow::evalEc2
-(const blitz::Array<double,2>& u, const blitz::Array<double,2>& v,
- blitz::Array<double,2>& error) const {
+template <typename T>
+void bob::ip::optflow::VanillaHornAndSchunckFlow<T>::evalEc2
+(const blitz::Array<T,2>& u, const blitz::Array<T,2>& v,
+ blitz::Array<T,2>& error) const {
 
   bob::core::array::assertSameShape(u, v);
   bob::core::array::assertSameShape(u, error);
-  bob::core::array::assertSameShape(u, m_u);
+  bob::core::array::assertSameShape(u, getShape());
 
-  laplacian_avg_hs(u, m_u);
-  laplacian_avg_hs(v, m_u);
-  error = blitz::pow2(m_u - u) + blitz::pow2(m_v - v);
+  typename Workspaces<FlowWorkspace<T> >::Lease lease = m_workspaces.take();
+  FlowWorkspace<T>& w = hs_workspace(*lease, getShape(), m_packed);
+  laplacian_avg_hs(u, w.u);
+  laplacian_avg_hs(v, w.v);
+  error = blitz::pow2(w.u - u) + blitz::pow2(w.v - v);
 
 }
 
-void bob::ip::optflow::VanillaHornAndSchunckFlow::evalEb
-(const blitz::Array<double,2>& i1, const blitz::Array<double,2>& i2,
- const blitz::Array<double,2>& u, const blitz::Array<double,2>& v,
- blitz::Array<double,2>& error) const {
+template <typename T>
+void bob::ip::optflow::VanillaHornAndSchunckFlow<T>::evalEb
+(const blitz::Array<T,2>& i1, const blitz::Array<T,2>& i2,
+ const blitz::Array<T,2>& u, const blitz::Array<T,2>& v,
+ blitz::Array<T,2>& error) const {
 
   bob::core::array::assertSameShape(i1, i2);
   bob::core::array::assertSameShape(u, v);
   bob::core::array::assertSameShape(u, error);
-  bob::core::array::assertSameShape(error, m_u);
-  m_gradient(i1, i2, m_ex, m_ey, m_et);
-  error = m_ex*u + m_ey*v + m_et;
+  bob::core::array::assertSameShape(error, getShape());
+
+  typename Workspaces<FlowWorkspace<T> >::Lease lease = m_workspaces.take();
+  FlowWorkspace<T>& w = hs_workspace(*lease, getShape(), m_packed);
+  m_gradient(i1, i2, w.ex, w.ey, hs_raw_et(w.et, getShape()));
+  error = w.ex*u + w.ey*v + w.et;
 
 }
 
-bob::ip::optflow::HornAndSchunckFlow::HornAndSchunckFlow
+template <typename T>
+bob::ip::optflow::HornAndSchunckFlow<T>::HornAndSchunckFlow
 (const blitz::TinyVector<int,2>& shape) :
   m_gradient(shape),
-  m_ex(shape),
-  m_ey(shape),
-  m_et(shape),
-  m_u(shape),
-  m_v(shape),
-  m_cterm(shape)
+  m_multigrid(shape),
+  m_tile_rows(32),
+  m_tile_depth(1),
+  m_packed(false)
 {
 }
 
-bob::ip::optflow::HornAndSchunckFlow::~HornAndSchunckFlow() { }
+template <typename T>
+bob::ip::optflow::HornAndSchunckFlow<T>::~HornAndSchunckFlow() { }
 
-void bob::ip::optflow::HornAndSchunckFlow::setShape
+template <typename T>
+void bob::ip::optflow::HornAndSchunckFlow<T>::setShape
 (const blitz::TinyVector<int,2>& shape) {
+  m_workspaces.clear();
   m_gradient.setShape(shape);
-  m_ex.resize(shape);
-  m_ey.resize(shape);
-  m_et.resize(shape);
-  m_u.resize(shape);
-  m_v.resize(shape);
-  m_cterm.resize(shape);
+  m_multigrid.setShape(shape);
 }
 
-void bob::ip::optflow::HornAndSchunckFlow::operator() (double alpha,
-    size_t iterations, const blitz::Array<double,2>& i1,
-    const blitz::Array<double,2>& i2, const blitz::Array<double,2>& i3,
-    blitz::Array<double,2>& u0, blitz::Array<double,2>& v0) const {
+template <typename T>
+void bob::ip::optflow::HornAndSchunckFlow<T>::setThreads
+(size_t threads) {
+  m_pool.setThreads(threads);
+  m_gradient.setThreads(threads);
+}
 
-  bob::core::array::assertSameShape(i1, i2);
-  bob::core::array::assertSameShape(i2, i3);
-  bob::core::array::assertSameShape(i1, m_ex);
-  bob::core::array::assertSameShape(u0, m_u);
-  bob::core::array::assertSameShape(v0, m_v);
+template <typename T>
+void bob::ip::optflow::HornAndSchunckFlow<T>::setTileRows(size_t rows) {
+  if (rows == 0) throw std::runtime_error("the tiles of the Jacobi solver must have at least one row");
+  m_tile_rows = rows;
+}
 
-  m_gradient(i1, i2, i3, m_ex, m_ey, m_et);
-  double a2 = std::pow(alpha, 2);
-  for (size_t i=0; i<iterations; ++i) {
-    bob::ip::optflow::laplacian_avg_hs_opencv(u0, m_u);
-    bob::ip::optflow::laplacian_avg_hs_opencv(v0, m_v);
-    m_cterm = (m_ex*m_u + m_ey*m_v + m_et) /
-      (blitz::pow2(m_ex) + blitz::pow2(m_ey) + a2);
-    u0 = m_u - m_ex*m_cterm;
-    v0 = m_v - m_ey*m_cterm;
-  }
+template <typename T>
+void bob::ip::optflow::HornAndSchunckFlow<T>::setTileDepth(size_t depth) {
+  if (depth == 0) throw std::runtime_error("the Jacobi solver must run at least one iteration per tile");
+  m_tile_depth = depth;
+}
+
+template <typename T>
+void bob::ip::optflow::HornAndSchunckFlow<T>::setPacked(bool packed) {
+  // the planes of the workspaces are laid out again when they are next taken
+  m_packed = packed;
+}
+
+template <typename T> template <typename U, int N>
+size_t bob::ip::optflow::HornAndSchunckFlow<T>::operator()
+(double alpha, size_t iterations, const blitz::Array<U,N>& i1,
+    const blitz::Array<U,N>& i2, const blitz::Array<U,N>& i3,
+    blitz::Array<T,2>& u0, blitz::Array<T,2>& v0,
+    Solver::Type solver, double omega, double tolerance) const {
+
+  // the gradient checks the images against its own shape
+  const blitz::TinyVector<int,2>& shape = getShape();
+  bob::core::array::assertSameShape(u0, shape);
+  bob::core::array::assertSameShape(v0, shape);
+
+  typename Workspaces<FlowWorkspace<T> >::Lease lease = m_workspaces.take();
+  FlowWorkspace<T>& w = hs_workspace(*lease, shape, m_packed);
+  const double a2 = std::pow(alpha, 2);
+  if (solver == Solver::Multigrid)
+    m_gradient(i1, i2, i3, w.ex, w.ey, hs_raw_et(w.et, shape));
+  else
+    m_gradient.coefficients(a2, i1, i2, i3, w.ex, w.ey, w.cx, w.cy, w.ct);
+  return hs_solve<OpenCVAverage>(m_pool, m_multigrid, solver, omega, a2,
+      iterations, tolerance, m_tile_rows, m_tile_depth, w.ex, w.ey, w.et,
+      w.cx, w.cy, w.ct, w.u, w.v, w.u2, w.v2, u0, v0, w.delta, w.norm);
+}
+
+template <typename T> template <typename U, int N>
+size_t bob::ip::optflow::HornAndSchunckFlow<T>::estimateSequence
+(double alpha, size_t iterations, const blitz::Array<U,N>& frames,
+    blitz::Array<T,3>& u, blitz::Array<T,3>& v, bool warm,
+    Solver::Type solver, double omega, double tolerance) const {
+  return hs_sequence<T>(m_pool, getShape(), frames.extent(0), 3, warm, u, v,
+      [&](int k, blitz::Array<T,2>& uk, blitz::Array<T,2>& vk) {
+        return (*this)(alpha, iterations, hs_frame(frames, k),
+            hs_frame(frames, k+1), hs_frame(frames, k+2), uk, vk, solver,
+            omega, tolerance);
+      });
 }
 
-void bob::ip::optflow::HornAndSchunckFlow::evalEc2
-(const blitz::Array<double,2>& u, const blitz::Array<double,2>& v,
- blitz::Array<double,2>& error) const {
+template <typename T>
+void bob::ip::optflow::HornAndSchunckFlow<T>::evalEc2
+(const blitz::Array<T,2>& u, const blitz::Array<T,2>& v,
+ blitz::Array<T,2>& error) const {
 
   bob::core::array::assertSameShape(u, v);
   bob::core::array::assertSameShape(u, error);
-  bob::core::array::assertSameShape(u, m_u);
+  bob::core::array::assertSameShape(u, getShape());
 
-  laplacian_avg_hs_opencv(u, m_u);
-  laplacian_avg_hs_opencv(v, m_u);
-  error = blitz::pow2(m_u - u) + blitz::pow2(m_v - v);
+  typename Workspaces<FlowWorkspace<T> >::Lease lease = m_workspaces.take();
+  FlowWorkspace<T>& w = hs_workspace(*lease, getShape(), m_packed);
+  laplacian_avg_hs_opencv(u, w.u);
+  laplacian_avg_hs_opencv(v, w.v);
+  error = blitz::pow2(w.u - u) + blitz::pow2(w.v - v);
 
 }
 
-void bob::ip::optflow::HornAndSchunckFlow::evalEb
-(const blitz::Array<double,2>& i1, const blitz::Array<double,2>& i2,
- const blitz::Array<double,2>& i3, const blitz::Array<double,2>& u,
- const blitz::Array<double,2>& v, blitz::Array<double,2>& error) const {
+template <typename T>
+void bob::ip::optflow::HornAndSchunckFlow<T>::evalEb
+(const blitz::Array<T,2>& i1, const blitz::Array<T,2>& i2,
+ const blitz::Array<T,2>& i3, const blitz::Array<T,2>& u,
+ const blitz::Array<T,2>& v, blitz::Array<T,2>& error) const {
 
   bob::core::array::assertSameShape(i1, i2);
   bob::core::array::assertSameShape(i2, i3);
   bob::core::array::assertSameShape(u, v);
   bob::core::array::assertSameShape(u, error);
-  bob::core::array::assertSameShape(error, m_u);
+  bob::core::array::assertSameShape(error, getShape());
 
-  m_gradient(i1, i2, i3, m_ex, m_ey, m_et);
-  error = m_ex*u + m_ey*v + m_et;
+  typename Workspaces<FlowWorkspace<T> >::Lease lease = m_workspaces.take();
+  FlowWorkspace<T>& w = hs_workspace(*lease, getShape(), m_packed);
+  m_gradient(i1, i2, i3, w.ex, w.ey, hs_raw_et(w.et, getShape()));
+  error = w.ex*u + w.ey*v + w.et;
 
 }
 
-void bob::ip::optflow::flowError (const blitz::Array<double,2>& i1,
-    const blitz::Array<double,2>& i2, const blitz::Array<double,2>& u,
-    const blitz::Array<double,2>& v, blitz::Array<double,2>& error) {
+template <typename T>
+void bob::ip::optflow::flowError (const blitz::Array<T,2>& i1,
+    const blitz::Array<T,2>& i2, const blitz::Array<T,2>& u,
+    const blitz::Array<T,2>& v, blitz::Array<T,2>& error) {
   bob::core::array::assertSameShape(i1, i2);
   bob::core::array::assertSameShape(u, v);
   bob::core::array::assertSameShape(i1, u);
@@ -208,3 +1007,130 @@ void bob::ip::optflow::flowError (const blitz::Array<double,2>& i1,
     }
   }
 }
+
+template class bob::ip::optflow::VanillaHornAndSchunckFlow<float>;
+template class bob::ip::optflow::VanillaHornAndSchunckFlow<double>;
+template class bob::ip::optflow::HornAndSchunckFlow<float>;
+template class bob::ip::optflow::HornAndSchunckFlow<double>;
+
+template size_t bob::ip::optflow::VanillaHornAndSchunckFlow<float>::operator()
+(double, size_t, const blitz::Array<float,2>&, const blitz::Array<float,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&, Solver::Type, double,
+ double) const;
+template size_t bob::ip::optflow::VanillaHornAndSchunckFlow<float>::operator()
+(double, size_t, const blitz::Array<uint8_t,2>&, const blitz::Array<uint8_t,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&, Solver::Type, double,
+ double) const;
+template size_t bob::ip::optflow::VanillaHornAndSchunckFlow<float>::operator()
+(double, size_t, const blitz::Array<uint16_t,2>&, const blitz::Array<uint16_t,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&, Solver::Type, double,
+ double) const;
+template size_t bob::ip::optflow::VanillaHornAndSchunckFlow<double>::operator()
+(double, size_t, const blitz::Array<double,2>&, const blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&, Solver::Type, double,
+ double) const;
+template size_t bob::ip::optflow::VanillaHornAndSchunckFlow<double>::operator()
+(double, size_t, const blitz::Array<uint8_t,2>&, const blitz::Array<uint8_t,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&, Solver::Type, double,
+ double) const;
+template size_t bob::ip::optflow::VanillaHornAndSchunckFlow<double>::operator()
+(double, size_t, const blitz::Array<uint16_t,2>&, const blitz::Array<uint16_t,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&, Solver::Type, double,
+ double) const;
+template size_t bob::ip::optflow::HornAndSchunckFlow<float>::operator()
+(double, size_t, const blitz::Array<float,2>&, const blitz::Array<float,2>&,
+ const blitz::Array<float,2>&, blitz::Array<float,2>&, blitz::Array<float,2>&,
+ Solver::Type, double, double) const;
+template size_t bob::ip::optflow::HornAndSchunckFlow<float>::operator()
+(double, size_t, const blitz::Array<uint8_t,2>&, const blitz::Array<uint8_t,2>&,
+ const blitz::Array<uint8_t,2>&, blitz::Array<float,2>&, blitz::Array<float,2>&,
+ Solver::Type, double, double) const;
+template size_t bob::ip::optflow::HornAndSchunckFlow<float>::operator()
+(double, size_t, const blitz::Array<uint16_t,2>&, const blitz::Array<uint16_t,2>&,
+ const blitz::Array<uint16_t,2>&, blitz::Array<float,2>&, blitz::Array<float,2>&,
+ Solver::Type, double, double) const;
+template size_t bob::ip::optflow::HornAndSchunckFlow<double>::operator()
+(double, size_t, const blitz::Array<double,2>&, const blitz::Array<double,2>&,
+ const blitz::Array<double,2>&, blitz::Array<double,2>&, blitz::Array<double,2>&,
+ Solver::Type, double, double) const;
+template size_t bob::ip::optflow::HornAndSchunckFlow<double>::operator()
+(double, size_t, const blitz::Array<uint8_t,2>&, const blitz::Array<uint8_t,2>&,
+ const blitz::Array<uint8_t,2>&, blitz::Array<double,2>&, blitz::Array<double,2>&,
+ Solver::Type, double, double) const;
+template size_t bob::ip::optflow::HornAndSchunckFlow<double>::operator()
+(double, size_t, const blitz::Array<uint16_t,2>&, const blitz::Array<uint16_t,2>&,
+ const blitz::Array<uint16_t,2>&, blitz::Array<double,2>&, blitz::Array<double,2>&,
+ Solver::Type, double, double) const;
+template size_t bob::ip::optflow::VanillaHornAndSchunckFlow<float>::operator()
+(double, size_t, const blitz::Array<uint8_t,3>&, const blitz::Array<uint8_t,3>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&, Solver::Type, double,
+ double) const;
+template size_t bob::ip::optflow::VanillaHornAndSchunckFlow<double>::operator()
+(double, size_t, const blitz::Array<uint8_t,3>&, const blitz::Array<uint8_t,3>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&, Solver::Type, double,
+ double) const;
+template size_t bob::ip::optflow::HornAndSchunckFlow<float>::operator()
+(double, size_t, const blitz::Array<uint8_t,3>&, const blitz::Array<uint8_t,3>&,
+ const blitz::Array<uint8_t,3>&, blitz::Array<float,2>&, blitz::Array<float,2>&,
+ Solver::Type, double, double) const;
+template size_t bob::ip::optflow::HornAndSchunckFlow<double>::operator()
+(double, size_t, const blitz::Array<uint8_t,3>&, const blitz::Array<uint8_t,3>&,
+ const blitz::Array<uint8_t,3>&, blitz::Array<double,2>&, blitz::Array<double,2>&,
+ Solver::Type, double, double) const;
+
+template void bob::ip::optflow::flowError<float>
+(const blitz::Array<float,2>&, const blitz::Array<float,2>&,
+ const blitz::Array<float,2>&, const blitz::Array<float,2>&,
+ blitz::Array<float,2>&);
+template void bob::ip::optflow::flowError<double>
+(const blitz::Array<double,2>&, const blitz::Array<double,2>&,
+ const blitz::Array<double,2>&, const blitz::Array<double,2>&,
+ blitz::Array<double,2>&);
+template size_t bob::ip::optflow::VanillaHornAndSchunckFlow<float>::estimateSequence
+(double, size_t, const blitz::Array<float,3>&, blitz::Array<float,3>&,
+ blitz::Array<float,3>&, bool, Solver::Type, double, double) const;
+template size_t bob::ip::optflow::VanillaHornAndSchunckFlow<float>::estimateSequence
+(double, size_t, const blitz::Array<uint8_t,3>&, blitz::Array<float,3>&,
+ blitz::Array<float,3>&, bool, Solver::Type, double, double) const;
+template size_t bob::ip::optflow::VanillaHornAndSchunckFlow<float>::estimateSequence
+(double, size_t, const blitz::Array<uint16_t,3>&, blitz::Array<float,3>&,
+ blitz::Array<float,3>&, bool, Solver::Type, double, double) const;
+template size_t bob::ip::optflow::VanillaHornAndSchunckFlow<float>::estimateSequence
+(double, size_t, const blitz::Array<uint8_t,4>&, blitz::Array<float,3>&,
+ blitz::Array<float,3>&, bool, Solver::Type, double, double) const;
+template size_t bob::ip::optflow::VanillaHornAndSchunckFlow<double>::estimateSequence
+(double, size_t, const blitz::Array<double,3>&, blitz::Array<double,3>&,
+ blitz::Array<double,3>&, bool, Solver::Type, double, double) const;
+template size_t bob::ip::optflow::VanillaHornAndSchunckFlow<double>::estimateSequence
+(double, size_t, const blitz::Array<uint8_t,3>&, blitz::Array<double,3>&,
+ blitz::Array<double,3>&, bool, Solver::Type, double, double) const;
+template size_t bob::ip::optflow::VanillaHornAndSchunckFlow<double>::estimateSequence
+(double, size_t, const blitz::Array<uint16_t,3>&, blitz::Array<double,3>&,
+ blitz::Array<double,3>&, bool, Solver::Type, double, double) const;
+template size_t bob::ip::optflow::VanillaHornAndSchunckFlow<double>::estimateSequence
+(double, size_t, const blitz::Array<uint8_t,4>&, blitz::Array<double,3>&,
+ blitz::Array<double,3>&, bool, Solver::Type, double, double) const;
+template size_t bob::ip::optflow::HornAndSchunckFlow<float>::estimateSequence
+(double, size_t, const blitz::Array<float,3>&, blitz::Array<float,3>&,
+ blitz::Array<float,3>&, bool, Solver::Type, double, double) const;
+template size_t bob::ip::optflow::HornAndSchunckFlow<float>::estimateSequence
+(double, size_t, const blitz::Array<uint8_t,3>&, blitz::Array<float,3>&,
+ blitz::Array<float,3>&, bool, Solver::Type, double, double) const;
+template size_t bob::ip::optflow::HornAndSchunckFlow<float>::estimateSequence
+(double, size_t, const blitz::Array<uint16_t,3>&, blitz::Array<float,3>&,
+ blitz::Array<float,3>&, bool, Solver::Type, double, double) const;
+template size_t bob::ip::optflow::HornAndSchunckFlow<float>::estimateSequence
+(double, size_t, const blitz::Array<uint8_t,4>&, blitz::Array<float,3>&,
+ blitz::Array<float,3>&, bool, Solver::Type, double, double) const;
+template size_t bob::ip::optflow::HornAndSchunckFlow<double>::estimateSequence
+(double, size_t, const blitz::Array<double,3>&, blitz::Array<double,3>&,
+ blitz::Array<double,3>&, bool, Solver::Type, double, double) const;
+template size_t bob::ip::optflow::HornAndSchunckFlow<double>::estimateSequence
+(double, size_t, const blitz::Array<uint8_t,3>&, blitz::Array<double,3>&,
+ blitz::Array<double,3>&, bool, Solver::Type, double, double) const;
+template size_t bob::ip::optflow::HornAndSchunckFlow<double>::estimateSequence
+(double, size_t, const blitz::Array<uint16_t,3>&, blitz::Array<double,3>&,
+ blitz::Array<double,3>&, bool, Solver::Type, double, double) const;
+template size_t bob::ip::optflow::HornAndSchunckFlow<double>::estimateSequence
+(double, size_t, const blitz::Array<uint8_t,4>&, blitz::Array<double,3>&,
+ blitz::Array<double,3>&, bool, Solver::Type, double, double) const;
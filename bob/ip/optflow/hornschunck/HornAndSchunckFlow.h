@@ -14,6 +14,9 @@
 #include <stdint.h>
 #include <blitz/array.h>
 #include "SpatioTemporalGradient.h"
+#include "ThreadPool.h"
+#include "Multigrid.h"
+#include "Workspaces.h"
 
 namespace bob { namespace ip { namespace optflow {
 
@@ -34,9 +37,14 @@ namespace bob { namespace ip { namespace optflow {
    *
    * Note that you will get the WRONG results if you use the Laplacian kernel
    * directly...
+   *
+   * Borders are mirrored inside the operator, so no temporary is allocated.
+   * The input and output arrays must not overlap. T is either float or
+   * double.
    */
-  void laplacian_avg_hs_opencv(const blitz::Array<double,2>& input,
-      blitz::Array<double,2>& output);
+  template <typename T>
+  void laplacian_avg_hs_opencv(const blitz::Array<T,2>& input,
+      blitz::Array<T,2>& output);
 
   /**
    * An approximation to the Laplacian operator. Using the following
@@ -52,9 +60,47 @@ namespace bob { namespace ip { namespace optflow {
    * [1/12 1/6 1/12]
    * [1/6   0  1/6 ]
    * [1/12 1/6 1/12]
+   *
+   * Borders are mirrored inside the operator, so no temporary is allocated.
+   * The input and output arrays must not overlap. T is either float or
+   * double.
    */
-  void laplacian_avg_hs(const blitz::Array<double,2>& input,
-      blitz::Array<double,2>& output);
+  template <typename T>
+  void laplacian_avg_hs(const blitz::Array<T,2>& input,
+      blitz::Array<T,2>& output);
+
+  /**
+   * The iterative solvers available to the flow estimators
+   */
+  namespace Solver {
+    enum Type {
+      Jacobi = 0, ///< Jacobi iterations, as described in the original paper
+      SOR = 1, ///< Multi-colour Gauss-Seidel with over-relaxation
+      Multigrid = 2 ///< Multigrid cycles with Gauss-Seidel smoothing
+    };
+  }
+
+  /**
+   * The planes one flow estimation works on, sized on first use
+   */
+  template <typename T>
+  struct FlowWorkspace {
+    FlowWorkspace(): packed(false) { }
+    blitz::Array<T,2> records; ///< Packed planes, if any
+    blitz::Array<T,2> ex; ///< Ex buffer
+    blitz::Array<T,2> ey; ///< Ey buffer
+    blitz::Array<T,2> et; ///< Et buffer, allocated on demand
+    blitz::Array<T,2> cx; ///< Ex/D coefficient plane
+    blitz::Array<T,2> cy; ///< Ey/D coefficient plane
+    blitz::Array<T,2> ct; ///< Et/D coefficient plane
+    blitz::Array<T,2> u; ///< U (x velocity) buffer
+    blitz::Array<T,2> v; ///< V (y velocity) buffer
+    blitz::Array<T,2> u2; ///< U ping-pong buffer
+    blitz::Array<T,2> v2; ///< V ping-pong buffer
+    blitz::Array<double,1> delta; ///< per-row update norms
+    blitz::Array<double,1> norm; ///< per-row flow norms
+    bool packed; ///< Tells if the planes are packed in records
+  };
 
   /**
    * This can calculate the Optical Flow between two sequences of images (i1,
@@ -112,7 +158,19 @@ namespace bob { namespace ip { namespace optflow {
    * image. More details are given at the source code for this class.
    * Calling it estimates u0 and v0 based on their initial state. If you want
    * to start from scratch, just set u0 and v0 to 0.
+   *
+   * The images, the flow and all internal planes are 2D arrays of type T,
+   * which is either float or double. Single precision halves the memory
+   * traffic and doubles the number of pixels per SIMD instruction. The
+   * norms used by the stopping tests are always accumulated in double
+   * precision.
+   *
+   * The const methods may be called from several threads at once: each call
+   * works on planes of its own, taken from a pool that keeps them for the
+   * next calls. The settings must not change meanwhile; setShape() throws
+   * if it finds a call still running.
    */
+  template <typename T>
   class VanillaHornAndSchunckFlow {
 
     public: //api
@@ -131,7 +189,7 @@ namespace bob { namespace ip { namespace optflow {
        * Returns the current shape supported
        */
       inline const blitz::TinyVector<int,2>& getShape() const {
-        return m_ex.shape();
+        return m_gradient.getShape();
       }
 
       /**
@@ -139,6 +197,99 @@ namespace bob { namespace ip { namespace optflow {
        */
       void setShape(const blitz::TinyVector<int,2>& shape);
 
+      /**
+       * Returns the number of threads used to run the iterations
+       */
+      inline size_t getThreads() const { return m_pool.getThreads(); }
+
+      /**
+       * Sets the number of threads used to compute the gradients and run
+       * the iterations. Each iteration is split in row bands that are
+       * updated in parallel and synchronized before the next iteration
+       * starts; the gradients are split in row bands as well. The results
+       * do not depend on this setting. Passing 0 uses all hardware threads.
+       */
+      void setThreads(size_t threads);
+
+      /**
+       * Returns the multigrid solver, to inspect or tune its cycles
+       */
+      inline const MultigridSolver& getMultigrid() const {
+        return m_multigrid;
+      }
+
+      /**
+       * Returns the multigrid solver, to inspect or tune its cycles
+       */
+      inline MultigridSolver& getMultigrid() { return m_multigrid; }
+
+      /**
+       * Returns the number of rows of the tiles of the cache-blocked Jacobi
+       * solver
+       */
+      inline size_t getTileRows() const { return m_tile_rows; }
+
+      /**
+       * Sets the number of rows of the tiles of the cache-blocked Jacobi
+       * solver. Must be at least 1. The tiles span the whole width of the
+       * images, so this should be chosen for a tile of the 9 planes used by
+       * the iterations (plus its halo) to fit in the L2 cache.
+       */
+      void setTileRows(size_t rows);
+
+      /**
+       * Returns the number of Jacobi iterations run on each tile while it
+       * is in cache
+       */
+      inline size_t getTileDepth() const { return m_tile_depth; }
+
+      /**
+       * Sets the number of Jacobi iterations run on each tile while it is
+       * in cache. Must be at least 1. With the default of 1, every iteration
+       * sweeps the whole frame. With a depth of k, the frame is cut in tiles
+       * of getTileRows() rows that are extended by an overlapped halo of k
+       * rows on each side. k iterations are run on each tile, on a shrinking
+       * range of rows, before moving to the next one. The halo rows are
+       * recomputed by neighbouring tiles, but the flow is only read from and
+       * written to memory once every k iterations. The results are
+       * identical to those of the untiled solver. The other solvers ignore
+       * this setting.
+       */
+      void setTileDepth(size_t depth);
+
+      /**
+       * Tells if the gradients and coefficient planes are packed in
+       * per-row records
+       */
+      inline bool getPacked() const { return m_packed; }
+
+      /**
+       * Sets if the gradients and coefficient planes used by the solvers
+       * are packed in a single buffer, where each image row holds a record
+       * of the rows of Ex, Ey, Ex/D, Ey/D and Et/D that follow each other.
+       * The gradient operator writes into the records and the
+       * Jacobi and SOR sweeps then read a single contiguous stream per
+       * image row instead of 5 planes, which is friendlier to the hardware
+       * prefetchers and the TLB on large images. The results are identical
+       * in both layouts. Off by default.
+       */
+      void setPacked(bool packed);
+
+      /**
+       * Tells if integer images are normalised to [0,1] before the flow is
+       * estimated
+       */
+      inline bool getNormalize() const { return m_gradient.getNormalize(); }
+
+      /**
+       * Sets if integer images are normalised to [0,1] before the flow is
+       * estimated. See ForwardGradient::setNormalize(). Off by default, so
+       * that alpha keeps the scale of the pixel values.
+       */
+      inline void setNormalize(bool normalize) {
+        m_gradient.setNormalize(normalize);
+      }
+
       /**
        * Calculates the square of the smoothness error (Ec^2) by using the
        * formula described in the paper:
@@ -147,8 +298,8 @@ namespace bob { namespace ip { namespace optflow {
        *
        * Sets the input matrix with the discrete values.
        */
-      void evalEc2 (const blitz::Array<double,2>& u,
-          const blitz::Array<double,2>& v, blitz::Array<double,2>& error) const;
+      void evalEc2 (const blitz::Array<T,2>& u,
+          const blitz::Array<T,2>& v, blitz::Array<T,2>& error) const;
 
       /**
        * Calculates the brightness error (Eb) as defined in the paper:
@@ -157,26 +308,73 @@ namespace bob { namespace ip { namespace optflow {
        *
        * Sets the input matrix with the discrete values
        */
-      void evalEb (const blitz::Array<double,2>& i1,
-          const blitz::Array<double,2>& i2, const blitz::Array<double,2>& u,
-          const blitz::Array<double,2>& v, blitz::Array<double,2>& error) const;
+      void evalEb (const blitz::Array<T,2>& i1,
+          const blitz::Array<T,2>& i2, const blitz::Array<T,2>& u,
+          const blitz::Array<T,2>& v, blitz::Array<T,2>& error) const;
 
       /**
        * Call this to evaluate the flow
+       *
+       * The solver defaults to the Jacobi iterations of the original paper.
+       * Solver::SOR selects a multi-colour (red-black for the 4-neighbour
+       * Laplacian, 4 colours for the 9-point one) Gauss-Seidel solver with
+       * successive over-relaxation, which reaches the same energy in far
+       * fewer iterations. Its relaxation factor omega must lie in (0, 2). If
+       * omega <= 0, it is estimated from the shape of the images.
+       * Solver::Multigrid runs multigrid cycles instead of iterations (see
+       * MultigridSolver), which converge at a rate that does not degrade
+       * with the size of the images. It ignores omega.
+       *
+       * If tolerance is positive, iterations becomes an upper bound: the
+       * Jacobi and SOR solvers stop as soon as the norm of an update of
+       * (u, v) falls below tolerance times the norm of (u, v), while the
+       * multigrid solver stops as soon as the norm of the residual of the
+       * linear system falls below tolerance times the norm of its
+       * right-hand side. These norms are accumulated by the sweeps
+       * themselves. Returns the number of iterations (or cycles) that were
+       * run.
+       *
+       * The images are either gray, of type T, uint8_t or uint16_t, or
+       * 8-bit RGB, planar or interleaved, as ForwardGradient::operator()
+       * takes them.
+       */
+      template <typename U, int N>
+      size_t operator() (double alpha, size_t iterations, const
+          blitz::Array<U,N>& i1, const blitz::Array<U,N>& i2,
+          blitz::Array<T,2>& u0, blitz::Array<T,2>& v0,
+          Solver::Type solver=Solver::Jacobi, double omega=0.,
+          double tolerance=0.) const;
+
+      /**
+       * Evaluates the flows of a whole sequence of frames, stacked along the
+       * first dimension of frames: u(k) and v(k) are set to the flow
+       * between frames k and k+1, as operator() would estimate it. The
+       * frames are either a 3D stack of gray images or a 4D stack of RGB
+       * images, read in place. u and v must have one slice less than the
+       * stack has frames.
+       *
+       * If warm is set, each flow starts from the previous one, the first
+       * from 0, as when going through a video. Otherwise all of them start
+       * from 0 and are independent, so they are estimated in parallel, each
+       * by one thread of the pool. Returns the total number of iterations
+       * (or cycles) that were run.
        */
-      void operator() (double alpha, size_t iterations, const
-          blitz::Array<double,2>& i1, const blitz::Array<double,2>& i2,
-          blitz::Array<double,2>& u0, blitz::Array<double,2>& v0) const;
+      template <typename U, int N>
+      size_t estimateSequence(double alpha, size_t iterations,
+          const blitz::Array<U,N>& frames, blitz::Array<T,3>& u,
+          blitz::Array<T,3>& v, bool warm=true,
+          Solver::Type solver=Solver::Jacobi, double omega=0.,
+          double tolerance=0.) const;
 
     private: //representation
 
-      bob::ip::optflow::HornAndSchunckGradient m_gradient; ///< Gradient operator
-      mutable blitz::Array<double,2> m_ex; ///< Ex buffer
-      mutable blitz::Array<double,2> m_ey; ///< Ey buffer
-      mutable blitz::Array<double,2> m_et; ///< Et buffer
-      mutable blitz::Array<double,2> m_u; ///< U (x velocity) buffer
-      mutable blitz::Array<double,2> m_v; ///< V (y velocity) buffer
-      mutable blitz::Array<double, 2> m_cterm; ///< common term buffer
+      bob::ip::optflow::HornAndSchunckGradient<T> m_gradient; ///< Gradient operator
+      mutable bob::ip::optflow::Workspaces<FlowWorkspace<T> > m_workspaces; ///< Idle planes
+      mutable bob::ip::optflow::ThreadPool m_pool; ///< Row-band workers
+      bob::ip::optflow::MultigridSolver m_multigrid; ///< Multigrid solver
+      size_t m_tile_rows; ///< Rows of the cache-blocked Jacobi tiles
+      size_t m_tile_depth; ///< Jacobi iterations run per tile
+      bool m_packed; ///< Packs the planes in per-row records
 
   };
 
@@ -184,8 +382,10 @@ namespace bob { namespace ip { namespace optflow {
    * This is a clone of the Vanilla HornAndSchunck method that uses a Sobel
    * gradient estimator instead of the forward estimator used by the
    * classical method. The Laplacian operator is also replaced with a more
-   * common method.
+   * common method. Like the Vanilla method, it may be used from several
+   * threads at once.
    */
+  template <typename T>
   class HornAndSchunckFlow {
 
     public: //api
@@ -204,7 +404,7 @@ namespace bob { namespace ip { namespace optflow {
        * Returns the current shape supported
        */
       inline const blitz::TinyVector<int,2>& getShape() const {
-        return m_ex.shape();
+        return m_gradient.getShape();
       }
 
       /**
@@ -212,6 +412,99 @@ namespace bob { namespace ip { namespace optflow {
        */
       void setShape(const blitz::TinyVector<int,2>& shape);
 
+      /**
+       * Returns the number of threads used to run the iterations
+       */
+      inline size_t getThreads() const { return m_pool.getThreads(); }
+
+      /**
+       * Sets the number of threads used to compute the gradients and run
+       * the iterations. Each iteration is split in row bands that are
+       * updated in parallel and synchronized before the next iteration
+       * starts; the gradients are split in row bands as well. The results
+       * do not depend on this setting. Passing 0 uses all hardware threads.
+       */
+      void setThreads(size_t threads);
+
+      /**
+       * Returns the multigrid solver, to inspect or tune its cycles
+       */
+      inline const MultigridSolver& getMultigrid() const {
+        return m_multigrid;
+      }
+
+      /**
+       * Returns the multigrid solver, to inspect or tune its cycles
+       */
+      inline MultigridSolver& getMultigrid() { return m_multigrid; }
+
+      /**
+       * Returns the number of rows of the tiles of the cache-blocked Jacobi
+       * solver
+       */
+      inline size_t getTileRows() const { return m_tile_rows; }
+
+      /**
+       * Sets the number of rows of the tiles of the cache-blocked Jacobi
+       * solver. Must be at least 1. The tiles span the whole width of the
+       * images, so this should be chosen for a tile of the 9 planes used by
+       * the iterations (plus its halo) to fit in the L2 cache.
+       */
+      void setTileRows(size_t rows);
+
+      /**
+       * Returns the number of Jacobi iterations run on each tile while it
+       * is in cache
+       */
+      inline size_t getTileDepth() const { return m_tile_depth; }
+
+      /**
+       * Sets the number of Jacobi iterations run on each tile while it is
+       * in cache. Must be at least 1. With the default of 1, every iteration
+       * sweeps the whole frame. With a depth of k, the frame is cut in tiles
+       * of getTileRows() rows that are extended by an overlapped halo of k
+       * rows on each side. k iterations are run on each tile, on a shrinking
+       * range of rows, before moving to the next one. The halo rows are
+       * recomputed by neighbouring tiles, but the flow is only read from and
+       * written to memory once every k iterations. The results are
+       * identical to those of the untiled solver. The other solvers ignore
+       * this setting.
+       */
+      void setTileDepth(size_t depth);
+
+      /**
+       * Tells if the gradients and coefficient planes are packed in
+       * per-row records
+       */
+      inline bool getPacked() const { return m_packed; }
+
+      /**
+       * Sets if the gradients and coefficient planes used by the solvers
+       * are packed in a single buffer, where each image row holds a record
+       * of the rows of Ex, Ey, Ex/D, Ey/D and Et/D that follow each other.
+       * The gradient operator writes into the records and the
+       * Jacobi and SOR sweeps then read a single contiguous stream per
+       * image row instead of 5 planes, which is friendlier to the hardware
+       * prefetchers and the TLB on large images. The results are identical
+       * in both layouts. Off by default.
+       */
+      void setPacked(bool packed);
+
+      /**
+       * Tells if integer images are normalised to [0,1] before the flow is
+       * estimated
+       */
+      inline bool getNormalize() const { return m_gradient.getNormalize(); }
+
+      /**
+       * Sets if integer images are normalised to [0,1] before the flow is
+       * estimated. See ForwardGradient::setNormalize(). Off by default, so
+       * that alpha keeps the scale of the pixel values.
+       */
+      inline void setNormalize(bool normalize) {
+        m_gradient.setNormalize(normalize);
+      }
+
       /**
        * Calculates the square of the smoothness error (Ec^2) by using the
        * formula described in the paper:
@@ -220,8 +513,8 @@ namespace bob { namespace ip { namespace optflow {
        *
        * Sets the input matrix with the discrete values.
        */
-      void evalEc2 (const blitz::Array<double,2>& u,
-          const blitz::Array<double,2>& v, blitz::Array<double,2>& error) const;
+      void evalEc2 (const blitz::Array<T,2>& u,
+          const blitz::Array<T,2>& v, blitz::Array<T,2>& error) const;
 
       /**
        * Calculates the brightness error (Eb) as defined in the paper:
@@ -230,28 +523,49 @@ namespace bob { namespace ip { namespace optflow {
        *
        * Sets the input matrix with the discrete values
        */
-      void evalEb (const blitz::Array<double,2>& i1,
-          const blitz::Array<double,2>& i2, const blitz::Array<double,2>& i3,
-          const blitz::Array<double,2>& u, const blitz::Array<double,2>& v,
-          blitz::Array<double,2>& error) const;
+      void evalEb (const blitz::Array<T,2>& i1,
+          const blitz::Array<T,2>& i2, const blitz::Array<T,2>& i3,
+          const blitz::Array<T,2>& u, const blitz::Array<T,2>& v,
+          blitz::Array<T,2>& error) const;
 
       /**
        * Call this to evaluate the flow
+       *
+       * See VanillaHornAndSchunckFlow::operator() for the solver and
+       * tolerance options. Returns the number of iterations that were run.
+       * The images are either gray, of type T, uint8_t or uint16_t, or
+       * 8-bit RGB, as VanillaHornAndSchunckFlow::operator() takes them.
+       */
+      template <typename U, int N>
+      size_t operator() (double alpha, size_t iterations, const
+          blitz::Array<U,N>& i1, const blitz::Array<U,N>& i2,
+          const blitz::Array<U,N>& i3,
+          blitz::Array<T,2>& u0, blitz::Array<T,2>& v0,
+          Solver::Type solver=Solver::Jacobi, double omega=0.,
+          double tolerance=0.) const;
+
+      /**
+       * Evaluates the flows of a whole sequence of frames, as
+       * VanillaHornAndSchunckFlow::estimateSequence() does, except that
+       * u(k) and v(k) are set to the flow of frames k, k+1 and k+2, so that
+       * they have 2 slices less than the stack has frames.
        */
-      void operator() (double alpha, size_t iterations, const
-          blitz::Array<double,2>& i1, const blitz::Array<double,2>& i2,
-          const blitz::Array<double,2>& i3,
-          blitz::Array<double,2>& u0, blitz::Array<double,2>& v0) const;
+      template <typename U, int N>
+      size_t estimateSequence(double alpha, size_t iterations,
+          const blitz::Array<U,N>& frames, blitz::Array<T,3>& u,
+          blitz::Array<T,3>& v, bool warm=true,
+          Solver::Type solver=Solver::Jacobi, double omega=0.,
+          double tolerance=0.) const;
 
     private: //representation
 
-      bob::ip::optflow::SobelGradient m_gradient; ///< Gradient operator
-      mutable blitz::Array<double,2> m_ex; ///< Ex buffer
-      mutable blitz::Array<double,2> m_ey; ///< Ey buffer
-      mutable blitz::Array<double,2> m_et; ///< Et buffer
-      mutable blitz::Array<double,2> m_u; ///< U (x velocity) buffer
-      mutable blitz::Array<double,2> m_v; ///< V (y velocity) buffer
-      mutable blitz::Array<double, 2> m_cterm; ///< common term buffer
+      bob::ip::optflow::SobelGradient<T> m_gradient; ///< Gradient operator
+      mutable bob::ip::optflow::Workspaces<FlowWorkspace<T> > m_workspaces; ///< Idle planes
+      mutable bob::ip::optflow::ThreadPool m_pool; ///< Row-band workers
+      bob::ip::optflow::MultigridSolver m_multigrid; ///< Multigrid solver
+      size_t m_tile_rows; ///< Rows of the cache-blocked Jacobi tiles
+      size_t m_tile_depth; ///< Jacobi iterations run per tile
+      bool m_packed; ///< Packs the planes in per-row records
 
   };
 
@@ -260,9 +574,10 @@ namespace bob { namespace ip { namespace optflow {
    *
    * E = i2(x-u,y-v) - i1(x,y))
    */
-  void flowError (const blitz::Array<double,2>& i1,
-      const blitz::Array<double,2>& i2, const blitz::Array<double,2>& u,
-      const blitz::Array<double,2>& v, blitz::Array<double,2>& error);
+  template <typename T>
+  void flowError (const blitz::Array<T,2>& i1,
+      const blitz::Array<T,2>& i2, const blitz::Array<T,2>& u,
+      const blitz::Array<T,2>& v, blitz::Array<T,2>& error);
 
 }}}
 
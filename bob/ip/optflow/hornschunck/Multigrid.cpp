@@ -0,0 +1,597 @@
+/**
+ * @date Sat 17 Oct 2026 14:03:47 CEST
+ *
+ * @brief Implements the multigrid solver for the Horn & Schunck system
+ *
+ * Copyright (C) 2011-2014 Idiap Research Institute, Martigny, Switzerland
+ */
+
+#include <algorithm>
+#include <stdexcept>
+#include <bob.core/assert.h>
+
+#include "Multigrid.h"
+#include "Stencil.h"
+
+/**
+ * Pivots of the coarsest factorization that fall below this fraction of the
+ * matching diagonal entry are considered null. This happens when the
+ * gradients vanish over the whole frame and the flow is not determined: the
+ * corresponding components of the coarse correction are set to zero.
+ */
+static const double PIVOT_TOLERANCE = 1e-12;
+
+/**
+ * Splits rows [0, rows) in one band per thread of the pool and calls
+ * f(start, end) for each band in parallel.
+ */
+template <typename F>
+static void mg_run(bob::ip::optflow::ThreadPool& pool, int rows, const F& f) {
+  const size_t bands = std::min(pool.getThreads(), static_cast<size_t>(rows));
+  pool.run(bands, [&](size_t b) {
+    f(bob::ip::optflow::band_start(rows, bands, b),
+      bob::ip::optflow::band_start(rows, bands, b+1));
+  });
+}
+
+/**
+ * Builds the system of the finest level out of the gradients, for rows
+ * [start, end)
+ */
+template <typename T>
+static void mg_system(double a2, const blitz::Array<T,2>& ex,
+    const blitz::Array<T,2>& ey, const blitz::Array<T,2>& et,
+    blitz::Array<double,2>& j11, blitz::Array<double,2>& j12,
+    blitz::Array<double,2>& j22, blitz::Array<double,2>& idet,
+    blitz::Array<double,2>& b1, blitz::Array<double,2>& b2,
+    int start, int end) {
+
+  for (int i=start; i<end; ++i) {
+    for (int j=0; j<ex.extent(1); ++j) {
+      const double x = ex(i,j);
+      const double y = ey(i,j);
+      const double t = et(i,j);
+      j11(i,j) = x*x;
+      j12(i,j) = x*y;
+      j22(i,j) = y*y;
+      idet(i,j) = 1. / ((j11(i,j) + a2)*(j22(i,j) + a2) - j12(i,j)*j12(i,j));
+      b1(i,j) = -x*t;
+      b2(i,j) = -y*t;
+    }
+  }
+
+}
+
+/**
+ * Copies rows [start, end) of a plane into another one, converting between
+ * scalar types if needed
+ */
+template <typename S, typename D>
+static void mg_copy(const blitz::Array<S,2>& from, blitz::Array<D,2>& to,
+    int start, int end) {
+  for (int i=start; i<end; ++i)
+    for (int j=0; j<from.extent(1); ++j) to(i,j) = from(i,j);
+}
+
+/**
+ * Averages the fine plane over 2x2 blocks into rows [start, end) of the
+ * coarse plane. Blocks that stick out of odd-sized planes only average the
+ * pixels they cover.
+ */
+static void mg_restrict(const blitz::Array<double,2>& fine,
+    blitz::Array<double,2>& coarse, int start, int end) {
+
+  const int height = fine.extent(0);
+  const int width = fine.extent(1);
+
+  for (int I=start; I<end; ++I) {
+    const double* f0 = &fine(2*I, 0);
+    const double* f1 = &fine(std::min(2*I+1, height-1), 0);
+    double* c = &coarse(I, 0);
+    for (int J=0; J<coarse.extent(1); ++J) {
+      const int j0 = 2*J;
+      const int j1 = std::min(2*J+1, width-1);
+      c[J] = .25*(f0[j0] + f0[j1] + f1[j0] + f1[j1]);
+    }
+  }
+
+}
+
+/**
+ * Returns the weight with which fine row (or column) i contributes to
+ * coarse row I, out of a total of n coarse rows, in the bilinear
+ * interpolation of mg_prolongate().
+ */
+static inline double mg_weight(int i, int I, int n) {
+  const int I1 = i >> 1;
+  const int I2 = (i & 1) ? std::min(I1+1, n-1) : std::max(I1-1, 0);
+  return ((I1 == I) ? .75 : 0.) + ((I2 == I) ? .25 : 0.);
+}
+
+/**
+ * Restricts the fine residual into rows [start, end) of the coarse
+ * right-hand side, with the transpose of the bilinear interpolation scaled
+ * by 1/4. Each coarse pixel gathers the 4x4 fine pixels around its block.
+ */
+static void mg_restrict_residual(const blitz::Array<double,2>& fine,
+    blitz::Array<double,2>& coarse, int start, int end) {
+
+  const int height = fine.extent(0);
+  const int width = fine.extent(1);
+  const int cheight = coarse.extent(0);
+  const int cwidth = coarse.extent(1);
+
+  for (int I=start; I<end; ++I) {
+    const int i0 = std::max(2*I-1, 0);
+    const int i1 = std::min(2*I+2, height-1);
+    for (int J=0; J<cwidth; ++J) {
+      const int j0 = std::max(2*J-1, 0);
+      const int j1 = std::min(2*J+2, width-1);
+      double sum = 0.;
+      for (int i=i0; i<=i1; ++i) {
+        const double wi = mg_weight(i, I, cheight);
+        if (wi == 0.) continue;
+        const double* f = &fine(i, 0);
+        double row = 0.;
+        for (int j=j0; j<=j1; ++j) row += mg_weight(j, J, cwidth) * f[j];
+        sum += wi * row;
+      }
+      coarse(I, J) = .25 * sum;
+    }
+  }
+
+}
+
+/**
+ * Returns the position of the u component of pixel (i, j) in the vector of
+ * unknowns of the coarsest system. Pixels are numbered along the longest
+ * side first, which keeps the bandwidth of the system small, and the u and
+ * v components of a pixel are interleaved.
+ */
+static inline int mg_index(int i, int j, int height, int width) {
+  return 2 * ((height >= width) ? i*width + j : j*height + i);
+}
+
+/**
+ * Computes the inverse of the 2x2 determinants of a level, for rows
+ * [start, end)
+ */
+static void mg_determinant(double a2, const blitz::Array<double,2>& j11,
+    const blitz::Array<double,2>& j12, const blitz::Array<double,2>& j22,
+    blitz::Array<double,2>& idet, int start, int end) {
+
+  for (int i=start; i<end; ++i) {
+    for (int j=0; j<j11.extent(1); ++j) {
+      idet(i,j) = 1. / ((j11(i,j) + a2)*(j22(i,j) + a2) - j12(i,j)*j12(i,j));
+    }
+  }
+
+}
+
+/**
+ * A Gauss-Seidel sweep over the pixels of one colour in rows [start, end).
+ * Each pixel is set to the solution of its 2x2 system, given the current
+ * values of its neighbours.
+ */
+template <typename Average>
+static void mg_smooth(double a2, const blitz::Array<double,2>& j11,
+    const blitz::Array<double,2>& j12, const blitz::Array<double,2>& j22,
+    const blitz::Array<double,2>& idet, const blitz::Array<double,2>& b1,
+    const blitz::Array<double,2>& b2, blitz::Array<double,2>& u,
+    blitz::Array<double,2>& v, int colour, int start, int end) {
+
+  const int height = u.extent(0);
+  const int width = u.extent(1);
+
+  for (int i=start; i<end; ++i) {
+    const int first = bob::ip::optflow::detail::first_of_colour<Average>(
+        colour, i);
+    if (first < 0) continue;
+
+    const int up = (i > 0) ? i-1 : 0;
+    const int down = (i < height-1) ? i+1 : height-1;
+    const double* u_up = &u(up,0);
+    double* u_mid = &u(i,0);
+    const double* u_down = &u(down,0);
+    const double* v_up = &v(up,0);
+    double* v_mid = &v(i,0);
+    const double* v_down = &v(down,0);
+
+    for (int j=first; j<width; j+=2) {
+      const int l = (j > 0) ? j-1 : 0;
+      const int r = (j < width-1) ? j+1 : width-1;
+      const double r1 = a2*Average::apply(u_up, u_mid, u_down, l, j, r) +
+        b1(i,j);
+      const double r2 = a2*Average::apply(v_up, v_mid, v_down, l, j, r) +
+        b2(i,j);
+      u_mid[j] = ((j22(i,j) + a2)*r1 - j12(i,j)*r2) * idet(i,j);
+      v_mid[j] = ((j11(i,j) + a2)*r2 - j12(i,j)*r1) * idet(i,j);
+    }
+  }
+
+}
+
+/**
+ * Computes the residual of the system of a level for rows [start, end). If
+ * residual and scale are not null, the squared norms of the residual and
+ * of the right-hand side on each row i are stored in residual[i] and
+ * scale[i].
+ */
+template <typename Average>
+static void mg_residual(double a2, const blitz::Array<double,2>& j11,
+    const blitz::Array<double,2>& j12, const blitz::Array<double,2>& j22,
+    const blitz::Array<double,2>& b1, const blitz::Array<double,2>& b2,
+    const blitz::Array<double,2>& u, const blitz::Array<double,2>& v,
+    blitz::Array<double,2>& r1, blitz::Array<double,2>& r2,
+    double* residual, double* scale, int start, int end) {
+
+  const int height = u.extent(0);
+  const int width = u.extent(1);
+
+  for (int i=start; i<end; ++i) {
+    const int up = (i > 0) ? i-1 : 0;
+    const int down = (i < height-1) ? i+1 : height-1;
+    const double* u_up = &u(up,0);
+    const double* u_mid = &u(i,0);
+    const double* u_down = &u(down,0);
+    const double* v_up = &v(up,0);
+    const double* v_mid = &v(i,0);
+    const double* v_down = &v(down,0);
+
+    for (int j=0; j<width; ++j) {
+      const int l = (j > 0) ? j-1 : 0;
+      const int r = (j < width-1) ? j+1 : width-1;
+      const double ubar = Average::apply(u_up, u_mid, u_down, l, j, r);
+      const double vbar = Average::apply(v_up, v_mid, v_down, l, j, r);
+      r1(i,j) = b1(i,j) + a2*(ubar - u_mid[j]) -
+        (j11(i,j)*u_mid[j] + j12(i,j)*v_mid[j]);
+      r2(i,j) = b2(i,j) + a2*(vbar - v_mid[j]) -
+        (j12(i,j)*u_mid[j] + j22(i,j)*v_mid[j]);
+    }
+
+    if (residual) {
+      double r = 0.;
+      double b = 0.;
+      for (int j=0; j<width; ++j) {
+        r += r1(i,j)*r1(i,j) + r2(i,j)*r2(i,j);
+        b += b1(i,j)*b1(i,j) + b2(i,j)*b2(i,j);
+      }
+      residual[i] = r;
+      scale[i] = b;
+    }
+  }
+
+}
+
+/**
+ * Interpolates the coarse correction bilinearly and adds it to rows
+ * [start, end) of the fine estimate. Coarse pixels sit at the centre of the
+ * 2x2 fine blocks they cover, so each fine pixel takes 9/16 of its own
+ * block, 3/16 of the two blocks next to it and 1/16 of the diagonal one.
+ * Borders are mirrored.
+ */
+static void mg_prolongate(const blitz::Array<double,2>& coarse,
+    blitz::Array<double,2>& fine, int start, int end) {
+
+  const int height = coarse.extent(0);
+  const int width = coarse.extent(1);
+
+  for (int i=start; i<end; ++i) {
+    const int I = i >> 1;
+    const int I2 = (i & 1) ? std::min(I+1, height-1) : std::max(I-1, 0);
+    const double* c0 = &coarse(I, 0);
+    const double* c1 = &coarse(I2, 0);
+    double* f = &fine(i, 0);
+    for (int j=0; j<fine.extent(1); ++j) {
+      const int J = j >> 1;
+      const int J2 = (j & 1) ? std::min(J+1, width-1) : std::max(J-1, 0);
+      f[j] += .5625*c0[J] + .1875*(c0[J2] + c1[J]) + .0625*c1[J2];
+    }
+  }
+
+}
+
+bob::ip::optflow::MultigridSolver::MultigridSolver
+(const blitz::TinyVector<int,2>& shape) :
+  m_levels(0),
+  m_cycle(1),
+  m_pre(2),
+  m_post(2)
+{
+  setShape(shape);
+}
+
+bob::ip::optflow::MultigridSolver::~MultigridSolver() { }
+
+void bob::ip::optflow::MultigridSolver::setShape
+(const blitz::TinyVector<int,2>& shape) {
+  m_hierarchies.clear();
+  m_shape = shape;
+  m_levels = 1;
+  for (blitz::TinyVector<int,2> s(shape); s(0) > 2 && s(1) > 2; ++m_levels) {
+    s(0) = (s(0) + 1) / 2;
+    s(1) = (s(1) + 1) / 2;
+  }
+}
+
+/**
+ * Allocates the levels and the work buffers of a hierarchy for the current
+ * shape
+ */
+void bob::ip::optflow::MultigridSolver::build(Hierarchy& h) const {
+  h.levels.clear();
+  blitz::TinyVector<int,2> s(m_shape);
+  while (true) {
+    h.levels.push_back(Level());
+    Level& level = h.levels.back();
+    level.j11.resize(s);
+    level.j12.resize(s);
+    level.j22.resize(s);
+    level.idet.resize(s);
+    level.b1.resize(s);
+    level.b2.resize(s);
+    level.u.resize(s);
+    level.v.resize(s);
+    level.r1.resize(s);
+    level.r2.resize(s);
+    level.a2 = 0.;
+    if (s(0) <= 2 || s(1) <= 2) break;
+    s(0) = (s(0) + 1) / 2;
+    s(1) = (s(1) + 1) / 2;
+  }
+  h.residual.resize(m_shape(0));
+  h.scale.resize(m_shape(0));
+  const size_t unknowns = 2 * s(0) * s(1);
+  h.bandwidth = 2 * (std::min(s(0), s(1)) + 1);
+  h.band.resize(unknowns * (h.bandwidth + 1));
+  h.pivot.resize(unknowns);
+  h.rhs.resize(unknowns);
+}
+
+void bob::ip::optflow::MultigridSolver::setCycle(size_t cycle) {
+  if (cycle == 0) throw std::runtime_error("the multigrid cycle must visit each coarser level at least once");
+  m_cycle = cycle;
+}
+
+template <typename Average>
+void bob::ip::optflow::MultigridSolver::factorize(Hierarchy& h) const {
+
+  const Level& c = h.levels.back();
+  const int height = c.u.extent(0);
+  const int width = c.u.extent(1);
+  const int bw = h.bandwidth;
+  const int n = h.pivot.size();
+
+  // assembles the lower half of the system: row k of h.band holds the
+  // diagonal entry of unknown k, followed by its coefficients on unknowns
+  // k-1, ..., k-bw
+  std::fill(h.band.begin(), h.band.end(), 0.);
+  for (int i=0; i<height; ++i) {
+    for (int j=0; j<width; ++j) {
+      const int p = mg_index(i, j, height, width);
+      double* ru = &h.band[p*(bw+1)];
+      double* rv = &h.band[(p+1)*(bw+1)];
+      ru[0] += c.j11(i,j) + c.a2;
+      rv[0] += c.j22(i,j) + c.a2;
+      rv[1] += c.j12(i,j);
+      for (int di=-1; di<=1; ++di) {
+        for (int dj=-1; dj<=1; ++dj) {
+          const double w = Average::weight(di, dj);
+          if (w == 0.) continue;
+          const int q = mg_index(std::min(std::max(i+di, 0), height-1),
+              std::min(std::max(j+dj, 0), width-1), height, width);
+          if (q > p) continue;
+          ru[p-q] -= c.a2 * w;
+          rv[p-q] -= c.a2 * w;
+        }
+      }
+    }
+  }
+
+  // in-place LDL^T factorization, within the band
+  for (int k=0; k<n; ++k) {
+    double* rk = &h.band[k*(bw+1)];
+    const int first = std::max(k-bw, 0);
+    for (int j=first; j<k; ++j) {
+      const double* rj = &h.band[j*(bw+1)];
+      double sum = rk[k-j];
+      for (int m=std::max(first, j-bw); m<j; ++m)
+        sum -= rk[k-m] * h.pivot[m] * rj[j-m];
+      rk[k-j] = (h.pivot[j] != 0.) ? sum / h.pivot[j] : 0.;
+    }
+    double d = rk[0];
+    for (int m=first; m<k; ++m) d -= rk[k-m] * rk[k-m] * h.pivot[m];
+    h.pivot[k] = (d > PIVOT_TOLERANCE * rk[0]) ? d : 0.;
+  }
+
+}
+
+void bob::ip::optflow::MultigridSolver::solveCoarsest(Hierarchy& h) const {
+
+  Level& c = h.levels.back();
+  const int height = c.u.extent(0);
+  const int width = c.u.extent(1);
+  const int bw = h.bandwidth;
+  const int n = h.pivot.size();
+
+  for (int i=0; i<height; ++i) {
+    for (int j=0; j<width; ++j) {
+      const int p = mg_index(i, j, height, width);
+      h.rhs[p] = c.b1(i,j);
+      h.rhs[p+1] = c.b2(i,j);
+    }
+  }
+
+  for (int k=0; k<n; ++k) {
+    const double* rk = &h.band[k*(bw+1)];
+    for (int m=std::max(k-bw, 0); m<k; ++m) h.rhs[k] -= rk[k-m] * h.rhs[m];
+  }
+  for (int k=0; k<n; ++k) {
+    h.rhs[k] = (h.pivot[k] != 0.) ? h.rhs[k] / h.pivot[k] : 0.;
+  }
+  for (int k=n-1; k>=0; --k) {
+    for (int m=k+1; m<=std::min(k+bw, n-1); ++m)
+      h.rhs[k] -= h.band[m*(bw+1) + (m-k)] * h.rhs[m];
+  }
+
+  for (int i=0; i<height; ++i) {
+    for (int j=0; j<width; ++j) {
+      const int p = mg_index(i, j, height, width);
+      c.u(i,j) = h.rhs[p];
+      c.v(i,j) = h.rhs[p+1];
+    }
+  }
+
+}
+
+/**
+ * Runs one cycle on the given level, recursing to the coarser ones. On the
+ * finest level, with a positive tolerance, the cycle returns true right
+ * after computing a residual that satisfies it. The coarsest level is
+ * solved exactly and always returns true.
+ */
+template <typename Average>
+bool bob::ip::optflow::MultigridSolver::cycle
+(bob::ip::optflow::ThreadPool& pool, Hierarchy& h, size_t level,
+ double tolerance) const {
+
+  Level& f = h.levels[level];
+  const int rows = f.u.extent(0);
+
+  int colour = 0;
+  auto smooth = [&](int start, int end) {
+    mg_smooth<Average>(f.a2, f.j11, f.j12, f.j22, f.idet, f.b1, f.b2, f.u,
+        f.v, colour, start, end);
+  };
+
+  if (level + 1 == h.levels.size()) {
+    solveCoarsest(h);
+    return true;
+  }
+
+  for (size_t k=0; k<m_pre; ++k)
+    for (colour=0; colour<Average::colours; ++colour)
+      mg_run(pool, rows, smooth);
+
+  double* residual = (tolerance > 0.) ? h.residual.data() : 0;
+  double* scale = (tolerance > 0.) ? h.scale.data() : 0;
+  mg_run(pool, rows, [&](int start, int end) {
+    mg_residual<Average>(f.a2, f.j11, f.j12, f.j22, f.b1, f.b2, f.u, f.v,
+        f.r1, f.r2, residual, scale, start, end);
+  });
+
+  if (residual) {
+    // rows are summed in order, so this does not depend on the threads
+    double r = 0.;
+    double b = 0.;
+    for (int i=0; i<rows; ++i) {
+      r += residual[i];
+      b += scale[i];
+    }
+    if (r <= tolerance*tolerance*b) return true;
+  }
+
+  Level& c = h.levels[level+1];
+  mg_run(pool, c.u.extent(0), [&](int start, int end) {
+    mg_restrict_residual(f.r1, c.b1, start, end);
+    mg_restrict_residual(f.r2, c.b2, start, end);
+    c.u(blitz::Range(start, end-1), blitz::Range::all()) = 0.;
+    c.v(blitz::Range(start, end-1), blitz::Range::all()) = 0.;
+  });
+
+  for (size_t k=0; k<m_cycle; ++k) cycle<Average>(pool, h, level+1, 0.);
+
+  mg_run(pool, rows, [&](int start, int end) {
+    mg_prolongate(c.u, f.u, start, end);
+    mg_prolongate(c.v, f.v, start, end);
+  });
+
+  for (size_t k=0; k<m_post; ++k)
+    for (colour=0; colour<Average::colours; ++colour)
+      mg_run(pool, rows, smooth);
+
+  return false;
+
+}
+
+template <typename Average, typename T>
+size_t bob::ip::optflow::MultigridSolver::solve
+(bob::ip::optflow::ThreadPool& pool, double a2, size_t cycles,
+ double tolerance, const blitz::Array<T,2>& ex, const blitz::Array<T,2>& ey,
+ const blitz::Array<T,2>& et, blitz::Array<T,2>& u,
+ blitz::Array<T,2>& v) const {
+
+  bob::core::array::assertSameShape(ex, m_shape);
+  Workspaces<Hierarchy>::Lease lease = m_hierarchies.take();
+  Hierarchy& h = *lease;
+  if (h.levels.empty() || h.levels[0].u.extent(0) != m_shape(0) ||
+      h.levels[0].u.extent(1) != m_shape(1)) build(h);
+
+  Level& fine = h.levels[0];
+  bob::core::array::assertSameShape(ex, fine.u);
+  bob::core::array::assertSameShape(ey, fine.u);
+  bob::core::array::assertSameShape(et, fine.u);
+  bob::core::array::assertSameShape(u, fine.u);
+  bob::core::array::assertSameShape(v, fine.u);
+
+  fine.a2 = a2;
+  mg_run(pool, fine.u.extent(0), [&](int start, int end) {
+    mg_system(a2, ex, ey, et, fine.j11, fine.j12, fine.j22, fine.idet,
+        fine.b1, fine.b2, start, end);
+    mg_copy(u, fine.u, start, end);
+    mg_copy(v, fine.v, start, end);
+  });
+
+  for (size_t l=1; l<h.levels.size(); ++l) {
+    const Level& f = h.levels[l-1];
+    Level& c = h.levels[l];
+    c.a2 = f.a2 / 4.;
+    mg_run(pool, c.u.extent(0), [&](int start, int end) {
+      mg_restrict(f.j11, c.j11, start, end);
+      mg_restrict(f.j12, c.j12, start, end);
+      mg_restrict(f.j22, c.j22, start, end);
+      mg_determinant(c.a2, c.j11, c.j12, c.j22, c.idet, start, end);
+    });
+  }
+
+  factorize<Average>(h);
+
+  // cycles report convergence, which a single level always reaches as it is
+  // solved exactly
+  size_t n = 0;
+  while (n < cycles) {
+    ++n;
+    if (cycle<Average>(pool, h, 0, tolerance)) break;
+  }
+
+  mg_run(pool, fine.u.extent(0), [&](int start, int end) {
+    mg_copy(fine.u, u, start, end);
+    mg_copy(fine.v, v, start, end);
+  });
+  return n;
+
+}
+
+template size_t bob::ip::optflow::MultigridSolver::solve
+<bob::ip::optflow::detail::HSAverage, float>(bob::ip::optflow::ThreadPool&,
+ double, size_t, double, const blitz::Array<float,2>&,
+ const blitz::Array<float,2>&, const blitz::Array<float,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&) const;
+
+template size_t bob::ip::optflow::MultigridSolver::solve
+<bob::ip::optflow::detail::HSAverage, double>(bob::ip::optflow::ThreadPool&,
+ double, size_t, double, const blitz::Array<double,2>&,
+ const blitz::Array<double,2>&, const blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&) const;
+
+template size_t bob::ip::optflow::MultigridSolver::solve
+<bob::ip::optflow::detail::OpenCVAverage, float>(bob::ip::optflow::ThreadPool&,
+ double, size_t, double, const blitz::Array<float,2>&,
+ const blitz::Array<float,2>&, const blitz::Array<float,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&) const;
+
+template size_t bob::ip::optflow::MultigridSolver::solve
+<bob::ip::optflow::detail::OpenCVAverage, double>(bob::ip::optflow::ThreadPool&,
+ double, size_t, double, const blitz::Array<double,2>&,
+ const blitz::Array<double,2>&, const blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&) const;
@@ -0,0 +1,199 @@
+/**
+ * @date Sat 17 Oct 2026 14:03:47 CEST
+ *
+ * @brief A geometric multigrid solver for the Horn & Schunck linear system
+ *
+ * Copyright (C) 2011-2014 Idiap Research Institute, Martigny, Switzerland
+ */
+
+#ifndef BOB_IP_OPTFLOW_MULTIGRID_H
+#define BOB_IP_OPTFLOW_MULTIGRID_H
+
+#include <cstdlib>
+#include <vector>
+#include <blitz/array.h>
+#include "ThreadPool.h"
+#include "Workspaces.h"
+
+namespace bob { namespace ip { namespace optflow {
+
+  /**
+   * Solves the linear system behind the Horn & Schunck method with
+   * multigrid cycles. At every pixel, the flow (u, v) satisfies:
+   *
+   * (J11 + alpha^2) u + J12 v = alpha^2 u_bar + b1
+   * J12 u + (J22 + alpha^2) v = alpha^2 v_bar + b2
+   *
+   * where, on the image grid, J11 = Ex^2, J12 = Ex*Ey, J22 = Ey^2,
+   * b1 = -Ex*Et and b2 = -Ey*Et, while u_bar and v_bar are the
+   * neighbourhood averages of the flow.
+   *
+   * Each level of the hierarchy halves the resolution of the one above it,
+   * until one of the sides is 2 pixels or less. The coarse systems are
+   * built by averaging the J planes over 2x2 blocks and dividing alpha^2 by
+   * 4, which keeps the smoothness term consistent with the doubled grid
+   * spacing. On each level, a cycle smooths the current estimate with
+   * multi-colour Gauss-Seidel sweeps, restricts the residual to the next
+   * level, solves there for a correction (recursively) and interpolates it
+   * back bilinearly before smoothing again. The residual is restricted with
+   * the transpose of the interpolation. The coarsest system is solved
+   * exactly, with a banded LDL^T factorization that is computed once per
+   * call to solve(). Smooth errors, which relaxation alone takes thousands
+   * of iterations to damp on large frames, are removed by the coarse
+   * levels, so a few cycles are enough regardless of the resolution.
+   *
+   * The same neighbourhood average is used on all levels. It is selected by
+   * the template parameter of solve(), which is one of the averages in
+   * Stencil.h.
+   *
+   * Each call to solve() works on a hierarchy of its own, taken from a pool,
+   * so that a solver may be shared by estimations running in different
+   * threads.
+   */
+  class MultigridSolver {
+
+    public: //api
+
+      /**
+       * Constructor, specify shape of the flow fields to be treated
+       */
+      MultigridSolver(const blitz::TinyVector<int,2>& shape);
+
+      /**
+       * Virtual destructor
+       */
+      virtual ~MultigridSolver();
+
+      /**
+       * Returns the current shape supported
+       */
+      inline const blitz::TinyVector<int,2>& getShape() const {
+        return m_shape;
+      }
+
+      /**
+       * Re-shape internal buffers, rebuilding the hierarchy of levels
+       */
+      void setShape(const blitz::TinyVector<int,2>& shape);
+
+      /**
+       * Returns the number of levels in the hierarchy, counting the finest
+       */
+      inline size_t getLevels() const { return m_levels; }
+
+      /**
+       * Returns the number of times each level visits the next coarser one
+       * during a cycle: 1 makes V-cycles and 2 makes W-cycles.
+       */
+      inline size_t getCycle() const { return m_cycle; }
+
+      /**
+       * Sets the number of times each level visits the next coarser one
+       * during a cycle: 1 makes V-cycles and 2 makes W-cycles. Must be at
+       * least 1.
+       */
+      void setCycle(size_t cycle);
+
+      /**
+       * Returns the number of Gauss-Seidel sweeps applied on each level
+       * before the residual is restricted
+       */
+      inline size_t getPreSmoothing() const { return m_pre; }
+
+      /**
+       * Sets the number of Gauss-Seidel sweeps applied on each level before
+       * the residual is restricted
+       */
+      inline void setPreSmoothing(size_t sweeps) { m_pre = sweeps; }
+
+      /**
+       * Returns the number of Gauss-Seidel sweeps applied on each level
+       * after the coarse correction is added
+       */
+      inline size_t getPostSmoothing() const { return m_post; }
+
+      /**
+       * Sets the number of Gauss-Seidel sweeps applied on each level after
+       * the coarse correction is added
+       */
+      inline void setPostSmoothing(size_t sweeps) { m_post = sweeps; }
+
+      /**
+       * Runs a number of cycles on the system built from the gradients
+       * (ex, ey, et) and the squared smoothness weight a2, starting from
+       * (u, v). The final estimate is written back to (u, v). The work of
+       * every step is split in row bands among the threads of the pool, and
+       * the result does not depend on their number.
+       *
+       * If tolerance is positive, the residual computed on the finest level
+       * of each cycle is compared to the right-hand side. Once its norm
+       * falls below tolerance times the norm of the right-hand side, the
+       * current estimate is returned without finishing the cycle. Returns
+       * the number of cycles that were (at least partly) run.
+       *
+       * Average is one of the neighbourhood averages of Stencil.h. The
+       * gradients and the flow are arrays of type T, which is either float
+       * or double, while the hierarchy is always solved in double
+       * precision.
+       */
+      template <typename Average, typename T>
+      size_t solve(bob::ip::optflow::ThreadPool& pool, double a2,
+          size_t cycles, double tolerance, const blitz::Array<T,2>& ex,
+          const blitz::Array<T,2>& ey, const blitz::Array<T,2>& et,
+          blitz::Array<T,2>& u, blitz::Array<T,2>& v) const;
+
+    private: //representation
+
+      /**
+       * The system and the work buffers of one level of the hierarchy
+       */
+      struct Level {
+        blitz::Array<double,2> j11; ///< J11 plane
+        blitz::Array<double,2> j12; ///< J12 plane
+        blitz::Array<double,2> j22; ///< J22 plane
+        blitz::Array<double,2> idet; ///< inverse of the 2x2 determinants
+        blitz::Array<double,2> b1; ///< right-hand side for u
+        blitz::Array<double,2> b2; ///< right-hand side for v
+        blitz::Array<double,2> u; ///< u estimate (correction if coarse)
+        blitz::Array<double,2> v; ///< v estimate (correction if coarse)
+        blitz::Array<double,2> r1; ///< u residual
+        blitz::Array<double,2> r2; ///< v residual
+        double a2; ///< alpha^2 scaled for this level
+      };
+
+      /**
+       * The levels and the work buffers of one call to solve()
+       */
+      struct Hierarchy {
+        std::vector<Level> levels; ///< finest level first
+        std::vector<double> band; ///< coarsest L factor, by rows
+        std::vector<double> pivot; ///< coarsest D factor
+        std::vector<double> rhs; ///< coarsest right-hand side
+        blitz::Array<double,1> residual; ///< per-row residual norms
+        blitz::Array<double,1> scale; ///< per-row right-hand norms
+        int bandwidth; ///< number of sub-diagonals of the coarsest system
+      };
+
+      void build(Hierarchy& h) const;
+
+      template <typename Average>
+      bool cycle(bob::ip::optflow::ThreadPool& pool, Hierarchy& h,
+          size_t level, double tolerance) const;
+
+      template <typename Average>
+      void factorize(Hierarchy& h) const;
+
+      void solveCoarsest(Hierarchy& h) const;
+
+      blitz::TinyVector<int,2> m_shape; ///< shape of the finest level
+      size_t m_levels; ///< number of levels, counting the finest
+      mutable Workspaces<Hierarchy> m_hierarchies; ///< idle hierarchies
+      size_t m_cycle; ///< coarse visits per level (1 = V, 2 = W)
+      size_t m_pre; ///< pre-smoothing sweeps
+      size_t m_post; ///< post-smoothing sweeps
+
+  };
+
+}}}
+
+#endif /* BOB_IP_OPTFLOW_MULTIGRID_H */
@@ -0,0 +1,65 @@
+/**
+ * @date Sat 17 Oct 2026 17:21:08 CEST
+ *
+ * @brief Detects and selects the SIMD instruction set used by the kernels
+ *
+ * Copyright (C) 2011-2014 Idiap Research Institute, Martigny, Switzerland
+ */
+
+#include <atomic>
+#include <string>
+#include <stdexcept>
+
+#include "Simd.h"
+
+bool bob::ip::optflow::isSimdSupported(bob::ip::optflow::Simd::Type simd) {
+  switch (simd) {
+    case Simd::Scalar: return true;
+#ifdef BOB_IP_OPTFLOW_X86_SIMD
+    case Simd::SSE2: return __builtin_cpu_supports("sse2");
+    case Simd::AVX2: return __builtin_cpu_supports("avx2");
+    case Simd::AVX512: return __builtin_cpu_supports("avx512f");
+#endif
+    default: return false;
+  }
+}
+
+bob::ip::optflow::Simd::Type bob::ip::optflow::getBestSimd() {
+#ifdef BOB_IP_OPTFLOW_X86_SIMD
+  // this may run from a static constructor, before the CPU model is set up
+  __builtin_cpu_init();
+#endif
+  static const Simd::Type best =
+    isSimdSupported(Simd::AVX512) ? Simd::AVX512 :
+    isSimdSupported(Simd::AVX2) ? Simd::AVX2 :
+    isSimdSupported(Simd::SSE2) ? Simd::SSE2 :
+    Simd::Scalar;
+  return best;
+}
+
+/**
+ * The instruction set in use, picked when the library is loaded
+ */
+static std::atomic<int> s_simd(bob::ip::optflow::getBestSimd());
+
+bob::ip::optflow::Simd::Type bob::ip::optflow::getSimd() {
+  return static_cast<Simd::Type>(s_simd.load(std::memory_order_relaxed));
+}
+
+void bob::ip::optflow::setSimd(bob::ip::optflow::Simd::Type simd) {
+  if (!isSimdSupported(simd)) {
+    throw std::runtime_error(std::string("the ") + getSimdName(simd) +
+        " instruction set is not supported on this machine");
+  }
+  s_simd.store(simd, std::memory_order_relaxed);
+}
+
+const char* bob::ip::optflow::getSimdName(bob::ip::optflow::Simd::Type simd) {
+  switch (simd) {
+    case Simd::Scalar: return "scalar";
+    case Simd::SSE2: return "sse2";
+    case Simd::AVX2: return "avx2";
+    case Simd::AVX512: return "avx512";
+    default: return "unknown";
+  }
+}
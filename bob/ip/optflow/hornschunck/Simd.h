@@ -0,0 +1,280 @@
+/**
+ * @date Sat 17 Oct 2026 17:21:08 CEST
+ *
+ * @brief Runtime selection of the SIMD instruction set used by the kernels
+ *
+ * Copyright (C) 2011-2014 Idiap Research Institute, Martigny, Switzerland
+ */
+
+#ifndef BOB_IP_OPTFLOW_SIMD_H
+#define BOB_IP_OPTFLOW_SIMD_H
+
+#include <cstring>
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define BOB_IP_OPTFLOW_X86_SIMD 1
+#endif
+
+namespace bob { namespace ip { namespace optflow {
+
+  /**
+   * The instruction sets the numerical kernels can be run with
+   */
+  namespace Simd {
+    enum Type {
+      Scalar = 0, ///< portable code, one value at a time
+      SSE2 = 1, ///< 2 doubles (4 floats) per instruction
+      AVX2 = 2, ///< 4 doubles (8 floats) per instruction
+      AVX512 = 3 ///< 8 doubles (16 floats) per instruction (AVX-512F)
+    };
+  }
+
+  /**
+   * Tells if the given instruction set can be used on this machine. This is
+   * probed with CPUID, which also accounts for the support of the operating
+   * system. Only the scalar path exists on platforms other than x86.
+   */
+  bool isSimdSupported(Simd::Type simd);
+
+  /**
+   * Returns the best instruction set supported by this machine
+   */
+  Simd::Type getBestSimd();
+
+  /**
+   * Returns the instruction set currently used by the kernels. This is the
+   * best supported one, unless it was changed with setSimd().
+   */
+  Simd::Type getSimd();
+
+  /**
+   * Forces the kernels to use the given instruction set, which must be
+   * supported by this machine. All instruction sets produce exactly the same
+   * results: they only differ in speed.
+   */
+  void setSimd(Simd::Type simd);
+
+  /**
+   * Returns the (lower case) name of an instruction set, e.g. "avx2"
+   */
+  const char* getSimdName(Simd::Type simd);
+
+  namespace detail {
+
+#ifdef BOB_IP_OPTFLOW_X86_SIMD
+    typedef double v2d __attribute__((vector_size(16))); ///< SSE2 register
+    typedef double v4d __attribute__((vector_size(32))); ///< AVX register
+    typedef double v8d __attribute__((vector_size(64))); ///< AVX-512 register
+    typedef float v4f __attribute__((vector_size(16))); ///< SSE2 register
+    typedef float v8f __attribute__((vector_size(32))); ///< AVX register
+    typedef float v16f __attribute__((vector_size(64))); ///< AVX-512 register
+#endif
+
+    /**
+     * The scalar type held by values of type V, which is either a float, a
+     * double or one of the vector types above
+     */
+    template <typename V> struct scalar { typedef V type; };
+
+#ifdef BOB_IP_OPTFLOW_X86_SIMD
+    template <> struct scalar<v2d> { typedef double type; };
+    template <> struct scalar<v4d> { typedef double type; };
+    template <> struct scalar<v8d> { typedef double type; };
+    template <> struct scalar<v4f> { typedef float type; };
+    template <> struct scalar<v8f> { typedef float type; };
+    template <> struct scalar<v16f> { typedef float type; };
+#endif
+
+    /**
+     * The number of scalars held by values of type V
+     */
+    template <typename V> struct lanes {
+      static const int value = sizeof(V) / sizeof(typename scalar<V>::type);
+    };
+
+    /**
+     * The vector type holding as many scalars of type T as fit in the given
+     * number of bytes
+     */
+    template <typename T, int Bytes> struct vector;
+
+#ifdef BOB_IP_OPTFLOW_X86_SIMD
+    template <> struct vector<double,16> { typedef v2d type; };
+    template <> struct vector<double,32> { typedef v4d type; };
+    template <> struct vector<double,64> { typedef v8d type; };
+    template <> struct vector<float,16> { typedef v4f type; };
+    template <> struct vector<float,32> { typedef v8f type; };
+    template <> struct vector<float,64> { typedef v16f type; };
+#endif
+
+    /**
+     * Loads lanes<V>::value consecutive scalars, with no alignment
+     * requirement
+     */
+    template <typename V, typename T> inline V load(const T* p) {
+      V v;
+      std::memcpy(&v, p, sizeof(V));
+      return v;
+    }
+
+    /**
+     * Stores lanes<V>::value consecutive scalars, with no alignment
+     * requirement
+     */
+    template <typename T, typename V> inline void store(T* p, const V& v) {
+      std::memcpy(p, &v, sizeof(V));
+    }
+
+    /**
+     * Broadcasts a scalar to all lanes of V
+     */
+    template <typename V> inline V broadcast(typename scalar<V>::type x) {
+      return V() + x;
+    }
+
+    template <> inline double broadcast<double>(double x) {
+      return x;
+    }
+
+    template <> inline float broadcast<float>(float x) {
+      return x;
+    }
+
+#ifdef BOB_IP_OPTFLOW_X86_SIMD
+    typedef uint8_t v16u8 __attribute__((vector_size(16))); ///< 16 bytes
+    typedef uint16_t v8u16 __attribute__((vector_size(16))); ///< 8 words
+    typedef int32_t v4i __attribute__((vector_size(16))); ///< 4 integers
+
+    /**
+     * Widens 16 bytes to 32-bit integers, by interleaving them with zeros.
+     * This only takes SSE2 unpack instructions, while the compilers split a
+     * direct conversion to wider vectors in scalar operations.
+     */
+    inline void widen(const v16u8& x, v4i (&w)[4]) {
+      const v16u8 z = {};
+      const v8u16 lo = (v8u16)__builtin_shuffle(x, z,
+          (v16u8){0,16,1,17,2,18,3,19,4,20,5,21,6,22,7,23});
+      const v8u16 hi = (v8u16)__builtin_shuffle(x, z,
+          (v16u8){8,24,9,25,10,26,11,27,12,28,13,29,14,30,15,31});
+      const v8u16 z16 = {};
+      w[0] = (v4i)__builtin_shuffle(lo, z16, (v8u16){0,8,1,9,2,10,3,11});
+      w[1] = (v4i)__builtin_shuffle(lo, z16, (v8u16){4,12,5,13,6,14,7,15});
+      w[2] = (v4i)__builtin_shuffle(hi, z16, (v8u16){0,8,1,9,2,10,3,11});
+      w[3] = (v4i)__builtin_shuffle(hi, z16, (v8u16){4,12,5,13,6,14,7,15});
+    }
+
+    /**
+     * Widens 8 words to 32-bit integers, by interleaving them with zeros
+     */
+    inline void widen(const v8u16& x, v4i (&w)[2]) {
+      const v8u16 z = {};
+      w[0] = (v4i)__builtin_shuffle(x, z, (v8u16){0,8,1,9,2,10,3,11});
+      w[1] = (v4i)__builtin_shuffle(x, z, (v8u16){4,12,5,13,6,14,7,15});
+    }
+
+    /**
+     * Converts 4 integers to floating-point values and stores them
+     */
+    template <typename T> inline void store4(T* p, const v4i& w) {
+#if defined(__clang__) || __GNUC__ >= 9
+      typedef T v4 __attribute__((vector_size(4 * sizeof(T))));
+      store(p, __builtin_convertvector(w, v4));
+#else
+      for (int k=0; k<4; ++k) p[k] = w[k];
+#endif
+    }
+#endif
+
+    /**
+     * Converts n consecutive values of type U, e.g. the pixels of an 8-bit
+     * image, to the scalars of V. Bytes and words are widened 16 bytes at a
+     * time, unless V is a scalar. The conversions from uint8_t and uint16_t
+     * are exact.
+     */
+    template <typename V, typename U> struct converter {
+      typedef typename scalar<V>::type T;
+      static void run(const U* src, T* dst, int n) {
+        for (int j=0; j<n; ++j) dst[j] = T(src[j]);
+      }
+    };
+
+#ifdef BOB_IP_OPTFLOW_X86_SIMD
+    template <typename V> struct converter<V,uint8_t> {
+      typedef typename scalar<V>::type T;
+      static void run(const uint8_t* src, T* dst, int n) {
+        int j = 0;
+        for (; lanes<V>::value > 1 && j+16<=n; j+=16) {
+          v4i w[4];
+          widen(load<v16u8>(src+j), w);
+          for (int k=0; k<4; ++k) store4(dst+j+4*k, w[k]);
+        }
+        for (; j<n; ++j) dst[j] = T(src[j]);
+      }
+    };
+
+    template <typename V> struct converter<V,uint16_t> {
+      typedef typename scalar<V>::type T;
+      static void run(const uint16_t* src, T* dst, int n) {
+        int j = 0;
+        for (; lanes<V>::value > 1 && j+8<=n; j+=8) {
+          v4i w[2];
+          widen(load<v8u16>(src+j), w);
+          for (int k=0; k<2; ++k) store4(dst+j+4*k, w[k]);
+        }
+        for (; j<n; ++j) dst[j] = T(src[j]);
+      }
+    };
+#endif
+
+    template <typename V, typename U>
+    inline void convert(const U* src, typename scalar<V>::type* dst, int n) {
+      converter<V,U>::run(src, dst, n);
+    }
+
+#ifdef BOB_IP_OPTFLOW_X86_SIMD
+    template <typename T, typename F> __attribute__((target("avx512f"), flatten))
+    void simd_avx512(const F& f) {
+      f.template run<typename vector<T,64>::type>();
+    }
+
+    template <typename T, typename F> __attribute__((target("avx2"), flatten))
+    void simd_avx2(const F& f) {
+      f.template run<typename vector<T,32>::type>();
+    }
+
+    template <typename T, typename F> __attribute__((target("sse2"), flatten))
+    void simd_sse2(const F& f) {
+      f.template run<typename vector<T,16>::type>();
+    }
+#endif
+
+    /**
+     * Calls f.run<V>(), where V is the widest vector of scalars of type T
+     * in the instruction set currently selected, or T itself for the scalar
+     * path. The call is compiled separately for each instruction set, with
+     * all the code it reaches inlined, so kernels are written once as
+     * templates on V.
+     *
+     * Kernels must perform the same operations, in the same order, on every
+     * lane as the scalar code does on a single value. The library is built
+     * without floating-point contraction, so no instruction set fuses
+     * multiplications and additions and the results do not depend on the
+     * path taken.
+     */
+    template <typename T, typename F> void simd_dispatch(const F& f) {
+      switch (getSimd()) {
+#ifdef BOB_IP_OPTFLOW_X86_SIMD
+        case Simd::AVX512: simd_avx512<T>(f); return;
+        case Simd::AVX2: simd_avx2<T>(f); return;
+        case Simd::SSE2: simd_sse2<T>(f); return;
+#endif
+        default: f.template run<T>(); return;
+      }
+    }
+
+  }
+
+}}}
+
+#endif /* BOB_IP_OPTFLOW_SIMD_H */
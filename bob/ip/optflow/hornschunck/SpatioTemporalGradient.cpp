@@ -10,270 +10,1365 @@
  */
 
 #include <cmath>
-#include <bob.sp/extrapolate.h>
-#include <bob.sp/conv.h>
+#include <limits>
+#include <algorithm>
+#include <type_traits>
+#include <stdexcept>
+#include <stdint.h>
 #include <bob.core/assert.h>
 
 #include "SpatioTemporalGradient.h"
+#include "Simd.h"
 
-static inline void fastconv(const blitz::Array<double,2>& image,
-    const blitz::Array<double,1>& kernel,
-    blitz::Array<double,2>& result, int dimension) {
-  blitz::Array<double,2> imageExtra(bob::sp::getConvSepOutputSize(image, kernel, dimension, bob::sp::Conv::Full));
-  bob::sp::extrapolateMirror(image, imageExtra);
-  bob::sp::convSep(imageExtra, kernel, result, dimension, bob::sp::Conv::Valid);
+using bob::ip::optflow::detail::lanes;
+using bob::ip::optflow::detail::load;
+using bob::ip::optflow::detail::store;
+using bob::ip::optflow::detail::broadcast;
+
+static const double HS_DIFF_KERNEL_DATA[] = {+1/4., -1/4.};
+static const blitz::Array<double,1> HS_DIFF_KERNEL(const_cast<double*>(HS_DIFF_KERNEL_DATA), blitz::shape(2), blitz::neverDeleteData);
+static const double HS_AVG_KERNEL_DATA[] = {+1., +1.};
+static const blitz::Array<double,1> HS_AVG_KERNEL(const_cast<double*>(HS_AVG_KERNEL_DATA), blitz::shape(2), blitz::neverDeleteData);
+
+static const double SOBEL_DIFF_KERNEL_DATA[] = {+1., 0., -1.};
+static const blitz::Array<double,1> SOBEL_DIFF_KERNEL(const_cast<double*>(SOBEL_DIFF_KERNEL_DATA), blitz::shape(3), blitz::neverDeleteData);
+static const double SOBEL_AVG_KERNEL_DATA[] = {+1., +2., +1};
+static const blitz::Array<double,1> SOBEL_AVG_KERNEL(const_cast<double*>(SOBEL_AVG_KERNEL_DATA), blitz::shape(3), blitz::neverDeleteData);
+
+static const double PREWITT_DIFF_KERNEL_DATA[] = {+1., 0., -1.};
+static const blitz::Array<double,1> PREWITT_DIFF_KERNEL(const_cast<double*>(PREWITT_DIFF_KERNEL_DATA), blitz::shape(3), blitz::neverDeleteData);
+static const double PREWITT_AVG_KERNEL_DATA[] = {+1., +1., +1};
+static const blitz::Array<double,1> PREWITT_AVG_KERNEL(const_cast<double*>(PREWITT_AVG_KERNEL_DATA), blitz::shape(3), blitz::neverDeleteData);
+
+static const double ISOTROPIC_DIFF_KERNEL_DATA[] = {+1., 0., -1.};
+static const blitz::Array<double,1> ISOTROPIC_DIFF_KERNEL(const_cast<double*>(ISOTROPIC_DIFF_KERNEL_DATA), blitz::shape(3), blitz::neverDeleteData);
+static const double ISOTROPIC_AVG_KERNEL_DATA[] = {+1., std::sqrt(2.), +1};
+static const blitz::Array<double,1> ISOTROPIC_AVG_KERNEL(const_cast<double*>(ISOTROPIC_AVG_KERNEL_DATA), blitz::shape(3), blitz::neverDeleteData);
+
+/**
+ * Applies the taps of the difference and averaging kernels given at run time.
+ * diff(next, cur[, prev]) combines the values at offsets +1, 0 (and -1) with
+ * the mirrored kernel, as in a convolution, while diff_t(f1, f2[, f3])
+ * combines the terms of consecutive frames, the oldest first.
+ */
+template <typename T>
+struct generic_taps {
+  T d[3];
+  T a[3];
+  generic_taps(const blitz::Array<double,1>& diff_kernel,
+      const blitz::Array<double,1>& avg_kernel) {
+    for (int k=0; k<diff_kernel.extent(0); ++k) {
+      d[k] = T(diff_kernel(k));
+      a[k] = T(avg_kernel(k));
+    }
+  }
+  template <typename V> V diff(const V& n, const V& c) const {
+    return broadcast<V>(d[0])*n + broadcast<V>(d[1])*c;
+  }
+  template <typename V> V avg(const V& n, const V& c) const {
+    return broadcast<V>(a[0])*n + broadcast<V>(a[1])*c;
+  }
+  template <typename V> V diff_t(const V& f1, const V& f2) const {
+    return broadcast<V>(d[1])*f1 + broadcast<V>(d[0])*f2;
+  }
+  template <typename V> V avg_t(const V& f1, const V& f2) const {
+    return broadcast<V>(a[1])*f1 + broadcast<V>(a[0])*f2;
+  }
+  template <typename V> V diff(const V& n, const V& c, const V& p) const {
+    return broadcast<V>(d[0])*n + broadcast<V>(d[1])*c + broadcast<V>(d[2])*p;
+  }
+  template <typename V> V avg(const V& n, const V& c, const V& p) const {
+    return broadcast<V>(a[0])*n + broadcast<V>(a[1])*c + broadcast<V>(a[2])*p;
+  }
+  template <typename V> V diff_t(const V& f1, const V& f2, const V& f3) const {
+    return broadcast<V>(d[2])*f1 + broadcast<V>(d[1])*f2 + broadcast<V>(d[0])*f3;
+  }
+  template <typename V> V avg_t(const V& f1, const V& f2, const V& f3) const {
+    return broadcast<V>(a[2])*f1 + broadcast<V>(a[1])*f2 + broadcast<V>(a[0])*f3;
+  }
+};
+
+/**
+ * The taps of HornAndSchunckGradient, [+1/4; -1/4] and [+1; +1]. The scaling
+ * by a power of 2 is exact, so it may be applied after the difference: the
+ * results are the same as with generic_taps.
+ */
+struct hs_taps {
+  template <typename V> V diff(const V& n, const V& c) const {
+    return (n - c)*broadcast<V>(0.25);
+  }
+  template <typename V> V avg(const V& n, const V& c) const {
+    return n + c;
+  }
+  template <typename V> V diff_t(const V& f1, const V& f2) const {
+    return (f2 - f1)*broadcast<V>(0.25);
+  }
+  template <typename V> V avg_t(const V& f1, const V& f2) const {
+    return f1 + f2;
+  }
+};
+
+/**
+ * The difference taps [+1; 0; -1] shared by the built-in central operators.
+ * Dropping the products by 0 and 1 does not change the results of
+ * generic_taps, except for non-finite inputs.
+ */
+struct central_diff_taps {
+  template <typename V> V diff(const V& n, const V&, const V& p) const {
+    return n - p;
+  }
+  template <typename V> V diff_t(const V& f1, const V&, const V& f3) const {
+    return f3 - f1;
+  }
+};
+
+/**
+ * The taps of SobelGradient: the averaging kernel is [+1; +2; +1]
+ */
+struct sobel_taps: public central_diff_taps {
+  template <typename V> V avg(const V& n, const V& c, const V& p) const {
+    return n + (c + c) + p;
+  }
+  template <typename V> V avg_t(const V& f1, const V& f2, const V& f3) const {
+    return f1 + (f2 + f2) + f3;
+  }
+};
+
+/**
+ * The taps of PrewittGradient: the averaging kernel is [+1; +1; +1]
+ */
+struct prewitt_taps: public central_diff_taps {
+  template <typename V> V avg(const V& n, const V& c, const V& p) const {
+    return n + c + p;
+  }
+  template <typename V> V avg_t(const V& f1, const V& f2, const V& f3) const {
+    return f1 + f2 + f3;
+  }
+};
+
+/**
+ * The taps of IsotropicGradient: the averaging kernel is [+1; sqrt(2); +1]
+ */
+struct isotropic_taps: public central_diff_taps {
+  template <typename V> V avg(const V& n, const V& c, const V& p) const {
+    return n + broadcast<V>(std::sqrt(2.))*c + p;
+  }
+  template <typename V> V avg_t(const V& f1, const V& f2, const V& f3) const {
+    return f1 + broadcast<V>(std::sqrt(2.))*f2 + f3;
+  }
+};
+
+/**
+ * The kernels with a specialised implementation of their taps
+ */
+enum taps_type {
+  GENERIC_TAPS,
+  HS_TAPS,
+  SOBEL_TAPS,
+  PREWITT_TAPS,
+  ISOTROPIC_TAPS
+};
+
+static bool same_kernel(const blitz::Array<double,1>& kernel,
+    const blitz::Array<double,1>& reference) {
+  for (int k=0; k<kernel.extent(0); ++k)
+    if (kernel(k) != reference(k)) return false;
+  return true;
+}
+
+/**
+ * Tells which taps implement the given kernels: the specialised ones if they
+ * are those of a built-in operator, the generic ones otherwise
+ */
+static taps_type select_taps(const blitz::Array<double,1>& diff_kernel,
+    const blitz::Array<double,1>& avg_kernel) {
+  if (diff_kernel.extent(0) == 2) {
+    return (same_kernel(diff_kernel, HS_DIFF_KERNEL) &&
+        same_kernel(avg_kernel, HS_AVG_KERNEL)) ? HS_TAPS : GENERIC_TAPS;
+  }
+  if (!same_kernel(diff_kernel, SOBEL_DIFF_KERNEL)) return GENERIC_TAPS;
+  if (same_kernel(avg_kernel, SOBEL_AVG_KERNEL)) return SOBEL_TAPS;
+  if (same_kernel(avg_kernel, PREWITT_AVG_KERNEL)) return PREWITT_TAPS;
+  if (same_kernel(avg_kernel, ISOTROPIC_AVG_KERNEL)) return ISOTROPIC_TAPS;
+  return GENERIC_TAPS;
+}
+
+/**
+ * The factor by which the spatial terms of frames of type U are scaled: the
+ * reciprocal of the largest value of U when integer frames are normalised,
+ * 1 otherwise
+ */
+template <typename T, typename U>
+static T input_scale(bool normalize) {
+  if (!normalize || !std::numeric_limits<U>::is_integer) return T(1);
+  return T(1) / T(std::numeric_limits<U>::max());
+}
+
+/**
+ * Scales the spatial terms of a frame
+ */
+template <typename V>
+static inline void scale_terms(const V& s, V& bx, V& by, V& bt) {
+  bx = bx*s;
+  by = by*s;
+  bt = bt*s;
+}
+
+/**
+ * Gives the rows of a frame of type U as contiguous rows of T. The rows of
+ * frames of type T with unit stride are read in place. The others, e.g. the
+ * rows of 8-bit frames, are converted when they are first asked for, into a
+ * ring of a few rows that stays in cache: frames are never converted whole.
+ * The kernels sweep the rows in order and need at most 3 of them at once.
+ */
+template <typename T, typename U>
+class frame_rows {
+
+  public:
+
+    frame_rows(const blitz::Array<U,2>& frame) :
+      m_frame(frame),
+      m_direct(std::is_same<T,U>::value && frame.stride(1) == 1)
+    {
+      if (!m_direct) m_ring.resize(RING, frame.extent(1));
+      for (int k=0; k<RING; ++k) m_rows[k] = -1;
+    }
+
+    int height() const { return m_frame.extent(0); }
+    int width() const { return m_frame.extent(1); }
+
+    template <typename V> const T* row(int i) {
+      if (m_direct) return reinterpret_cast<const T*>(&m_frame(i,0));
+      const int k = i % RING;
+      T* dst = &m_ring(k,0);
+      if (m_rows[k] != i) {
+        const int width = m_frame.extent(1);
+        if (m_frame.stride(1) == 1)
+          bob::ip::optflow::detail::convert<V>(&m_frame(i,0), dst, width);
+        else
+          for (int j=0; j<width; ++j) dst[j] = T(m_frame(i,j));
+        m_rows[k] = i;
+      }
+      return dst;
+    }
+
+  private:
+
+    enum { RING = 4 };
+    const blitz::Array<U,2>& m_frame;
+    const bool m_direct;
+    blitz::Array<T,2> m_ring; ///< converted rows
+    int m_rows[RING]; ///< the frame row held by each row of the ring
+
+};
+
+/**
+ * Gives the rows of an 8-bit RGB frame, seen as a (3, height, width) array
+ * with any strides, as contiguous rows of T holding its luma, i.e.
+ * 0.299 R + 0.587 G + 0.114 B (ITU-R BT.601, as bob.ip.color.rgb_to_gray()
+ * but without rounding). The rows are converted into a ring when they are
+ * first asked for, like in frame_rows, so no gray frame is ever stored.
+ * Channels with unit column stride are widened lanes<V>::value pixels at a
+ * time, the others one pixel at a time, with the same results.
+ */
+template <typename T>
+class color_rows {
+
+  public:
+
+    color_rows(const blitz::Array<uint8_t,3>& frame) :
+      m_frame(frame),
+      m_ring(RING, frame.extent(2)),
+      m_channels(3, frame.extent(2))
+    {
+      for (int k=0; k<RING; ++k) m_rows[k] = -1;
+    }
+
+    int height() const { return m_frame.extent(1); }
+    int width() const { return m_frame.extent(2); }
+
+    template <typename V> const T* row(int i) {
+      const int k = i % RING;
+      T* dst = &m_ring(k,0);
+      if (m_rows[k] == i) return dst;
+      const int width = m_frame.extent(2);
+      const T wr(0.299), wg(0.587), wb(0.114);
+      int j = 0;
+      if (m_frame.stride(2) == 1) {
+        T* c[3];
+        for (int p=0; p<3; ++p) {
+          c[p] = &m_channels(p,0);
+          bob::ip::optflow::detail::convert<V>(&m_frame(p,i,0), c[p], width);
+        }
+        const V vr = broadcast<V>(wr);
+        const V vg = broadcast<V>(wg);
+        const V vb = broadcast<V>(wb);
+        for (; j+lanes<V>::value<=width; j+=lanes<V>::value)
+          store(dst+j, vr*load<V>(c[0]+j) + vg*load<V>(c[1]+j) +
+              vb*load<V>(c[2]+j));
+        for (; j<width; ++j) dst[j] = wr*c[0][j] + wg*c[1][j] + wb*c[2][j];
+      }
+      else {
+        for (; j<width; ++j) dst[j] = wr*T(m_frame(0,i,j)) +
+          wg*T(m_frame(1,i,j)) + wb*T(m_frame(2,i,j));
+      }
+      m_rows[k] = i;
+      return dst;
+    }
+
+  private:
+
+    enum { RING = 4 };
+    const blitz::Array<uint8_t,3>& m_frame;
+    blitz::Array<T,2> m_ring; ///< converted rows
+    blitz::Array<T,2> m_channels; ///< the channels of the last row, as T
+    int m_rows[RING]; ///< the frame row held by each row of the ring
+
+};
+
+/**
+ * The class that reads the rows of frames of (blitz array) type A as rows
+ * of T: frame_rows for gray frames and color_rows for RGB ones
+ */
+template <typename T, typename A> struct rows_of;
+
+template <typename T, typename U> struct rows_of<T, blitz::Array<U,2> > {
+  typedef frame_rows<T,U> type;
+};
+
+template <typename T> struct rows_of<T, blitz::Array<uint8_t,3> > {
+  typedef color_rows<T> type;
+};
+
+/**
+ * Checks that a frame matches the shape of the images of a gradient
+ * operator and returns it the way the kernels read it: gray frames as they
+ * are and RGB frames as a (3, height, width) view, whether their channels
+ * are planar, i.e. (3, height, width), or interleaved, i.e.
+ * (height, width, 3). Planar wins if both match.
+ */
+template <typename U>
+static blitz::Array<U,2> planar_frame(const blitz::Array<U,2>& frame,
+    const blitz::TinyVector<int,2>& shape) {
+  bob::core::array::assertSameShape(frame, shape);
+  return frame;
+}
+
+static blitz::Array<uint8_t,3> planar_frame(
+    const blitz::Array<uint8_t,3>& frame,
+    const blitz::TinyVector<int,2>& shape) {
+  if (frame.extent(0) == 3 && frame.extent(1) == shape(0) &&
+      frame.extent(2) == shape(1)) return frame;
+  if (frame.extent(0) == shape(0) && frame.extent(1) == shape(1) &&
+      frame.extent(2) == 3) return frame.transpose(2, 0, 1);
+  throw std::runtime_error("RGB images must be shaped (3, height, width) or (height, width, 3), where (height, width) is the shape of the gradient operator");
+}
+
+/**
+ * Stores a frame, as read by the kernels, in dst
+ */
+template <typename T, typename A>
+static void copy_frame(const A& frame, blitz::Array<T,2>& dst) {
+  typename rows_of<T,A>::type rows(frame);
+  for (int i=0; i<rows.height(); ++i) {
+    const T* src = rows.template row<T>(i);
+    std::copy(src, src + rows.width(), &dst(i,0));
+  }
+}
+
+/**
+ * Where fused_forward() and fused_central() write the gradients of a pixel
+ * (or of lanes<V>::value consecutive pixels): Ex, Ey and Et as they are
+ */
+template <typename T>
+struct gradient_output {
+  blitz::Array<T,2>& Ex;
+  blitz::Array<T,2>& Ey;
+  blitz::Array<T,2>& Et;
+  bool contiguous() const {
+    return Ex.stride(1) == 1 && Ey.stride(1) == 1 && Et.stride(1) == 1;
+  }
+  template <typename V>
+  void put(int i, int j, const V& ex, const V& ey, const V& et) const {
+    store(&Ex(i,j), ex);
+    store(&Ey(i,j), ey);
+    store(&Et(i,j), et);
+  }
+};
+
+/**
+ * Turns the gradients of a pixel into the coefficients of the Horn &
+ * Schunck update as they are computed: Ex and Ey are kept, along with
+ * Ex/D, Ey/D and Et/D, where D = Ex^2 + Ey^2 + a2. Et itself is dropped.
+ */
+template <typename T>
+struct coefficient_output {
+  T a2;
+  blitz::Array<T,2>& Ex;
+  blitz::Array<T,2>& Ey;
+  blitz::Array<T,2>& Cx;
+  blitz::Array<T,2>& Cy;
+  blitz::Array<T,2>& Ct;
+  bool contiguous() const {
+    return Ex.stride(1) == 1 && Ey.stride(1) == 1 && Cx.stride(1) == 1 &&
+      Cy.stride(1) == 1 && Ct.stride(1) == 1;
+  }
+  template <typename V>
+  void put(int i, int j, const V& ex, const V& ey, const V& et) const {
+    const V d = ex*ex + ey*ey + broadcast<V>(a2);
+    store(&Ex(i,j), ex);
+    store(&Ey(i,j), ey);
+    store(&Cx(i,j), ex/d);
+    store(&Cy(i,j), ey/d);
+    store(&Ct(i,j), et/d);
+  }
+};
+
+/**
+ * Applies the separable kernels of ForwardGradient to the 2x2 neighbourhood
+ * (i,j), (i,j+1), (i+1,j) and (i+1,j+1) of a frame, whose values are given as
+ * p00, p01, p10 and p11. The results are the spatial terms of Ex, Ey and Et
+ * for this frame: each kernel is first applied along one dimension, at both
+ * positions of the other one, then along the other dimension.
+ */
+template <typename V, typename K>
+static inline void forward_terms(const K& k,
+    const V& p00, const V& p01, const V& p10, const V& p11,
+    V& bx, V& by, V& bt) {
+  bx = k.avg(k.diff(p11, p10), k.diff(p01, p00)); // AK^T * (DK * i)
+  by = k.avg(k.diff(p11, p01), k.diff(p10, p00)); // AK * (DK^T * i)
+  bt = k.avg(k.avg(p11, p10), k.avg(p01, p00)); // AK^T * (AK * i)
 }
 
-bob::ip::optflow::ForwardGradient::ForwardGradient(const blitz::Array<double,1>& diff_kernel,
+/**
+ * Computes Ex, Ey and Et of ForwardGradient in a single sweep over the
+ * frames: each output pixel only depends on a 2x2x2 neighbourhood, so there
+ * is no need for intermediate images. The last row and column are mirrored.
+ * The spatial terms of i1 and i2 are scaled by s1 and s2, unless both are 1.
+ * Only the rows [row0, row1) of the outputs are computed, so that row bands
+ * can be given to different threads. The gradients go to out (see
+ * gradient_output and coefficient_output).
+ *
+ * If keep is not null, i2 is copied to it on the way.
+ */
+template <typename V, typename T, typename A1, typename A2, typename K,
+         typename O>
+static void fused_forward(const K& k, const A1& i1, T s1, const A2& i2, T s2,
+    const O& out, blitz::Array<T,2>* keep, int row0, int row1) {
+
+  const bool vectorize = lanes<V>::value > 1 && out.contiguous() &&
+    (!keep || keep->stride(1) == 1);
+  const bool scaled = (s1 != T(1) || s2 != T(1));
+  const V vs1 = broadcast<V>(s1);
+  const V vs2 = broadcast<V>(s2);
+  typename rows_of<T,A1>::type rows1(i1);
+  typename rows_of<T,A2>::type rows2(i2);
+  const int height = rows1.height();
+  const int width = rows1.width();
+
+  for (int i=row0; i<row1; ++i) {
+    const int n = std::min(i+1, height-1);
+    const T* x0 = rows1.template row<V>(i);
+    const T* x1 = rows1.template row<V>(n);
+    const T* y0 = rows2.template row<V>(i);
+    const T* y1 = rows2.template row<V>(n);
+    int j = 0;
+    if (vectorize) {
+      T* s = keep ? &(*keep)(i,0) : 0;
+      for (; j+lanes<V>::value<width; j+=lanes<V>::value) {
+        V bx1, by1, bt1, bx2, by2, bt2;
+        const V y = load<V>(y0+j);
+        forward_terms(k, load<V>(x0+j), load<V>(x0+j+1), load<V>(x1+j),
+            load<V>(x1+j+1), bx1, by1, bt1);
+        forward_terms(k, y, load<V>(y0+j+1), load<V>(y1+j),
+            load<V>(y1+j+1), bx2, by2, bt2);
+        if (scaled) {
+          scale_terms(vs1, bx1, by1, bt1);
+          scale_terms(vs2, bx2, by2, bt2);
+        }
+        // the mirrored kernels along time combine the terms of both frames
+        out.put(i, j, k.avg_t(bx1, bx2), k.avg_t(by1, by2),
+            k.diff_t(bt1, bt2));
+        if (s) store(s+j, y);
+      }
+    }
+    for (; j<width; ++j) {
+      const int r = std::min(j+1, width-1);
+      T bx1, by1, bt1, bx2, by2, bt2;
+      forward_terms(k, x0[j], x0[r], x1[j], x1[r], bx1, by1, bt1);
+      forward_terms(k, y0[j], y0[r], y1[j], y1[r], bx2, by2, bt2);
+      if (scaled) {
+        scale_terms(s1, bx1, by1, bt1);
+        scale_terms(s2, bx2, by2, bt2);
+      }
+      out.put(i, j, k.avg_t(bx1, bx2), k.avg_t(by1, by2),
+          k.diff_t(bt1, bt2));
+      if (keep) (*keep)(i,j) = y0[j];
+    }
+  }
+
+}
+
+/**
+ * Runs fused_forward() with the instruction set currently selected and the
+ * taps that implement the kernels
+ */
+template <typename T, typename A1, typename A2, typename O>
+struct fused_forward_kernel {
+  const blitz::Array<double,1>& diff_kernel;
+  const blitz::Array<double,1>& avg_kernel;
+  const A1& i1;
+  T s1;
+  const A2& i2;
+  T s2;
+  const O& out;
+  blitz::Array<T,2>* keep;
+  int row0;
+  int row1;
+  template <typename V> void run() const {
+    if (select_taps(diff_kernel, avg_kernel) == HS_TAPS)
+      fused_forward<V>(hs_taps(), i1, s1, i2, s2, out, keep, row0, row1);
+    else
+      fused_forward<V>(generic_taps<T>(diff_kernel, avg_kernel), i1, s1,
+          i2, s2, out, keep, row0, row1);
+  }
+};
+
+/**
+ * The number of row bands the outputs are split in: one per thread, but no
+ * more than there are rows
+ */
+static size_t gradient_bands(const bob::ip::optflow::ThreadPool& pool,
+    int height) {
+  return std::max<size_t>(1, std::min(pool.getThreads(), (size_t)height));
+}
+
+template <typename T>
+bob::ip::optflow::ForwardGradient<T>::ForwardGradient(const blitz::Array<double,1>& diff_kernel,
     const blitz::Array<double,1>& avg_kernel,
     const blitz::TinyVector<int,2>& shape) :
   m_diff_kernel(diff_kernel.copy()),
   m_avg_kernel(avg_kernel.copy()),
-  m_buffer1(shape),
-  m_buffer2(shape)
+  m_shape(shape),
+  m_normalize(false),
+  m_pushed(0)
 {
   blitz::TinyVector<int,1> required_shape(2);
   bob::core::array::assertSameShape(m_diff_kernel, required_shape);
   bob::core::array::assertSameShape(m_avg_kernel, required_shape);
 }
 
-bob::ip::optflow::ForwardGradient::ForwardGradient(const bob::ip::optflow::ForwardGradient& other) :
+template <typename T>
+bob::ip::optflow::ForwardGradient<T>::ForwardGradient(const bob::ip::optflow::ForwardGradient<T>& other) :
   m_diff_kernel(other.m_diff_kernel.copy()),
   m_avg_kernel(other.m_avg_kernel.copy()),
-  m_buffer1(other.m_buffer1.shape()),
-  m_buffer2(other.m_buffer2.shape())
+  m_shape(other.m_shape),
+  m_normalize(other.m_normalize),
+  m_pool(other.m_pool.getThreads()),
+  m_pushed(0)
 {
 }
 
-bob::ip::optflow::ForwardGradient::~ForwardGradient() { }
+template <typename T>
+bob::ip::optflow::ForwardGradient<T>::~ForwardGradient() { }
 
-bob::ip::optflow::ForwardGradient& bob::ip::optflow::ForwardGradient::operator= (const bob::ip::optflow::ForwardGradient& other) {
+template <typename T>
+bob::ip::optflow::ForwardGradient<T>& bob::ip::optflow::ForwardGradient<T>::operator= (const bob::ip::optflow::ForwardGradient<T>& other) {
   m_diff_kernel.reference(other.m_diff_kernel.copy());
   m_avg_kernel.reference(other.m_avg_kernel.copy());
-  m_buffer1.resize(other.m_buffer1.shape());
-  m_buffer2.resize(other.m_buffer2.shape());
+  m_shape = other.m_shape;
+  m_normalize = other.m_normalize;
+  m_pool.setThreads(other.m_pool.getThreads());
+  reset();
   return *this;
 }
 
-void bob::ip::optflow::ForwardGradient::setShape(const blitz::TinyVector<int,2>& shape) {
-  m_buffer1.resize(shape);
-  m_buffer2.resize(shape);
+template <typename T>
+void bob::ip::optflow::ForwardGradient<T>::setShape(const blitz::TinyVector<int,2>& shape) {
+  m_shape = shape;
+  reset();
 }
 
-void bob::ip::optflow::ForwardGradient::setDiffKernel(const blitz::Array<double,1>& k) {
+template <typename T>
+void bob::ip::optflow::ForwardGradient<T>::setDiffKernel(const blitz::Array<double,1>& k) {
   bob::core::array::assertSameDimensionLength(k.extent(0), 2);
   m_diff_kernel.reference(k.copy());
+  reset();
 }
 
-void bob::ip::optflow::ForwardGradient::setAvgKernel(const blitz::Array<double,1>& k) {
+template <typename T>
+void bob::ip::optflow::ForwardGradient<T>::setAvgKernel(const blitz::Array<double,1>& k) {
   bob::core::array::assertSameDimensionLength(k.extent(0), 2);
   m_avg_kernel.reference(k.copy());
+  reset();
+}
+
+template <typename T>
+void bob::ip::optflow::ForwardGradient<T>::setNormalize(bool normalize) {
+  m_normalize = normalize;
+  reset();
+}
+
+template <typename T>
+void bob::ip::optflow::ForwardGradient<T>::setThreads(size_t threads) {
+  m_pool.setThreads(threads);
 }
 
-void bob::ip::optflow::ForwardGradient::operator()(const blitz::Array<double,2>& i1,
-    const blitz::Array<double,2>& i2, blitz::Array<double,2>& Ex,
-    blitz::Array<double,2>& Ey, blitz::Array<double,2>& Et) const {
+template <typename T> template <typename U, int N>
+void bob::ip::optflow::ForwardGradient<T>::operator()(const blitz::Array<U,N>& i1,
+    const blitz::Array<U,N>& i2, blitz::Array<T,2>& Ex,
+    blitz::Array<T,2>& Ey, blitz::Array<T,2>& Et) const {
 
   // all arrays have to have the same shape
-  bob::core::array::assertSameShape(i1, i2);
+  const blitz::Array<U,N> f1 = planar_frame(i1, m_shape);
+  const blitz::Array<U,N> f2 = planar_frame(i2, m_shape);
   bob::core::array::assertSameShape(Ex, Ey);
   bob::core::array::assertSameShape(Ey, Et);
-  bob::core::array::assertSameShape(i1, Ex);
-  bob::core::array::assertSameShape(m_buffer1, i1);
+  bob::core::array::assertSameShape(Ex, m_shape);
 
-  // Notation:
-  // DK - difference kernel
-  // AK - averaging kernel
-  // v^T - vector (v) transposed
-  // A * B - A convolved with B (A is mirrored)
+  // The convolutions along x, y and t are applied to each pixel at once:
+  // Ex = AK_t * AK^T * DK * (i1,i2), Ey = AK_t * AK * DK^T * (i1,i2) and
+  // Et = DK_t * AK^T * AK * (i1,i2), where _t denotes the time axis
+  typedef fused_forward_kernel<T, blitz::Array<U,N>, blitz::Array<U,N>,
+          gradient_output<T> > kernel;
+  const T s = input_scale<T,U>(m_normalize);
+  const gradient_output<T> out{Ex, Ey, Et};
+  const int height = m_shape(0);
+  const size_t bands = gradient_bands(m_pool, height);
+  m_pool.run(bands, [&](size_t b) {
+    bob::ip::optflow::detail::simd_dispatch<T>(kernel{m_diff_kernel,
+        m_avg_kernel, f1, s, f2, s, out, 0,
+        bob::ip::optflow::band_start(height, bands, b),
+        bob::ip::optflow::band_start(height, bands, b+1)});
+  });
+}
 
-  // Differentiation along the X direction (extent 1) => Ex matrix
-  fastconv(i1, m_diff_kernel, Ex, 1); // Ex =  DK * i1
-  fastconv(Ex, m_avg_kernel, m_buffer1, 0); // Buffer1 = AK^T * Ex
+template <typename T> template <typename U, int N>
+void bob::ip::optflow::ForwardGradient<T>::coefficients(double a2,
+    const blitz::Array<U,N>& i1, const blitz::Array<U,N>& i2,
+    blitz::Array<T,2>& Ex, blitz::Array<T,2>& Ey, blitz::Array<T,2>& Cx,
+    blitz::Array<T,2>& Cy, blitz::Array<T,2>& Ct) const {
 
-  fastconv(i2, m_diff_kernel, Ex, 1); // Ex = DK * i2
-  fastconv(Ex, m_avg_kernel, m_buffer2, 0); // Buffer2 = AK^T * Ex
+  const blitz::Array<U,N> f1 = planar_frame(i1, m_shape);
+  const blitz::Array<U,N> f2 = planar_frame(i2, m_shape);
+  bob::core::array::assertSameShape(Ex, Ey);
+  bob::core::array::assertSameShape(Ey, Cx);
+  bob::core::array::assertSameShape(Cx, Cy);
+  bob::core::array::assertSameShape(Cy, Ct);
+  bob::core::array::assertSameShape(Ex, m_shape);
 
-  // The averaging operation along the t coordinate is performed by hand
-  Ex = (m_avg_kernel(1) * m_buffer1) + (m_avg_kernel(0) * m_buffer2);
+  typedef fused_forward_kernel<T, blitz::Array<U,N>, blitz::Array<U,N>,
+          coefficient_output<T> > kernel;
+  const T s = input_scale<T,U>(m_normalize);
+  const coefficient_output<T> out{T(a2), Ex, Ey, Cx, Cy, Ct};
+  const int height = m_shape(0);
+  const size_t bands = gradient_bands(m_pool, height);
+  m_pool.run(bands, [&](size_t b) {
+    bob::ip::optflow::detail::simd_dispatch<T>(kernel{m_diff_kernel,
+        m_avg_kernel, f1, s, f2, s, out, 0,
+        bob::ip::optflow::band_start(height, bands, b),
+        bob::ip::optflow::band_start(height, bands, b+1)});
+  });
+}
 
-  // Differentiation along the Y direction (extent 0) => Ey matrix
-  fastconv(i1, m_diff_kernel, Ey, 0); // Ey =  DK^T * i1
-  fastconv(Ey, m_avg_kernel, m_buffer1, 1); // Buffer1 = AK * Ey
+template <typename T> template <typename U, int N>
+bool bob::ip::optflow::ForwardGradient<T>::push(const blitz::Array<U,N>& frame,
+    blitz::Array<T,2>& Ex, blitz::Array<T,2>& Ey, blitz::Array<T,2>& Et) {
 
-  fastconv(i2, m_diff_kernel, Ey, 0); // Ey =  DK^T * i2
-  fastconv(Ey, m_avg_kernel, m_buffer2, 1); // Buffer2 = AK * Ey
+  std::lock_guard<std::mutex> lock(m_sequence);
+  const blitz::Array<U,N> f = planar_frame(frame, m_shape);
+  bob::core::array::assertSameShape(Ex, Ey);
+  bob::core::array::assertSameShape(Ey, Et);
+  bob::core::array::assertSameShape(Ex, m_shape);
 
-  // The averaging operation along the t coordinate is performed by hand
-  Ey = (m_avg_kernel(1) * m_buffer1) + (m_avg_kernel(0) * m_buffer2);
+  const size_t k = m_pushed % 2;
+  blitz::Array<T,2>& slot = m_frames[k];
+  if (slot.extent(0) != m_shape(0) || slot.extent(1) != m_shape(1))
+    slot.resize(m_shape);
+  m_scales[k] = input_scale<T,U>(m_normalize);
 
-  // Differentiation along the T direction i1 -> i2 => Et matrix
-  fastconv(i1, m_avg_kernel, Et, 1); // Et =  AK * i1
-  fastconv(Et, m_avg_kernel, m_buffer1, 0); // Buffer1 = AK^T * Et
+  if (m_pushed++ == 0) {
+    copy_frame(f, slot);
+    return false;
+  }
 
-  fastconv(i2, m_avg_kernel, Et, 1); // Et =  AK * i2
-  fastconv(Et, m_avg_kernel, m_buffer2, 0); // Buffer2 = AK^T * Et
+  typedef fused_forward_kernel<T, blitz::Array<T,2>, blitz::Array<U,N>,
+          gradient_output<T> > kernel;
+  const gradient_output<T> out{Ex, Ey, Et};
+  const int height = m_shape(0);
+  const size_t bands = gradient_bands(m_pool, height);
+  m_pool.run(bands, [&](size_t b) {
+    bob::ip::optflow::detail::simd_dispatch<T>(kernel{m_diff_kernel,
+        m_avg_kernel, m_frames[1-k], m_scales[1-k], f, m_scales[k], out,
+        &slot,
+        bob::ip::optflow::band_start(height, bands, b),
+        bob::ip::optflow::band_start(height, bands, b+1)});
+  });
+  return true;
 
-  // The difference operation along the t coordinate is performed by hand
-  Et = (m_diff_kernel(1) * m_buffer1) + (m_diff_kernel(0) * m_buffer2);
 }
 
-static const double HS_DIFF_KERNEL_DATA[] = {+1/4., -1/4.};
-static const blitz::Array<double,1> HS_DIFF_KERNEL(const_cast<double*>(HS_DIFF_KERNEL_DATA), blitz::shape(2), blitz::neverDeleteData);
-static const double HS_AVG_KERNEL_DATA[] = {+1., +1.};
-static const blitz::Array<double,1> HS_AVG_KERNEL(const_cast<double*>(HS_AVG_KERNEL_DATA), blitz::shape(2), blitz::neverDeleteData);
+template <typename T>
+void bob::ip::optflow::ForwardGradient<T>::reset() {
+  std::lock_guard<std::mutex> lock(m_sequence);
+  m_pushed = 0;
+}
 
-bob::ip::optflow::HornAndSchunckGradient::HornAndSchunckGradient(const blitz::TinyVector<int,2>& shape):
-  bob::ip::optflow::ForwardGradient(HS_DIFF_KERNEL, HS_AVG_KERNEL, shape)
+template <typename T>
+bob::ip::optflow::HornAndSchunckGradient<T>::HornAndSchunckGradient(const blitz::TinyVector<int,2>& shape):
+  bob::ip::optflow::ForwardGradient<T>(HS_DIFF_KERNEL, HS_AVG_KERNEL, shape)
 {
 }
 
-bob::ip::optflow::HornAndSchunckGradient::~HornAndSchunckGradient() { }
+template <typename T>
+bob::ip::optflow::HornAndSchunckGradient<T>::~HornAndSchunckGradient() { }
+
+/**
+ * Applies the separable kernels of CentralGradient to the 3x3 neighbourhood
+ * of a pixel (i,j) in a frame, where p[r][c] is the value at row i+1-r and
+ * column j+1-c. The results are the spatial terms of Ex, Ey and Et for this
+ * frame, computed in the same order as in forward_terms().
+ */
+template <typename V, typename K>
+static inline void central_terms(const K& k, const V (&p)[3][3],
+    V& bx, V& by, V& bt) {
+  bx = k.avg(k.diff(p[0][0], p[0][1], p[0][2]),
+      k.diff(p[1][0], p[1][1], p[1][2]),
+      k.diff(p[2][0], p[2][1], p[2][2])); // AK^T * (DK * i)
+  by = k.avg(k.diff(p[0][0], p[1][0], p[2][0]),
+      k.diff(p[0][1], p[1][1], p[2][1]),
+      k.diff(p[0][2], p[1][2], p[2][2])); // AK * (DK^T * i)
+  bt = k.avg(k.avg(p[0][0], p[0][1], p[0][2]),
+      k.avg(p[1][0], p[1][1], p[1][2]),
+      k.avg(p[2][0], p[2][1], p[2][2])); // AK^T * (AK * i)
+}
+
+/**
+ * Loads the 3x3 neighbourhood of column j for central_terms(), given the
+ * rows i+1, i and i-1 of a frame
+ */
+template <typename V, typename T>
+static inline void neighbourhood(const T* const (&rows)[3], int j,
+    V (&p)[3][3]) {
+  for (int r=0; r<3; ++r) {
+    p[r][0] = load<V>(rows[r]+j+1);
+    p[r][1] = load<V>(rows[r]+j);
+    p[r][2] = load<V>(rows[r]+j-1);
+  }
+}
+
+/**
+ * Computes the spatial terms of a frame at pixel j of a row, given the rows
+ * i+1, i and i-1 of the frame, mirroring the columns at the borders, and
+ * scales them by s
+ */
+template <typename T, typename K>
+static inline void central_pixel_terms(const K& k, const T* const (&rows)[3],
+    int width, int j, T s, T& bx, T& by, T& bt) {
+  const int cols[3] = {std::min(j+1, width-1), j, std::max(j-1, 0)};
+  T p[3][3];
+  for (int r=0; r<3; ++r)
+    for (int c=0; c<3; ++c) p[r][c] = rows[r][cols[c]];
+  central_terms(k, p, bx, by, bt);
+  if (s != T(1)) scale_terms(s, bx, by, bt);
+}
+
+/**
+ * Computes Ex, Ey and Et of CentralGradient at pixel (i,j), given the rows
+ * i+1, i and i-1 of the frames, and writes them to out
+ */
+template <typename T, typename K, typename O>
+static inline void central_pixel(const K& k, const T* const (&rows)[3][3],
+    T s, int width, int i, int j, const O& out) {
+  T bx[3], by[3], bt[3];
+  for (int f=0; f<3; ++f)
+    central_pixel_terms(k, rows[f], width, j, s, bx[f], by[f], bt[f]);
+  out.put(i, j, k.avg_t(bx[0], bx[1], bx[2]), k.avg_t(by[0], by[1], by[2]),
+      k.diff_t(bt[0], bt[1], bt[2]));
+}
+
+/**
+ * Computes Ex, Ey and Et of CentralGradient in a single sweep over the 3
+ * frames: each output pixel only depends on a 3x3x3 neighbourhood, so there
+ * is no need for intermediate images. The borders are mirrored. The spatial
+ * terms of the frames are scaled by s, unless it is 1. Only the rows
+ * [row0, row1) of the outputs are computed. The gradients go to out, as in
+ * fused_forward().
+ */
+template <typename V, typename T, typename A, typename K, typename O>
+static void fused_central(const K& k, const A& i1, const A& i2,
+    const A& i3, T s, const O& out, int row0, int row1) {
+
+  typedef typename rows_of<T,A>::type reader;
+  reader rows1(i1), rows2(i2), rows3(i3);
+  reader* frames[3] = {&rows1, &rows2, &rows3};
+  const int height = rows1.height();
+  const int width = rows1.width();
+  const bool vectorize = lanes<V>::value > 1 && width > 1 &&
+    out.contiguous();
+  const bool scaled = (s != T(1));
+  const V vs = broadcast<V>(s);
+
+  for (int i=row0; i<row1; ++i) {
+    const int rows[3] = {std::min(i+1, height-1), i, std::max(i-1, 0)};
+    const T* x[3][3];
+    for (int f=0; f<3; ++f)
+      for (int r=0; r<3; ++r) x[f][r] = frames[f]->template row<V>(rows[r]);
+    int j = 0;
+    if (vectorize) {
+      central_pixel(k, x, s, width, i, 0, out);
+      for (j=1; j+lanes<V>::value<width; j+=lanes<V>::value) {
+        V p[3][3], bx[3], by[3], bt[3];
+        for (int f=0; f<3; ++f) {
+          neighbourhood(x[f], j, p);
+          central_terms(k, p, bx[f], by[f], bt[f]);
+          if (scaled) scale_terms(vs, bx[f], by[f], bt[f]);
+        }
+        // the mirrored kernels along time combine the terms of the 3 frames
+        out.put(i, j, k.avg_t(bx[0], bx[1], bx[2]),
+            k.avg_t(by[0], by[1], by[2]), k.diff_t(bt[0], bt[1], bt[2]));
+      }
+    }
+    for (; j<width; ++j) central_pixel(k, x, s, width, i, j, out);
+  }
+
+}
+
+/**
+ * Runs fused_central() with the instruction set currently selected and the
+ * taps that implement the kernels
+ */
+template <typename T, typename A, typename O>
+struct fused_central_kernel {
+  const blitz::Array<double,1>& diff_kernel;
+  const blitz::Array<double,1>& avg_kernel;
+  const A& i1;
+  const A& i2;
+  const A& i3;
+  T s;
+  const O& out;
+  int row0;
+  int row1;
+  template <typename V> void run() const {
+    switch (select_taps(diff_kernel, avg_kernel)) {
+      case SOBEL_TAPS:
+        fused_central<V>(sobel_taps(), i1, i2, i3, s, out, row0, row1);
+        break;
+      case PREWITT_TAPS:
+        fused_central<V>(prewitt_taps(), i1, i2, i3, s, out, row0, row1);
+        break;
+      case ISOTROPIC_TAPS:
+        fused_central<V>(isotropic_taps(), i1, i2, i3, s, out, row0, row1);
+        break;
+      default:
+        fused_central<V>(generic_taps<T>(diff_kernel, avg_kernel), i1, i2,
+            i3, s, out, row0, row1);
+    }
+  }
+};
+
+/**
+ * Computes the spatial terms of a frame at pixel (i,j), stores them in the
+ * rows of terms and, if cached is not null, combines them with those of the
+ * 2 previous frames into Ex, Ey and Et, like central_pixel() does
+ */
+template <typename T, typename K>
+static inline void stream_pixel(const K& k, const T* const (&rows)[3], T s,
+    const T* const (*cached)[3], T* const (&terms)[3], int i, int j,
+    blitz::Array<T,2>& Ex, blitz::Array<T,2>& Ey, blitz::Array<T,2>& Et) {
+  T bx, by, bt;
+  central_pixel_terms(k, rows, Ex.extent(1), j, s, bx, by, bt);
+  terms[0][j] = bx;
+  terms[1][j] = by;
+  terms[2][j] = bt;
+  if (!cached) return;
+  Ex(i,j) = k.avg_t(cached[0][0][j], cached[1][0][j], bx);
+  Ey(i,j) = k.avg_t(cached[0][1][j], cached[1][1][j], by);
+  Et(i,j) = k.diff_t(cached[0][2][j], cached[1][2][j], bt);
+}
+
+/**
+ * Computes the spatial terms of Ex, Ey and Et for the last frame of a
+ * sequence, scaled by s, and stores them in terms. If cached is not null, it
+ * holds those of the 2 previous frames, the oldest first, and all are
+ * combined in the same sweep into Ex, Ey and Et, with the same results as
+ * fused_central(). The terms computed and the cached ones may not alias.
+ * Only the rows [row0, row1) are computed.
+ */
+template <typename V, typename T, typename A, typename K>
+static void stream_central(const K& k, const A& frame, T s,
+    const blitz::Array<T,2>* const (*cached)[3], blitz::Array<T,2>* terms,
+    blitz::Array<T,2>& Ex, blitz::Array<T,2>& Ey, blitz::Array<T,2>& Et,
+    int row0, int row1) {
 
-bob::ip::optflow::CentralGradient::CentralGradient(const blitz::Array<double,1>& diff_kernel,
+  const int height = Ex.extent(0);
+  const int width = Ex.extent(1);
+  const bool vectorize = lanes<V>::value > 1 && width > 1 &&
+    Ex.stride(1) == 1 && Ey.stride(1) == 1 && Et.stride(1) == 1;
+  const bool scaled = (s != T(1));
+  const V vs = broadcast<V>(s);
+  typename rows_of<T,A>::type reader(frame);
+
+  for (int i=row0; i<row1; ++i) {
+    const int rows[3] = {std::min(i+1, height-1), i, std::max(i-1, 0)};
+    const T* x[3];
+    for (int r=0; r<3; ++r) x[r] = reader.template row<V>(rows[r]);
+    const T* c[2][3] = {{0}};
+    for (int f=0; cached && f<2; ++f)
+      for (int t=0; t<3; ++t) c[f][t] = &(*cached[f][t])(i,0);
+    T* const b[3] = {&terms[0](i,0), &terms[1](i,0), &terms[2](i,0)};
+    const T* const (*cr)[3] = cached ? c : 0;
+    int j = 0;
+    if (vectorize) {
+      stream_pixel(k, x, s, cr, b, i, 0, Ex, Ey, Et);
+      T* ex = &Ex(i,0);
+      T* ey = &Ey(i,0);
+      T* et = &Et(i,0);
+      for (j=1; j+lanes<V>::value<width; j+=lanes<V>::value) {
+        V p[3][3], bx, by, bt;
+        neighbourhood(x, j, p);
+        central_terms(k, p, bx, by, bt);
+        if (scaled) scale_terms(vs, bx, by, bt);
+        store(b[0]+j, bx);
+        store(b[1]+j, by);
+        store(b[2]+j, bt);
+        if (!cached) continue;
+        store(ex+j, k.avg_t(load<V>(c[0][0]+j), load<V>(c[1][0]+j), bx));
+        store(ey+j, k.avg_t(load<V>(c[0][1]+j), load<V>(c[1][1]+j), by));
+        store(et+j, k.diff_t(load<V>(c[0][2]+j), load<V>(c[1][2]+j), bt));
+      }
+    }
+    for (; j<width; ++j) stream_pixel(k, x, s, cr, b, i, j, Ex, Ey, Et);
+  }
+
+}
+
+/**
+ * Runs stream_central() with the instruction set currently selected and the
+ * taps that implement the kernels
+ */
+template <typename T, typename A>
+struct stream_central_kernel {
+  const blitz::Array<double,1>& diff_kernel;
+  const blitz::Array<double,1>& avg_kernel;
+  const A& frame;
+  T s;
+  const blitz::Array<T,2>* const (*cached)[3];
+  blitz::Array<T,2>* terms;
+  blitz::Array<T,2>& Ex;
+  blitz::Array<T,2>& Ey;
+  blitz::Array<T,2>& Et;
+  int row0;
+  int row1;
+  template <typename V> void run() const {
+    switch (select_taps(diff_kernel, avg_kernel)) {
+      case SOBEL_TAPS:
+        stream_central<V>(sobel_taps(), frame, s, cached, terms, Ex, Ey, Et,
+            row0, row1);
+        break;
+      case PREWITT_TAPS:
+        stream_central<V>(prewitt_taps(), frame, s, cached, terms, Ex, Ey,
+            Et, row0, row1);
+        break;
+      case ISOTROPIC_TAPS:
+        stream_central<V>(isotropic_taps(), frame, s, cached, terms, Ex, Ey,
+            Et, row0, row1);
+        break;
+      default:
+        stream_central<V>(generic_taps<T>(diff_kernel, avg_kernel), frame, s,
+            cached, terms, Ex, Ey, Et, row0, row1);
+    }
+  }
+};
+
+template <typename T>
+bob::ip::optflow::CentralGradient<T>::CentralGradient(const blitz::Array<double,1>& diff_kernel,
     const blitz::Array<double,1>& avg_kernel,
     const blitz::TinyVector<int,2>& shape) :
   m_diff_kernel(diff_kernel.copy()),
   m_avg_kernel(avg_kernel.copy()),
-  m_buffer1(shape),
-  m_buffer2(shape),
-  m_buffer3(shape)
+  m_shape(shape),
+  m_normalize(false),
+  m_pushed(0)
 {
   blitz::TinyVector<int,1> required_shape(3);
   bob::core::array::assertSameShape(m_diff_kernel, required_shape);
   bob::core::array::assertSameShape(m_avg_kernel, required_shape);
 }
 
-bob::ip::optflow::CentralGradient::CentralGradient(const bob::ip::optflow::CentralGradient& other) :
+template <typename T>
+bob::ip::optflow::CentralGradient<T>::CentralGradient(const bob::ip::optflow::CentralGradient<T>& other) :
   m_diff_kernel(other.m_diff_kernel.copy()),
   m_avg_kernel(other.m_avg_kernel.copy()),
-  m_buffer1(other.m_buffer1.shape()),
-  m_buffer2(other.m_buffer2.shape()),
-  m_buffer3(other.m_buffer3.shape())
+  m_shape(other.m_shape),
+  m_normalize(other.m_normalize),
+  m_pool(other.m_pool.getThreads()),
+  m_pushed(0)
 {
 }
 
-bob::ip::optflow::CentralGradient::~CentralGradient() { }
+template <typename T>
+bob::ip::optflow::CentralGradient<T>::~CentralGradient() { }
 
-bob::ip::optflow::CentralGradient& bob::ip::optflow::CentralGradient::operator= (const bob::ip::optflow::CentralGradient& other) {
+template <typename T>
+bob::ip::optflow::CentralGradient<T>& bob::ip::optflow::CentralGradient<T>::operator= (const bob::ip::optflow::CentralGradient<T>& other) {
   m_diff_kernel.reference(other.m_diff_kernel.copy());
   m_avg_kernel.reference(other.m_avg_kernel.copy());
-  m_buffer1.resize(other.m_buffer1.shape());
-  m_buffer2.resize(other.m_buffer2.shape());
-  m_buffer3.resize(other.m_buffer3.shape());
+  m_shape = other.m_shape;
+  m_normalize = other.m_normalize;
+  m_pool.setThreads(other.m_pool.getThreads());
+  reset();
   return *this;
 }
 
-void bob::ip::optflow::CentralGradient::setShape(const blitz::TinyVector<int,2>& shape) {
-  m_buffer1.resize(shape);
-  m_buffer2.resize(shape);
-  m_buffer3.resize(shape);
+template <typename T>
+void bob::ip::optflow::CentralGradient<T>::setShape(const blitz::TinyVector<int,2>& shape) {
+  m_shape = shape;
+  reset();
 }
 
-void bob::ip::optflow::CentralGradient::setDiffKernel(const blitz::Array<double,1>& k) {
+template <typename T>
+void bob::ip::optflow::CentralGradient<T>::setDiffKernel(const blitz::Array<double,1>& k) {
   bob::core::array::assertSameDimensionLength(k.extent(0), 3);
   m_diff_kernel.reference(k.copy());
+  reset();
 }
 
-void bob::ip::optflow::CentralGradient::setAvgKernel(const blitz::Array<double,1>& k) {
+template <typename T>
+void bob::ip::optflow::CentralGradient<T>::setAvgKernel(const blitz::Array<double,1>& k) {
   bob::core::array::assertSameDimensionLength(k.extent(0), 3);
   m_avg_kernel.reference(k.copy());
+  reset();
+}
+
+template <typename T>
+void bob::ip::optflow::CentralGradient<T>::setNormalize(bool normalize) {
+  m_normalize = normalize;
+  reset();
 }
 
-void bob::ip::optflow::CentralGradient::operator() (const blitz::Array<double,2>& i1,
-    const blitz::Array<double,2>& i2, const blitz::Array<double,2>& i3,
-    blitz::Array<double,2>& Ex, blitz::Array<double,2>& Ey,
-    blitz::Array<double,2>& Et) const {
+template <typename T>
+void bob::ip::optflow::CentralGradient<T>::setThreads(size_t threads) {
+  m_pool.setThreads(threads);
+}
+
+template <typename T> template <typename U, int N>
+void bob::ip::optflow::CentralGradient<T>::operator() (const blitz::Array<U,N>& i1,
+    const blitz::Array<U,N>& i2, const blitz::Array<U,N>& i3,
+    blitz::Array<T,2>& Ex, blitz::Array<T,2>& Ey,
+    blitz::Array<T,2>& Et) const {
 
   // all arrays have to have the same shape
-  bob::core::array::assertSameShape(i1, i2);
-  bob::core::array::assertSameShape(i2, i3);
+  const blitz::Array<U,N> f1 = planar_frame(i1, m_shape);
+  const blitz::Array<U,N> f2 = planar_frame(i2, m_shape);
+  const blitz::Array<U,N> f3 = planar_frame(i3, m_shape);
   bob::core::array::assertSameShape(Ex, Ey);
   bob::core::array::assertSameShape(Ey, Et);
-  bob::core::array::assertSameShape(i1, Ex);
-  bob::core::array::assertSameShape(m_buffer1, i1);
-
-  // Notation:
-  // DK - difference kernel
-  // AK - averaging kernel
-  // v^T - vector (v) transposed
-  // A * B - A convolved with B (A is mirrored)
+  bob::core::array::assertSameShape(Ex, m_shape);
 
-  // Differentiation along the X direction (extent 1) => Ex matrix
-  fastconv(i1, m_diff_kernel, Ex, 1); // Ex =  DK * i1
-  fastconv(Ex, m_avg_kernel, m_buffer1, 0); // Buffer1 = AK^T * Ex
-
-  fastconv(i2, m_diff_kernel, Ex, 1); // Ex = DK * i2
-  fastconv(Ex, m_avg_kernel, m_buffer2, 0); // Buffer2 = AK^T * Ex
-
-  fastconv(i3, m_diff_kernel, Ex, 1); // Ex = DK * i3
-  fastconv(Ex, m_avg_kernel, m_buffer3, 0); // Buffer3 = AK^T * Ex
+  // The convolutions along x, y and t are applied to each pixel at once:
+  // Ex = AK_t * AK^T * DK * (i1,i2,i3), Ey = AK_t * AK * DK^T * (i1,i2,i3)
+  // and Et = DK_t * AK^T * AK * (i1,i2,i3), where _t denotes the time axis
+  typedef fused_central_kernel<T, blitz::Array<U,N>, gradient_output<T> >
+    kernel;
+  const T s = input_scale<T,U>(m_normalize);
+  const gradient_output<T> out{Ex, Ey, Et};
+  const int height = m_shape(0);
+  const size_t bands = gradient_bands(m_pool, height);
+  m_pool.run(bands, [&](size_t b) {
+    bob::ip::optflow::detail::simd_dispatch<T>(kernel{m_diff_kernel,
+        m_avg_kernel, f1, f2, f3, s, out,
+        bob::ip::optflow::band_start(height, bands, b),
+        bob::ip::optflow::band_start(height, bands, b+1)});
+  });
+}
 
-  // The averaging operation along the t coordinate is performed by hand
-  Ex = (m_avg_kernel(2) * m_buffer1) + (m_avg_kernel(1) * m_buffer2) +
-    (m_avg_kernel(0) * m_buffer3);
+template <typename T> template <typename U, int N>
+void bob::ip::optflow::CentralGradient<T>::coefficients(double a2,
+    const blitz::Array<U,N>& i1, const blitz::Array<U,N>& i2,
+    const blitz::Array<U,N>& i3, blitz::Array<T,2>& Ex,
+    blitz::Array<T,2>& Ey, blitz::Array<T,2>& Cx, blitz::Array<T,2>& Cy,
+    blitz::Array<T,2>& Ct) const {
 
-  // Differentiation along the Y direction (extent 0) => Ey matrix
-  fastconv(i1, m_diff_kernel, Ey, 0); // Ey =  DK^T * i1
-  fastconv(Ey, m_avg_kernel, m_buffer1, 1); // Buffer1 = AK * Ey
+  const blitz::Array<U,N> f1 = planar_frame(i1, m_shape);
+  const blitz::Array<U,N> f2 = planar_frame(i2, m_shape);
+  const blitz::Array<U,N> f3 = planar_frame(i3, m_shape);
+  bob::core::array::assertSameShape(Ex, Ey);
+  bob::core::array::assertSameShape(Ey, Cx);
+  bob::core::array::assertSameShape(Cx, Cy);
+  bob::core::array::assertSameShape(Cy, Ct);
+  bob::core::array::assertSameShape(Ex, m_shape);
 
-  fastconv(i2, m_diff_kernel, Ey, 0); // Ey =  DK^T * i2
-  fastconv(Ey, m_avg_kernel, m_buffer2, 1); // Buffer2 = AK * Ey
+  typedef fused_central_kernel<T, blitz::Array<U,N>, coefficient_output<T> >
+    kernel;
+  const T s = input_scale<T,U>(m_normalize);
+  const coefficient_output<T> out{T(a2), Ex, Ey, Cx, Cy, Ct};
+  const int height = m_shape(0);
+  const size_t bands = gradient_bands(m_pool, height);
+  m_pool.run(bands, [&](size_t b) {
+    bob::ip::optflow::detail::simd_dispatch<T>(kernel{m_diff_kernel,
+        m_avg_kernel, f1, f2, f3, s, out,
+        bob::ip::optflow::band_start(height, bands, b),
+        bob::ip::optflow::band_start(height, bands, b+1)});
+  });
+}
 
-  fastconv(i3, m_diff_kernel, Ey, 0); // Ey =  DK^T * i3
-  fastconv(Ey, m_avg_kernel, m_buffer3, 1); // Buffer3 = AK * Ey
+template <typename T> template <typename U, int N>
+bool bob::ip::optflow::CentralGradient<T>::push(const blitz::Array<U,N>& frame,
+    blitz::Array<T,2>& Ex, blitz::Array<T,2>& Ey, blitz::Array<T,2>& Et) {
 
-  // The averaging operation along the t coordinate is performed by hand
-  Ey = (m_avg_kernel(2) * m_buffer1) + (m_avg_kernel(1) * m_buffer2) +
-    (m_avg_kernel(0) * m_buffer3);
+  std::lock_guard<std::mutex> lock(m_sequence);
+  const blitz::Array<U,N> f = planar_frame(frame, m_shape);
+  bob::core::array::assertSameShape(Ex, Ey);
+  bob::core::array::assertSameShape(Ey, Et);
+  bob::core::array::assertSameShape(Ex, m_shape);
 
-  // Differentiation along the T direction i1 -> i2 => Et matrix
-  fastconv(i1, m_avg_kernel, Et, 1); // Et =  AK * i1
-  fastconv(Et, m_avg_kernel, m_buffer1, 0); // Buffer1 = AK^T * Et
+  blitz::Array<T,2>* slot = m_terms[m_pushed % 3];
+  for (int k=0; k<3; ++k) {
+    if (slot[k].extent(0) != m_shape(0) || slot[k].extent(1) != m_shape(1))
+      slot[k].resize(m_shape);
+  }
 
-  fastconv(i2, m_avg_kernel, Et, 1); // Et =  AK * i2
-  fastconv(Et, m_avg_kernel, m_buffer2, 0); // Buffer2 = AK^T * Et
+  // the terms of the 2 previous frames, the oldest first
+  const blitz::Array<T,2>* cached[2][3];
+  for (int f=0; f<2; ++f)
+    for (int k=0; k<3; ++k) cached[f][k] = &m_terms[(m_pushed + 1 + f) % 3][k];
 
-  fastconv(i3, m_avg_kernel, Et, 1); // Et =  AK * i3
-  fastconv(Et, m_avg_kernel, m_buffer3, 0); // Buffer3 = AK^T * Et
+  typedef stream_central_kernel<T, blitz::Array<U,N> > kernel;
+  const bool full = (m_pushed >= 2);
+  const T s = input_scale<T,U>(m_normalize);
+  const int height = m_shape(0);
+  const size_t bands = gradient_bands(m_pool, height);
+  m_pool.run(bands, [&](size_t b) {
+    bob::ip::optflow::detail::simd_dispatch<T>(kernel{
+        m_diff_kernel, m_avg_kernel, f, s, full ? cached : 0, slot, Ex,
+        Ey, Et, bob::ip::optflow::band_start(height, bands, b),
+        bob::ip::optflow::band_start(height, bands, b+1)});
+  });
+  ++m_pushed;
+  return full;
 
-  // The difference operation along the t coordinate is performed by hand
-  Et = (m_diff_kernel(2) * m_buffer1) + (m_diff_kernel(1) * m_buffer2) +
-    (m_diff_kernel(0) * m_buffer3);
 }
 
-static const double SOBEL_DIFF_KERNEL_DATA[] = {+1., 0., -1.};
-static const blitz::Array<double,1> SOBEL_DIFF_KERNEL(const_cast<double*>(SOBEL_DIFF_KERNEL_DATA), blitz::shape(3), blitz::neverDeleteData);
-static const double SOBEL_AVG_KERNEL_DATA[] = {+1., +2., +1};
-static const blitz::Array<double,1> SOBEL_AVG_KERNEL(const_cast<double*>(SOBEL_AVG_KERNEL_DATA), blitz::shape(3), blitz::neverDeleteData);
+template <typename T>
+void bob::ip::optflow::CentralGradient<T>::reset() {
+  std::lock_guard<std::mutex> lock(m_sequence);
+  m_pushed = 0;
+}
 
-bob::ip::optflow::SobelGradient::SobelGradient(const blitz::TinyVector<int,2>& shape):
-  bob::ip::optflow::CentralGradient(SOBEL_DIFF_KERNEL, SOBEL_AVG_KERNEL, shape)
+template <typename T>
+bob::ip::optflow::SobelGradient<T>::SobelGradient(const blitz::TinyVector<int,2>& shape):
+  bob::ip::optflow::CentralGradient<T>(SOBEL_DIFF_KERNEL, SOBEL_AVG_KERNEL, shape)
 {
 }
 
-bob::ip::optflow::SobelGradient::~SobelGradient() { }
+template <typename T>
+bob::ip::optflow::SobelGradient<T>::~SobelGradient() { }
 
-static const double PREWITT_DIFF_KERNEL_DATA[] = {+1., 0., -1.};
-static const blitz::Array<double,1> PREWITT_DIFF_KERNEL(const_cast<double*>(PREWITT_DIFF_KERNEL_DATA), blitz::shape(3), blitz::neverDeleteData);
-static const double PREWITT_AVG_KERNEL_DATA[] = {+1., +1., +1};
-static const blitz::Array<double,1> PREWITT_AVG_KERNEL(const_cast<double*>(PREWITT_AVG_KERNEL_DATA), blitz::shape(3), blitz::neverDeleteData);
-
-bob::ip::optflow::PrewittGradient::PrewittGradient(const blitz::TinyVector<int,2>& shape):
-  bob::ip::optflow::CentralGradient(PREWITT_DIFF_KERNEL, PREWITT_AVG_KERNEL, shape)
+template <typename T>
+bob::ip::optflow::PrewittGradient<T>::PrewittGradient(const blitz::TinyVector<int,2>& shape):
+  bob::ip::optflow::CentralGradient<T>(PREWITT_DIFF_KERNEL, PREWITT_AVG_KERNEL, shape)
 {
 }
 
-bob::ip::optflow::PrewittGradient::~PrewittGradient() { }
-
-static const double ISOTROPIC_DIFF_KERNEL_DATA[] = {+1., 0., -1.};
-static const blitz::Array<double,1> ISOTROPIC_DIFF_KERNEL(const_cast<double*>(ISOTROPIC_DIFF_KERNEL_DATA), blitz::shape(3), blitz::neverDeleteData);
-static const double ISOTROPIC_AVG_KERNEL_DATA[] = {+1., std::sqrt(2.), +1};
-static const blitz::Array<double,1> ISOTROPIC_AVG_KERNEL(const_cast<double*>(ISOTROPIC_AVG_KERNEL_DATA), blitz::shape(3), blitz::neverDeleteData);
+template <typename T>
+bob::ip::optflow::PrewittGradient<T>::~PrewittGradient() { }
 
-bob::ip::optflow::IsotropicGradient::IsotropicGradient(const blitz::TinyVector<int,2>& shape):
-  bob::ip::optflow::CentralGradient(ISOTROPIC_DIFF_KERNEL, ISOTROPIC_AVG_KERNEL, shape)
+template <typename T>
+bob::ip::optflow::IsotropicGradient<T>::IsotropicGradient(const blitz::TinyVector<int,2>& shape):
+  bob::ip::optflow::CentralGradient<T>(ISOTROPIC_DIFF_KERNEL, ISOTROPIC_AVG_KERNEL, shape)
 {
 }
 
-bob::ip::optflow::IsotropicGradient::~IsotropicGradient() { }
+template <typename T>
+bob::ip::optflow::IsotropicGradient<T>::~IsotropicGradient() { }
+
+template class bob::ip::optflow::ForwardGradient<float>;
+template class bob::ip::optflow::ForwardGradient<double>;
+template class bob::ip::optflow::HornAndSchunckGradient<float>;
+template class bob::ip::optflow::HornAndSchunckGradient<double>;
+template class bob::ip::optflow::CentralGradient<float>;
+template class bob::ip::optflow::CentralGradient<double>;
+template class bob::ip::optflow::SobelGradient<float>;
+template class bob::ip::optflow::SobelGradient<double>;
+template class bob::ip::optflow::PrewittGradient<float>;
+template class bob::ip::optflow::PrewittGradient<double>;
+template class bob::ip::optflow::IsotropicGradient<float>;
+template class bob::ip::optflow::IsotropicGradient<double>;
+
+template void bob::ip::optflow::ForwardGradient<float>::operator()<float>
+(const blitz::Array<float,2>&, const blitz::Array<float,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&) const;
+template bool bob::ip::optflow::ForwardGradient<float>::push<float>
+(const blitz::Array<float,2>&, blitz::Array<float,2>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&);
+template void bob::ip::optflow::ForwardGradient<float>::operator()<uint8_t>
+(const blitz::Array<uint8_t,2>&, const blitz::Array<uint8_t,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&) const;
+template bool bob::ip::optflow::ForwardGradient<float>::push<uint8_t>
+(const blitz::Array<uint8_t,2>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&);
+template void bob::ip::optflow::ForwardGradient<float>::operator()<uint16_t>
+(const blitz::Array<uint16_t,2>&, const blitz::Array<uint16_t,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&) const;
+template bool bob::ip::optflow::ForwardGradient<float>::push<uint16_t>
+(const blitz::Array<uint16_t,2>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&);
+template void bob::ip::optflow::ForwardGradient<double>::operator()<double>
+(const blitz::Array<double,2>&, const blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&) const;
+template bool bob::ip::optflow::ForwardGradient<double>::push<double>
+(const blitz::Array<double,2>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&);
+template void bob::ip::optflow::ForwardGradient<double>::operator()<uint8_t>
+(const blitz::Array<uint8_t,2>&, const blitz::Array<uint8_t,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&) const;
+template bool bob::ip::optflow::ForwardGradient<double>::push<uint8_t>
+(const blitz::Array<uint8_t,2>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&);
+template void bob::ip::optflow::ForwardGradient<double>::operator()<uint16_t>
+(const blitz::Array<uint16_t,2>&, const blitz::Array<uint16_t,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&) const;
+template bool bob::ip::optflow::ForwardGradient<double>::push<uint16_t>
+(const blitz::Array<uint16_t,2>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&);
+template void bob::ip::optflow::CentralGradient<float>::operator()<float>
+(const blitz::Array<float,2>&, const blitz::Array<float,2>&,
+ const blitz::Array<float,2>&, blitz::Array<float,2>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&) const;
+template bool bob::ip::optflow::CentralGradient<float>::push<float>
+(const blitz::Array<float,2>&, blitz::Array<float,2>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&);
+template void bob::ip::optflow::CentralGradient<float>::operator()<uint8_t>
+(const blitz::Array<uint8_t,2>&, const blitz::Array<uint8_t,2>&,
+ const blitz::Array<uint8_t,2>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&) const;
+template bool bob::ip::optflow::CentralGradient<float>::push<uint8_t>
+(const blitz::Array<uint8_t,2>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&);
+template void bob::ip::optflow::CentralGradient<float>::operator()<uint16_t>
+(const blitz::Array<uint16_t,2>&, const blitz::Array<uint16_t,2>&,
+ const blitz::Array<uint16_t,2>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&) const;
+template bool bob::ip::optflow::CentralGradient<float>::push<uint16_t>
+(const blitz::Array<uint16_t,2>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&);
+template void bob::ip::optflow::CentralGradient<double>::operator()<double>
+(const blitz::Array<double,2>&, const blitz::Array<double,2>&,
+ const blitz::Array<double,2>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&) const;
+template bool bob::ip::optflow::CentralGradient<double>::push<double>
+(const blitz::Array<double,2>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&);
+template void bob::ip::optflow::CentralGradient<double>::operator()<uint8_t>
+(const blitz::Array<uint8_t,2>&, const blitz::Array<uint8_t,2>&,
+ const blitz::Array<uint8_t,2>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&) const;
+template bool bob::ip::optflow::CentralGradient<double>::push<uint8_t>
+(const blitz::Array<uint8_t,2>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&);
+template void bob::ip::optflow::CentralGradient<double>::operator()<uint16_t>
+(const blitz::Array<uint16_t,2>&, const blitz::Array<uint16_t,2>&,
+ const blitz::Array<uint16_t,2>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&) const;
+template bool bob::ip::optflow::CentralGradient<double>::push<uint16_t>
+(const blitz::Array<uint16_t,2>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&);
+template void bob::ip::optflow::ForwardGradient<float>::coefficients<float>
+(double, const blitz::Array<float,2>&, const blitz::Array<float,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&) const;
+template void bob::ip::optflow::ForwardGradient<float>::coefficients<uint8_t>
+(double, const blitz::Array<uint8_t,2>&, const blitz::Array<uint8_t,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&) const;
+template void bob::ip::optflow::ForwardGradient<float>::coefficients<uint16_t>
+(double, const blitz::Array<uint16_t,2>&, const blitz::Array<uint16_t,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&) const;
+template void bob::ip::optflow::ForwardGradient<double>::coefficients<double>
+(double, const blitz::Array<double,2>&, const blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&) const;
+template void bob::ip::optflow::ForwardGradient<double>::coefficients<uint8_t>
+(double, const blitz::Array<uint8_t,2>&, const blitz::Array<uint8_t,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&) const;
+template void bob::ip::optflow::ForwardGradient<double>::coefficients<uint16_t>
+(double, const blitz::Array<uint16_t,2>&, const blitz::Array<uint16_t,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&) const;
+template void bob::ip::optflow::CentralGradient<float>::coefficients<float>
+(double, const blitz::Array<float,2>&, const blitz::Array<float,2>&,
+ const blitz::Array<float,2>&, blitz::Array<float,2>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&, blitz::Array<float,2>&) const;
+template void bob::ip::optflow::CentralGradient<float>::coefficients<uint8_t>
+(double, const blitz::Array<uint8_t,2>&, const blitz::Array<uint8_t,2>&,
+ const blitz::Array<uint8_t,2>&, blitz::Array<float,2>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&, blitz::Array<float,2>&) const;
+template void bob::ip::optflow::CentralGradient<float>::coefficients<uint16_t>
+(double, const blitz::Array<uint16_t,2>&, const blitz::Array<uint16_t,2>&,
+ const blitz::Array<uint16_t,2>&, blitz::Array<float,2>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&, blitz::Array<float,2>&) const;
+template void bob::ip::optflow::CentralGradient<double>::coefficients<double>
+(double, const blitz::Array<double,2>&, const blitz::Array<double,2>&,
+ const blitz::Array<double,2>&, blitz::Array<double,2>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&, blitz::Array<double,2>&) const;
+template void bob::ip::optflow::CentralGradient<double>::coefficients<uint8_t>
+(double, const blitz::Array<uint8_t,2>&, const blitz::Array<uint8_t,2>&,
+ const blitz::Array<uint8_t,2>&, blitz::Array<double,2>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&, blitz::Array<double,2>&) const;
+template void bob::ip::optflow::CentralGradient<double>::coefficients<uint16_t>
+(double, const blitz::Array<uint16_t,2>&, const blitz::Array<uint16_t,2>&,
+ const blitz::Array<uint16_t,2>&, blitz::Array<double,2>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&, blitz::Array<double,2>&) const;
+template void bob::ip::optflow::ForwardGradient<float>::operator()<uint8_t>
+(const blitz::Array<uint8_t,3>&, const blitz::Array<uint8_t,3>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&) const;
+template bool bob::ip::optflow::ForwardGradient<float>::push<uint8_t>
+(const blitz::Array<uint8_t,3>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&);
+template void bob::ip::optflow::ForwardGradient<double>::operator()<uint8_t>
+(const blitz::Array<uint8_t,3>&, const blitz::Array<uint8_t,3>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&) const;
+template bool bob::ip::optflow::ForwardGradient<double>::push<uint8_t>
+(const blitz::Array<uint8_t,3>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&);
+template void bob::ip::optflow::CentralGradient<float>::operator()<uint8_t>
+(const blitz::Array<uint8_t,3>&, const blitz::Array<uint8_t,3>&,
+ const blitz::Array<uint8_t,3>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&) const;
+template bool bob::ip::optflow::CentralGradient<float>::push<uint8_t>
+(const blitz::Array<uint8_t,3>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&);
+template void bob::ip::optflow::CentralGradient<double>::operator()<uint8_t>
+(const blitz::Array<uint8_t,3>&, const blitz::Array<uint8_t,3>&,
+ const blitz::Array<uint8_t,3>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&) const;
+template bool bob::ip::optflow::CentralGradient<double>::push<uint8_t>
+(const blitz::Array<uint8_t,3>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&);
+template void bob::ip::optflow::ForwardGradient<float>::coefficients<uint8_t>
+(double, const blitz::Array<uint8_t,3>&, const blitz::Array<uint8_t,3>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&) const;
+template void bob::ip::optflow::ForwardGradient<double>::coefficients<uint8_t>
+(double, const blitz::Array<uint8_t,3>&, const blitz::Array<uint8_t,3>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&) const;
+template void bob::ip::optflow::CentralGradient<float>::coefficients<uint8_t>
+(double, const blitz::Array<uint8_t,3>&, const blitz::Array<uint8_t,3>&,
+ const blitz::Array<uint8_t,3>&, blitz::Array<float,2>&, blitz::Array<float,2>&,
+ blitz::Array<float,2>&, blitz::Array<float,2>&, blitz::Array<float,2>&) const;
+template void bob::ip::optflow::CentralGradient<double>::coefficients<uint8_t>
+(double, const blitz::Array<uint8_t,3>&, const blitz::Array<uint8_t,3>&,
+ const blitz::Array<uint8_t,3>&, blitz::Array<double,2>&, blitz::Array<double,2>&,
+ blitz::Array<double,2>&, blitz::Array<double,2>&, blitz::Array<double,2>&) const;
@@ -10,23 +10,35 @@
 #ifndef BOB_IP_SPATIOTEMPORALGRADIENT_H
 #define BOB_IP_SPATIOTEMPORALGRADIENT_H
 
+#include <mutex>
 #include <blitz/array.h>
 
+#include "ThreadPool.h"
+
 namespace bob { namespace ip { namespace optflow {
 
   /**
    * This class computes the spatio-temporal gradient using a 2-term
    * approximation composed of 2 separable kernels (one for the diference term
    * and another one for the averaging term).
+   *
+   * Gradients are 2D arrays of type T, which is either float or double.
+   * Images are either of type T or 8-bit or 16-bit unsigned integers, which
+   * are converted as they are read (see setNormalize()). The kernels are
+   * always given in double precision.
+   *
+   * The const methods keep no state between calls and may be called on the
+   * same object from several threads at once. The setters must not be
+   * called while another thread computes with the object.
    */
+  template <typename T>
   class ForwardGradient {
 
     public: //api
 
       /**
        * Constructor. We initialize with the shape of the images we need to
-       * treat and with the kernels to be applied. The shape is used by the
-       * internal buffers.
+       * treat and with the kernels to be applied.
        *
        * @param diff_kernel The kernel that contains the difference operation.
        * Typically, this is [1; -1]. Note the kernel is mirrored during the
@@ -64,11 +76,11 @@ namespace bob { namespace ip { namespace optflow {
        * Returns the current shape supported
        */
       inline const blitz::TinyVector<int,2>& getShape() const {
-        return m_buffer1.shape();
+        return m_shape;
       }
 
       /**
-       * Re-shape internal buffers
+       * Sets the shape of the images to be treated
        */
       void setShape(const blitz::TinyVector<int,2>& shape);
 
@@ -96,20 +108,105 @@ namespace bob { namespace ip { namespace optflow {
        */
       void setAvgKernel(const blitz::Array<double,1>& k);
 
+      /**
+       * Tells if integer images are normalised to [0,1]
+       */
+      inline bool getNormalize() const { return m_normalize; }
+
+      /**
+       * Sets if integer images (uint8_t or uint16_t) are normalised to [0,1],
+       * i.e. divided by the largest value of their type. The spatial terms
+       * of each image are scaled rather than its pixels, so the gradients
+       * are those of the normalised images up to rounding. Images of type T
+       * are never scaled. Off by default.
+       */
+      void setNormalize(bool normalize);
+
+      /**
+       * Returns the number of threads the gradients are computed with
+       */
+      inline size_t getThreads() const { return m_pool.getThreads(); }
+
+      /**
+       * Sets the number of threads the gradients are computed with. The
+       * rows of the outputs are split in as many bands, each computed in a
+       * single sweep by one thread. Each output pixel only depends on its
+       * own neighbourhood, so the results do not depend on the number of
+       * threads. Passing 0 uses all hardware threads. Defaults to 1.
+       */
+      void setThreads(size_t threads);
+
       /**
        * Call this to run the gradient operator and return Ex, Ey and Et - the
-       * spatio temporal gradients for the image pair i1, i2
+       * spatio temporal gradients for the image pair i1, i2. The three
+       * gradients are computed in a single sweep over the images. The
+       * images are either gray (N = 2), with U being T, uint8_t or uint16_t,
+       * or 8-bit RGB (N = 3, U = uint8_t), with their channels planar, i.e.
+       * shaped (3, height, width), or interleaved, i.e. shaped
+       * (height, width, 3). RGB images are converted to their luma,
+       * 0.299 R + 0.587 G + 0.114 B, row by row as they are read.
+       */
+      template <typename U, int N>
+      void operator()(const blitz::Array<U,N>& i1,
+        const blitz::Array<U,N>& i2, blitz::Array<T,2>& Ex,
+        blitz::Array<T,2>& Ey, blitz::Array<T,2>& Et) const;
+
+      /**
+       * Computes the gradients of the image pair i1, i2 exactly as
+       * operator() does, but turns them into the coefficients of the Horn &
+       * Schunck update in the same sweep: with D = Ex^2 + Ey^2 + a2, where
+       * a2 is the square of the smoothness weight, Cx = Ex/D, Cy = Ey/D and
+       * Ct = Et/D. Ex and Ey, which the update also needs, are stored as
+       * well, but Et never is.
+       */
+      template <typename U, int N>
+      void coefficients(double a2, const blitz::Array<U,N>& i1,
+        const blitz::Array<U,N>& i2, blitz::Array<T,2>& Ex,
+        blitz::Array<T,2>& Ey, blitz::Array<T,2>& Cx, blitz::Array<T,2>& Cy,
+        blitz::Array<T,2>& Ct) const;
+
+      /**
+       * Feeds the next frame of a sequence. Once at least 2 frames were
+       * pushed, returns true and sets Ex, Ey and Et to the gradients of the
+       * last 2 frames, exactly as operator() would. Returns false, leaving
+       * Ex, Ey and Et untouched, after the first frame.
+       *
+       * A copy of the frame is kept for the next call, written while the
+       * gradients are computed. Keeping its filtered terms instead would
+       * take 3 images per frame, which are more expensive to store and read
+       * back than the 2x2 stencil is to evaluate again. Integer frames are
+       * kept converted to T.
+       *
+       * Calls to push() and reset() from different threads are serialised,
+       * each frame being fed in full before the next one.
        */
-      void operator()(const blitz::Array<double,2>& i1,
-        const blitz::Array<double,2>& i2, blitz::Array<double,2>& Ex,
-        blitz::Array<double,2>& Ey, blitz::Array<double,2>& Et) const;
+      template <typename U, int N>
+      bool push(const blitz::Array<U,N>& frame, blitz::Array<T,2>& Ex,
+          blitz::Array<T,2>& Ey, blitz::Array<T,2>& Et);
+
+      /**
+       * Forgets the frames pushed so far, to start a new sequence. This is
+       * done automatically when the shape, the kernels or the normalisation
+       * change.
+       */
+      void reset();
+
+      /**
+       * Returns the number of frames pushed since the last reset
+       */
+      inline size_t getPushed() const { return m_pushed; }
 
     private: //representation
 
       blitz::Array<double,1> m_diff_kernel;
       blitz::Array<double,1> m_avg_kernel;
-      mutable blitz::Array<double,2> m_buffer1;
-      mutable blitz::Array<double,2> m_buffer2;
+      blitz::TinyVector<int,2> m_shape;
+      bool m_normalize;
+      mutable bob::ip::optflow::ThreadPool m_pool;
+      blitz::Array<T,2> m_frames[2]; ///< copies of the last frames pushed
+      T m_scales[2]; ///< scales of the spatial terms of these frames
+      size_t m_pushed;
+      std::mutex m_sequence; ///< serialises push() and reset()
 
   };
 
@@ -126,13 +223,14 @@ namespace bob { namespace ip { namespace optflow {
    * Ey = 1/4 * ([+1 +1]^T * ([-1 +1]*(i1)) + [+1 +1]^T * ([-1 +1]*(i2)))
    * Et = 1/4 * ([+1 +1]^T * ([+1 +1]*(i1)) - [+1 +1]^T * ([+1 +1]*(i2)))
    */
-  class HornAndSchunckGradient : public virtual ForwardGradient {
+  template <typename T>
+  class HornAndSchunckGradient : public virtual ForwardGradient<T> {
 
     public: //api
 
       /**
        * Constructor. We initialize with the shape of the images we need to
-       * treat. The shape is used by the internal buffers.
+       * treat.
        *
        * The difference kernel for this operator is [+1/4; -1/4]
        * The averaging kernel for this oeprator is [+1; +1]
@@ -150,15 +248,19 @@ namespace bob { namespace ip { namespace optflow {
    * This class computes the spatio-temporal gradient using a 3-term
    * approximation composed of 2 separable kernels (one for the diference term
    * and another one for the averaging term).
+   *
+   * As with ForwardGradient, gradients are of type T, while images may also
+   * be 8-bit or 16-bit unsigned integers, and the const methods may be called
+   * from several threads at once.
    */
+  template <typename T>
   class CentralGradient {
 
     public: //api
 
       /**
        * Constructor. We initialize with the shape of the images we need to
-       * treat and with the kernels to be applied. The shape is used by the
-       * internal buffers.
+       * treat and with the kernels to be applied.
        *
        * @param diff_kernel The kernel that contains the difference operation.
        * Typically, this is [1; -1]. Note the kernel is mirrored during the
@@ -196,11 +298,11 @@ namespace bob { namespace ip { namespace optflow {
        * Returns the current shape supported
        */
       inline const blitz::TinyVector<int,2>& getShape() const {
-        return m_buffer1.shape();
+        return m_shape;
       }
 
       /**
-       * Re-shape internal buffers
+       * Sets the shape of the images to be treated
        */
       void setShape(const blitz::TinyVector<int,2>& shape);
 
@@ -229,20 +331,93 @@ namespace bob { namespace ip { namespace optflow {
       void setAvgKernel(const blitz::Array<double,1>& k);
 
       /**
-       * Call this to run the gradient operator.
+       * Tells if integer images are normalised to [0,1]
+       */
+      inline bool getNormalize() const { return m_normalize; }
+
+      /**
+       * Sets if integer images (uint8_t or uint16_t) are normalised to [0,1],
+       * i.e. divided by the largest value of their type. The spatial terms
+       * of each image are scaled rather than its pixels, so the gradients
+       * are those of the normalised images up to rounding. Images of type T
+       * are never scaled. Off by default.
+       */
+      void setNormalize(bool normalize);
+
+      /**
+       * Returns the number of threads the gradients are computed with
+       */
+      inline size_t getThreads() const { return m_pool.getThreads(); }
+
+      /**
+       * Sets the number of threads the gradients are computed with. The
+       * rows of the outputs are split in as many bands, each computed in a
+       * single sweep by one thread. Each output pixel only depends on its
+       * own neighbourhood, so the results do not depend on the number of
+       * threads. Passing 0 uses all hardware threads. Defaults to 1.
+       */
+      void setThreads(size_t threads);
+
+      /**
+       * Call this to run the gradient operator. The images are either gray
+       * or 8-bit RGB, as in ForwardGradient::operator().
+       */
+      template <typename U, int N>
+      void operator() (const blitz::Array<U,N>& i1,
+          const blitz::Array<U,N>& i2, const blitz::Array<U,N>& i3,
+          blitz::Array<T,2>& Ex, blitz::Array<T,2>& Ey,
+          blitz::Array<T,2>& Et) const;
+
+      /**
+       * Computes the gradients of the images i1, i2 and i3 and turns them
+       * into the coefficients of the Horn & Schunck update in the same
+       * sweep, as ForwardGradient::coefficients() does
+       */
+      template <typename U, int N>
+      void coefficients(double a2, const blitz::Array<U,N>& i1,
+          const blitz::Array<U,N>& i2, const blitz::Array<U,N>& i3,
+          blitz::Array<T,2>& Ex, blitz::Array<T,2>& Ey,
+          blitz::Array<T,2>& Cx, blitz::Array<T,2>& Cy,
+          blitz::Array<T,2>& Ct) const;
+
+      /**
+       * Feeds the next frame of a sequence. Once at least 3 frames were
+       * pushed, returns true and sets Ex, Ey and Et to the gradients of the
+       * last 3 frames, exactly as operator() would. Returns false, leaving
+       * Ex, Ey and Et untouched, after the first 2 frames.
+       *
+       * Each frame is only filtered once: its spatial terms are kept for the
+       * next 2 calls, so that only those of the new frame are computed,
+       * along with the combination of the 3 frames, in a single sweep.
+       * Calls from different threads are serialised, as for
+       * ForwardGradient::push().
+       */
+      template <typename U, int N>
+      bool push(const blitz::Array<U,N>& frame, blitz::Array<T,2>& Ex,
+          blitz::Array<T,2>& Ey, blitz::Array<T,2>& Et);
+
+      /**
+       * Forgets the frames pushed so far, to start a new sequence. This is
+       * done automatically when the shape, the kernels or the normalisation
+       * change.
+       */
+      void reset();
+
+      /**
+       * Returns the number of frames pushed since the last reset
        */
-      void operator() (const blitz::Array<double,2>& i1,
-          const blitz::Array<double,2>& i2, const blitz::Array<double,2>& i3,
-          blitz::Array<double,2>& Ex, blitz::Array<double,2>& Ey,
-          blitz::Array<double,2>& Et) const;
+      inline size_t getPushed() const { return m_pushed; }
 
     private: //representation
 
       blitz::Array<double,1> m_diff_kernel;
       blitz::Array<double,1> m_avg_kernel;
-      mutable blitz::Array<double,2> m_buffer1;
-      mutable blitz::Array<double,2> m_buffer2;
-      mutable blitz::Array<double,2> m_buffer3;
+      blitz::TinyVector<int,2> m_shape;
+      bool m_normalize;
+      mutable bob::ip::optflow::ThreadPool m_pool;
+      blitz::Array<T,2> m_terms[3][3]; ///< Ex, Ey and Et terms of 3 frames
+      size_t m_pushed;
+      std::mutex m_sequence; ///< serialises push() and reset()
 
   };
 
@@ -265,13 +440,14 @@ namespace bob { namespace ip { namespace optflow {
    * Et = h(x)h(y)h'(t) = [2] [1 2 1]   [0]
    *                      [1]        [+1]
    */
-  class SobelGradient: public virtual CentralGradient {
+  template <typename T>
+  class SobelGradient: public virtual CentralGradient<T> {
 
     public: //api
 
       /**
        * Constructor. We initialize with the shape of the images we need to
-       * treat. The shape is used by the internal buffers.
+       * treat.
        *
        * The difference kernel for this operator is [+1; 0; -1]
        * The averaging kernel for this oeprator is [+1; +2; +1]
@@ -291,13 +467,14 @@ namespace bob { namespace ip { namespace optflow {
    * directions. It is equivalent to a Sobel gradient except the averaging term
    * is all 1's.
    */
-  class PrewittGradient: public virtual CentralGradient {
+  template <typename T>
+  class PrewittGradient: public virtual CentralGradient<T> {
 
     public: //api
 
       /**
        * Constructor. We initialize with the shape of the images we need to
-       * treat. The shape is used by the internal buffers.
+       * treat.
        *
        * The difference kernel for this operator is [+1; 0; -1]
        * The averaging kernel for this oeprator is [+1; +1; +1]
@@ -317,13 +494,14 @@ namespace bob { namespace ip { namespace optflow {
    * is equivalent to a Sobel gradient except the averaging middle term is
    * sqrt(2).
    */
-  class IsotropicGradient: public virtual CentralGradient {
+  template <typename T>
+  class IsotropicGradient: public virtual CentralGradient<T> {
 
     public: //api
 
       /**
        * Constructor. We initialize with the shape of the images we need to
-       * treat. The shape is used by the internal buffers.
+       * treat.
        *
        * The difference kernel for this operator is [+1; 0; -1]
        * The averaging kernel for this oeprator is [+1; sqrt(2); +1]
@@ -0,0 +1,98 @@
+/**
+ * @date Sat 17 Oct 2026 14:03:47 CEST
+ *
+ * @brief Neighbourhood averages (discrete Laplacians) shared by the solvers
+ *
+ * Copyright (C) 2011-2014 Idiap Research Institute, Martigny, Switzerland
+ */
+
+#ifndef BOB_IP_OPTFLOW_STENCIL_H
+#define BOB_IP_OPTFLOW_STENCIL_H
+
+#include "Simd.h"
+
+namespace bob { namespace ip { namespace optflow { namespace detail {
+
+  /**
+   * The averaging operator from the Horn & Schunck paper:
+   *
+   * [1/12 1/6 1/12]
+   * [1/6   0  1/6 ]
+   * [1/12 1/6 1/12]
+   *
+   * apply() receives the rows above, at and below the pixel being treated
+   * together with the (already mirrored) offsets of the columns to its left,
+   * centre and right. combine() does the same work on the 8 neighbours
+   * themselves (u = up, m = middle, d = down; l = left, c = centre,
+   * r = right), which may be scalars or SIMD vectors of them, always in the
+   * same order and with coefficients of the same precision. weight() returns
+   * the coefficient of the neighbour at offset (di, dj).
+   *
+   * Pixels of the same parity class (i%2, j%2) are never neighbours of each
+   * other under this stencil, which makes 4 colours for Gauss-Seidel sweeps.
+   */
+  struct HSAverage {
+    static const int colours = 4;
+    template <typename V>
+    static inline V combine(const V& ul, const V& uc, const V& ur,
+        const V& ml, const V& mr, const V& dl, const V& dc, const V& dr) {
+      typedef typename scalar<V>::type T;
+      return T(1./12.)*(ul + ur + dl + dr) + T(1./6.)*(uc + ml + mr + dc);
+    }
+    template <typename T>
+    static inline T apply(const T* up, const T* mid, const T* down, int l,
+        int c, int r) {
+      return combine(up[l], up[c], up[r], mid[l], mid[r], down[l], down[c],
+          down[r]);
+    }
+    static inline double weight(int di, int dj) {
+      if (di && dj) return 1./12.;
+      return (di || dj) ? 1./6. : 0.;
+    }
+  };
+
+  /**
+   * The averaging operator used by OpenCV:
+   *
+   * [ 0  1/4  0  ]
+   * [1/4  0  1/4 ]
+   * [ 0  1/4  0  ]
+   *
+   * Only direct neighbours are involved, so a red-black colouring (by the
+   * parity of i+j) decouples the pixels for Gauss-Seidel sweeps.
+   */
+  struct OpenCVAverage {
+    static const int colours = 2;
+    template <typename V>
+    static inline V combine(const V& /*ul*/, const V& uc, const V& /*ur*/,
+        const V& ml, const V& mr, const V& /*dl*/, const V& dc,
+        const V& /*dr*/) {
+      typedef typename scalar<V>::type T;
+      return T(.25)*(uc + ml + mr + dc);
+    }
+    template <typename T>
+    static inline T apply(const T* up, const T* mid, const T* down, int l,
+        int c, int r) {
+      return combine(up[l], up[c], up[r], mid[l], mid[r], down[l], down[c],
+          down[r]);
+    }
+    static inline double weight(int di, int dj) {
+      return ((di != 0) != (dj != 0)) ? .25 : 0.;
+    }
+  };
+
+  /**
+   * Returns the first column of the given colour on row i, for the parity
+   * colouring of the stencil Average, or -1 if the row holds no pixel of
+   * that colour. Pixels of the same colour on a row are 2 columns apart.
+   */
+  template <typename Average>
+  inline int first_of_colour(int colour, int i) {
+    if (Average::colours == 2) return (colour + i) & 1;
+    if ((i & 1) != (colour >> 1)) return -1;
+    return colour & 1;
+  }
+
+}}}}
+
+#endif /* BOB_IP_OPTFLOW_STENCIL_H */
@@ -0,0 +1,57 @@
+/**
+ * @date Sat 17 Oct 2026 18:05:47 CEST
+ *
+ * @brief Implementation of the queue of background jobs
+ *
+ * Copyright (C) 2011-2014 Idiap Research Institute, Martigny, Switzerland
+ */
+
+#include "TaskQueue.h"
+
+bob::ip::optflow::TaskQueue::TaskQueue(size_t threads):
+  m_running(0),
+  m_quit(false)
+{
+  if (!threads) threads = std::thread::hardware_concurrency();
+  if (!threads) threads = 1;
+  for (size_t k=0; k<threads; ++k)
+    m_workers.push_back(std::thread(&TaskQueue::work, this));
+}
+
+bob::ip::optflow::TaskQueue::~TaskQueue() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+  m_wake.notify_all();
+  for (size_t k=0; k<m_workers.size(); ++k) m_workers[k].join();
+}
+
+void bob::ip::optflow::TaskQueue::submit(std::function<void()> job) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_jobs.push_back(std::move(job));
+  }
+  m_wake.notify_one();
+}
+
+void bob::ip::optflow::TaskQueue::wait() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_idle.wait(lock, [&]{ return m_jobs.empty() && !m_running; });
+}
+
+void bob::ip::optflow::TaskQueue::work() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    m_wake.wait(lock, [&]{ return m_quit || !m_jobs.empty(); });
+    if (m_jobs.empty()) return; //m_quit
+    std::function<void()> job = std::move(m_jobs.front());
+    m_jobs.pop_front();
+    ++m_running;
+    lock.unlock();
+    job();
+    job = std::function<void()>();
+    lock.lock();
+    if (!--m_running && m_jobs.empty()) m_idle.notify_all();
+  }
+}
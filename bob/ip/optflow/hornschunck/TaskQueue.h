@@ -0,0 +1,80 @@
+/**
+ * @date Sat 17 Oct 2026 18:05:47 CEST
+ *
+ * @brief A queue of jobs run in the background by persistent worker threads
+ *
+ * Copyright (C) 2011-2014 Idiap Research Institute, Martigny, Switzerland
+ */
+
+#ifndef BOB_IP_OPTFLOW_TASKQUEUE_H
+#define BOB_IP_OPTFLOW_TASKQUEUE_H
+
+#include <cstdlib>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace bob { namespace ip { namespace optflow {
+
+  /**
+   * A first-in, first-out queue of jobs, run by a number of worker threads
+   * while the threads submitting them go on with their own work. Unlike the
+   * ThreadPool, which splits one computation and waits for it, jobs are
+   * independent and nobody waits for them: each job reports its own results
+   * and errors, and must not throw.
+   */
+  class TaskQueue {
+
+    public: //api
+
+      /**
+       * Constructor, specify the number of worker threads. Passing 0 selects
+       * the number of hardware threads available on the machine.
+       */
+      TaskQueue(size_t threads=0);
+
+      /**
+       * Virtual destructor, runs the pending jobs and joins all workers
+       */
+      virtual ~TaskQueue();
+
+      /**
+       * Returns the number of worker threads
+       */
+      inline size_t getThreads() const { return m_workers.size(); }
+
+      /**
+       * Appends a job to the queue, to be run by the first idle worker
+       */
+      void submit(std::function<void()> job);
+
+      /**
+       * Waits until all jobs submitted so far are done
+       */
+      void wait();
+
+    private: //methods
+
+      TaskQueue(const TaskQueue&) = delete;
+      TaskQueue& operator= (const TaskQueue&) = delete;
+
+      void work();
+
+    private: //representation
+
+      std::vector<std::thread> m_workers; ///< background threads
+      std::mutex m_mutex; ///< protects all variables below
+      std::condition_variable m_wake; ///< signals a new job to workers
+      std::condition_variable m_idle; ///< signals the end of all jobs
+      std::deque<std::function<void()> > m_jobs; ///< jobs not started yet
+      size_t m_running; ///< number of jobs being run
+      bool m_quit; ///< tells workers to leave once the queue is empty
+
+  };
+
+}}}
+
+#endif /* BOB_IP_OPTFLOW_TASKQUEUE_H */
@@ -0,0 +1,121 @@
+/**
+ * @date Sat 17 Oct 2026 10:12:31 CEST
+ *
+ * @brief Implementation of the fork-join thread pool
+ *
+ * Copyright (C) 2011-2014 Idiap Research Institute, Martigny, Switzerland
+ */
+
+#include "ThreadPool.h"
+
+static size_t resolve_threads(size_t threads) {
+  if (threads) return threads;
+  size_t hw = std::thread::hardware_concurrency();
+  return hw ? hw : 1;
+}
+
+bob::ip::optflow::ThreadPool::ThreadPool(size_t threads):
+  m_task(0),
+  m_tasks(0),
+  m_next(0),
+  m_finished(0),
+  m_generation(0),
+  m_quit(false)
+{
+  start(resolve_threads(threads));
+}
+
+bob::ip::optflow::ThreadPool::~ThreadPool() {
+  stop();
+}
+
+void bob::ip::optflow::ThreadPool::setThreads(size_t threads) {
+  threads = resolve_threads(threads);
+  std::lock_guard<std::mutex> busy(m_busy);
+  if (threads == getThreads()) return;
+  stop();
+  start(threads);
+}
+
+void bob::ip::optflow::ThreadPool::start(size_t threads) {
+  m_quit = false;
+  for (size_t k=1; k<threads; ++k)
+    m_workers.push_back(std::thread(&ThreadPool::work, this));
+}
+
+void bob::ip::optflow::ThreadPool::stop() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+  m_wake.notify_all();
+  for (size_t k=0; k<m_workers.size(); ++k) m_workers[k].join();
+  m_workers.clear();
+}
+
+void bob::ip::optflow::ThreadPool::work() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  size_t seen = m_generation;
+  while (true) {
+    m_wake.wait(lock, [&]{ return m_quit || m_generation != seen; });
+    if (m_quit) return;
+    seen = m_generation;
+    drain(lock);
+  }
+}
+
+void bob::ip::optflow::ThreadPool::drain(std::unique_lock<std::mutex>& lock) {
+  while (m_next < m_tasks) {
+    size_t t = m_next++;
+    lock.unlock();
+    std::exception_ptr error;
+    try {
+      (*m_task)(t);
+    }
+    catch (...) {
+      error = std::current_exception();
+    }
+    lock.lock();
+    if (error && !m_error) m_error = error;
+    if (++m_finished == m_tasks) m_done.notify_all();
+  }
+}
+
+void bob::ip::optflow::ThreadPool::run(size_t tasks,
+    const std::function<void(size_t)>& task) {
+
+  bool serial = (tasks <= 1);
+  if (!serial) {
+    //a task of the running job, whatever its thread, must not wait for it
+    std::lock_guard<std::mutex> lock(m_mutex);
+    serial = (m_task != 0);
+  }
+
+  std::unique_lock<std::mutex> busy(m_busy, std::defer_lock);
+  if (serial || !busy.try_lock() || m_workers.empty()) { //serial path
+    if (busy.owns_lock()) busy.unlock();
+    for (size_t t=0; t<tasks; ++t) task(t);
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_task = &task;
+  m_tasks = tasks;
+  m_next = 0;
+  m_finished = 0;
+  m_error = std::exception_ptr();
+  ++m_generation;
+  m_wake.notify_all();
+
+  drain(lock);
+  m_done.wait(lock, [&]{ return m_finished == m_tasks; });
+
+  m_task = 0;
+  m_tasks = 0;
+  std::exception_ptr error = m_error;
+  m_error = std::exception_ptr();
+  lock.unlock();
+
+  if (error) std::rethrow_exception(error);
+
+}
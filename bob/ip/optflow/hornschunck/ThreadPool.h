@@ -0,0 +1,107 @@
+/**
+ * @date Sat 17 Oct 2026 10:12:31 CEST
+ *
+ * @brief A minimal fork-join thread pool for the row-band parallel loops
+ *
+ * Copyright (C) 2011-2014 Idiap Research Institute, Martigny, Switzerland
+ */
+
+#ifndef BOB_IP_OPTFLOW_THREADPOOL_H
+#define BOB_IP_OPTFLOW_THREADPOOL_H
+
+#include <cstdlib>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+namespace bob { namespace ip { namespace optflow {
+
+  /**
+   * A pool of persistent worker threads that executes a number of
+   * independent tasks and waits for all of them to finish before returning.
+   * The calling thread takes part in the work, so a pool with N threads
+   * keeps N-1 workers in the background. A pool with a single thread runs
+   * everything serially on the caller.
+   *
+   * The pool may be shared by objects that are used from several threads at
+   * once: a job submitted while another one is running is simply run
+   * serially by its caller, instead of waiting for the workers. This holds
+   * for jobs submitted by the tasks of the running job as well, which may
+   * thus split their own work with the same pool.
+   */
+  class ThreadPool {
+
+    public: //api
+
+      /**
+       * Constructor, specify the total number of threads to use. Passing 0
+       * selects the number of hardware threads available on the machine.
+       */
+      ThreadPool(size_t threads=1);
+
+      /**
+       * Virtual destructor, joins all workers
+       */
+      virtual ~ThreadPool();
+
+      /**
+       * Returns the total number of threads, counting the caller
+       */
+      inline size_t getThreads() const { return m_workers.size() + 1; }
+
+      /**
+       * Re-sizes the pool. Passing 0 selects the number of hardware threads
+       * available on the machine. Waits for the running job, if any.
+       */
+      void setThreads(size_t threads);
+
+      /**
+       * Runs task(0), ..., task(tasks-1), distributing the calls among the
+       * threads of the pool, and returns once all of them are done. If any
+       * task throws, the first exception caught is re-thrown here after all
+       * other tasks have finished. If the workers are busy with the job of
+       * another thread, the tasks are all run by the caller, in order.
+       */
+      void run(size_t tasks, const std::function<void(size_t)>& task);
+
+    private: //methods
+
+      ThreadPool(const ThreadPool&) = delete;
+      ThreadPool& operator= (const ThreadPool&) = delete;
+
+      void start(size_t threads);
+      void stop();
+      void work();
+      void drain(std::unique_lock<std::mutex>& lock);
+
+    private: //representation
+
+      std::vector<std::thread> m_workers; ///< background threads
+      std::mutex m_busy; ///< held by the thread whose job the workers run
+      std::mutex m_mutex; ///< protects all variables below
+      std::condition_variable m_wake; ///< signals a new job to workers
+      std::condition_variable m_done; ///< signals job completion to caller
+      const std::function<void(size_t)>* m_task; ///< the current job
+      size_t m_tasks; ///< number of tasks in the current job
+      size_t m_next; ///< next task to be picked up
+      size_t m_finished; ///< number of tasks finished
+      size_t m_generation; ///< incremented on every new job
+      std::exception_ptr m_error; ///< first exception thrown by a task
+      bool m_quit; ///< tells workers to leave
+
+  };
+
+  /**
+   * Returns the first row of band b when splitting rows into a number of
+   * contiguous bands of (nearly) equal height.
+   */
+  inline int band_start(int rows, size_t bands, size_t b) {
+    return static_cast<int>((static_cast<size_t>(rows) * b) / bands);
+  }
+
+}}}
+
+#endif /* BOB_IP_OPTFLOW_THREADPOOL_H */
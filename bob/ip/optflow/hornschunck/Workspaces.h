@@ -0,0 +1,121 @@
+/**
+ * @date Sat 17 Oct 2026 16:41:09 CEST
+ *
+ * @brief A pool of work buffers, so that const methods can run concurrently
+ *
+ * Copyright (C) 2011-2014 Idiap Research Institute, Martigny, Switzerland
+ */
+
+#ifndef BOB_IP_OPTFLOW_WORKSPACES_H
+#define BOB_IP_OPTFLOW_WORKSPACES_H
+
+#include <cstdlib>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+namespace bob { namespace ip { namespace optflow {
+
+  /**
+   * A pool of workspaces of type W, each holding the work buffers of one
+   * computation. Every call takes a workspace for itself and gives it back
+   * once done, so that calls running at the same time from different
+   * threads never share buffers, while successive calls reuse the same
+   * buffers instead of allocating new ones. The pool grows to the largest
+   * number of calls that ever ran at once. W must be default constructible;
+   * its buffers are sized by the caller.
+   */
+  template <typename W>
+  class Workspaces {
+
+    public: //api
+
+      /**
+       * A workspace taken from a pool, given back when destroyed
+       */
+      class Lease {
+
+        public:
+
+          Lease(Workspaces& pool, std::unique_ptr<W> workspace):
+            m_pool(&pool), m_workspace(std::move(workspace)) { }
+
+          Lease(Lease&& other):
+            m_pool(other.m_pool), m_workspace(std::move(other.m_workspace)) { }
+
+          ~Lease() { if (m_workspace) m_pool->give(std::move(m_workspace)); }
+
+          inline W& operator*() const { return *m_workspace; }
+          inline W* operator->() const { return m_workspace.get(); }
+
+        private:
+
+          Lease(const Lease&) = delete;
+          Lease& operator= (const Lease&) = delete;
+
+          Workspaces* m_pool;
+          std::unique_ptr<W> m_workspace;
+
+      };
+
+      Workspaces(): m_leased(0) { }
+
+      /**
+       * Takes an idle workspace, or a new one if all of them are in use
+       */
+      Lease take() {
+        std::unique_ptr<W> workspace;
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          if (!m_idle.empty()) {
+            workspace = std::move(m_idle.back());
+            m_idle.pop_back();
+          }
+          ++m_leased;
+        }
+        try {
+          if (!workspace) workspace.reset(new W());
+        }
+        catch (...) {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          --m_leased;
+          throw;
+        }
+        return Lease(*this, std::move(workspace));
+      }
+
+      /**
+       * Releases the idle workspaces, e.g. when their buffers no longer
+       * have the right shape. The object owning the pool is being
+       * reconfigured then, which must not happen while it computes in
+       * another thread: throws if a workspace is still in use.
+       */
+      void clear() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_leased) throw std::runtime_error("cannot reconfigure an object while it is computing in another thread");
+        m_idle.clear();
+      }
+
+    private: //methods
+
+      Workspaces(const Workspaces&) = delete;
+      Workspaces& operator= (const Workspaces&) = delete;
+
+      void give(std::unique_ptr<W> workspace) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_idle.push_back(std::move(workspace));
+        --m_leased;
+      }
+
+    private: //representation
+
+      std::mutex m_mutex; ///< protects all variables below
+      std::vector<std::unique_ptr<W> > m_idle; ///< workspaces not in use
+      size_t m_leased; ///< number of workspaces in use
+
+  };
+
+}}}
+
+#endif /* BOB_IP_OPTFLOW_WORKSPACES_H */
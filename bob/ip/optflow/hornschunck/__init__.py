@@ -1,5 +1,5 @@
 # import Libraries of other lib packages
-import bob.sp
+import bob.core
 
 from ._library import *
 from . import version
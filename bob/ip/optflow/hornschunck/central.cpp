@@ -7,6 +7,7 @@
  * Copyright (C) 2011-2014 Idiap Research Institute, Martigny, Switzerland
  */
 
+#include <string>
 #include <bob.blitz/cppapi.h>
 #include <bob.blitz/cleanup.h>
 #include <bob.extension/documentation.h>
@@ -14,6 +15,17 @@
 
 #include "SpatioTemporalGradient.h"
 
+extern bool PyBobIpOptflowImage_Check(PyBlitzArrayObject* image,
+    int type_num);
+extern bool PyBobIpOptflowImage_Matches(PyBlitzArrayObject* image,
+    Py_ssize_t height, Py_ssize_t width);
+extern int PyBobIpOptflowImage_Converter(PyObject* o,
+    PyBlitzArrayObject** a);
+extern bool PyBobIpOptflowObject_Idle(PyObject* self, Py_ssize_t busy,
+    const char* attribute);
+extern PyBlitzArrayObject* PyBobIpOptflowArray_Recycle(PyObject** pool,
+    int type_num, Py_ssize_t ndim, Py_ssize_t* shape);
+
 /************************************************
  * Implementation of CentralGradient base class *
  ************************************************/
@@ -27,44 +39,62 @@ static auto s_forward = bob::extension::ClassDoc(
 
     "This class computes the spatio-temporal gradient using a 3-term "
     "approximation composed of 2 separable kernels (one for the diference "
-    "term and another one for the averaging term)."
+    "term and another one for the averaging term).\n"
+    "\n"
+    "Gradients are evaluated without holding the GIL, so that several Python "
+    "threads may use the same estimator at once. Images pushed from several "
+    "threads are taken one after the other."
     )
     .add_constructor(
         bob::extension::FunctionDoc(
           CLASS_NAME,
           "Constructor",
           "We initialize with the shape of the images we need to treat and "
-          "with the kernels to be applied. The shape is used by the internal "
-          "buffers.\n"
+          "with the kernels to be applied.\n"
           )
-        .add_prototype("difference, average, (height, width)", "")
+        .add_prototype("difference, average, (height, width), [dtype]", "")
         .add_parameter("difference", "array-like, 1D float64", "The kernel that contains the difference operation. Typically, this is ``[1, 0, -1]``. Note the kernel is mirrored during the convolution operation. To obtain a ``[-1, 0, +1]`` sliding operator, specify ``[+1, 0, -1]``. This kernel must have a shape = (3,).")
         .add_parameter("average", "array-like, 1D float64", "The kernel that contains the spatial averaging operation. This kernel is typically ``[+1, +1, +1]``. This kernel must have a shape = (3,).")
         .add_parameter("(height, width)", "tuple", "the height and width of images to be fed into the the gradient estimator")
+        .add_parameter("dtype", ":py:class:`numpy.dtype` or dtype-like", "the scalar type of the images and gradients this estimator works with, either ``float64`` (the default) or ``float32``")
         )
     ;
 
 typedef struct {
   PyObject_HEAD
-  bob::ip::optflow::CentralGradient* cxx;
+  int type_num;
+  bob::ip::optflow::CentralGradient<double>* cxx;
+  bob::ip::optflow::CentralGradient<float>* cxx32;
+  Py_ssize_t busy; //number of calls running without the GIL
+  PyObject* recycled; //arrays returned so far, see PyBobIpOptflowArray_Recycle()
 } PyBobIpOptflowCentralGradientObject;
 
 
+/**
+ * Returns the shape of the estimator, whatever its scalar type
+ */
+static const blitz::TinyVector<int,2>& PyBobIpOptflowCentralGradient_shape
+(PyBobIpOptflowCentralGradientObject* self) {
+  return self->cxx32 ? self->cxx32->getShape() : self->cxx->getShape();
+}
+
 static int PyBobIpOptflowCentralGradient_init
 (PyBobIpOptflowCentralGradientObject* self, PyObject* args, PyObject* kwds) {
 
   /* Parses input arguments in a single shot */
-  static const char* const_kwlist[] = {"difference", "average", "shape", 0};
+  static const char* const_kwlist[] = {"difference", "average", "shape", "dtype", 0};
   static char** kwlist = const_cast<char**>(const_kwlist);
 
   PyBlitzArrayObject* diff = 0;
   PyBlitzArrayObject* avg = 0;
   Py_ssize_t height, width;
+  int type_num = NPY_FLOAT64;
 
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&O&(nn)", kwlist,
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&O&(nn)|O&", kwlist,
         &PyBlitzArray_Converter, &diff,
         &PyBlitzArray_Converter, &avg,
-        &height, &width)) return -1;
+        &height, &width,
+        &PyBlitzArray_TypenumConverter, &type_num)) return -1;
 
   //protects acquired resources through this scope
   auto diff_ = make_safe(diff);
@@ -80,13 +110,25 @@ static int PyBobIpOptflowCentralGradient_init
     return 0;
   }
 
+  if (type_num != NPY_FLOAT64 && type_num != NPY_FLOAT32) {
+    PyErr_Format(PyExc_TypeError, "`%s' only supports float64 or float32 as `dtype', not %s", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(type_num));
+    return -1;
+  }
+
   try {
     blitz::TinyVector<int,2> shape;
     shape(0) = height; shape(1) = width;
-    self->cxx = new bob::ip::optflow::CentralGradient(
-        *PyBlitzArrayCxx_AsBlitz<double,1>(diff),
-        *PyBlitzArrayCxx_AsBlitz<double,1>(avg),
-        shape);
+    if (type_num == NPY_FLOAT32)
+      self->cxx32 = new bob::ip::optflow::CentralGradient<float>(
+          *PyBlitzArrayCxx_AsBlitz<double,1>(diff),
+          *PyBlitzArrayCxx_AsBlitz<double,1>(avg),
+          shape);
+    else
+      self->cxx = new bob::ip::optflow::CentralGradient<double>(
+          *PyBlitzArrayCxx_AsBlitz<double,1>(diff),
+          *PyBlitzArrayCxx_AsBlitz<double,1>(avg),
+          shape);
+    self->type_num = type_num;
   }
   catch (std::exception& ex) {
     PyErr_SetString(PyExc_RuntimeError, ex.what());
@@ -104,7 +146,9 @@ static int PyBobIpOptflowCentralGradient_init
 static void PyBobIpOptflowCentralGradient_delete
 (PyBobIpOptflowCentralGradientObject* self) {
 
+  Py_XDECREF(self->recycled);
   delete self->cxx;
+  delete self->cxx32;
   Py_TYPE(self)->tp_free((PyObject*)self);
 
 }
@@ -117,12 +161,14 @@ static auto s_shape = bob::extension::VariableDoc(
 
 static PyObject* PyBobIpOptflowCentralGradient_getShape
 (PyBobIpOptflowCentralGradientObject* self, void* /*closure*/) {
-  auto shape = self->cxx->getShape();
+  auto shape = PyBobIpOptflowCentralGradient_shape(self);
   return Py_BuildValue("nn", shape(0), shape(1));
 }
 
 static int PyBobIpOptflowCentralGradient_setShape (PyBobIpOptflowCentralGradientObject* self, PyObject* o, void* /*closure*/) {
 
+  if (!PyBobIpOptflowObject_Idle((PyObject*)self, self->busy, "shape")) return -1;
+
   Py_ssize_t height = 0;
   Py_ssize_t width = 0;
 
@@ -131,7 +177,8 @@ static int PyBobIpOptflowCentralGradient_setShape (PyBobIpOptflowCentralGradient
   try {
     blitz::TinyVector<int,2> shape;
     shape(0) = height; shape(1) = width;
-    self->cxx->setShape(shape);
+    if (self->cxx32) self->cxx32->setShape(shape);
+    else self->cxx->setShape(shape);
   }
   catch (std::exception& ex) {
     PyErr_SetString(PyExc_RuntimeError, ex.what());
@@ -153,7 +200,8 @@ static auto s_difference = bob::extension::VariableDoc(
 
 static PyObject* PyBobIpOptflowCentralGradient_getDifference
 (PyBobIpOptflowCentralGradientObject* self, void* /*closure*/) {
-  auto retval = PyBlitzArrayCxx_NewFromConstArray(self->cxx->getDiffKernel());
+  auto retval = PyBlitzArrayCxx_NewFromConstArray(self->cxx32 ?
+      self->cxx32->getDiffKernel() : self->cxx->getDiffKernel());
   if (!retval) return 0;
   return PyBlitzArray_NUMPY_WRAP(retval);
 }
@@ -161,6 +209,8 @@ static PyObject* PyBobIpOptflowCentralGradient_getDifference
 static int PyBobIpOptflowCentralGradient_setDifference
 (PyBobIpOptflowCentralGradientObject* self, PyObject* o, void* /*closure*/) {
 
+  if (!PyBobIpOptflowObject_Idle((PyObject*)self, self->busy, "difference")) return -1;
+
   PyBlitzArrayObject* kernel = 0;
 
   if (!PyBlitzArray_Converter(o, &kernel)) return 0;
@@ -173,7 +223,8 @@ static int PyBobIpOptflowCentralGradient_setDifference
   }
 
   try {
-    self->cxx->setDiffKernel(*PyBlitzArrayCxx_AsBlitz<double,1>(kernel));
+    if (self->cxx32) self->cxx32->setDiffKernel(*PyBlitzArrayCxx_AsBlitz<double,1>(kernel));
+    else self->cxx->setDiffKernel(*PyBlitzArrayCxx_AsBlitz<double,1>(kernel));
   }
   catch (std::exception& ex) {
     PyErr_SetString(PyExc_RuntimeError, ex.what());
@@ -195,7 +246,8 @@ static auto s_average = bob::extension::VariableDoc(
 
 static PyObject* PyBobIpOptflowCentralGradient_getAverage
 (PyBobIpOptflowCentralGradientObject* self, void* /*closure*/) {
-  auto retval = PyBlitzArrayCxx_NewFromConstArray(self->cxx->getAvgKernel());
+  auto retval = PyBlitzArrayCxx_NewFromConstArray(self->cxx32 ?
+      self->cxx32->getAvgKernel() : self->cxx->getAvgKernel());
   if (!retval) return 0;
   return PyBlitzArray_NUMPY_WRAP(retval);
 }
@@ -203,6 +255,8 @@ static PyObject* PyBobIpOptflowCentralGradient_getAverage
 static int PyBobIpOptflowCentralGradient_setAverage
 (PyBobIpOptflowCentralGradientObject* self, PyObject* o, void* /*closure*/) {
 
+  if (!PyBobIpOptflowObject_Idle((PyObject*)self, self->busy, "average")) return -1;
+
   PyBlitzArrayObject* kernel = 0;
 
   if (!PyBlitzArray_Converter(o, &kernel)) return 0;
@@ -215,7 +269,8 @@ static int PyBobIpOptflowCentralGradient_setAverage
   }
 
   try {
-    self->cxx->setAvgKernel(*PyBlitzArrayCxx_AsBlitz<double,1>(kernel));
+    if (self->cxx32) self->cxx32->setAvgKernel(*PyBlitzArrayCxx_AsBlitz<double,1>(kernel));
+    else self->cxx->setAvgKernel(*PyBlitzArrayCxx_AsBlitz<double,1>(kernel));
   }
   catch (std::exception& ex) {
     PyErr_SetString(PyExc_RuntimeError, ex.what());
@@ -230,6 +285,96 @@ static int PyBobIpOptflowCentralGradient_setAverage
 
 }
 
+static auto s_dtype = bob::extension::VariableDoc(
+    "dtype",
+    ":py:class:`numpy.dtype`",
+    "The scalar type of the gradients this estimator works with, either ``float64`` or ``float32``",
+    "This attribute is read-only: it is set when the estimator is created. The images are either of this type, ``uint8`` or ``uint16``, or ``uint8`` RGB. The kernels are always stored in double precision."
+    );
+
+static PyObject* PyBobIpOptflowCentralGradient_getDtype
+(PyBobIpOptflowCentralGradientObject* self, void* /*closure*/) {
+  return reinterpret_cast<PyObject*>(PyArray_DescrFromType(self->type_num));
+}
+
+static auto s_pushed = bob::extension::VariableDoc(
+    "pushed",
+    "int",
+    "The number of images given to :py:meth:`push` since the last :py:meth:`reset`"
+    );
+
+static PyObject* PyBobIpOptflowCentralGradient_getPushed
+(PyBobIpOptflowCentralGradientObject* self, void* /*closure*/) {
+  return Py_BuildValue("n", static_cast<Py_ssize_t>(self->cxx32 ?
+        self->cxx32->getPushed() : self->cxx->getPushed()));
+}
+
+static auto s_normalize = bob::extension::VariableDoc(
+    "normalize",
+    "bool",
+    "Whether ``uint8`` and ``uint16`` images are normalised to the range :math:`[0, 1]`",
+    "If set, the gradients of integer images are those of the images divided by the largest value of their type (255 or 65535). Images of type :py:attr:`dtype` are never scaled. Changing this attribute calls :py:meth:`reset`. Defaults to ``False``."
+    );
+
+static PyObject* PyBobIpOptflowCentralGradient_getNormalize
+(PyBobIpOptflowCentralGradientObject* self, void* /*closure*/) {
+  if (self->cxx32 ? self->cxx32->getNormalize() : self->cxx->getNormalize())
+    Py_RETURN_TRUE;
+  Py_RETURN_FALSE;
+}
+
+static int PyBobIpOptflowCentralGradient_setNormalize
+(PyBobIpOptflowCentralGradientObject* self, PyObject* o, void* /*closure*/) {
+  if (!PyBobIpOptflowObject_Idle((PyObject*)self, self->busy, "normalize")) return -1;
+  int normalize = PyObject_IsTrue(o);
+  if (normalize < 0) return -1;
+  if (self->cxx32) self->cxx32->setNormalize(normalize);
+  else self->cxx->setNormalize(normalize);
+  return 0;
+}
+
+static auto s_threads = bob::extension::VariableDoc(
+    "threads",
+    ":py:class:`int`",
+    "The number of threads used to compute the gradients",
+    "The rows of the gradients are split in bands which are computed in parallel. The gradients do not depend on this setting. Setting it to 0 uses all hardware threads available on the machine. The default is 1 (serial execution)."
+    );
+
+static PyObject* PyBobIpOptflowCentralGradient_getThreads
+(PyBobIpOptflowCentralGradientObject* self, void* /*closure*/) {
+  return Py_BuildValue("n", (self->cxx32 ? self->cxx32->getThreads() : self->cxx->getThreads()));
+}
+
+static int PyBobIpOptflowCentralGradient_setThreads
+(PyBobIpOptflowCentralGradientObject* self, PyObject* o, void* /*closure*/) {
+
+  if (!PyBobIpOptflowObject_Idle((PyObject*)self, self->busy, "threads")) return -1;
+
+  Py_ssize_t threads = PyNumber_AsSsize_t(o, PyExc_OverflowError);
+  if (PyErr_Occurred()) return -1;
+
+  if (threads < 0) {
+    PyErr_Format(PyExc_ValueError, "`threads' of %s must be zero or positive, not %" PY_FORMAT_SIZE_T "d", Py_TYPE(self)->tp_name, threads);
+    return -1;
+  }
+
+  try {
+    if (self->cxx32) self->cxx32->setThreads(threads);
+    else self->cxx->setThreads(threads);
+  }
+  catch (std::exception& ex) {
+    PyErr_SetString(PyExc_RuntimeError, ex.what());
+    return -1;
+  }
+  catch (...) {
+    PyErr_Format(PyExc_RuntimeError, "cannot reset `threads' of %s: unknown exception caught", Py_TYPE(self)->tp_name);
+    return -1;
+  }
+
+  return 0;
+
+}
+
 static PyGetSetDef PyBobIpOptflowCentralGradient_getseters[] = {
     {
       s_difference.name(),
@@ -252,6 +397,34 @@ static PyGetSetDef PyBobIpOptflowCentralGradient_getseters[] = {
       s_shape.doc(),
       0
     },
+    {
+      s_dtype.name(),
+      (getter)PyBobIpOptflowCentralGradient_getDtype,
+      0,
+      s_dtype.doc(),
+      0
+    },
+    {
+      s_pushed.name(),
+      (getter)PyBobIpOptflowCentralGradient_getPushed,
+      0,
+      s_pushed.doc(),
+      0
+    },
+    {
+      s_normalize.name(),
+      (getter)PyBobIpOptflowCentralGradient_getNormalize,
+      (setter)PyBobIpOptflowCentralGradient_setNormalize,
+      s_normalize.doc(),
+      0
+    },
+    {
+      s_threads.name(),
+      (getter)PyBobIpOptflowCentralGradient_getThreads,
+      (setter)PyBobIpOptflowCentralGradient_setThreads,
+      s_threads.doc(),
+      0
+    },
     {0}  /* Sentinel */
 };
 
@@ -321,15 +494,57 @@ PyObject* PyBobIpOptflowCentralGradient_Str(PyBobIpOptflowCentralGradientObject*
 
 }
 
+/**
+ * Runs the gradient operator on images of type T or, depending on the type
+ * of `image1', of 8-bit or 16-bit unsigned integers
+ */
+template <typename T>
+static void PyBobIpOptflowCentralGradient_evaluate_as
+(const bob::ip::optflow::CentralGradient<T>& op,
+    PyBlitzArrayObject* image1,
+    PyBlitzArrayObject* image2,
+    PyBlitzArrayObject* image3,
+    PyBlitzArrayObject* ex, PyBlitzArrayObject* ey,
+    PyBlitzArrayObject* et) {
+  blitz::Array<T,2>& Ex = *PyBlitzArrayCxx_AsBlitz<T,2>(ex);
+  blitz::Array<T,2>& Ey = *PyBlitzArrayCxx_AsBlitz<T,2>(ey);
+  blitz::Array<T,2>& Et = *PyBlitzArrayCxx_AsBlitz<T,2>(et);
+  switch (image1->type_num) {
+    case NPY_UINT8:
+      if (image1->ndim == 3)
+        op(*PyBlitzArrayCxx_AsBlitz<uint8_t,3>(image1),
+            *PyBlitzArrayCxx_AsBlitz<uint8_t,3>(image2),
+            *PyBlitzArrayCxx_AsBlitz<uint8_t,3>(image3),
+            Ex, Ey, Et);
+      else
+        op(*PyBlitzArrayCxx_AsBlitz<uint8_t,2>(image1),
+            *PyBlitzArrayCxx_AsBlitz<uint8_t,2>(image2),
+            *PyBlitzArrayCxx_AsBlitz<uint8_t,2>(image3),
+            Ex, Ey, Et);
+      break;
+    case NPY_UINT16:
+      op(*PyBlitzArrayCxx_AsBlitz<uint16_t,2>(image1),
+          *PyBlitzArrayCxx_AsBlitz<uint16_t,2>(image2),
+          *PyBlitzArrayCxx_AsBlitz<uint16_t,2>(image3),
+          Ex, Ey, Et);
+      break;
+    default:
+      op(*PyBlitzArrayCxx_AsBlitz<T,2>(image1),
+          *PyBlitzArrayCxx_AsBlitz<T,2>(image2),
+          *PyBlitzArrayCxx_AsBlitz<T,2>(image3),
+          Ex, Ey, Et);
+  }
+}
+
 static auto s_evaluate = bob::extension::FunctionDoc(
     "evaluate",
     "Evaluates the spatio-temporal gradient from the input image tripplet"
     )
     .add_prototype("image1, image2, image3, [ex, ey, et]", "ex, ey, et")
-    .add_parameter("image1, image2, image3", "array-like (2D, float64)",
+    .add_parameter("image1, image2, image3", "array-like (2D float, uint8 or uint16, or 3D uint8)",
       "Sequence of images to evaluate the gradient from. All images should have the same shape, which should match that of this functor. The gradient is evaluated w.r.t. the image in the center of the tripplet.")
-    .add_parameter("ex, ey, et", "array (2D, float64)", "The evaluated gradients in the horizontal, vertical and time directions (respectively) will be output in these variables, which should have dimensions matching those of this functor. If you don't provide arrays for ``ex``, ``ey`` and ``et``, then they will be allocated internally and returned. You must either provide neither ``ex``, ``ey`` and ``et`` or all, otherwise an exception will be raised.")
-    .add_return("ex, ey, et", "array (2D, float64)", "The evaluated gradients are returned by this function. Each matrix will have a shape that matches the input images.")
+    .add_parameter("ex, ey, et", "array (2D, float)", "The evaluated gradients in the horizontal, vertical and time directions (respectively) will be output in these variables, which should have dimensions matching those of this functor. If you don't provide arrays for ``ex``, ``ey`` and ``et``, then they will be allocated internally and returned, reusing the arrays returned by earlier calls that you have dropped since. You must either provide neither ``ex``, ``ey`` and ``et`` or all, otherwise an exception will be raised.")
+    .add_return("ex, ey, et", "array (2D, float)", "The evaluated gradients are returned by this function. Each matrix will have a shape that matches the input images.")
     ;
 
 static PyObject* PyBobIpOptflowCentralGradient_evaluate
@@ -354,9 +569,9 @@ static PyObject* PyBobIpOptflowCentralGradient_evaluate
   PyBlitzArrayObject* et = 0;
 
   if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&O&O&|O&O&O&", kwlist,
-        &PyBlitzArray_Converter, &image1,
-        &PyBlitzArray_Converter, &image2,
-        &PyBlitzArray_Converter, &image3,
+        &PyBobIpOptflowImage_Converter, &image1,
+        &PyBobIpOptflowImage_Converter, &image2,
+        &PyBobIpOptflowImage_Converter, &image3,
         &PyBlitzArray_OutputConverter, &ex,
         &PyBlitzArray_OutputConverter, &ey,
         &PyBlitzArray_OutputConverter, &et
@@ -370,37 +585,37 @@ static PyObject* PyBobIpOptflowCentralGradient_evaluate
   auto ey_ = make_xsafe(ey);
   auto et_ = make_xsafe(et);
 
-  if (image1->type_num != NPY_FLOAT64 || image1->ndim != 2) {
-    PyErr_Format(PyExc_TypeError, "`%s' only supports 2D 64-bit float arrays for input array `image1', but you passed a %" PY_FORMAT_SIZE_T "dD array with type `%s'", Py_TYPE(self)->tp_name, image1->ndim, PyBlitzArray_TypenumAsString(image1->type_num));
+  if (!PyBobIpOptflowImage_Check(image1, self->type_num)) {
+    PyErr_Format(PyExc_TypeError, "`%s' only supports 2D %s, uint8 or uint16 arrays, or 3D uint8 RGB arrays, for input array `image1', but you passed a %" PY_FORMAT_SIZE_T "dD array with type `%s'", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(self->type_num), image1->ndim, PyBlitzArray_TypenumAsString(image1->type_num));
     return 0;
   }
 
-  if (image2->type_num != NPY_FLOAT64 || image2->ndim != 2) {
-    PyErr_Format(PyExc_TypeError, "`%s' only supports 2D 64-bit float arrays for input array `image2', but you passed a %" PY_FORMAT_SIZE_T "dD array with type `%s'", Py_TYPE(self)->tp_name, image2->ndim, PyBlitzArray_TypenumAsString(image2->type_num));
+  if (image2->type_num != image1->type_num || image2->ndim != image1->ndim) {
+    PyErr_Format(PyExc_TypeError, "`%s' only supports %" PY_FORMAT_SIZE_T "dD %s arrays (the type and dimensions of `image1') for input array `image2', but you passed a %" PY_FORMAT_SIZE_T "dD array with type `%s'", Py_TYPE(self)->tp_name, image1->ndim, PyBlitzArray_TypenumAsString(image1->type_num), image2->ndim, PyBlitzArray_TypenumAsString(image2->type_num));
     return 0;
   }
 
-  if (image3->type_num != NPY_FLOAT64 || image3->ndim != 2) {
-    PyErr_Format(PyExc_TypeError, "`%s' only supports 2D 64-bit float arrays for input array `image3', but you passed a %" PY_FORMAT_SIZE_T "dD array with type `%s'", Py_TYPE(self)->tp_name, image3->ndim, PyBlitzArray_TypenumAsString(image3->type_num));
+  if (image3->type_num != image1->type_num || image3->ndim != image1->ndim) {
+    PyErr_Format(PyExc_TypeError, "`%s' only supports %" PY_FORMAT_SIZE_T "dD %s arrays (the type and dimensions of `image1') for input array `image3', but you passed a %" PY_FORMAT_SIZE_T "dD array with type `%s'", Py_TYPE(self)->tp_name, image1->ndim, PyBlitzArray_TypenumAsString(image1->type_num), image3->ndim, PyBlitzArray_TypenumAsString(image3->type_num));
     return 0;
   }
 
   //check all input image dimensions are consistent
-  Py_ssize_t height = self->cxx->getShape()(0);
-  Py_ssize_t width = self->cxx->getShape()(1);
+  Py_ssize_t height = PyBobIpOptflowCentralGradient_shape(self)(0);
+  Py_ssize_t width = PyBobIpOptflowCentralGradient_shape(self)(1);
 
-  if (image1->shape[0] != height || image1->shape[1] != width) {
-    PyErr_Format(PyExc_RuntimeError, "`%s' only supports arrays with shape (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d) for input array `image1', but `image1''s shape is (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d)", Py_TYPE(self)->tp_name, height, width, image1->shape[0], image1->shape[1]);
+  if (!PyBobIpOptflowImage_Matches(image1, height, width)) {
+    PyErr_Format(PyExc_RuntimeError, "`%s' only supports arrays with shape (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d), or (3, %" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d) and (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d, 3) for RGB images, for input array `image1'", Py_TYPE(self)->tp_name, height, width, height, width, height, width);
     return 0;
   }
 
-  if (image2->shape[0] != height || image2->shape[1] != width) {
-    PyErr_Format(PyExc_RuntimeError, "`%s' only supports arrays with shape (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d) for input array `image2', but `image2''s shape is (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d)", Py_TYPE(self)->tp_name, height, width, image2->shape[0], image2->shape[1]);
+  if (!PyBobIpOptflowImage_Matches(image2, height, width)) {
+    PyErr_Format(PyExc_RuntimeError, "`%s' only supports arrays with shape (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d), or (3, %" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d) and (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d, 3) for RGB images, for input array `image2'", Py_TYPE(self)->tp_name, height, width, height, width, height, width);
     return 0;
   }
 
-  if (image3->shape[0] != height || image3->shape[1] != width) {
-    PyErr_Format(PyExc_RuntimeError, "`%s' only supports arrays with shape (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d) for input array `image3', but `image3''s shape is (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d)", Py_TYPE(self)->tp_name, height, width, image3->shape[0], image3->shape[1]);
+  if (!PyBobIpOptflowImage_Matches(image3, height, width)) {
+    PyErr_Format(PyExc_RuntimeError, "`%s' only supports arrays with shape (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d), or (3, %" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d) and (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d, 3) for RGB images, for input array `image3'", Py_TYPE(self)->tp_name, height, width, height, width, height, width);
     return 0;
   }
 
@@ -413,18 +628,18 @@ static PyObject* PyBobIpOptflowCentralGradient_evaluate
 
   if (ex) {
 
-    if (ex->type_num != NPY_FLOAT64 || ex->ndim != 2) {
-      PyErr_Format(PyExc_TypeError, "`%s' only supports 2D 64-bit float arrays for (optional) input array `ex'", Py_TYPE(self)->tp_name);
+    if (ex->type_num != self->type_num || ex->ndim != 2) {
+      PyErr_Format(PyExc_TypeError, "`%s' only supports 2D %s arrays for (optional) input array `ex'", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(self->type_num));
       return 0;
     }
 
-    if (ey->type_num != NPY_FLOAT64 || ey->ndim != 2) {
-      PyErr_Format(PyExc_TypeError, "`%s' only supports 2D 64-bit float arrays for (optional) input array `ey'", Py_TYPE(self)->tp_name);
+    if (ey->type_num != self->type_num || ey->ndim != 2) {
+      PyErr_Format(PyExc_TypeError, "`%s' only supports 2D %s arrays for (optional) input array `ey'", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(self->type_num));
       return 0;
     }
 
-    if (et->type_num != NPY_FLOAT64 || et->ndim != 2) {
-      PyErr_Format(PyExc_TypeError, "`%s' only supports 2D 64-bit float arrays for (optional) input array `et'", Py_TYPE(self)->tp_name);
+    if (et->type_num != self->type_num || et->ndim != 2) {
+      PyErr_Format(PyExc_TypeError, "`%s' only supports 2D %s arrays for (optional) input array `et'", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(self->type_num));
       return 0;
     }
 
@@ -446,46 +661,213 @@ static PyObject* PyBobIpOptflowCentralGradient_evaluate
   }
   else { //allocates ex, ey and et
 
-    ex = (PyBlitzArrayObject*)PyBlitzArray_SimpleNew(NPY_FLOAT64,
-        image1->ndim, image1->shape);
-    auto bz_ex = PyBlitzArrayCxx_AsBlitz<double,2>(ex);
-    (*bz_ex) = 0.;
+    Py_ssize_t shape[2] = {height, width};
+
+    ex = PyBobIpOptflowArray_Recycle(&self->recycled, self->type_num,
+        2, shape);
+    if (!ex) return 0;
     ex_ = make_safe(ex);
 
-    ey = (PyBlitzArrayObject*)PyBlitzArray_SimpleNew(NPY_FLOAT64,
-        image1->ndim, image1->shape);
-    auto bz_ey = PyBlitzArrayCxx_AsBlitz<double,2>(ey);
-    (*bz_ey) = 0.;
+    ey = PyBobIpOptflowArray_Recycle(&self->recycled, self->type_num,
+        2, shape);
+    if (!ey) return 0;
     ey_ = make_safe(ey);
 
-    et = (PyBlitzArrayObject*)PyBlitzArray_SimpleNew(NPY_FLOAT64,
-        image1->ndim, image1->shape);
-    auto bz_et = PyBlitzArrayCxx_AsBlitz<double,2>(et);
-    (*bz_et) = 0.;
+    et = PyBobIpOptflowArray_Recycle(&self->recycled, self->type_num,
+        2, shape);
+    if (!et) return 0;
     et_ = make_safe(et);
 
   }
 
   /** all basic checks are done, can call the functor now **/
+  //runs without the GIL, so that other Python threads may run meanwhile
+  std::string failure;
+  bool failed = false;
+  ++self->busy;
+  Py_BEGIN_ALLOW_THREADS
   try {
-    self->cxx->operator()(
-        *PyBlitzArrayCxx_AsBlitz<double,2>(image1),
-        *PyBlitzArrayCxx_AsBlitz<double,2>(image2),
-        *PyBlitzArrayCxx_AsBlitz<double,2>(image3),
-        *PyBlitzArrayCxx_AsBlitz<double,2>(ex),
-        *PyBlitzArrayCxx_AsBlitz<double,2>(ey),
-        *PyBlitzArrayCxx_AsBlitz<double,2>(et)
-        );
+    if (self->cxx32) PyBobIpOptflowCentralGradient_evaluate_as(*self->cxx32, image1, image2, image3, ex, ey, et);
+    else PyBobIpOptflowCentralGradient_evaluate_as(*self->cxx, image1, image2, image3, ex, ey, et);
   }
   catch (std::exception& e) {
-    PyErr_SetString(PyExc_RuntimeError, e.what());
+    failure = e.what();
+    failed = true;
+  }
+  catch (...) {
+    failed = true;
+  }
+  Py_END_ALLOW_THREADS
+  --self->busy;
+
+  if (failed) {
+    if (failure.empty()) PyErr_Format(PyExc_RuntimeError, "%s cannot evaluate gradient: unknown exception caught", Py_TYPE(self)->tp_name);
+    else PyErr_SetString(PyExc_RuntimeError, failure.c_str());
     return 0;
   }
+
+  return Py_BuildValue("(NNN)",
+    PyBlitzArray_NUMPY_WRAP(Py_BuildValue("O", ex)),
+    PyBlitzArray_NUMPY_WRAP(Py_BuildValue("O", ey)),
+    PyBlitzArray_NUMPY_WRAP(Py_BuildValue("O", et))
+    );
+
+}
+
+/**
+ * Pushes an image of type T, uint8_t or uint16_t to the gradient operator
+ */
+template <typename T>
+static bool PyBobIpOptflowCentralGradient_push_as
+(bob::ip::optflow::CentralGradient<T>& op, PyBlitzArrayObject* image,
+    PyBlitzArrayObject* ex, PyBlitzArrayObject* ey,
+    PyBlitzArrayObject* et) {
+  blitz::Array<T,2>& Ex = *PyBlitzArrayCxx_AsBlitz<T,2>(ex);
+  blitz::Array<T,2>& Ey = *PyBlitzArrayCxx_AsBlitz<T,2>(ey);
+  blitz::Array<T,2>& Et = *PyBlitzArrayCxx_AsBlitz<T,2>(et);
+  switch (image->type_num) {
+    case NPY_UINT8:
+      if (image->ndim == 3)
+        return op.push(*PyBlitzArrayCxx_AsBlitz<uint8_t,3>(image),
+            Ex, Ey, Et);
+      return op.push(*PyBlitzArrayCxx_AsBlitz<uint8_t,2>(image),
+          Ex, Ey, Et);
+    case NPY_UINT16:
+      return op.push(*PyBlitzArrayCxx_AsBlitz<uint16_t,2>(image),
+          Ex, Ey, Et);
+    default:
+      return op.push(*PyBlitzArrayCxx_AsBlitz<T,2>(image),
+          Ex, Ey, Et);
+  }
+}
+
+static auto s_push = bob::extension::FunctionDoc(
+    "push",
+    "Feeds the next image of a sequence and evaluates the spatio-temporal gradient of the last images",
+    "Call this method on each image of a video, in order, instead of :py:meth:`evaluate` on each triplet of consecutive images. The gradients are the same as those :py:meth:`evaluate` returns for the last 3 images, but each image is only filtered once: its filtered terms are kept for the next 2 calls. Until enough images were pushed, ``None`` is returned. Call :py:meth:`reset` to start a new sequence."
+    )
+    .add_prototype("image, [ex, ey, et]", "gradients")
+    .add_parameter("image", "array-like (2D float, uint8 or uint16, or 3D uint8)", "The next image of the sequence, with a shape that matches that of this functor. Images of a sequence may have different types.")
+    .add_parameter("ex, ey, et", "array (2D, float)", "The evaluated gradients in the horizontal, vertical and time directions (respectively) will be output in these variables, as in :py:meth:`evaluate`. They are left untouched if ``None`` is returned.")
+    .add_return("gradients", "(ex, ey, et) or None", "The evaluated gradients, or ``None`` if less than 3 images were pushed so far")
+    ;
+
+static PyObject* PyBobIpOptflowCentralGradient_push
+(PyBobIpOptflowCentralGradientObject* self, PyObject* args, PyObject* kwds) {
+
+  static const char* const_kwlist[] = {
+    "image",
+    "ex",
+    "ey",
+    "et",
+    0
+    };
+  static char** kwlist = const_cast<char**>(const_kwlist);
+
+  PyBlitzArrayObject* image = 0;
+  PyBlitzArrayObject* ex = 0;
+  PyBlitzArrayObject* ey = 0;
+  PyBlitzArrayObject* et = 0;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&|O&O&O&", kwlist,
+        &PyBobIpOptflowImage_Converter, &image,
+        &PyBlitzArray_OutputConverter, &ex,
+        &PyBlitzArray_OutputConverter, &ey,
+        &PyBlitzArray_OutputConverter, &et
+        )) return 0;
+
+  //protects acquired resources through this scope
+  auto image_ = make_safe(image);
+  auto ex_ = make_xsafe(ex);
+  auto ey_ = make_xsafe(ey);
+  auto et_ = make_xsafe(et);
+
+  if (!PyBobIpOptflowImage_Check(image, self->type_num)) {
+    PyErr_Format(PyExc_TypeError, "`%s' only supports 2D %s, uint8 or uint16 arrays, or 3D uint8 RGB arrays, for input array `image', but you passed a %" PY_FORMAT_SIZE_T "dD array with type `%s'", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(self->type_num), image->ndim, PyBlitzArray_TypenumAsString(image->type_num));
+    return 0;
+  }
+
+  Py_ssize_t height = PyBobIpOptflowCentralGradient_shape(self)(0);
+  Py_ssize_t width = PyBobIpOptflowCentralGradient_shape(self)(1);
+
+  if (!PyBobIpOptflowImage_Matches(image, height, width)) {
+    PyErr_Format(PyExc_RuntimeError, "`%s' only supports arrays with shape (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d), or (3, %" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d) and (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d, 3) for RGB images, for input array `image'", Py_TYPE(self)->tp_name, height, width, height, width, height, width);
+    return 0;
+  }
+
+  if ((ex && !ey) || (ex && !et) ||
+      (ey && !ex) || (ey && !et) ||
+      (et && !ex) || (et && !ey)) {
+    PyErr_Format(PyExc_RuntimeError, "`%s' requires `ex', `ey' and `et' or none", Py_TYPE(self)->tp_name);
+    return 0;
+  }
+
+  if (ex) {
+
+    PyBlitzArrayObject* outputs[] = {ex, ey, et};
+    const char* names[] = {"ex", "ey", "et"};
+    for (int k=0; k<3; ++k) {
+      if (outputs[k]->type_num != self->type_num || outputs[k]->ndim != 2) {
+        PyErr_Format(PyExc_TypeError, "`%s' only supports 2D %s arrays for (optional) input array `%s'", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(self->type_num), names[k]);
+        return 0;
+      }
+      if (outputs[k]->shape[0] != height || outputs[k]->shape[1] != width) {
+        PyErr_Format(PyExc_RuntimeError, "`%s' only supports arrays with shape (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d) for input array `%s', but `%s''s shape is (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d)", Py_TYPE(self)->tp_name, height, width, names[k], names[k], outputs[k]->shape[0], outputs[k]->shape[1]);
+        return 0;
+      }
+    }
+
+  }
+  else { //allocates ex, ey and et
+
+    Py_ssize_t shape[2] = {height, width};
+
+    ex = PyBobIpOptflowArray_Recycle(&self->recycled, self->type_num,
+        2, shape);
+    if (!ex) return 0;
+    ex_ = make_safe(ex);
+
+    ey = PyBobIpOptflowArray_Recycle(&self->recycled, self->type_num,
+        2, shape);
+    if (!ey) return 0;
+    ey_ = make_safe(ey);
+
+    et = PyBobIpOptflowArray_Recycle(&self->recycled, self->type_num,
+        2, shape);
+    if (!et) return 0;
+    et_ = make_safe(et);
+
+  }
+
+  bool ready = false;
+
+  //runs without the GIL, so that other Python threads may run meanwhile
+  std::string failure;
+  bool failed = false;
+  ++self->busy;
+  Py_BEGIN_ALLOW_THREADS
+  try {
+    if (self->cxx32) ready = PyBobIpOptflowCentralGradient_push_as(*self->cxx32, image, ex, ey, et);
+    else ready = PyBobIpOptflowCentralGradient_push_as(*self->cxx, image, ex, ey, et);
+  }
+  catch (std::exception& e) {
+    failure = e.what();
+    failed = true;
+  }
   catch (...) {
-    PyErr_Format(PyExc_RuntimeError, "%s cannot evaluate gradient: unknown exception caught", Py_TYPE(self)->tp_name);
+    failed = true;
+  }
+  Py_END_ALLOW_THREADS
+  --self->busy;
+
+  if (failed) {
+    if (failure.empty()) PyErr_Format(PyExc_RuntimeError, "%s cannot push image: unknown exception caught", Py_TYPE(self)->tp_name);
+    else PyErr_SetString(PyExc_RuntimeError, failure.c_str());
     return 0;
   }
 
+  if (!ready) Py_RETURN_NONE;
+
   return Py_BuildValue("(NNN)",
     PyBlitzArray_NUMPY_WRAP(Py_BuildValue("O", ex)),
     PyBlitzArray_NUMPY_WRAP(Py_BuildValue("O", ey)),
@@ -494,6 +876,24 @@ static PyObject* PyBobIpOptflowCentralGradient_evaluate
 
 }
 
+static auto s_reset = bob::extension::FunctionDoc(
+    "reset",
+    "Forgets the images pushed so far, to start a new sequence",
+    "This is done automatically when the shape or the kernels of this functor change."
+    )
+    .add_prototype("")
+    ;
+
+static PyObject* PyBobIpOptflowCentralGradient_reset
+(PyBobIpOptflowCentralGradientObject* self) {
+  //waits for the image being pushed in another thread, if any
+  Py_BEGIN_ALLOW_THREADS
+  if (self->cxx32) self->cxx32->reset();
+  else self->cxx->reset();
+  Py_END_ALLOW_THREADS
+  Py_RETURN_NONE;
+}
+
 static PyMethodDef PyBobIpOptflowCentralGradient_methods[] = {
   {
     s_evaluate.name(),
@@ -501,6 +901,18 @@ static PyMethodDef PyBobIpOptflowCentralGradient_methods[] = {
     METH_VARARGS|METH_KEYWORDS,
     s_evaluate.doc()
   },
+  {
+    s_push.name(),
+    (PyCFunction)PyBobIpOptflowCentralGradient_push,
+    METH_VARARGS|METH_KEYWORDS,
+    s_push.doc()
+  },
+  {
+    s_reset.name(),
+    (PyCFunction)PyBobIpOptflowCentralGradient_reset,
+    METH_NOARGS,
+    s_reset.doc()
+  },
   {0} /* Sentinel */
 };
 
@@ -511,7 +923,11 @@ static PyObject* PyBobIpOptflowCentralGradient_new
   PyBobIpOptflowCentralGradientObject* self =
     (PyBobIpOptflowCentralGradientObject*)type->tp_alloc(type, 0);
 
+  self->type_num = NPY_FLOAT64;
   self->cxx = 0;
+  self->cxx32 = 0;
+  self->busy = 0;
+  self->recycled = 0;
 
   return reinterpret_cast<PyObject*>(self);
 
@@ -586,40 +1002,50 @@ static auto s_sobel = bob::extension::ClassDoc(
         bob::extension::FunctionDoc(
           CLASS_NAME,
           "Constructor",
-          "We initialize with the shape of the images we need to treat. "
-          "The shape is used by the internal buffers.\n"
+          "We initialize with the shape of the images we need to treat.\n"
           "\n"
           "The difference kernel for this operator is fixed to "
           ":math:`[+1, 0, -1]`. The averaging kernel is fixed to "
           ":math:`[1, 2, 1]`.\n"
           "\n"
           )
-        .add_prototype("(height, width)", "")
+        .add_prototype("(height, width), [dtype]", "")
         .add_parameter("(height, width)", "tuple", "the height and width of images to be fed into the the gradient estimator")
+        .add_parameter("dtype", ":py:class:`numpy.dtype` or dtype-like", "the scalar type of the images and gradients this estimator works with, either ``float64`` (the default) or ``float32``")
         )
     ;
 
 typedef struct {
   PyBobIpOptflowCentralGradientObject parent;
-  bob::ip::optflow::SobelGradient* cxx;
+  bob::ip::optflow::SobelGradient<double>* cxx;
+  bob::ip::optflow::SobelGradient<float>* cxx32;
 } PyBobIpOptflowSobelGradientObject;
 
 static int PyBobIpOptflowSobelGradient_init
 (PyBobIpOptflowSobelGradientObject* self, PyObject* args, PyObject* kwds) {
 
   /* Parses input arguments in a single shot */
-  static const char* const_kwlist[] = {"shape", 0};
+  static const char* const_kwlist[] = {"shape", "dtype", 0};
   static char** kwlist = const_cast<char**>(const_kwlist);
 
   Py_ssize_t height, width;
+  int type_num = NPY_FLOAT64;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "(nn)|O&", kwlist,
+        &height, &width, &PyBlitzArray_TypenumConverter, &type_num)) return -1;
 
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "(nn)", kwlist,
-        &height, &width)) return -1;
+  if (type_num != NPY_FLOAT64 && type_num != NPY_FLOAT32) {
+    PyErr_Format(PyExc_TypeError, "`%s' only supports float64 or float32 as `dtype', not %s", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(type_num));
+    return -1;
+  }
 
   try {
     blitz::TinyVector<int,2> shape;
     shape(0) = height; shape(1) = width;
-    self->cxx = new bob::ip::optflow::SobelGradient(shape);
+    if (type_num == NPY_FLOAT32)
+      self->cxx32 = new bob::ip::optflow::SobelGradient<float>(shape);
+    else
+      self->cxx = new bob::ip::optflow::SobelGradient<double>(shape);
   }
   catch (std::exception& ex) {
     PyErr_SetString(PyExc_RuntimeError, ex.what());
@@ -630,7 +1056,9 @@ static int PyBobIpOptflowSobelGradient_init
     return -1;
   }
 
+  self->parent.type_num = type_num;
   self->parent.cxx = self->cxx;
+  self->parent.cxx32 = self->cxx32;
 
   return 0;
 
@@ -640,7 +1068,10 @@ static void PyBobIpOptflowSobelGradient_delete
 (PyBobIpOptflowSobelGradientObject* self) {
 
   self->parent.cxx = 0;
+  self->parent.cxx32 = 0;
+  Py_XDECREF(self->parent.recycled);
   delete self->cxx;
+  delete self->cxx32;
   Py_TYPE(&self->parent)->tp_free((PyObject*)self);
 
 }
@@ -714,40 +1145,50 @@ static auto s_prewitt = bob::extension::ClassDoc(
         bob::extension::FunctionDoc(
           CLASS_NAME,
           "Constructor",
-          "We initialize with the shape of the images we need to treat. "
-          "The shape is used by the internal buffers.\n"
+          "We initialize with the shape of the images we need to treat.\n"
           "\n"
           "The difference kernel for this operator is fixed to "
           ":math:`[+1, 0, -1]`. The averaging kernel is fixed to "
           ":math:`[1, 1, 1]`.\n"
           "\n"
           )
-        .add_prototype("(height, width)", "")
+        .add_prototype("(height, width), [dtype]", "")
         .add_parameter("(height, width)", "tuple", "the height and width of images to be fed into the the gradient estimator")
+        .add_parameter("dtype", ":py:class:`numpy.dtype` or dtype-like", "the scalar type of the images and gradients this estimator works with, either ``float64`` (the default) or ``float32``")
         )
     ;
 
 typedef struct {
   PyBobIpOptflowCentralGradientObject parent;
-  bob::ip::optflow::PrewittGradient* cxx;
+  bob::ip::optflow::PrewittGradient<double>* cxx;
+  bob::ip::optflow::PrewittGradient<float>* cxx32;
 } PyBobIpOptflowPrewittGradientObject;
 
 static int PyBobIpOptflowPrewittGradient_init
 (PyBobIpOptflowPrewittGradientObject* self, PyObject* args, PyObject* kwds) {
 
   /* Parses input arguments in a single shot */
-  static const char* const_kwlist[] = {"shape", 0};
+  static const char* const_kwlist[] = {"shape", "dtype", 0};
   static char** kwlist = const_cast<char**>(const_kwlist);
 
   Py_ssize_t height, width;
+  int type_num = NPY_FLOAT64;
 
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "(nn)", kwlist,
-        &height, &width)) return -1;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "(nn)|O&", kwlist,
+        &height, &width, &PyBlitzArray_TypenumConverter, &type_num)) return -1;
+
+  if (type_num != NPY_FLOAT64 && type_num != NPY_FLOAT32) {
+    PyErr_Format(PyExc_TypeError, "`%s' only supports float64 or float32 as `dtype', not %s", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(type_num));
+    return -1;
+  }
 
   try {
     blitz::TinyVector<int,2> shape;
     shape(0) = height; shape(1) = width;
-    self->cxx = new bob::ip::optflow::PrewittGradient(shape);
+    if (type_num == NPY_FLOAT32)
+      self->cxx32 = new bob::ip::optflow::PrewittGradient<float>(shape);
+    else
+      self->cxx = new bob::ip::optflow::PrewittGradient<double>(shape);
   }
   catch (std::exception& ex) {
     PyErr_SetString(PyExc_RuntimeError, ex.what());
@@ -758,7 +1199,9 @@ static int PyBobIpOptflowPrewittGradient_init
     return -1;
   }
 
+  self->parent.type_num = type_num;
   self->parent.cxx = self->cxx;
+  self->parent.cxx32 = self->cxx32;
 
   return 0;
 
@@ -768,7 +1211,10 @@ static void PyBobIpOptflowPrewittGradient_delete
 (PyBobIpOptflowPrewittGradientObject* self) {
 
   self->parent.cxx = 0;
+  self->parent.cxx32 = 0;
+  Py_XDECREF(self->parent.recycled);
   delete self->cxx;
+  delete self->cxx32;
   Py_TYPE(&self->parent)->tp_free((PyObject*)self);
 
 }
@@ -842,40 +1288,50 @@ static auto s_isotropic = bob::extension::ClassDoc(
         bob::extension::FunctionDoc(
           CLASS_NAME,
           "Constructor",
-          "We initialize with the shape of the images we need to treat. "
-          "The shape is used by the internal buffers.\n"
+          "We initialize with the shape of the images we need to treat.\n"
           "\n"
           "The difference kernel for this operator is fixed to "
           ":math:`[+1, 0, -1]`. The averaging kernel is fixed to "
           ":math:`[1, \\sqrt{2}, 1]`.\n"
           "\n"
           )
-        .add_prototype("(height, width)", "")
+        .add_prototype("(height, width), [dtype]", "")
         .add_parameter("(height, width)", "tuple", "the height and width of images to be fed into the the gradient estimator")
+        .add_parameter("dtype", ":py:class:`numpy.dtype` or dtype-like", "the scalar type of the images and gradients this estimator works with, either ``float64`` (the default) or ``float32``")
         )
     ;
 
 typedef struct {
   PyBobIpOptflowCentralGradientObject parent;
-  bob::ip::optflow::IsotropicGradient* cxx;
+  bob::ip::optflow::IsotropicGradient<double>* cxx;
+  bob::ip::optflow::IsotropicGradient<float>* cxx32;
 } PyBobIpOptflowIsotropicGradientObject;
 
 static int PyBobIpOptflowIsotropicGradient_init
 (PyBobIpOptflowIsotropicGradientObject* self, PyObject* args, PyObject* kwds) {
 
   /* Parses input arguments in a single shot */
-  static const char* const_kwlist[] = {"shape", 0};
+  static const char* const_kwlist[] = {"shape", "dtype", 0};
   static char** kwlist = const_cast<char**>(const_kwlist);
 
   Py_ssize_t height, width;
+  int type_num = NPY_FLOAT64;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "(nn)|O&", kwlist,
+        &height, &width, &PyBlitzArray_TypenumConverter, &type_num)) return -1;
 
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "(nn)", kwlist,
-        &height, &width)) return -1;
+  if (type_num != NPY_FLOAT64 && type_num != NPY_FLOAT32) {
+    PyErr_Format(PyExc_TypeError, "`%s' only supports float64 or float32 as `dtype', not %s", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(type_num));
+    return -1;
+  }
 
   try {
     blitz::TinyVector<int,2> shape;
     shape(0) = height; shape(1) = width;
-    self->cxx = new bob::ip::optflow::IsotropicGradient(shape);
+    if (type_num == NPY_FLOAT32)
+      self->cxx32 = new bob::ip::optflow::IsotropicGradient<float>(shape);
+    else
+      self->cxx = new bob::ip::optflow::IsotropicGradient<double>(shape);
   }
   catch (std::exception& ex) {
     PyErr_SetString(PyExc_RuntimeError, ex.what());
@@ -886,7 +1342,9 @@ static int PyBobIpOptflowIsotropicGradient_init
     return -1;
   }
 
+  self->parent.type_num = type_num;
   self->parent.cxx = self->cxx;
+  self->parent.cxx32 = self->cxx32;
 
   return 0;
 
@@ -896,7 +1354,10 @@ static void PyBobIpOptflowIsotropicGradient_delete
 (PyBobIpOptflowIsotropicGradientObject* self) {
 
   self->parent.cxx = 0;
+  self->parent.cxx32 = 0;
+  Py_XDECREF(self->parent.recycled);
   delete self->cxx;
+  delete self->cxx32;
   Py_TYPE(&self->parent)->tp_free((PyObject*)self);
 
 }
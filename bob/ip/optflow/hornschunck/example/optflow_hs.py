@@ -48,7 +48,7 @@ def optflow_hs(movie, iterations, alpha, template, stop=0):
   video = bob.io.VideoReader(movie)
   print("Loading", video.info)
 
-  # The images for the optical flow computation must be grayscale
+  # The color frames are converted to gray by the flow estimator itself
   previous = None
   
   # These are the output vectors from the flow computation
@@ -65,11 +65,11 @@ def optflow_hs(movie, iterations, alpha, template, stop=0):
     if previous is None:
       # we need 2 images to compute the flow, if we are on the first iteration,
       # keep the image and defer the calculation until we have a second frame
-      previous = bob.ip.rgb_to_gray(frame)
+      previous = frame
       continue
 
     # if you get to this point, we have two consecutive images
-    current = bob.ip.rgb_to_gray(frame)
+    current = frame
     flow(alpha, iterations, previous, current, u, v)
     
     # please note the HS algorithm output is as float64 and that the flow2hsv
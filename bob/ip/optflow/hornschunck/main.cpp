@@ -2,7 +2,7 @@
  * @author Andre Anjos <andre.anjos@idiap.ch>
  * @date Fri 25 Oct 16:54:55 2013
  *
- * @brief Bindings to bob::sp
+ * @brief Bindings for the optical flow estimators
  */
 
 #ifdef NO_IMPORT_ARRAY
@@ -11,10 +11,14 @@
 #include <bob.blitz/cppapi.h>
 #include <bob.blitz/cleanup.h>
 #include <bob.core/api.h>
-#include <bob.sp/api.h>
 #include <bob.extension/documentation.h>
+#include <string>
+#include <vector>
+#include <functional>
 
 #include "HornAndSchunckFlow.h"
+#include "Simd.h"
+#include "TaskQueue.h"
 
 extern PyTypeObject PyBobIpOptflowHornAndSchunck_Type;
 extern PyTypeObject PyBobIpOptflowVanillaHornAndSchunck_Type;
@@ -25,6 +29,28 @@ extern PyTypeObject PyBobIpOptflowSobelGradient_Type;
 extern PyTypeObject PyBobIpOptflowPrewittGradient_Type;
 extern PyTypeObject PyBobIpOptflowIsotropicGradient_Type;
 
+/**
+ * Tells if the memory spanned by two arrays overlaps, accounting for their
+ * strides, which may be negative
+ */
+static bool PyBobIpOptflowArray_Overlap(const PyBlitzArrayObject* a,
+    const PyBlitzArrayObject* b) {
+  const char* lo[2];
+  const char* hi[2];
+  const PyBlitzArrayObject* x[2] = {a, b};
+  for (int k=0; k<2; ++k) {
+    lo[k] = hi[k] = static_cast<const char*>(x[k]->data);
+    for (Py_ssize_t d=0; d<x[k]->ndim; ++d) {
+      if (!x[k]->shape[d]) return false; //empty
+      Py_ssize_t extent = (x[k]->shape[d] - 1) * x[k]->stride[d];
+      if (extent < 0) lo[k] += extent;
+      else hi[k] += extent;
+    }
+    hi[k] += PyBlitzArray_TypenumSize(x[k]->type_num);
+  }
+  return lo[0] < hi[1] && lo[1] < hi[0];
+}
+
 static auto s_laplacian_avg_hs = bob::extension::FunctionDoc(
     "laplacian_avg_hs",
 
@@ -57,42 +83,69 @@ static auto s_laplacian_avg_hs = bob::extension::FunctionDoc(
     "   You will get the **wrong** results if you use the Laplacian kernel "
     "directly."
     )
-    .add_prototype("input", "output")
-    .add_parameter("input", "array-like (2D, float64)",
+    .add_prototype("input, [out]", "output")
+    .add_parameter("input", "array-like (2D, float64 or float32)",
       "The 2D array to which you'd like to apply the laplacian operator.")
-    .add_return("output", "array (2D, float)", "The result of applying the laplacian operator on ``input``.")
+    .add_parameter("out", "array (2D, float)", "If given, the result is written in this array, which must have the shape and data type of ``input``, and must not share memory with it. Otherwise, a new array is allocated.")
+    .add_return("output", "array (2D, float)", "The result of applying the laplacian operator on ``input``, with the same data type, i.e. ``out`` if it was given.")
     ;
 
 PyObject* PyBobIpOptflowHornAndSchunck_LaplacianAverage(
     PyObject*, PyObject* args, PyObject* kwds) {
 
-  static const char* const_kwlist[] = {"input", 0};
+  static const char* const_kwlist[] = {"input", "out", 0};
   static char** kwlist = const_cast<char**>(const_kwlist);
 
   PyBlitzArrayObject* input = 0;
+  PyBlitzArrayObject* output = 0;
 
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&", kwlist,
-        &PyBlitzArray_Converter, &input)) return 0;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&|O&", kwlist,
+        &PyBlitzArray_Converter, &input,
+        &PyBlitzArray_OutputConverter, &output)) return 0;
 
   //protects acquired resources through this scope
   auto input_ = make_safe(input);
+  auto output_ = make_xsafe(output);
 
-  if (input->type_num != NPY_FLOAT64 || input->ndim != 2) {
-    PyErr_SetString(PyExc_TypeError, "function only supports 2D 64-bit float arrays for `input' array");
+  if ((input->type_num != NPY_FLOAT64 && input->type_num != NPY_FLOAT32) ||
+      input->ndim != 2) {
+    PyErr_SetString(PyExc_TypeError, "function only supports 2D 64-bit or 32-bit float arrays for `input' array");
     return 0;
   }
 
-  //allocates the output
-  auto output = (PyBlitzArrayObject*)PyBlitzArray_SimpleNew(NPY_FLOAT64,
-      input->ndim, input->shape);
-  if (!output) return 0;
-  auto output_ = make_safe(output);
+  if (output) {
+    if (output->type_num != input->type_num || output->ndim != 2) {
+      PyErr_Format(PyExc_TypeError, "function only supports 2D %s arrays (like `input') for output array `out'", PyBlitzArray_TypenumAsString(input->type_num));
+      return 0;
+    }
+    if (output->shape[0] != input->shape[0] ||
+        output->shape[1] != input->shape[1]) {
+      PyErr_Format(PyExc_RuntimeError, "input array `input' has shape = (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d) which differs from that of `out' = (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d)", input->shape[0], input->shape[1], output->shape[0], output->shape[1]);
+      return 0;
+    }
+    if (PyBobIpOptflowArray_Overlap(input, output)) {
+      PyErr_SetString(PyExc_ValueError, "output array `out' must not share memory with input array `input'");
+      return 0;
+    }
+  }
+  else { //allocates the output
+    output = (PyBlitzArrayObject*)PyBlitzArray_SimpleNew(input->type_num,
+        input->ndim, input->shape);
+    if (!output) return 0;
+    output_ = make_safe(output);
+  }
 
   try {
-    bob::ip::optflow::laplacian_avg_hs(
-        *PyBlitzArrayCxx_AsBlitz<double,2>(input),
-        *PyBlitzArrayCxx_AsBlitz<double,2>(output)
-        );
+    if (input->type_num == NPY_FLOAT32)
+      bob::ip::optflow::laplacian_avg_hs(
+          *PyBlitzArrayCxx_AsBlitz<float,2>(input),
+          *PyBlitzArrayCxx_AsBlitz<float,2>(output)
+          );
+    else
+      bob::ip::optflow::laplacian_avg_hs(
+          *PyBlitzArrayCxx_AsBlitz<double,2>(input),
+          *PyBlitzArrayCxx_AsBlitz<double,2>(output)
+          );
   }
   catch (std::exception& e) {
     PyErr_SetString(PyExc_RuntimeError, e.what());
@@ -140,42 +193,69 @@ static auto s_laplacian_avg_hs_opencv = bob::extension::FunctionDoc(
     "   You will get the **wrong** results if you use the Laplacian kernel "
     "directly."
     )
-    .add_prototype("input", "output")
-    .add_parameter("input", "array-like (2D, float64)",
+    .add_prototype("input, [out]", "output")
+    .add_parameter("input", "array-like (2D, float64 or float32)",
       "The 2D array to which you'd like to apply the laplacian operator.")
-    .add_return("output", "array (2D, float)", "The result of applying the laplacian operator on ``input``.")
+    .add_parameter("out", "array (2D, float)", "If given, the result is written in this array, which must have the shape and data type of ``input``, and must not share memory with it. Otherwise, a new array is allocated.")
+    .add_return("output", "array (2D, float)", "The result of applying the laplacian operator on ``input``, with the same data type, i.e. ``out`` if it was given.")
     ;
 
 PyObject* PyBobIpOptflowHornAndSchunck_LaplacianAverageOpenCV(
     PyObject*, PyObject* args, PyObject* kwds) {
 
-  static const char* const_kwlist[] = {"input", 0};
+  static const char* const_kwlist[] = {"input", "out", 0};
   static char** kwlist = const_cast<char**>(const_kwlist);
 
   PyBlitzArrayObject* input = 0;
+  PyBlitzArrayObject* output = 0;
 
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&", kwlist,
-        &PyBlitzArray_Converter, &input)) return 0;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&|O&", kwlist,
+        &PyBlitzArray_Converter, &input,
+        &PyBlitzArray_OutputConverter, &output)) return 0;
 
   //protects acquired resources through this scope
   auto input_ = make_safe(input);
+  auto output_ = make_xsafe(output);
 
-  if (input->type_num != NPY_FLOAT64 || input->ndim != 2) {
-    PyErr_SetString(PyExc_TypeError, "function only supports 2D 64-bit float arrays for `input' array");
+  if ((input->type_num != NPY_FLOAT64 && input->type_num != NPY_FLOAT32) ||
+      input->ndim != 2) {
+    PyErr_SetString(PyExc_TypeError, "function only supports 2D 64-bit or 32-bit float arrays for `input' array");
     return 0;
   }
 
-  //allocates the output
-  auto output = (PyBlitzArrayObject*)PyBlitzArray_SimpleNew(NPY_FLOAT64,
-      input->ndim, input->shape);
-  if (!output) return 0;
-  auto output_ = make_safe(output);
+  if (output) {
+    if (output->type_num != input->type_num || output->ndim != 2) {
+      PyErr_Format(PyExc_TypeError, "function only supports 2D %s arrays (like `input') for output array `out'", PyBlitzArray_TypenumAsString(input->type_num));
+      return 0;
+    }
+    if (output->shape[0] != input->shape[0] ||
+        output->shape[1] != input->shape[1]) {
+      PyErr_Format(PyExc_RuntimeError, "input array `input' has shape = (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d) which differs from that of `out' = (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d)", input->shape[0], input->shape[1], output->shape[0], output->shape[1]);
+      return 0;
+    }
+    if (PyBobIpOptflowArray_Overlap(input, output)) {
+      PyErr_SetString(PyExc_ValueError, "output array `out' must not share memory with input array `input'");
+      return 0;
+    }
+  }
+  else { //allocates the output
+    output = (PyBlitzArrayObject*)PyBlitzArray_SimpleNew(input->type_num,
+        input->ndim, input->shape);
+    if (!output) return 0;
+    output_ = make_safe(output);
+  }
 
   try {
-    bob::ip::optflow::laplacian_avg_hs_opencv(
-        *PyBlitzArrayCxx_AsBlitz<double,2>(input),
-        *PyBlitzArrayCxx_AsBlitz<double,2>(output)
-        );
+    if (input->type_num == NPY_FLOAT32)
+      bob::ip::optflow::laplacian_avg_hs_opencv(
+          *PyBlitzArrayCxx_AsBlitz<float,2>(input),
+          *PyBlitzArrayCxx_AsBlitz<float,2>(output)
+          );
+    else
+      bob::ip::optflow::laplacian_avg_hs_opencv(
+          *PyBlitzArrayCxx_AsBlitz<double,2>(input),
+          *PyBlitzArrayCxx_AsBlitz<double,2>(output)
+          );
   }
   catch (std::exception& e) {
     PyErr_SetString(PyExc_RuntimeError, e.what());
@@ -203,11 +283,12 @@ static auto s_flow_error = bob::extension::FunctionDoc(
     "   E = i2(x-u,y-v) - i1(x,y))\n"
     "\n"
     )
-    .add_prototype("image1, image2, u, v", "E")
-    .add_parameter("image1, image2", "array-like (2D, float64)",
+    .add_prototype("image1, image2, u, v, [out]", "E")
+    .add_parameter("image1, image2", "array-like (2D, float64 or float32)",
       "Sequence of images the flow was estimated with")
-    .add_parameter("u, v", "array-like (2D, float64)", "The estimated flows in the horizontal and vertical directions (respectively), which should have dimensions matching those of ``image1`` and ``image2``.")
-    .add_return("E", "array (2D, float)", "The estimated flow error E.")
+    .add_parameter("u, v", "array-like (2D, float)", "The estimated flows in the horizontal and vertical directions (respectively), which should have dimensions and data type matching those of ``image1`` and ``image2``.")
+    .add_parameter("out", "array (2D, float)", "If given, the error is written in this array, which must have the shape and data type of ``image1``, and must not share memory with any of the inputs. Otherwise, a new array is allocated.")
+    .add_return("E", "array (2D, float)", "The estimated flow error E, i.e. ``out`` if it was given.")
     ;
 
 PyObject* PyBobIpOptflowHornAndSchunck_FlowError(PyObject*,
@@ -218,22 +299,23 @@ PyObject* PyBobIpOptflowHornAndSchunck_FlowError(PyObject*,
     "image2",
     "u",
     "v",
+    "out",
+    0
     };
   static char** kwlist = const_cast<char**>(const_kwlist);
 
-  double alpha;
-  Py_ssize_t iterations;
   PyBlitzArrayObject* image1 = 0;
   PyBlitzArrayObject* image2 = 0;
   PyBlitzArrayObject* u = 0;
   PyBlitzArrayObject* v = 0;
+  PyBlitzArrayObject* error = 0;
 
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&O&O&O&", kwlist,
-        &alpha, &iterations,
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&O&O&O&|O&", kwlist,
         &PyBlitzArray_Converter, &image1,
         &PyBlitzArray_Converter, &image2,
         &PyBlitzArray_Converter, &u,
-        &PyBlitzArray_Converter, &v
+        &PyBlitzArray_Converter, &v,
+        &PyBlitzArray_OutputConverter, &error
         )) return 0;
 
   //protects acquired resources through this scope
@@ -241,24 +323,26 @@ PyObject* PyBobIpOptflowHornAndSchunck_FlowError(PyObject*,
   auto image2_ = make_safe(image2);
   auto u_ = make_safe(u);
   auto v_ = make_safe(v);
+  auto error_ = make_xsafe(error);
 
-  if (image1->type_num != NPY_FLOAT64 || image1->ndim != 2) {
-    PyErr_Format(PyExc_TypeError, "function only supports 2D 64-bit float arrays for input array `image1' - you passed a %" PY_FORMAT_SIZE_T "d array of type `%s'", image1->ndim, PyBlitzArray_TypenumAsString(image1->type_num));
+  if ((image1->type_num != NPY_FLOAT64 && image1->type_num != NPY_FLOAT32) ||
+      image1->ndim != 2) {
+    PyErr_Format(PyExc_TypeError, "function only supports 2D 64-bit or 32-bit float arrays for input array `image1' - you passed a %" PY_FORMAT_SIZE_T "d array of type `%s'", image1->ndim, PyBlitzArray_TypenumAsString(image1->type_num));
     return 0;
   }
 
-  if (image2->type_num != NPY_FLOAT64 || image2->ndim != 2) {
-    PyErr_Format(PyExc_TypeError, "function only supports 2D 64-bit float arrays for input array `image2' - you passed a %" PY_FORMAT_SIZE_T "d array of type `%s'", image2->ndim, PyBlitzArray_TypenumAsString(image2->type_num));
+  if (image2->type_num != image1->type_num || image2->ndim != 2) {
+    PyErr_Format(PyExc_TypeError, "function only supports 2D %s arrays (like `image1') for input array `image2' - you passed a %" PY_FORMAT_SIZE_T "d array of type `%s'", PyBlitzArray_TypenumAsString(image1->type_num), image2->ndim, PyBlitzArray_TypenumAsString(image2->type_num));
     return 0;
   }
 
-  if (u->type_num != NPY_FLOAT64 || u->ndim != 2) {
-    PyErr_Format(PyExc_TypeError, "function only supports 2D 64-bit float arrays for input array `u' - you passed a %" PY_FORMAT_SIZE_T "d array of type `%s'", u->ndim, PyBlitzArray_TypenumAsString(u->type_num));
+  if (u->type_num != image1->type_num || u->ndim != 2) {
+    PyErr_Format(PyExc_TypeError, "function only supports 2D %s arrays (like `image1') for input array `u' - you passed a %" PY_FORMAT_SIZE_T "d array of type `%s'", PyBlitzArray_TypenumAsString(image1->type_num), u->ndim, PyBlitzArray_TypenumAsString(u->type_num));
     return 0;
   }
 
-  if (v->type_num != NPY_FLOAT64 || v->ndim != 2) {
-    PyErr_Format(PyExc_TypeError, "function only supports 2D 64-bit float arrays for input array `v' - you passed a %" PY_FORMAT_SIZE_T "d array of type `%s'", v->ndim, PyBlitzArray_TypenumAsString(v->type_num));
+  if (v->type_num != image1->type_num || v->ndim != 2) {
+    PyErr_Format(PyExc_TypeError, "function only supports 2D %s arrays (like `image1') for input array `v' - you passed a %" PY_FORMAT_SIZE_T "d array of type `%s'", PyBlitzArray_TypenumAsString(image1->type_num), v->ndim, PyBlitzArray_TypenumAsString(v->type_num));
     return 0;
   }
 
@@ -281,20 +365,49 @@ PyObject* PyBobIpOptflowHornAndSchunck_FlowError(PyObject*,
     return 0;
   }
 
-  //allocates the error return
-  auto error = (PyBlitzArrayObject*)PyBlitzArray_SimpleNew(NPY_FLOAT64,
-      image1->ndim, image1->shape);
-  auto error_ = make_safe(error);
+  if (error) {
+    if (error->type_num != image1->type_num || error->ndim != 2) {
+      PyErr_Format(PyExc_TypeError, "function only supports 2D %s arrays (like `image1') for output array `out'", PyBlitzArray_TypenumAsString(image1->type_num));
+      return 0;
+    }
+    if (error->shape[0] != height || error->shape[1] != width) {
+      PyErr_Format(PyExc_RuntimeError, "input arrays `image1', `image2', `u' and `v' have shape = (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d) which differs from that of `out' = (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d)", height, width, error->shape[0], error->shape[1]);
+      return 0;
+    }
+    const PyBlitzArrayObject* inputs[4] = {image1, image2, u, v};
+    const char* names[4] = {"image1", "image2", "u", "v"};
+    for (int k=0; k<4; ++k) {
+      if (PyBobIpOptflowArray_Overlap(inputs[k], error)) {
+        PyErr_Format(PyExc_ValueError, "output array `out' must not share memory with input array `%s'", names[k]);
+        return 0;
+      }
+    }
+  }
+  else { //allocates the error return
+    error = (PyBlitzArrayObject*)PyBlitzArray_SimpleNew(image1->type_num,
+        image1->ndim, image1->shape);
+    if (!error) return 0;
+    error_ = make_safe(error);
+  }
 
   /** all basic checks are done, can call the functor now **/
   try {
-    bob::ip::optflow::flowError(
-        *PyBlitzArrayCxx_AsBlitz<double,2>(image1),
-        *PyBlitzArrayCxx_AsBlitz<double,2>(image2),
-        *PyBlitzArrayCxx_AsBlitz<double,2>(u),
-        *PyBlitzArrayCxx_AsBlitz<double,2>(v),
-        *PyBlitzArrayCxx_AsBlitz<double,2>(error)
-        );
+    if (image1->type_num == NPY_FLOAT32)
+      bob::ip::optflow::flowError(
+          *PyBlitzArrayCxx_AsBlitz<float,2>(image1),
+          *PyBlitzArrayCxx_AsBlitz<float,2>(image2),
+          *PyBlitzArrayCxx_AsBlitz<float,2>(u),
+          *PyBlitzArrayCxx_AsBlitz<float,2>(v),
+          *PyBlitzArrayCxx_AsBlitz<float,2>(error)
+          );
+    else
+      bob::ip::optflow::flowError(
+          *PyBlitzArrayCxx_AsBlitz<double,2>(image1),
+          *PyBlitzArrayCxx_AsBlitz<double,2>(image2),
+          *PyBlitzArrayCxx_AsBlitz<double,2>(u),
+          *PyBlitzArrayCxx_AsBlitz<double,2>(v),
+          *PyBlitzArrayCxx_AsBlitz<double,2>(error)
+          );
   }
   catch (std::exception& e) {
     PyErr_SetString(PyExc_RuntimeError, e.what());
@@ -310,6 +423,450 @@ PyObject* PyBobIpOptflowHornAndSchunck_FlowError(PyObject*,
 
 }
 
+/**
+ * Converts a solver name, as accepted by the ``estimate`` methods of the
+ * flow estimators, into the equivalent C++ enumeration value
+ */
+int PyBobIpOptflowSolver_Converter(PyObject* o,
+    bob::ip::optflow::Solver::Type* solver) {
+
+  std::string name;
+
+#if PY_VERSION_HEX < 0x03000000
+  if (PyString_Check(o)) name = PyString_AS_STRING(o);
+  else
+#endif
+  if (PyUnicode_Check(o)) {
+    auto bytes = make_safe(PyUnicode_AsASCIIString(o));
+    if (!bytes) return 0;
+    name = PyBytes_AsString(bytes.get());
+  }
+  else {
+    PyErr_Format(PyExc_TypeError, "solver names must be strings, not `%s'", Py_TYPE(o)->tp_name);
+    return 0;
+  }
+
+  if (name == "jacobi") *solver = bob::ip::optflow::Solver::Jacobi;
+  else if (name == "sor") *solver = bob::ip::optflow::Solver::SOR;
+  else if (name == "multigrid") *solver = bob::ip::optflow::Solver::Multigrid;
+  else {
+    PyErr_Format(PyExc_ValueError, "unknown solver `%s' - valid choices are `jacobi', `sor' and `multigrid'", name.c_str());
+    return 0;
+  }
+
+  return 1;
+
+}
+
+/**
+ * Tells if an array is an image the estimators working with the scalar type
+ * type_num accept: a 2D array of this type, or of 8-bit or 16-bit unsigned
+ * integers, or a 3D array of 8-bit RGB pixels, with its 3 channels first
+ * (planar) or last (interleaved)
+ */
+bool PyBobIpOptflowImage_Check(PyBlitzArrayObject* image, int type_num) {
+  if (image->ndim == 3) return image->type_num == NPY_UINT8 &&
+    (image->shape[0] == 3 || image->shape[2] == 3);
+  if (image->ndim != 2) return false;
+  return image->type_num == type_num || image->type_num == NPY_UINT8 ||
+    image->type_num == NPY_UINT16;
+}
+
+/**
+ * Tells if an image accepted by PyBobIpOptflowImage_Check() has height rows
+ * and width columns
+ */
+bool PyBobIpOptflowImage_Matches(PyBlitzArrayObject* image,
+    Py_ssize_t height, Py_ssize_t width) {
+  if (image->ndim == 2)
+    return image->shape[0] == height && image->shape[1] == width;
+  return (image->shape[0] == 3 && image->shape[1] == height &&
+      image->shape[2] == width) || (image->shape[0] == height &&
+      image->shape[1] == width && image->shape[2] == 3);
+}
+
+/**
+ * Tells if an array is a stack of images PyBobIpOptflowImage_Check() accepts
+ * along its first dimension
+ */
+bool PyBobIpOptflowStack_Check(PyBlitzArrayObject* stack, int type_num) {
+  if (stack->ndim == 4) return stack->type_num == NPY_UINT8 &&
+    (stack->shape[1] == 3 || stack->shape[3] == 3);
+  if (stack->ndim != 3) return false;
+  return stack->type_num == type_num || stack->type_num == NPY_UINT8 ||
+    stack->type_num == NPY_UINT16;
+}
+
+/**
+ * Tells if the images of a stack accepted by PyBobIpOptflowStack_Check() have
+ * height rows and width columns
+ */
+bool PyBobIpOptflowStack_Matches(PyBlitzArrayObject* stack,
+    Py_ssize_t height, Py_ssize_t width) {
+  if (stack->ndim == 3)
+    return stack->shape[1] == height && stack->shape[2] == width;
+  return (stack->shape[1] == 3 && stack->shape[2] == height &&
+      stack->shape[3] == width) || (stack->shape[1] == height &&
+      stack->shape[2] == width && stack->shape[3] == 3);
+}
+
+/**
+ * Converts an image, or a stack of images, into a bob.blitz array reading the
+ * pixels where they are: crops, channels of RGB images, reversed or
+ * Fortran-ordered arrays are not copied, as long as they are aligned and in
+ * the byte order of the machine, since the gradients read rows through their
+ * strides. C-contiguous arrays take the usual path. Objects that are not
+ * numpy arrays are converted the way numpy does, which only copies them if
+ * they do not expose their memory through the buffer protocol.
+ */
+int PyBobIpOptflowImage_Converter(PyObject* o, PyBlitzArrayObject** a) {
+
+  if (PyBlitzArray_Check(o)) return PyBlitzArray_Converter(o, a);
+
+  PyArrayObject* array = reinterpret_cast<PyArrayObject*>(PyArray_FromAny(o,
+        0, 1, BLITZ_ARRAY_MAXDIMS, NPY_ARRAY_ALIGNED|NPY_ARRAY_NOTSWAPPED, 0));
+  if (!array) return 0;
+  auto array_ = make_safe(array);
+
+  if (PyArray_IS_C_CONTIGUOUS(array))
+    return PyBlitzArray_Converter(reinterpret_cast<PyObject*>(array), a);
+
+  //blitz counts strides in elements: odd byte strides need a copy
+  for (int k=0; k<PyArray_NDIM(array); ++k)
+    if (PyArray_STRIDE(array, k) % PyArray_ITEMSIZE(array))
+      return PyBlitzArray_Converter(reinterpret_cast<PyObject*>(array), a);
+
+  Py_ssize_t shape[BLITZ_ARRAY_MAXDIMS];
+  Py_ssize_t stride[BLITZ_ARRAY_MAXDIMS];
+  for (int k=0; k<PyArray_NDIM(array); ++k) {
+    shape[k] = PyArray_DIM(array, k);
+    stride[k] = PyArray_STRIDE(array, k);
+  }
+
+  *a = reinterpret_cast<PyBlitzArrayObject*>(PyBlitzArray_SimpleNewFromData(
+        PyArray_TYPE(array), PyArray_NDIM(array), shape, stride,
+        PyArray_DATA(array), 0));
+  if (!*a) return 0;
+
+  //the view keeps the numpy array, hence the pixels, alive
+  Py_INCREF(array);
+  (*a)->base = reinterpret_cast<PyObject*>(array);
+  return 1;
+
+}
+
+/**
+ * Tells if the attribute of an object may be reset, i.e. if none of its
+ * methods is running without the GIL in another thread (busy counts them).
+ * Sets a RuntimeError otherwise.
+ */
+bool PyBobIpOptflowObject_Idle(PyObject* self, Py_ssize_t busy,
+    const char* attribute) {
+  if (!busy) return true;
+  PyErr_Format(PyExc_RuntimeError, "cannot reset `%s' of %s while it is computing in another thread", attribute, Py_TYPE(self)->tp_name);
+  return false;
+}
+
+/**
+ * Maximum number of arrays an object keeps for PyBobIpOptflowArray_Recycle()
+ */
+static const Py_ssize_t RECYCLED_ARRAYS = 16;
+
+/**
+ * Returns a new reference to an array of type type_num and shape, for a
+ * method to fill in and return when the caller did not provide one. The
+ * arrays returned so far are kept in the list *pool, created on the first
+ * call and released with the object owning it: those the caller has dropped
+ * since, i.e. that only the pool still references, are handed out again
+ * instead of allocating new ones, so that calls on a stream of frames stop
+ * allocating once the caller drops the results of the previous frames.
+ * Recycled arrays are not cleared. Returns 0 with an exception set on error.
+ */
+PyBlitzArrayObject* PyBobIpOptflowArray_Recycle(PyObject** pool,
+    int type_num, Py_ssize_t ndim, Py_ssize_t* shape) {
+
+  if (!*pool) *pool = PyList_New(0);
+  if (!*pool) return 0;
+  PyObject* list = *pool;
+
+  for (Py_ssize_t k=0; k<PyList_GET_SIZE(list); ++k) {
+    PyBlitzArrayObject* array =
+      reinterpret_cast<PyBlitzArrayObject*>(PyList_GET_ITEM(list, k));
+    if (Py_REFCNT(array) != 1) continue; //still in use
+    bool matches = array->type_num == type_num && array->ndim == ndim;
+    for (Py_ssize_t d=0; matches && d<ndim; ++d)
+      matches = array->shape[d] == shape[d];
+    if (matches) {
+      Py_INCREF(array);
+      return array;
+    }
+  }
+
+  PyBlitzArrayObject* array = reinterpret_cast<PyBlitzArrayObject*>(
+      PyBlitzArray_SimpleNew(type_num, ndim, shape));
+  if (!array) return 0;
+  auto array_ = make_safe(array);
+
+  //released arrays of another type or shape are of no use anymore
+  for (Py_ssize_t k=PyList_GET_SIZE(list)-1; k>=0; --k)
+    if (Py_REFCNT(PyList_GET_ITEM(list, k)) == 1 &&
+        PyList_SetSlice(list, k, k+1, 0) < 0) return 0;
+
+  if (PyList_GET_SIZE(list) < RECYCLED_ARRAYS &&
+      PyList_Append(list, reinterpret_cast<PyObject*>(array)) < 0) return 0;
+
+  Py_INCREF(array);
+  return array;
+
+}
+
+/**
+ * The queue running the jobs of the ``estimate_async`` methods, created on
+ * first use with one worker per hardware thread. It is never destroyed: the
+ * pending jobs are waited for when the interpreter exits instead, see
+ * PyBobIpOptflowAsync_Wait(), and the idle workers end with the process.
+ */
+static bob::ip::optflow::TaskQueue* s_async_queue = 0;
+
+/**
+ * Sets the result, or the exception, of a concurrent.futures.Future from the
+ * outcome of a background job. Runs with the GIL.
+ */
+static void PyBobIpOptflowAsync_Resolve(PyObject* future, bool failed,
+    const std::string& failure, const char* what,
+    const std::function<PyObject*()>& result) {
+
+  PyObject* value = 0;
+  if (!failed) value = result();
+
+  PyObject* outcome = 0;
+  if (value) {
+    outcome = PyObject_CallMethod(future, const_cast<char*>("set_result"),
+        const_cast<char*>("N"), value);
+  }
+  else {
+    PyObject* type = 0;
+    PyObject* error = 0;
+    PyObject* traceback = 0;
+    if (failed) {
+      if (failure.empty()) error = PyUnicode_FromFormat("%s: unknown exception caught", what);
+      else error = PyUnicode_FromString(failure.c_str());
+      if (error) error = PyObject_CallFunction(PyExc_RuntimeError,
+          const_cast<char*>("N"), error);
+    }
+    else {
+      PyErr_Fetch(&type, &error, &traceback);
+      PyErr_NormalizeException(&type, &error, &traceback);
+      Py_XDECREF(type);
+      Py_XDECREF(traceback);
+    }
+    if (error) outcome = PyObject_CallMethod(future,
+        const_cast<char*>("set_exception"), const_cast<char*>("N"), error);
+  }
+
+  //nobody may catch errors of the future itself, e.g. if it was resolved
+  if (!outcome) PyErr_WriteUnraisable(future);
+  Py_XDECREF(outcome);
+
+}
+
+/**
+ * Runs compute() in the background, without the GIL, and returns a
+ * concurrent.futures.Future set to the object result() builds afterwards
+ * with the GIL, or to the exception compute() or result() raised. owner and
+ * the objects in pinned, e.g. the arrays compute() reads and writes, are
+ * kept alive until then, and *busy counts the job as a call running without
+ * the GIL from its submission, so that the attributes of owner cannot be
+ * reset meanwhile. A job cancelled through its future before it starts is
+ * not run. what describes the job in error messages. Returns 0 with an
+ * exception set if the job cannot be submitted.
+ */
+PyObject* PyBobIpOptflowAsync_Submit(PyObject* owner, Py_ssize_t* busy,
+    const std::vector<PyObject*>& pinned, std::function<void()> compute,
+    std::function<PyObject*()> result, const char* what) {
+
+  PyObject* futures = PyImport_ImportModule("concurrent.futures");
+  if (!futures) return 0;
+  auto futures_ = make_safe(futures);
+  PyObject* future = PyObject_CallMethod(futures, const_cast<char*>("Future"), 0);
+  if (!future) return 0;
+  auto future_ = make_safe(future);
+
+  try {
+#if PY_VERSION_HEX < 0x03070000
+    PyEval_InitThreads();
+#endif
+    if (!s_async_queue) s_async_queue = new bob::ip::optflow::TaskQueue();
+
+    //the job starts by taking the GIL, i.e. after this function returns
+    s_async_queue->submit([=]() {
+
+      PyGILState_STATE state = PyGILState_Ensure();
+      PyObject* running = PyObject_CallMethod(future,
+          const_cast<char*>("set_running_or_notify_cancel"), 0);
+      if (!running) PyErr_WriteUnraisable(future);
+      bool cancelled = !running || !PyObject_IsTrue(running);
+      Py_XDECREF(running);
+      PyGILState_Release(state);
+
+      std::string failure;
+      bool failed = false;
+      if (!cancelled) {
+        try {
+          compute();
+        }
+        catch (std::exception& e) {
+          failure = e.what();
+          failed = true;
+        }
+        catch (...) {
+          failed = true;
+        }
+      }
+
+      state = PyGILState_Ensure();
+      --*busy;
+      if (!cancelled)
+        PyBobIpOptflowAsync_Resolve(future, failed, failure, what, result);
+      for (size_t k=0; k<pinned.size(); ++k) Py_DECREF(pinned[k]);
+      Py_DECREF(future);
+      Py_DECREF(owner);
+      PyGILState_Release(state);
+
+    });
+  }
+  catch (std::exception& e) {
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+    return 0;
+  }
+
+  //references released by the job, once done
+  Py_INCREF(owner);
+  Py_INCREF(future);
+  for (size_t k=0; k<pinned.size(); ++k) Py_INCREF(pinned[k]);
+  ++*busy;
+
+  Py_INCREF(future);
+  return future;
+
+}
+
+/**
+ * Waits for the jobs submitted through PyBobIpOptflowAsync_Submit(), which
+ * need the interpreter to complete. Registered to run at exit.
+ */
+static PyObject* PyBobIpOptflowAsync_Wait(PyObject*) {
+  if (s_async_queue) {
+    Py_BEGIN_ALLOW_THREADS
+    s_async_queue->wait();
+    Py_END_ALLOW_THREADS
+  }
+  Py_RETURN_NONE;
+}
+
+static PyMethodDef s_async_wait = {
+  "_wait_async",
+  (PyCFunction)PyBobIpOptflowAsync_Wait,
+  METH_NOARGS,
+  "Waits for the pending estimate_async() jobs"
+};
+
+static auto s_get_simd = bob::extension::FunctionDoc(
+    "get_simd",
+
+    "Returns the instruction set used by the numerical kernels",
+
+    "The flow solvers, the Laplacian averages and the gradients process "
+    "several pixels per instruction when the processor allows it. By default, "
+    "the best instruction set of the running machine is used. All "
+    "instruction sets produce exactly the same results.\n"
+    )
+    .add_prototype("", "name")
+    .add_return("name", "str", "One of ``'scalar'``, ``'sse2'``, ``'avx2'`` or ``'avx512'``")
+    ;
+
+PyObject* PyBobIpOptflowHornAndSchunck_GetSimd(PyObject*) {
+  return Py_BuildValue("s",
+      bob::ip::optflow::getSimdName(bob::ip::optflow::getSimd()));
+}
+
+static auto s_supported_simd = bob::extension::FunctionDoc(
+    "supported_simd",
+
+    "Returns the instruction sets supported by this machine",
+
+    "The list always contains ``'scalar'``, followed by the vector "
+    "instruction sets supported by the processor, from the narrowest to the "
+    "widest."
+    )
+    .add_prototype("", "names")
+    .add_return("names", "tuple", "The names of the supported instruction sets")
+    ;
+
+PyObject* PyBobIpOptflowHornAndSchunck_SupportedSimd(PyObject*) {
+
+  std::vector<const char*> names;
+  for (int k=bob::ip::optflow::Simd::Scalar;
+      k<=bob::ip::optflow::Simd::AVX512; ++k) {
+    auto simd = static_cast<bob::ip::optflow::Simd::Type>(k);
+    if (bob::ip::optflow::isSimdSupported(simd))
+      names.push_back(bob::ip::optflow::getSimdName(simd));
+  }
+
+  PyObject* retval = PyTuple_New(names.size());
+  if (!retval) return 0;
+  for (size_t k=0; k<names.size(); ++k) {
+    PyObject* name = Py_BuildValue("s", names[k]);
+    if (!name) { Py_DECREF(retval); return 0; }
+    PyTuple_SET_ITEM(retval, k, name);
+  }
+
+  return retval;
+
+}
+
+static auto s_set_simd = bob::extension::FunctionDoc(
+    "set_simd",
+
+    "Selects the instruction set used by the numerical kernels",
+
+    "This is mostly useful for benchmarking, as all instruction sets produce "
+    "exactly the same results. The setting is global to the module and "
+    "affects all estimators and gradients."
+    )
+    .add_prototype("name")
+    .add_parameter("name", "str", "One of the names returned by :py:func:`supported_simd`")
+    ;
+
+PyObject* PyBobIpOptflowHornAndSchunck_SetSimd(PyObject*,
+    PyObject* args, PyObject* kwds) {
+
+  static const char* const_kwlist[] = {"name", 0};
+  static char** kwlist = const_cast<char**>(const_kwlist);
+
+  const char* name = 0;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &name)) return 0;
+
+  for (int k=bob::ip::optflow::Simd::Scalar;
+      k<=bob::ip::optflow::Simd::AVX512; ++k) {
+    auto simd = static_cast<bob::ip::optflow::Simd::Type>(k);
+    if (std::string(name) != bob::ip::optflow::getSimdName(simd)) continue;
+    try {
+      bob::ip::optflow::setSimd(simd);
+    }
+    catch (std::exception& e) {
+      PyErr_SetString(PyExc_RuntimeError, e.what());
+      return 0;
+    }
+    Py_RETURN_NONE;
+  }
+
+  PyErr_Format(PyExc_ValueError, "unknown instruction set `%s' - valid choices are `scalar', `sse2', `avx2' and `avx512'", name);
+  return 0;
+
+}
+
 static PyMethodDef module_methods[] = {
   {
     s_laplacian_avg_hs.name(),
@@ -329,6 +886,24 @@ static PyMethodDef module_methods[] = {
     METH_VARARGS|METH_KEYWORDS,
     s_flow_error.doc()
   },
+  {
+    s_get_simd.name(),
+    (PyCFunction)PyBobIpOptflowHornAndSchunck_GetSimd,
+    METH_NOARGS,
+    s_get_simd.doc()
+  },
+  {
+    s_supported_simd.name(),
+    (PyCFunction)PyBobIpOptflowHornAndSchunck_SupportedSimd,
+    METH_NOARGS,
+    s_supported_simd.doc()
+  },
+  {
+    s_set_simd.name(),
+    (PyCFunction)PyBobIpOptflowHornAndSchunck_SetSimd,
+    METH_VARARGS|METH_KEYWORDS,
+    s_set_simd.doc()
+  },
   {0}  /* Sentinel */
 };
 
@@ -419,7 +994,17 @@ static PyObject* create_module (void) {
   /* imports dependencies */
   if (import_bob_blitz() < 0) return 0;
   if (import_bob_core_logging() < 0) return 0;
-  if (import_bob_sp() < 0) return 0;
+
+  /* background estimations need the interpreter to complete */
+  PyObject* atexit = PyImport_ImportModule("atexit");
+  if (!atexit) return 0;
+  auto atexit_ = make_safe(atexit);
+  PyObject* wait = PyCFunction_New(&s_async_wait, 0);
+  if (!wait) return 0;
+  PyObject* registered = PyObject_CallMethod(atexit,
+      const_cast<char*>("register"), const_cast<char*>("N"), wait);
+  if (!registered) return 0;
+  Py_DECREF(registered);
 
   return Py_BuildValue(ret, module);
 }
@@ -14,7 +14,8 @@ import nose.tools
 import pkg_resources
 
 
-from . import VanillaFlow, HornAndSchunckGradient, laplacian_avg_hs
+from . import VanillaFlow, Flow, HornAndSchunckGradient, SobelGradient, \
+    laplacian_avg_hs, get_simd, set_simd, supported_simd
 
 def F(f):
   """Returns the test file on the "data" subdirectory"""
@@ -108,6 +109,444 @@ def test_synthetic():
   assert  numpy.allclose(v_cxx, v_py, atol=1e-15)
 
 
+def test_threads():
+
+  # The row-band parallel solver must give the very same results as the
+  # serial one, for both flow estimators
+  N = 50
+  alpha = 1.5
+
+  numpy.random.seed(0)
+  i1, i2, i3 = [numpy.random.rand(37, 23) for k in range(3)]
+
+  serial = VanillaFlow(i1.shape)
+  nose.tools.eq_(serial.threads, 1)
+  u_ref, v_ref = serial.estimate(alpha, N, i1, i2)
+  parallel = VanillaFlow(i1.shape)
+  parallel.threads = 3
+  nose.tools.eq_(parallel.threads, 3)
+  u, v = parallel.estimate(alpha, N, i1, i2)
+  assert numpy.array_equal(u, u_ref)
+  assert numpy.array_equal(v, v_ref)
+
+  serial = Flow(i1.shape)
+  u_ref, v_ref = serial.estimate(alpha, N, i1, i2, i3)
+  parallel = Flow(i1.shape)
+  parallel.threads = 4
+  u, v = parallel.estimate(alpha, N, i1, i2, i3)
+  assert numpy.array_equal(u, u_ref)
+  assert numpy.array_equal(v, v_ref)
+
+
+def test_sor():
+
+  # The SOR solver converges to the same flow as the Jacobi iterations, but
+  # in a fraction of the sweeps
+  N = 200
+  alpha = 1.5
+
+  i1, i2, i3 = make_image_tripplet()
+
+  flow = VanillaFlow(i1.shape)
+  u_ref, v_ref = flow.estimate(alpha, 50000, i1, i2)
+  u_jac, v_jac = flow.estimate(alpha, N, i1, i2)
+  u_sor, v_sor = flow.estimate(alpha, N, i1, i2, solver='sor')
+  assert abs(u_sor - u_ref).max() < 0.1 * abs(u_jac - u_ref).max()
+  assert abs(v_sor - v_ref).max() < 0.1 * abs(v_jac - v_ref).max()
+  u_sor, v_sor = flow.estimate(alpha, 2000, i1, i2, solver='sor', omega=1.5)
+  assert numpy.allclose(u_sor, u_ref, atol=1e-10)
+  assert numpy.allclose(v_sor, v_ref, atol=1e-10)
+
+  flow = Flow(i1.shape)
+  u_ref, v_ref = flow.estimate(alpha, 50000, i1, i2, i3)
+  u_sor, v_sor = flow.estimate(alpha, N, i1, i2, i3, solver='sor')
+  assert numpy.allclose(u_sor, u_ref, atol=1e-10)
+  assert numpy.allclose(v_sor, v_ref, atol=1e-10)
+
+  # multi-colour sweeps are independent of the number of threads
+  flow.threads = 3
+  u, v = flow.estimate(alpha, N, i1, i2, i3, solver='sor')
+  assert numpy.array_equal(u, u_sor)
+  assert numpy.array_equal(v, v_sor)
+
+  nose.tools.assert_raises(ValueError, flow.estimate, alpha, N, i1, i2, i3,
+      solver='sor', omega=2.)
+  nose.tools.assert_raises(ValueError, flow.estimate, alpha, N, i1, i2, i3,
+      solver='newton')
+
+def test_multigrid():
+
+  # The multigrid solver converges to the same flow as the Jacobi
+  # iterations in a couple dozen cycles
+  alpha = 1.5
+
+  i1, i2, i3 = make_image_tripplet()
+
+  flow = VanillaFlow(i1.shape)
+  nose.tools.eq_(flow.cycle, 1)
+  nose.tools.eq_(flow.smoothing, (2, 2))
+  u_ref, v_ref = flow.estimate(alpha, 50000, i1, i2)
+  u, v = flow.estimate(alpha, 20, i1, i2, solver='multigrid')
+  assert numpy.allclose(u, u_ref, atol=1e-10)
+  assert numpy.allclose(v, v_ref, atol=1e-10)
+
+  flow = Flow(i1.shape)
+  u_ref, v_ref = flow.estimate(alpha, 50000, i1, i2, i3)
+  u_mg, v_mg = flow.estimate(alpha, 30, i1, i2, i3, solver='multigrid')
+  assert numpy.allclose(u_mg, u_ref, atol=1e-8)
+  assert numpy.allclose(v_mg, v_ref, atol=1e-8)
+
+  # cycles are independent of the number of threads
+  flow.threads = 3
+  u, v = flow.estimate(alpha, 30, i1, i2, i3, solver='multigrid')
+  assert numpy.array_equal(u, u_mg)
+  assert numpy.array_equal(v, v_mg)
+
+  # W-cycles with more smoothing converge as well
+  flow.cycle = 2
+  flow.smoothing = (3, 3)
+  nose.tools.eq_(flow.smoothing, (3, 3))
+  u, v = flow.estimate(alpha, 30, i1, i2, i3, solver='multigrid')
+  assert numpy.allclose(u, u_ref, atol=1e-8)
+  assert numpy.allclose(v, v_ref, atol=1e-8)
+
+  def set_cycle(value): flow.cycle = value
+  nose.tools.assert_raises(ValueError, set_cycle, 0)
+
+def test_tolerance():
+
+  # With a tolerance, iterations is only an upper bound and the number of
+  # iterations actually run is returned along with the flow
+  alpha = 1.5
+  N = 5000
+
+  i1, i2, i3 = make_image_tripplet()
+
+  for flow, images in ((VanillaFlow(i1.shape), (i1, i2)),
+      (Flow(i1.shape), (i1, i2, i3))):
+    u_ref, v_ref = flow.estimate(alpha, 50000, *images)
+    for solver in ('jacobi', 'sor', 'multigrid'):
+      u, v, n = flow.estimate(alpha, N, *images, solver=solver,
+          tolerance=1e-10)
+      assert 0 < n < N
+      assert numpy.allclose(u, u_ref, atol=1e-6)
+      assert numpy.allclose(v, v_ref, atol=1e-6)
+
+      # the stopping decision does not depend on the number of threads
+      flow.threads = 3
+      u3, v3, n3 = flow.estimate(alpha, N, *images, solver=solver,
+          tolerance=1e-10)
+      flow.threads = 1
+      nose.tools.eq_(n3, n)
+      assert numpy.array_equal(u3, u)
+      assert numpy.array_equal(v3, v)
+
+    # a zero tolerance runs all iterations
+    u, v, n = flow.estimate(alpha, 10, *images, tolerance=0.)
+    nose.tools.eq_(n, 10)
+
+    nose.tools.assert_raises(ValueError, flow.estimate, alpha, N, *images,
+        tolerance=-1.)
+
+
+def test_simd():
+
+  # All instruction sets must produce exactly the same gradients and flows
+  numpy.random.seed(0)
+  i1, i2, i3 = [numpy.random.rand(19, 29) for k in range(3)]
+
+  supported = supported_simd()
+  nose.tools.eq_(supported[0], 'scalar')
+  assert get_simd() in supported
+  nose.tools.assert_raises(ValueError, set_simd, 'mmx')
+
+  best = get_simd()
+  results = []
+  try:
+    for simd in supported:
+      set_simd(simd)
+      nose.tools.eq_(get_simd(), simd)
+      r = list(HornAndSchunckGradient(i1.shape)(i1, i2))
+      r += list(SobelGradient(i1.shape)(i1, i2, i3))
+      r.append(laplacian_avg_hs(i1))
+      r += list(VanillaFlow(i1.shape).estimate(1.5, 20, i1, i2))
+      r += list(Flow(i1.shape).estimate(1.5, 20, i1, i2, i3))
+      results.append(r)
+  finally:
+    set_simd(best)
+
+  for r in results[1:]:
+    for a, b in zip(r, results[0]):
+      assert numpy.array_equal(a, b)
+
+
+def test_tiling():
+
+  # Cache-blocked Jacobi iterations give exactly the untiled flow
+  numpy.random.seed(0)
+  images = [255 * numpy.random.rand(37, 23) for k in range(3)]
+  alpha = 20.
+
+  for flow, n in ((VanillaFlow(images[0].shape), 2),
+      (Flow(images[0].shape), 3)):
+    nose.tools.eq_(flow.tiling, (32, 1))
+    u_ref, v_ref = flow.estimate(alpha, 25, *images[:n])
+    u_tol, v_tol, n_tol = flow.estimate(alpha, 500, *images[:n],
+        solver='jacobi', omega=0., tolerance=1e-3)
+    for tiling in ((1, 2), (5, 4), (8, 7), (100, 3)):
+      flow.tiling = tiling
+      nose.tools.eq_(flow.tiling, tiling)
+      for threads in (1, 3):
+        flow.threads = threads
+        u, v = flow.estimate(alpha, 25, *images[:n])
+        assert numpy.array_equal(u, u_ref)
+        assert numpy.array_equal(v, v_ref)
+        u, v, k = flow.estimate(alpha, 500, *images[:n], solver='jacobi',
+            omega=0., tolerance=1e-3)
+        nose.tools.eq_(k, n_tol)
+        assert numpy.array_equal(u, u_tol)
+        assert numpy.array_equal(v, v_tol)
+    flow.threads = 1
+
+    def set_tiling(value):
+      flow.tiling = value
+    nose.tools.assert_raises(ValueError, set_tiling, (0, 2))
+    nose.tools.assert_raises(ValueError, set_tiling, (4, 0))
+
+
+def test_packed():
+
+  # Packing the gradients and coefficients in per-row records does not
+  # change the flow, whatever the solver
+  numpy.random.seed(0)
+  images = [255 * numpy.random.rand(37, 23) for k in range(3)]
+  alpha = 20.
+
+  for flow, n in ((VanillaFlow(images[0].shape), 2),
+      (Flow(images[0].shape), 3)):
+    assert not flow.packed
+    for solver in ('jacobi', 'sor', 'multigrid'):
+      flow.packed = False
+      u_ref, v_ref = flow.estimate(alpha, 10, *images[:n], solver=solver)
+      flow.packed = True
+      assert flow.packed
+      u, v = flow.estimate(alpha, 10, *images[:n], solver=solver)
+      assert numpy.array_equal(u, u_ref)
+      assert numpy.array_equal(v, v_ref)
+
+
+def test_float32():
+
+  # The single precision pipeline keeps the data type and stays close to the
+  # double precision one
+  numpy.random.seed(0)
+  images = [255 * numpy.random.rand(19, 29) for k in range(3)]
+  images32 = [k.astype('float32') for k in images]
+  alpha = 200.
+
+  for cls, n in ((VanillaFlow, 2), (Flow, 3)):
+    flow = cls(images[0].shape)
+    flow32 = cls(images[0].shape, dtype='float32')
+    nose.tools.eq_(flow.dtype, numpy.float64)
+    nose.tools.eq_(flow32.dtype, numpy.float32)
+    nose.tools.assert_raises(TypeError, flow32.estimate, alpha, 10,
+        *images[:n])
+    for solver in ('jacobi', 'sor', 'multigrid'):
+      u, v = flow.estimate(alpha, 20, *images[:n], solver=solver)
+      u32, v32 = flow32.estimate(alpha, 20, *images32[:n], solver=solver)
+      nose.tools.eq_(u32.dtype, numpy.float32)
+      nose.tools.eq_(v32.dtype, numpy.float32)
+      assert numpy.allclose(u32, u, atol=1e-4)
+      assert numpy.allclose(v32, v, atol=1e-4)
+    e32 = flow32.eval_ec2(u32, v32)
+    nose.tools.eq_(e32.dtype, numpy.float32)
+
+  g = HornAndSchunckGradient(images[0].shape, dtype='float32')
+  for e32, e in zip(g(*images32[:2]),
+      HornAndSchunckGradient(images[0].shape)(*images[:2])):
+    nose.tools.eq_(e32.dtype, numpy.float32)
+    assert numpy.allclose(e32, e, atol=1e-3)
+
+  l32 = laplacian_avg_hs(images32[0])
+  nose.tools.eq_(l32.dtype, numpy.float32)
+  assert numpy.allclose(l32, laplacian_avg_hs(images[0]), atol=1e-3)
+
+  nose.tools.assert_raises(TypeError, VanillaFlow, images[0].shape,
+      dtype='int32')
+
+
+def test_integer():
+
+  # The flow of 8-bit images is that of the same images in floating point
+  numpy.random.seed(0)
+  images = [numpy.random.randint(0, 256, (19, 29)).astype('uint8')
+      for k in range(3)]
+  alpha = 200.
+
+  for cls, n in ((VanillaFlow, 2), (Flow, 3)):
+    flow = cls(images[0].shape)
+    u, v = flow.estimate(alpha, 20, *images[:n])
+    ud, vd = flow.estimate(alpha, 20,
+        *[k.astype('float64') for k in images[:n]])
+    assert numpy.array_equal(u, ud)
+    assert numpy.array_equal(v, vd)
+    nose.tools.assert_raises(TypeError, flow.estimate, alpha, 20,
+        *([images[0].astype('uint16')] + images[1:n]))
+    flow.normalize = True
+    u, v = flow.estimate(alpha / 255., 20, *images[:n])
+    assert numpy.allclose(u, ud, atol=1e-6)
+    assert numpy.allclose(v, vd, atol=1e-6)
+
+def test_rgb():
+
+  # The flow of 8-bit RGB images is that of their luma
+  numpy.random.seed(0)
+  images = [numpy.random.randint(0, 256, (19, 29, 3)).astype('uint8')
+      for k in range(3)]
+  gray = [0.299 * k[..., 0] + 0.587 * k[..., 1] + 0.114 * k[..., 2]
+      for k in images]
+  alpha = 200.
+
+  for cls, n in ((VanillaFlow, 2), (Flow, 3)):
+    flow = cls(gray[0].shape)
+    u, v = flow.estimate(alpha, 20, *images[:n])
+    ug, vg = flow.estimate(alpha, 20, *gray[:n])
+    assert u.shape == ug.shape
+    assert numpy.allclose(u, ug)
+    assert numpy.allclose(v, vg)
+    nose.tools.assert_raises(TypeError, flow.estimate, alpha, 20,
+        *([gray[0]] + images[1:n]))
+
+def test_sequence():
+
+  # The flows of a stack of frames are those estimated pair by pair (or
+  # triplet by triplet), each starting from the previous one unless warm
+  # starts are disabled
+  numpy.random.seed(0)
+  frames = numpy.random.rand(6, 19, 23)
+  alpha = 200.
+
+  for cls, n in ((VanillaFlow, 2), (Flow, 3)):
+    flow = cls(frames.shape[1:])
+    for warm in (True, False):
+      flow.threads = 1 if warm else 3
+      u, v = flow.estimate_sequence(alpha, 10, frames, warm=warm)
+      assert u.shape == (len(frames) - n + 1,) + frames.shape[1:]
+      ue = numpy.zeros(frames.shape[1:])
+      ve = numpy.zeros(frames.shape[1:])
+      for k in range(len(u)):
+        if not warm: ue[:] = 0; ve[:] = 0
+        flow.estimate(alpha, 10, *frames[k:k+n], u=ue, v=ve)
+        assert numpy.array_equal(u[k], ue)
+        assert numpy.array_equal(v[k], ve)
+    nose.tools.assert_raises(RuntimeError, flow.estimate_sequence, alpha, 10,
+        frames[:n-1])
+
+def test_concurrent():
+
+  # One estimator shared by several threads gives the same flows as when the
+  # calls are made one after the other
+  import threading
+  numpy.random.seed(0)
+  images = [numpy.random.rand(31, 37) for k in range(8)]
+  alpha = 200.
+
+  for cls, n in ((VanillaFlow, 2), (Flow, 3)):
+    for solver in ('jacobi', 'sor', 'multigrid'):
+      flow = cls(images[0].shape)
+      flow.threads = 2
+      expected = [flow.estimate(alpha, 10, *images[k:k+n], solver=solver)
+          for k in range(len(images) - n + 1)]
+      results = [None] * len(expected)
+      def run(k):
+        for repeat in range(5):
+          results[k] = flow.estimate(alpha, 10, *images[k:k+n], solver=solver)
+      threads = [threading.Thread(target=run, args=(k,))
+          for k in range(len(expected))]
+      for t in threads: t.start()
+      for t in threads: t.join()
+      for (u, v), (ue, ve) in zip(results, expected):
+        assert numpy.array_equal(u, ue)
+        assert numpy.array_equal(v, ve)
+
+def test_out():
+
+  # Results are written in the arrays passed as `out', and the arrays
+  # returned otherwise are reused once dropped
+  from . import laplacian_avg_hs_opencv, flow_error
+  numpy.random.seed(0)
+  images = [numpy.random.rand(19, 23) for k in range(3)]
+  u, v = [numpy.random.rand(19, 23) for k in range(2)]
+  out = numpy.empty_like(u)
+  address = lambda a: a.__array_interface__['data'][0]
+
+  for function in (laplacian_avg_hs, laplacian_avg_hs_opencv):
+    function(u, out=out)
+    assert numpy.array_equal(out, function(u))
+  flow_error(images[0], images[1], u, v, out=out)
+  assert numpy.array_equal(out, flow_error(images[0], images[1], u, v))
+  for overlapping in (images[0], u):
+    nose.tools.assert_raises(ValueError, flow_error, images[0], images[1],
+        u, v, out=overlapping)
+  nose.tools.assert_raises(RuntimeError, laplacian_avg_hs, u, out=out[1:])
+  shifted = numpy.zeros((20, 23))
+  for function in (laplacian_avg_hs, laplacian_avg_hs_opencv):
+    nose.tools.assert_raises(ValueError, function, u, out=u)
+    nose.tools.assert_raises(ValueError, function, shifted[:-1],
+        out=shifted[1:])
+    function(shifted[:-1], out=numpy.empty_like(u)) #no overlap
+
+  for cls, n in ((VanillaFlow, 2), (Flow, 3)):
+    flow = cls(u.shape)
+    flow.eval_ec2(u, v, out=out)
+    assert numpy.array_equal(out, flow.eval_ec2(u, v))
+    flow.eval_eb(*(images[:n] + [u, v]), out=out)
+    assert numpy.array_equal(out, flow.eval_eb(*(images[:n] + [u, v])))
+    nose.tools.assert_raises(TypeError, flow.eval_ec2, u, v,
+        out=out.astype('float32'))
+    kept = flow.estimate(200., 5, *images[:n])
+    dropped = set(address(a) for a in flow.estimate(200., 5, *images[:n]))
+    assert not dropped & set(address(a) for a in kept)
+    assert dropped == set(address(a) for a in flow.estimate(200., 5, *images[:n]))
+
+  grad = SobelGradient(u.shape)
+  for image in images: grad.push(image)
+  dropped = set(address(a) for a in grad.push(images[0]))
+  assert dropped == set(address(a) for a in grad.push(images[1]))
+
+
+def test_async():
+
+  # Flows estimated in the background are those estimated right away
+  import asyncio
+  numpy.random.seed(0)
+  images = [numpy.random.rand(19, 23) for k in range(3)]
+
+  for cls, n in ((VanillaFlow, 2), (Flow, 3)):
+    flow = cls(images[0].shape)
+    futures = [flow.estimate_async(200., 10, *images[:n]),
+        flow.estimate_async(200., 100, *images[:n], solver='sor',
+          tolerance=1e-6)]
+    u, v = flow.estimate(200., 10, *images[:n])
+    u_async, v_async = futures[0].result()
+    assert numpy.array_equal(u, u_async)
+    assert numpy.array_equal(v, v_async)
+    assert len(futures[1].result()) == 3
+    flow.threads = 2 #not busy anymore
+    nose.tools.assert_raises(RuntimeError, flow.estimate_async, 200., 10,
+        *[k[1:] for k in images[:n]])
+
+    async def estimate():
+      return await flow.estimate_awaitable(200., 10, *images[:n])
+    loop = asyncio.new_event_loop()
+    try:
+      u_async, v_async = loop.run_until_complete(estimate())
+    finally:
+      loop.close()
+    assert numpy.array_equal(u, u_async)
+    assert numpy.array_equal(v, v_async)
+
+
 #TODO: When enabaling this test, import bob.io.base and bob.io.image
 #TODO: This includes making this package dependent on bob.io.base and bob.io.image
 @nose.tools.nottest
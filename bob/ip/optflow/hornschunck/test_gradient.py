@@ -11,7 +11,9 @@
 
 import numpy
 import scipy.signal
-from . import HornAndSchunckGradient, SobelGradient
+import nose.tools
+from . import HornAndSchunckGradient, SobelGradient, ForwardGradient, \
+    CentralGradient
 
 def make_image_pair_1():
   """Creates two images for you to calculate the flow
@@ -179,6 +181,37 @@ def Central_Et(im1, im2, im3):
 
   return c3 - c1
 
+def Forward_Generic(d, a, im1, im2):
+  """Calculates Ex, Ey and Et of a forward operator with any kernels"""
+
+  def terms(im):
+    p = numpy.pad(im.astype('float64'), ((0, 1), (0, 1)), 'edge')
+    p00, p01, p10, p11 = p[:-1,:-1], p[:-1,1:], p[1:,:-1], p[1:,1:]
+    diff = lambda n, c: d[0]*n + d[1]*c
+    avg = lambda n, c: a[0]*n + a[1]*c
+    return (avg(diff(p11, p10), diff(p01, p00)),
+        avg(diff(p11, p01), diff(p10, p00)),
+        avg(avg(p11, p10), avg(p01, p00)))
+
+  (x1, y1, t1), (x2, y2, t2) = terms(im1), terms(im2)
+  return a[1]*x1 + a[0]*x2, a[1]*y1 + a[0]*y2, d[1]*t1 + d[0]*t2
+
+def Central_Generic(d, a, im1, im2, im3):
+  """Calculates Ex, Ey and Et of a central operator with any kernels"""
+
+  d = numpy.array(d, 'float64')
+  a = numpy.array(a, 'float64')
+
+  def conv(K):
+    return [scipy.signal.convolve2d(im.astype('float64'), K, 'same', 'symm')
+        for im in (im1, im2, im3)]
+
+  cx, cy, ct = conv(numpy.outer(a, d)), conv(numpy.outer(d, a)), \
+      conv(numpy.outer(a, a))
+  return (a[2]*cx[0] + a[1]*cx[1] + a[0]*cx[2],
+      a[2]*cy[0] + a[1]*cy[1] + a[0]*cy[2],
+      d[2]*ct[0] + d[1]*ct[1] + d[0]*ct[2])
+
 def test_HornAndSchunckCxxAgainstPythonSynthetic():
 
   i1, i2 = make_image_pair_1()
@@ -201,6 +234,20 @@ def test_HornAndSchunckCxxAgainstPythonSynthetic():
   assert numpy.array_equal(ey_cxx, ey_python)
   assert numpy.array_equal(et_cxx, et_python)
 
+def test_HornAndSchunckCxxAgainstPythonRandom():
+
+  # large enough for several pixels to be processed per instruction, with
+  # contiguous and strided images
+  numpy.random.seed(0)
+  i1 = numpy.random.uniform(0, 255, (23, 82))
+  i2 = numpy.random.uniform(0, 255, (23, 82))
+  for j1, j2 in ((i1[:,:41].copy(), i2[:,:41].copy()), (i1[:,::2], i2[:,::2])):
+    grad = HornAndSchunckGradient(j1.shape)
+    ex_cxx, ey_cxx, et_cxx = grad(j1, j2)
+    assert numpy.allclose(ex_cxx, Forward_Ex(j1, j2))
+    assert numpy.allclose(ey_cxx, Forward_Ey(j1, j2))
+    assert numpy.allclose(et_cxx, Forward_Et(j1, j2))
+
 def test_SobelCxxAgainstPythonSynthetic():
 
   i1, i2, i3 = make_image_tripplet_1()
@@ -212,3 +259,177 @@ def test_SobelCxxAgainstPythonSynthetic():
   assert numpy.array_equal(ex_cxx, ex_python)
   assert numpy.array_equal(ey_cxx, ey_python)
   assert numpy.array_equal(et_cxx, et_python)
+
+def test_SobelCxxAgainstPythonRandom():
+
+  numpy.random.seed(0)
+  i1 = numpy.random.uniform(0, 255, (23, 82))
+  i2 = numpy.random.uniform(0, 255, (23, 82))
+  i3 = numpy.random.uniform(0, 255, (23, 82))
+  for j1, j2, j3 in ((i1[:,:41].copy(), i2[:,:41].copy(), i3[:,:41].copy()),
+      (i1[:,::2], i2[:,::2], i3[:,::2])):
+    grad = SobelGradient(j1.shape)
+    ex_cxx, ey_cxx, et_cxx = grad(j1, j2, j3)
+    assert numpy.allclose(ex_cxx, Central_Ex(j1, j2, j3))
+    assert numpy.allclose(ey_cxx, Central_Ey(j1, j2, j3))
+    assert numpy.allclose(et_cxx, Central_Et(j1, j2, j3))
+
+def test_generic():
+
+  # kernels other than the built-in ones take the generic path, which gives
+  # the same results as the specialised one
+  numpy.random.seed(0)
+  i1, i2, i3 = [numpy.random.uniform(0, 255, (23, 82)) for k in range(3)]
+
+  d, a = [0.3, -0.5], [0.7, 1.2]
+  grad = ForwardGradient(d, a, i1.shape)
+  for p, e in zip(grad(i1, i2), Forward_Generic(d, a, i1, i2)):
+    assert numpy.allclose(p, e)
+  grad.difference = [0.5, -0.5] #twice that of Horn & Schunck, which is exact
+  grad.average = [1., 1.]
+  for p, e in zip(grad(i1, i2), HornAndSchunckGradient(i1.shape)(i1, i2)):
+    assert numpy.array_equal(p, 2*e)
+
+  d, a = [0.5, 0.25, -1.], [0.3, 1.5, 0.8]
+  grad = CentralGradient(d, a, i1.shape)
+  for p, e in zip(grad(i1, i2, i3), Central_Generic(d, a, i1, i2, i3)):
+    assert numpy.allclose(p, e)
+  sobel = SobelGradient(i1.shape)(i1, i2, i3)
+  grad.difference = [2., 0., -2.] #twice that of Sobel
+  grad.average = [1., 2., 1.]
+  for p, e in zip(grad(i1, i2, i3), sobel):
+    assert numpy.array_equal(p, 2*e)
+  grad.difference = [1., 0., -1.]
+  for p, e in zip(grad(i1, i2, i3), sobel):
+    assert numpy.array_equal(p, e)
+
+def test_push():
+
+  numpy.random.seed(0)
+  frames = [numpy.random.uniform(0, 255, (23, 41)) for k in range(6)]
+  for grad, n in ((HornAndSchunckGradient(frames[0].shape), 2),
+      (SobelGradient(frames[0].shape), 3)):
+    for k, frame in enumerate(frames):
+      pushed = grad.push(frame)
+      assert grad.pushed == k + 1
+      if k + 1 < n:
+        assert pushed is None
+        continue
+      expected = grad.evaluate(*frames[k+1-n:k+1])
+      for p, e in zip(pushed, expected):
+        assert numpy.array_equal(p, e)
+    grad.reset()
+    assert grad.pushed == 0
+    assert grad.push(frames[0]) is None
+
+def test_integer():
+
+  # 8-bit and 16-bit frames give the gradients of the same frames in floating
+  # point, or of the frames divided by 255 or 65535 if they are normalised
+  numpy.random.seed(0)
+  for dtype in ('uint8', 'uint16'):
+    top = numpy.iinfo(dtype).max
+    frames = [numpy.random.randint(0, top + 1, (23, 41)).astype(dtype)
+        for k in range(3)]
+    for grad, n in ((HornAndSchunckGradient(frames[0].shape), 2),
+        (SobelGradient(frames[0].shape), 3)):
+      assert not grad.normalize
+      for p, e in zip(grad(*frames[:n]),
+          grad(*[f.astype('float64') for f in frames[:n]])):
+        assert numpy.array_equal(p, e)
+      grad.normalize = True
+      normalised = grad(*[f / float(top) for f in frames[:n]])
+      for p, e in zip(grad(*frames[:n]), normalised):
+        assert numpy.allclose(p, e)
+      for frame in frames[:n]:
+        pushed = grad.push(frame)
+      for p, e in zip(pushed, grad(*frames[:n])):
+        assert numpy.array_equal(p, e)
+
+def test_rgb():
+
+  # 8-bit RGB frames, planar or interleaved, give the gradients of their luma
+  numpy.random.seed(0)
+  frames = [numpy.random.randint(0, 256, (3, 23, 41)).astype('uint8')
+      for k in range(3)]
+  gray = [0.299 * f[0] + 0.587 * f[1] + 0.114 * f[2] for f in frames]
+  interleaved = [numpy.ascontiguousarray(f.transpose(1, 2, 0)) for f in frames]
+  for grad, n in ((HornAndSchunckGradient(gray[0].shape), 2),
+      (SobelGradient(gray[0].shape), 3)):
+    expected = grad(*gray[:n])
+    for p, e in zip(grad(*frames[:n]), expected):
+      assert p.shape == e.shape
+      assert numpy.allclose(p, e)
+    for p, e in zip(grad(*interleaved[:n]), expected):
+      assert numpy.allclose(p, e)
+    for frame in interleaved[:n]:
+      pushed = grad.push(frame)
+    for p, e in zip(pushed, expected):
+      assert numpy.allclose(p, e)
+    nose.tools.assert_raises(TypeError, grad, *[f.astype('uint16') for f in
+      frames[:n]])
+    nose.tools.assert_raises(RuntimeError, grad, *[f[:2] for f in
+      frames[:n]])
+
+def test_threads():
+
+  # the gradients computed over row bands are those of a serial evaluation
+  numpy.random.seed(0)
+  frames = [numpy.random.uniform(0, 255, (37, 41)) for k in range(4)]
+  for grad, n in ((HornAndSchunckGradient(frames[0].shape), 2),
+      (SobelGradient(frames[0].shape), 3)):
+    assert grad.threads == 1
+    expected = grad(*frames[:n])
+    grad.threads = 4
+    assert grad.threads == 4
+    for p, e in zip(grad(*frames[:n]), expected):
+      assert numpy.array_equal(p, e)
+    for frame in frames[:n]:
+      pushed = grad.push(frame)
+    for p, e in zip(pushed, expected):
+      assert numpy.array_equal(p, e)
+    nose.tools.assert_raises(ValueError, setattr, grad, 'threads', -1)
+
+def test_strided():
+
+  # crops, channels, reversed and Fortran-ordered views are read in place,
+  # with the gradients of their contiguous copies
+  numpy.random.seed(0)
+  frames = [numpy.random.uniform(0, 255, (31, 45, 3)) for k in range(3)]
+  views = (
+      [f[2:25, 3:40, 0] for f in frames],
+      [f[::-1, ::-2, 1] for f in frames],
+      [numpy.asfortranarray(f[:23, :37, 2]) for f in frames],
+      [f.astype('uint8')[:23, :37, 1] for f in frames],
+      [f[:37, :23, :].astype('uint8').transpose(1, 0, 2) for f in frames],
+      )
+  for view in views:
+    copies = [numpy.ascontiguousarray(f) for f in view]
+    shape = copies[0].shape[:2]
+    for grad, n in ((HornAndSchunckGradient(shape), 2),
+        (SobelGradient(shape), 3)):
+      expected = grad(*copies[:n])
+      for p, e in zip(grad(*view[:n]), expected):
+        assert numpy.array_equal(p, e)
+
+  # numpy reports the copies it makes to tracemalloc: aligned views are not
+  # copied, while views with odd byte strides are
+  import tracemalloc
+  from numpy.lib.stride_tricks import as_strided
+  buffers = [numpy.random.uniform(0, 255, 2 * 120 * 160) for k in range(3)]
+  in_place = [numpy.asfortranarray(b[:120*160].reshape(120, 160))
+      for b in buffers]
+  odd = [as_strided(b, shape=(120, 160), strides=(160 * 12, 12))
+      for b in buffers]
+  grad = SobelGradient((120, 160))
+  for view, copied in ((in_place, False), (odd, True)):
+    expected = grad(*[numpy.ascontiguousarray(f) for f in view])
+    tracemalloc.start()
+    try:
+      result = grad(*view)
+      peak = tracemalloc.get_traced_memory()[1]
+    finally:
+      tracemalloc.stop()
+    assert (peak >= view[0].nbytes) == copied
+    for p, e in zip(result, expected):
+      assert numpy.array_equal(p, e)
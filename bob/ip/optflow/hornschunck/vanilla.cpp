@@ -7,6 +7,10 @@
  * Copyright (C) 2011-2014 Idiap Research Institute, Martigny, Switzerland
  */
 
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
 #include <bob.blitz/cppapi.h>
 #include <bob.blitz/cleanup.h>
 #include <bob.extension/documentation.h>
@@ -14,6 +18,27 @@
 
 #include "HornAndSchunckFlow.h"
 
+extern bool PyBobIpOptflowImage_Check(PyBlitzArrayObject* image,
+    int type_num);
+extern bool PyBobIpOptflowImage_Matches(PyBlitzArrayObject* image,
+    Py_ssize_t height, Py_ssize_t width);
+extern int PyBobIpOptflowImage_Converter(PyObject* o,
+    PyBlitzArrayObject** a);
+extern bool PyBobIpOptflowObject_Idle(PyObject* self, Py_ssize_t busy,
+    const char* attribute);
+extern PyBlitzArrayObject* PyBobIpOptflowArray_Recycle(PyObject** pool,
+    int type_num, Py_ssize_t ndim, Py_ssize_t* shape);
+extern PyObject* PyBobIpOptflowAsync_Submit(PyObject* owner, Py_ssize_t* busy,
+    const std::vector<PyObject*>& pinned, std::function<void()> compute,
+    std::function<PyObject*()> result, const char* what);
+extern bool PyBobIpOptflowStack_Check(PyBlitzArrayObject* stack,
+    int type_num);
+extern bool PyBobIpOptflowStack_Matches(PyBlitzArrayObject* stack,
+    Py_ssize_t height, Py_ssize_t width);
+
+extern int PyBobIpOptflowSolver_Converter(PyObject* o,
+    bob::ip::optflow::Solver::Type* solver);
+
 /*************************************
  * Implementation of Flow base class *
  *************************************/
@@ -100,40 +125,76 @@ static auto s_flow = bob::extension::ClassDoc(
     "   \n"
     "   This is a dense flow estimator. The optical flow is computed for all "
     "pixels in the image.\n"
+    "\n"
+    "The estimation runs without holding the GIL, so that one estimator may "
+    "be shared by several Python threads, each estimating its own flows at "
+    "the same time. Its attributes cannot be set while it does so.\n"
     )
     .add_constructor(
         bob::extension::FunctionDoc(
           CLASS_NAME,
           "Initializes the functor with the sizes of images to be treated."
           )
-        .add_prototype("(height, width)", "")
+        .add_prototype("(height, width), [dtype]", "")
         .add_parameter("(height, width)", "tuple", "the height and width of images to be fed into the the flow estimator")
+        .add_parameter("dtype", ":py:class:`numpy.dtype` or dtype-like", "the scalar type of the images and flows this estimator works with, either ``float64`` (the default) or ``float32``. In single precision, the frames, gradients and flows take half the memory and bandwidth, and the kernels process twice as many pixels per instruction.")
         )
     ;
 
 
 typedef struct {
   PyObject_HEAD
-  bob::ip::optflow::VanillaHornAndSchunckFlow* cxx;
+  int type_num;
+  bob::ip::optflow::VanillaHornAndSchunckFlow<double>* cxx;
+  bob::ip::optflow::VanillaHornAndSchunckFlow<float>* cxx32;
+  Py_ssize_t busy; //number of calls running without the GIL
+  PyObject* recycled; //arrays returned so far, see PyBobIpOptflowArray_Recycle()
 } PyBobIpOptflowVanillaHornAndSchunckObject;
 
 
+/**
+ * Returns the shape of the estimator, whatever its scalar type
+ */
+static const blitz::TinyVector<int,2>& PyBobIpOptflowVanillaHornAndSchunck_shape
+(PyBobIpOptflowVanillaHornAndSchunckObject* self) {
+  return self->cxx32 ? self->cxx32->getShape() : self->cxx->getShape();
+}
+
+/**
+ * Returns the multigrid solver of the estimator, whatever its scalar type
+ */
+static bob::ip::optflow::MultigridSolver& PyBobIpOptflowVanillaHornAndSchunck_multigrid
+(PyBobIpOptflowVanillaHornAndSchunckObject* self) {
+  return self->cxx32 ? self->cxx32->getMultigrid() :
+    self->cxx->getMultigrid();
+}
+
 static int PyBobIpOptflowVanillaHornAndSchunck_init
 (PyBobIpOptflowVanillaHornAndSchunckObject* self, PyObject* args, PyObject* kwds) {
 
   /* Parses input arguments in a single shot */
-  static const char* const_kwlist[] = {"shape", 0};
+  static const char* const_kwlist[] = {"shape", "dtype", 0};
   static char** kwlist = const_cast<char**>(const_kwlist);
 
   Py_ssize_t height, width;
+  int type_num = NPY_FLOAT64;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "(nn)|O&", kwlist,
+        &height, &width, &PyBlitzArray_TypenumConverter, &type_num)) return -1;
 
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "(nn)", kwlist,
-        &height, &width)) return -1;
+  if (type_num != NPY_FLOAT64 && type_num != NPY_FLOAT32) {
+    PyErr_Format(PyExc_TypeError, "`%s' only supports float64 or float32 as `dtype', not %s", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(type_num));
+    return -1;
+  }
 
   try {
     blitz::TinyVector<int,2> shape;
     shape(0) = height; shape(1) = width;
-    self->cxx = new bob::ip::optflow::VanillaHornAndSchunckFlow(shape);
+    if (type_num == NPY_FLOAT32)
+      self->cxx32 = new bob::ip::optflow::VanillaHornAndSchunckFlow<float>(shape);
+    else
+      self->cxx = new bob::ip::optflow::VanillaHornAndSchunckFlow<double>(shape);
+    self->type_num = type_num;
   }
   catch (std::exception& ex) {
     PyErr_SetString(PyExc_RuntimeError, ex.what());
@@ -151,7 +212,9 @@ static int PyBobIpOptflowVanillaHornAndSchunck_init
 static void PyBobIpOptflowVanillaHornAndSchunck_delete
 (PyBobIpOptflowVanillaHornAndSchunckObject* self) {
 
+  Py_XDECREF(self->recycled);
   delete self->cxx;
+  delete self->cxx32;
   Py_TYPE(self)->tp_free((PyObject*)self);
 
 }
@@ -164,12 +227,14 @@ static auto s_shape = bob::extension::VariableDoc(
 
 static PyObject* PyBobIpOptflowVanillaHornAndSchunck_getShape
 (PyBobIpOptflowVanillaHornAndSchunckObject* self, void* /*closure*/) {
-  auto shape = self->cxx->getShape();
+  auto shape = PyBobIpOptflowVanillaHornAndSchunck_shape(self);
   return Py_BuildValue("nn", shape(0), shape(1));
 }
 
 static int PyBobIpOptflowVanillaHornAndSchunck_setShape (PyBobIpOptflowVanillaHornAndSchunckObject* self, PyObject* o, void* /*closure*/) {
 
+  if (!PyBobIpOptflowObject_Idle((PyObject*)self, self->busy, "shape")) return -1;
+
   Py_ssize_t height = 0;
   Py_ssize_t width = 0;
 
@@ -178,7 +243,8 @@ static int PyBobIpOptflowVanillaHornAndSchunck_setShape (PyBobIpOptflowVanillaHo
   try {
     blitz::TinyVector<int,2> shape;
     shape(0) = height; shape(1) = width;
-    self->cxx->setShape(shape);
+    if (self->cxx32) self->cxx32->setShape(shape);
+    else self->cxx->setShape(shape);
   }
   catch (std::exception& ex) {
     PyErr_SetString(PyExc_RuntimeError, ex.what());
@@ -193,6 +259,219 @@ static int PyBobIpOptflowVanillaHornAndSchunck_setShape (PyBobIpOptflowVanillaHo
 
 }
 
+static auto s_threads = bob::extension::VariableDoc(
+    "threads",
+    ":py:class:`int`",
+    "The number of threads used to compute the gradients and run the iterations of this flow estimator",
+    "The gradients and each iteration are split in row bands which are updated in parallel. The estimated flow does not depend on this setting. Setting it to 0 uses all hardware threads available on the machine. The default is 1 (serial execution)."
+    );
+
+static PyObject* PyBobIpOptflowVanillaHornAndSchunck_getThreads
+(PyBobIpOptflowVanillaHornAndSchunckObject* self, void* /*closure*/) {
+  return Py_BuildValue("n", (self->cxx32 ? self->cxx32->getThreads() : self->cxx->getThreads()));
+}
+
+static int PyBobIpOptflowVanillaHornAndSchunck_setThreads (PyBobIpOptflowVanillaHornAndSchunckObject* self, PyObject* o, void* /*closure*/) {
+
+  if (!PyBobIpOptflowObject_Idle((PyObject*)self, self->busy, "threads")) return -1;
+
+  Py_ssize_t threads = PyNumber_AsSsize_t(o, PyExc_OverflowError);
+  if (PyErr_Occurred()) return -1;
+
+  if (threads < 0) {
+    PyErr_Format(PyExc_ValueError, "`threads' of %s must be zero or positive, not %" PY_FORMAT_SIZE_T "d", Py_TYPE(self)->tp_name, threads);
+    return -1;
+  }
+
+  try {
+    if (self->cxx32) self->cxx32->setThreads(threads);
+    else self->cxx->setThreads(threads);
+  }
+  catch (std::exception& ex) {
+    PyErr_SetString(PyExc_RuntimeError, ex.what());
+    return -1;
+  }
+  catch (...) {
+    PyErr_Format(PyExc_RuntimeError, "cannot reset `threads' of %s: unknown exception caught", Py_TYPE(self)->tp_name);
+    return -1;
+  }
+
+  return 0;
+
+}
+
+static auto s_cycle = bob::extension::VariableDoc(
+    "cycle",
+    ":py:class:`int`",
+    "The number of times each level visits the next coarser one during a cycle of the ``'multigrid'`` solver",
+    "1 (the default) makes V-cycles and 2 makes W-cycles. Must be at least 1."
+    );
+
+static PyObject* PyBobIpOptflowVanillaHornAndSchunck_getCycle
+(PyBobIpOptflowVanillaHornAndSchunckObject* self, void* /*closure*/) {
+  return Py_BuildValue("n", PyBobIpOptflowVanillaHornAndSchunck_multigrid(self).getCycle());
+}
+
+static int PyBobIpOptflowVanillaHornAndSchunck_setCycle (PyBobIpOptflowVanillaHornAndSchunckObject* self, PyObject* o, void* /*closure*/) {
+
+  if (!PyBobIpOptflowObject_Idle((PyObject*)self, self->busy, "cycle")) return -1;
+
+  Py_ssize_t cycle = PyNumber_AsSsize_t(o, PyExc_OverflowError);
+  if (PyErr_Occurred()) return -1;
+
+  if (cycle < 1) {
+    PyErr_Format(PyExc_ValueError, "`cycle' of %s must be at least 1, not %" PY_FORMAT_SIZE_T "d", Py_TYPE(self)->tp_name, cycle);
+    return -1;
+  }
+
+  try {
+    PyBobIpOptflowVanillaHornAndSchunck_multigrid(self).setCycle(cycle);
+  }
+  catch (std::exception& ex) {
+    PyErr_SetString(PyExc_RuntimeError, ex.what());
+    return -1;
+  }
+  catch (...) {
+    PyErr_Format(PyExc_RuntimeError, "cannot reset `cycle' of %s: unknown exception caught", Py_TYPE(self)->tp_name);
+    return -1;
+  }
+
+  return 0;
+
+}
+
+static auto s_smoothing = bob::extension::VariableDoc(
+    "smoothing",
+    "(int, int)",
+    "The number of Gauss-Seidel sweeps of the ``'multigrid'`` solver before and after each coarse correction (respectively)",
+    "The default is ``(2, 2)``."
+    );
+
+static PyObject* PyBobIpOptflowVanillaHornAndSchunck_getSmoothing
+(PyBobIpOptflowVanillaHornAndSchunckObject* self, void* /*closure*/) {
+  return Py_BuildValue("(nn)", PyBobIpOptflowVanillaHornAndSchunck_multigrid(self).getPreSmoothing(),
+      PyBobIpOptflowVanillaHornAndSchunck_multigrid(self).getPostSmoothing());
+}
+
+static int PyBobIpOptflowVanillaHornAndSchunck_setSmoothing (PyBobIpOptflowVanillaHornAndSchunckObject* self, PyObject* o, void* /*closure*/) {
+
+  if (!PyBobIpOptflowObject_Idle((PyObject*)self, self->busy, "smoothing")) return -1;
+
+  Py_ssize_t pre = 0;
+  Py_ssize_t post = 0;
+  if (!PyArg_ParseTuple(o, "nn", &pre, &post)) return -1;
+
+  if (pre < 0 || post < 0) {
+    PyErr_Format(PyExc_ValueError, "`smoothing' of %s must hold zero or positive values, not (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d)", Py_TYPE(self)->tp_name, pre, post);
+    return -1;
+  }
+
+  PyBobIpOptflowVanillaHornAndSchunck_multigrid(self).setPreSmoothing(pre);
+  PyBobIpOptflowVanillaHornAndSchunck_multigrid(self).setPostSmoothing(post);
+  return 0;
+
+}
+
+static auto s_tiling = bob::extension::VariableDoc(
+    "tiling",
+    "(int, int)",
+    "The number of rows of the tiles of the ``'jacobi'`` solver and the number of iterations run on each tile while it is in cache (respectively)",
+    "With a depth of 1 (the default), every iteration sweeps the whole frame. With a larger depth, the frame is cut in tiles of the given number of rows, and that many iterations are run on each tile (plus a halo of rows, recomputed by the neighbouring tiles) before moving on to the next one. This keeps the iterations fed from the cache on frames much larger than it. The estimated flow does not depend on this setting. Both values must be at least 1. The default is ``(32, 1)``."
+    );
+
+static PyObject* PyBobIpOptflowVanillaHornAndSchunck_getTiling
+(PyBobIpOptflowVanillaHornAndSchunckObject* self, void* /*closure*/) {
+  if (self->cxx32) return Py_BuildValue("(nn)", self->cxx32->getTileRows(),
+      self->cxx32->getTileDepth());
+  return Py_BuildValue("(nn)", self->cxx->getTileRows(),
+      self->cxx->getTileDepth());
+}
+
+static int PyBobIpOptflowVanillaHornAndSchunck_setTiling (PyBobIpOptflowVanillaHornAndSchunckObject* self, PyObject* o, void* /*closure*/) {
+
+  if (!PyBobIpOptflowObject_Idle((PyObject*)self, self->busy, "tiling")) return -1;
+
+  Py_ssize_t rows = 0;
+  Py_ssize_t depth = 0;
+  if (!PyArg_ParseTuple(o, "nn", &rows, &depth)) return -1;
+
+  if (rows < 1 || depth < 1) {
+    PyErr_Format(PyExc_ValueError, "`tiling' of %s must hold values of at least 1, not (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d)", Py_TYPE(self)->tp_name, rows, depth);
+    return -1;
+  }
+
+  if (self->cxx32) {
+    self->cxx32->setTileRows(rows);
+    self->cxx32->setTileDepth(depth);
+  }
+  else {
+    self->cxx->setTileRows(rows);
+    self->cxx->setTileDepth(depth);
+  }
+  return 0;
+
+}
+
+static auto s_packed = bob::extension::VariableDoc(
+    "packed",
+    "bool",
+    "Whether the gradients and the coefficients of the update are packed in per-row records",
+    "If set, a single buffer holds, for each image row, the rows of all gradients and coefficients the ``'jacobi'`` and ``'sor'`` solvers read, one after the other. The solvers then read one contiguous stream per image row instead of 5 separate planes, which is usually faster on large frames. The estimated flow does not depend on this setting. Defaults to ``False``."
+    );
+
+static PyObject* PyBobIpOptflowVanillaHornAndSchunck_getPacked
+(PyBobIpOptflowVanillaHornAndSchunckObject* self, void* /*closure*/) {
+  if (self->cxx32 ? self->cxx32->getPacked() : self->cxx->getPacked())
+    Py_RETURN_TRUE;
+  Py_RETURN_FALSE;
+}
+
+static int PyBobIpOptflowVanillaHornAndSchunck_setPacked
+(PyBobIpOptflowVanillaHornAndSchunckObject* self, PyObject* o, void* /*closure*/) {
+  if (!PyBobIpOptflowObject_Idle((PyObject*)self, self->busy, "packed")) return -1;
+  int packed = PyObject_IsTrue(o);
+  if (packed < 0) return -1;
+  if (self->cxx32) self->cxx32->setPacked(packed);
+  else self->cxx->setPacked(packed);
+  return 0;
+}
+
+static auto s_dtype = bob::extension::VariableDoc(
+    "dtype",
+    ":py:class:`numpy.dtype`",
+    "The scalar type of the flows this estimator works with, either ``float64`` or ``float32``",
+    "This attribute is read-only: it is set when the estimator is created. The images are either of this type, ``uint8`` or ``uint16``, or ``uint8`` RGB."
+    );
+
+static PyObject* PyBobIpOptflowVanillaHornAndSchunck_getDtype
+(PyBobIpOptflowVanillaHornAndSchunckObject* self, void* /*closure*/) {
+  return reinterpret_cast<PyObject*>(PyArray_DescrFromType(self->type_num));
+}
+
+static auto s_normalize = bob::extension::VariableDoc(
+    "normalize",
+    "bool",
+    "Whether ``uint8`` and ``uint16`` images are normalised to the range :math:`[0, 1]` before the flow is estimated",
+    "If set, the gradients of integer images are those of the images divided by the largest value of their type (255 or 65535), so ``alpha`` should be scaled accordingly. Images of type :py:attr:`dtype` are never scaled. Defaults to ``False``."
+    );
+
+static PyObject* PyBobIpOptflowVanillaHornAndSchunck_getNormalize
+(PyBobIpOptflowVanillaHornAndSchunckObject* self, void* /*closure*/) {
+  if (self->cxx32 ? self->cxx32->getNormalize() : self->cxx->getNormalize())
+    Py_RETURN_TRUE;
+  Py_RETURN_FALSE;
+}
+
+static int PyBobIpOptflowVanillaHornAndSchunck_setNormalize
+(PyBobIpOptflowVanillaHornAndSchunckObject* self, PyObject* o, void* /*closure*/) {
+  if (!PyBobIpOptflowObject_Idle((PyObject*)self, self->busy, "normalize")) return -1;
+  int normalize = PyObject_IsTrue(o);
+  if (normalize < 0) return -1;
+  if (self->cxx32) self->cxx32->setNormalize(normalize);
+  else self->cxx->setNormalize(normalize);
+  return 0;
+}
+
 static PyGetSetDef PyBobIpOptflowVanillaHornAndSchunck_getseters[] = {
     {
       s_shape.name(),
@@ -201,6 +480,55 @@ static PyGetSetDef PyBobIpOptflowVanillaHornAndSchunck_getseters[] = {
       s_shape.doc(),
       0
     },
+    {
+      s_threads.name(),
+      (getter)PyBobIpOptflowVanillaHornAndSchunck_getThreads,
+      (setter)PyBobIpOptflowVanillaHornAndSchunck_setThreads,
+      s_threads.doc(),
+      0
+    },
+    {
+      s_cycle.name(),
+      (getter)PyBobIpOptflowVanillaHornAndSchunck_getCycle,
+      (setter)PyBobIpOptflowVanillaHornAndSchunck_setCycle,
+      s_cycle.doc(),
+      0
+    },
+    {
+      s_smoothing.name(),
+      (getter)PyBobIpOptflowVanillaHornAndSchunck_getSmoothing,
+      (setter)PyBobIpOptflowVanillaHornAndSchunck_setSmoothing,
+      s_smoothing.doc(),
+      0
+    },
+    {
+      s_tiling.name(),
+      (getter)PyBobIpOptflowVanillaHornAndSchunck_getTiling,
+      (setter)PyBobIpOptflowVanillaHornAndSchunck_setTiling,
+      s_tiling.doc(),
+      0
+    },
+    {
+      s_packed.name(),
+      (getter)PyBobIpOptflowVanillaHornAndSchunck_getPacked,
+      (setter)PyBobIpOptflowVanillaHornAndSchunck_setPacked,
+      s_packed.doc(),
+      0
+    },
+    {
+      s_dtype.name(),
+      (getter)PyBobIpOptflowVanillaHornAndSchunck_getDtype,
+      0,
+      s_dtype.doc(),
+      0
+    },
+    {
+      s_normalize.name(),
+      (getter)PyBobIpOptflowVanillaHornAndSchunck_getNormalize,
+      (setter)PyBobIpOptflowVanillaHornAndSchunck_setNormalize,
+      s_normalize.doc(),
+      0
+    },
     {0}  /* Sentinel */
 };
 
@@ -227,25 +555,97 @@ PyObject* PyBobIpOptflowVanillaHornAndSchunck_Repr(PyBobIpOptflowVanillaHornAndS
 
 }
 
+/**
+ * Estimates the flow from images of type T or, depending on the type of
+ * `image1', of 8-bit or 16-bit unsigned integers
+ */
+template <typename T>
+static size_t PyBobIpOptflowVanillaHornAndSchunck_estimate_as
+(const bob::ip::optflow::VanillaHornAndSchunckFlow<T>& op, double alpha,
+    size_t iterations, PyBlitzArrayObject* image1,
+    PyBlitzArrayObject* image2,
+    PyBlitzArrayObject* u, PyBlitzArrayObject* v,
+    bob::ip::optflow::Solver::Type solver, double omega, double tolerance) {
+  blitz::Array<T,2>& U = *PyBlitzArrayCxx_AsBlitz<T,2>(u);
+  blitz::Array<T,2>& V = *PyBlitzArrayCxx_AsBlitz<T,2>(v);
+  switch (image1->type_num) {
+    case NPY_UINT8:
+      if (image1->ndim == 3)
+        return op(alpha, iterations,
+            *PyBlitzArrayCxx_AsBlitz<uint8_t,3>(image1),
+            *PyBlitzArrayCxx_AsBlitz<uint8_t,3>(image2),
+            U, V, solver, omega, tolerance);
+      return op(alpha, iterations,
+          *PyBlitzArrayCxx_AsBlitz<uint8_t,2>(image1),
+          *PyBlitzArrayCxx_AsBlitz<uint8_t,2>(image2),
+          U, V, solver, omega, tolerance);
+    case NPY_UINT16:
+      return op(alpha, iterations,
+          *PyBlitzArrayCxx_AsBlitz<uint16_t,2>(image1),
+          *PyBlitzArrayCxx_AsBlitz<uint16_t,2>(image2),
+          U, V, solver, omega, tolerance);
+    default:
+      return op(alpha, iterations,
+          *PyBlitzArrayCxx_AsBlitz<T,2>(image1),
+          *PyBlitzArrayCxx_AsBlitz<T,2>(image2),
+          U, V, solver, omega, tolerance);
+  }
+}
+
 static auto s_estimate = bob::extension::FunctionDoc(
     "estimate",
     "Estimates the optical flow leading to ``image2``. This method will use "
     "the leading image ``image1``, to estimate the optical flow leading to "
-    "``image2``. All input images should be 2D 64-bit float arrays with the "
-    "shape ``(height, width)`` as specified in the construction of the object."
+    "``image2``. All input images should be 2D arrays of type "
+    ":py:attr:`dtype`, ``uint8`` or ``uint16`` with the shape "
+    "``(height, width)`` as specified in the construction of the object, or "
+    "``uint8`` RGB images with the shape ``(3, height, width)`` or "
+    "``(height, width, 3)``, which are converted to gray on the fly."
     )
-    .add_prototype("alpha, iterations, image1, image2, [u, v]", "u, v")
+    .add_prototype("alpha, iterations, image1, image2, [u, v], [solver], [omega]", "u, v")
+    .add_prototype("alpha, iterations, image1, image2, u, v, solver, omega, tolerance", "u, v, n")
     .add_parameter("alpha", "float", "The weighting factor between brightness constness and the field smoothness. According to original paper, :math:`\\alpha^2` should be more or less set to noise in estimating :math:`E_x^2 + E_y^2`. In practice, many algorithms consider values around 200 a good default. The higher this number is, the more importance on smoothing you will be putting.")
     .add_parameter("iterations", "int", "Number of iterations for which to minimize the flow error")
-    .add_parameter("image1, image2", "array-like (2D, float64)",
-      "Sequence of images to estimate the flow from")
-    .add_parameter("u, v", "array (2D, float64)", "The estimated flows in the horizontal and vertical directions (respectively) will be output in these variables, which should have dimensions matching those of this functor. If you don't provide arrays for ``u`` and ``v``, then they will be allocated internally and returned. You must either provide neither ``u`` and ``v`` or both, otherwise an exception will be raised. Notice that, if you provide ``u`` and ``v`` which are non-zero, they will be taken as initial values for the error minimization. These arrays will be updated with the final value of the flow leading to ``image2``.")
-    .add_return("u, v", "array (2D, float)", "The estimated flows in the horizontal and vertical directions (respectively)."
+    .add_parameter("image1, image2", "array-like (2D float, uint8 or uint16, or 3D uint8)",
+      "Sequence of images to estimate the flow from, all of the same type")
+    .add_parameter("u, v", "array (2D, float)", "The estimated flows in the horizontal and vertical directions (respectively) will be output in these variables, which should have dimensions matching those of this functor. If you don't provide arrays for ``u`` and ``v``, then they will be allocated internally and returned, reusing the arrays returned by earlier calls that you have dropped since. You must either provide neither ``u`` and ``v`` or both, otherwise an exception will be raised. Notice that, if you provide ``u`` and ``v`` which are non-zero, they will be taken as initial values for the error minimization. These arrays will be updated with the final value of the flow leading to ``image2``.")
+    .add_parameter("solver", "str", "The iterative solver to use. ``'jacobi'`` (the default) runs the Jacobi iterations of the original paper, optionally cache-blocked (see :py:attr:`tiling`). ``'sor'`` runs a multi-colour Gauss-Seidel solver with successive over-relaxation, which reaches the same error in far fewer iterations. In this case, ``iterations`` counts complete sweeps over all pixels. ``'multigrid'`` runs multigrid cycles (see :py:attr:`cycle` and :py:attr:`smoothing`), whose convergence rate does not degrade with the size of the images. In this case, ``iterations`` counts cycles.")
+    .add_parameter("omega", "float", "The relaxation factor of the ``'sor'`` solver, in the interval :math:`(0, 2)`. If set to 0 (the default), it is estimated from the shape of the images. This parameter is ignored by the other solvers.")
+    .add_parameter("tolerance", "float", "If given, ``iterations`` becomes an upper bound, and the solver stops as soon as the norm of an update of the flow falls below ``tolerance`` times the norm of the flow (for the ``'multigrid'`` solver, as soon as the norm of the residual of the linear system falls below ``tolerance`` times the norm of its right-hand side). The number of iterations that were run is then returned as well.")
+    .add_return("u, v", "array (2D, float)", "The estimated flows in the horizontal and vertical directions (respectively).")
+    .add_return("n", "int", "The number of iterations that were run, only returned if ``tolerance`` is given."
     )
     ;
 
-static PyObject* PyBobIpOptflowVanillaHornAndSchunck_estimate
-(PyBobIpOptflowVanillaHornAndSchunckObject* self, PyObject* args, PyObject* kwds) {
+/**
+ * Returns the flows u and v as numpy arrays, followed by the number of
+ * iterations n if a tolerance was given
+ */
+static PyObject* PyBobIpOptflowVanillaHornAndSchunck_flows(PyBlitzArrayObject* u,
+    PyBlitzArrayObject* v, bool tolerance, size_t n) {
+
+  if (tolerance) {
+    return Py_BuildValue("(NNn)",
+      PyBlitzArray_NUMPY_WRAP(Py_BuildValue("O", u)),
+      PyBlitzArray_NUMPY_WRAP(Py_BuildValue("O", v)),
+      static_cast<Py_ssize_t>(n)
+      );
+  }
+
+  return Py_BuildValue("(NN)",
+    PyBlitzArray_NUMPY_WRAP(Py_BuildValue("O", u)),
+    PyBlitzArray_NUMPY_WRAP(Py_BuildValue("O", v))
+    );
+
+}
+
+/**
+ * Parses and checks the arguments of estimate(), then estimates the flow
+ * right away or, if async is set, in the background
+ */
+static PyObject* PyBobIpOptflowVanillaHornAndSchunck_estimate_call
+(PyBobIpOptflowVanillaHornAndSchunckObject* self, PyObject* args, PyObject* kwds,
+    bool async) {
 
   static const char* const_kwlist[] = {
     "alpha",
@@ -254,6 +654,9 @@ static PyObject* PyBobIpOptflowVanillaHornAndSchunck_estimate
     "image2",
     "u",
     "v",
+    "solver",
+    "omega",
+    "tolerance",
     0
     };
   static char** kwlist = const_cast<char**>(const_kwlist);
@@ -264,13 +667,18 @@ static PyObject* PyBobIpOptflowVanillaHornAndSchunck_estimate
   PyBlitzArrayObject* image2 = 0;
   PyBlitzArrayObject* u = 0;
   PyBlitzArrayObject* v = 0;
+  bob::ip::optflow::Solver::Type solver = bob::ip::optflow::Solver::Jacobi;
+  double omega = 0.;
+  PyObject* tolerance = 0;
 
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "dnO&O&|O&O&", kwlist,
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "dnO&O&|O&O&O&dO", kwlist,
         &alpha, &iterations,
-        &PyBlitzArray_Converter, &image1,
-        &PyBlitzArray_Converter, &image2,
+        &PyBobIpOptflowImage_Converter, &image1,
+        &PyBobIpOptflowImage_Converter, &image2,
         &PyBlitzArray_OutputConverter, &u,
-        &PyBlitzArray_OutputConverter, &v
+        &PyBlitzArray_OutputConverter, &v,
+        &PyBobIpOptflowSolver_Converter, &solver,
+        &omega, &tolerance
         )) return 0;
 
   //protects acquired resources through this scope
@@ -279,30 +687,45 @@ static PyObject* PyBobIpOptflowVanillaHornAndSchunck_estimate
   auto u_ = make_xsafe(u);
   auto v_ = make_xsafe(v);
 
-  if (image1->type_num != NPY_FLOAT64 || image1->ndim != 2) {
-    PyErr_Format(PyExc_TypeError, "`%s' only supports 2D 64-bit float arrays for input array `image1'", Py_TYPE(self)->tp_name);
+  if (!PyBobIpOptflowImage_Check(image1, self->type_num)) {
+    PyErr_Format(PyExc_TypeError, "`%s' only supports 2D %s, uint8 or uint16 arrays, or 3D uint8 RGB arrays, for input array `image1'", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(self->type_num));
     return 0;
   }
 
-  if (image2->type_num != NPY_FLOAT64 || image2->ndim != 2) {
-    PyErr_Format(PyExc_TypeError, "`%s' only supports 2D 64-bit float arrays for input array `image2'", Py_TYPE(self)->tp_name);
+  if (image2->type_num != image1->type_num || image2->ndim != image1->ndim) {
+    PyErr_Format(PyExc_TypeError, "`%s' only supports %" PY_FORMAT_SIZE_T "dD %s arrays (the type and dimensions of `image1') for input array `image2'", Py_TYPE(self)->tp_name, image1->ndim, PyBlitzArray_TypenumAsString(image1->type_num));
     return 0;
   }
 
   //check all input image dimensions are consistent
-  Py_ssize_t height = self->cxx->getShape()(0);
-  Py_ssize_t width = self->cxx->getShape()(1);
+  Py_ssize_t height = PyBobIpOptflowVanillaHornAndSchunck_shape(self)(0);
+  Py_ssize_t width = PyBobIpOptflowVanillaHornAndSchunck_shape(self)(1);
 
-  if (image1->shape[0] != height || image1->shape[1] != width) {
-    PyErr_Format(PyExc_RuntimeError, "`%s' only supports arrays with shape (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d) for input array `image1', but `image1''s shape is (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d)", Py_TYPE(self)->tp_name, height, width, image1->shape[0], image1->shape[1]);
+  if (!PyBobIpOptflowImage_Matches(image1, height, width)) {
+    PyErr_Format(PyExc_RuntimeError, "`%s' only supports arrays with shape (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d), or (3, %" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d) and (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d, 3) for RGB images, for input array `image1'", Py_TYPE(self)->tp_name, height, width, height, width, height, width);
     return 0;
   }
 
-  if (image2->shape[0] != height || image2->shape[1] != width) {
-    PyErr_Format(PyExc_RuntimeError, "`%s' only supports arrays with shape (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d) for input array `image2', but `image2''s shape is (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d)", Py_TYPE(self)->tp_name, height, width, image2->shape[0], image2->shape[1]);
+  if (!PyBobIpOptflowImage_Matches(image2, height, width)) {
+    PyErr_Format(PyExc_RuntimeError, "`%s' only supports arrays with shape (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d), or (3, %" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d) and (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d, 3) for RGB images, for input array `image2'", Py_TYPE(self)->tp_name, height, width, height, width, height, width);
+    return 0;
+  }
+
+  if (solver == bob::ip::optflow::Solver::SOR && omega >= 2.) {
+    PyErr_Format(PyExc_ValueError, "`%s' requires the relaxation factor `omega' to be smaller than 2, but you provided %g", Py_TYPE(self)->tp_name, omega);
     return 0;
   }
 
+  double tol = 0.;
+  if (tolerance) {
+    tol = PyFloat_AsDouble(tolerance);
+    if (PyErr_Occurred()) return 0;
+    if (tol < 0.) {
+      PyErr_Format(PyExc_ValueError, "`%s' requires the `tolerance' to be zero or positive, but you provided %g", Py_TYPE(self)->tp_name, tol);
+      return 0;
+    }
+  }
+
   if (u && !v) {
     PyErr_Format(PyExc_RuntimeError, "`%s' requires either both `u' and `v' or none, but you provided `u' and not `v'", Py_TYPE(self)->tp_name);
     return 0;
@@ -315,13 +738,13 @@ static PyObject* PyBobIpOptflowVanillaHornAndSchunck_estimate
 
   if (u) { //&& v
 
-    if (u->type_num != NPY_FLOAT64 || u->ndim != 2) {
-      PyErr_Format(PyExc_TypeError, "`%s' only supports 2D 64-bit float arrays for (optional) input array `u'", Py_TYPE(self)->tp_name);
+    if (u->type_num != self->type_num || u->ndim != 2) {
+      PyErr_Format(PyExc_TypeError, "`%s' only supports 2D %s arrays for (optional) input array `u'", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(self->type_num));
       return 0;
     }
 
-    if (v->type_num != NPY_FLOAT64 || v->ndim != 2) {
-      PyErr_Format(PyExc_TypeError, "`%s' only supports 2D 64-bit float arrays for input array `v'", Py_TYPE(self)->tp_name);
+    if (v->type_num != self->type_num || v->ndim != 2) {
+      PyErr_Format(PyExc_TypeError, "`%s' only supports 2D %s arrays for input array `v'", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(self->type_num));
       return 0;
     }
 
@@ -338,38 +761,344 @@ static PyObject* PyBobIpOptflowVanillaHornAndSchunck_estimate
   }
   else { //allocates u and v
 
-    u = (PyBlitzArrayObject*)PyBlitzArray_SimpleNew(NPY_FLOAT64,
-        image1->ndim, image1->shape);
-    auto bz_u = PyBlitzArrayCxx_AsBlitz<double,2>(u);
-    (*bz_u) = 0.;
+    Py_ssize_t shape[2] = {height, width};
+
+    u = PyBobIpOptflowArray_Recycle(&self->recycled, self->type_num,
+        2, shape);
+    if (!u) return 0;
+    if (self->cxx32) (*PyBlitzArrayCxx_AsBlitz<float,2>(u)) = 0.;
+    else (*PyBlitzArrayCxx_AsBlitz<double,2>(u)) = 0.;
     u_ = make_safe(u);
 
-    v = (PyBlitzArrayObject*)PyBlitzArray_SimpleNew(NPY_FLOAT64,
-        image1->ndim, image1->shape);
-    auto bz_v = PyBlitzArrayCxx_AsBlitz<double,2>(v);
-    (*bz_v) = 0.;
+    v = PyBobIpOptflowArray_Recycle(&self->recycled, self->type_num,
+        2, shape);
+    if (!v) return 0;
+    if (self->cxx32) (*PyBlitzArrayCxx_AsBlitz<float,2>(v)) = 0.;
+    else (*PyBlitzArrayCxx_AsBlitz<double,2>(v)) = 0.;
     v_ = make_safe(v);
 
   }
 
   /** all basic checks are done, can call the functor now **/
+  if (async) {
+    auto cxx = self->cxx;
+    auto cxx32 = self->cxx32;
+    auto n = std::make_shared<size_t>(0);
+    bool with_n = (tolerance != 0);
+    return PyBobIpOptflowAsync_Submit(reinterpret_cast<PyObject*>(self),
+        &self->busy, {
+          reinterpret_cast<PyObject*>(image1),
+          reinterpret_cast<PyObject*>(image2),
+          reinterpret_cast<PyObject*>(u),
+          reinterpret_cast<PyObject*>(v)
+        },
+        [=]() {
+          if (cxx32)
+            *n = PyBobIpOptflowVanillaHornAndSchunck_estimate_as(*cxx32, alpha, iterations,
+                image1, image2, u, v, solver, omega, tol);
+          else
+            *n = PyBobIpOptflowVanillaHornAndSchunck_estimate_as(*cxx, alpha, iterations,
+                image1, image2, u, v, solver, omega, tol);
+        },
+        [=]() { return PyBobIpOptflowVanillaHornAndSchunck_flows(u, v, with_n, *n); },
+        "cannot estimate flow");
+  }
+
+  size_t n = 0;
+  //runs without the GIL, so that other Python threads may run meanwhile
+  std::string failure;
+  bool failed = false;
+  ++self->busy;
+  Py_BEGIN_ALLOW_THREADS
   try {
-    self->cxx->operator()(alpha, iterations,
-        *PyBlitzArrayCxx_AsBlitz<double,2>(image1),
-        *PyBlitzArrayCxx_AsBlitz<double,2>(image2),
-        *PyBlitzArrayCxx_AsBlitz<double,2>(u),
-        *PyBlitzArrayCxx_AsBlitz<double,2>(v)
-        );
+    if (self->cxx32)
+      n = PyBobIpOptflowVanillaHornAndSchunck_estimate_as(*self->cxx32, alpha, iterations,
+          image1, image2, u, v, solver, omega, tol);
+    else
+      n = PyBobIpOptflowVanillaHornAndSchunck_estimate_as(*self->cxx, alpha, iterations,
+          image1, image2, u, v, solver, omega, tol);
   }
   catch (std::exception& e) {
-    PyErr_SetString(PyExc_RuntimeError, e.what());
+    failure = e.what();
+    failed = true;
+  }
+  catch (...) {
+    failed = true;
+  }
+  Py_END_ALLOW_THREADS
+  --self->busy;
+
+  if (failed) {
+    if (failure.empty()) PyErr_Format(PyExc_RuntimeError, "%s cannot estimate flow: unknown exception caught", Py_TYPE(self)->tp_name);
+    else PyErr_SetString(PyExc_RuntimeError, failure.c_str());
+    return 0;
+  }
+
+  return PyBobIpOptflowVanillaHornAndSchunck_flows(u, v, tolerance != 0, n);
+
+}
+
+static PyObject* PyBobIpOptflowVanillaHornAndSchunck_estimate
+(PyBobIpOptflowVanillaHornAndSchunckObject* self, PyObject* args, PyObject* kwds) {
+  return PyBobIpOptflowVanillaHornAndSchunck_estimate_call(self, args, kwds, false);
+}
+
+static auto s_estimate_async = bob::extension::FunctionDoc(
+    "estimate_async",
+    "Estimates the optical flow like :py:meth:`estimate`, but in the background",
+    "The arguments are checked right away, then the estimation is queued to "
+    "a pool of worker threads shared by all estimators, and a "
+    ":py:class:`concurrent.futures.Future` is returned at once, while the "
+    "calling thread goes on with its own work. The future is set to what "
+    ":py:meth:`estimate` returns once the flow is estimated, or to the "
+    "exception raised. The images and flows passed are kept alive until "
+    "then, and must not be modified meanwhile. The attributes of this "
+    "estimator cannot be set while the estimation is pending. Cancelling the "
+    "future before it starts running drops the estimation."
+    )
+    .add_prototype("alpha, iterations, image1, image2, [u, v], [solver], [omega], [tolerance]", "future")
+    .add_parameter("alpha, iterations, image1, image2, u, v, solver, omega, tolerance", "various", "The same arguments as for :py:meth:`estimate`")
+    .add_return("future", ":py:class:`concurrent.futures.Future`", "The future result of the estimation, i.e. ``(u, v)`` or ``(u, v, n)``")
+    ;
+
+static PyObject* PyBobIpOptflowVanillaHornAndSchunck_estimate_async
+(PyBobIpOptflowVanillaHornAndSchunckObject* self, PyObject* args, PyObject* kwds) {
+  return PyBobIpOptflowVanillaHornAndSchunck_estimate_call(self, args, kwds, true);
+}
+
+static auto s_estimate_awaitable = bob::extension::FunctionDoc(
+    "estimate_awaitable",
+    "Estimates the optical flow in the background, for :py:mod:`asyncio` coroutines",
+    "Same as :py:meth:`estimate_async`, but the future returned is an "
+    ":py:class:`asyncio.Future` of the event loop running the coroutine, "
+    "which the coroutine may await without blocking the loop."
+    )
+    .add_prototype("alpha, iterations, image1, image2, [u, v], [solver], [omega], [tolerance]", "future")
+    .add_parameter("alpha, iterations, image1, image2, u, v, solver, omega, tolerance", "various", "The same arguments as for :py:meth:`estimate`")
+    .add_return("future", ":py:class:`asyncio.Future`", "The awaitable result of the estimation, i.e. ``(u, v)`` or ``(u, v, n)``")
+    ;
+
+static PyObject* PyBobIpOptflowVanillaHornAndSchunck_estimate_awaitable
+(PyBobIpOptflowVanillaHornAndSchunckObject* self, PyObject* args, PyObject* kwds) {
+
+  PyObject* asyncio = PyImport_ImportModule("asyncio");
+  if (!asyncio) return 0;
+  auto asyncio_ = make_safe(asyncio);
+
+  PyObject* future = PyBobIpOptflowVanillaHornAndSchunck_estimate_call(self, args, kwds, true);
+  if (!future) return 0;
+
+  return PyObject_CallMethod(asyncio, const_cast<char*>("wrap_future"),
+      const_cast<char*>("N"), future);
+
+}
+
+/**
+ * Estimates the flows of a stack of frames of type T or, depending on the
+ * type of `frames', of 8-bit or 16-bit unsigned integers
+ */
+template <typename T>
+static size_t PyBobIpOptflowVanillaHornAndSchunck_estimate_sequence_as
+(const bob::ip::optflow::VanillaHornAndSchunckFlow<T>& op, double alpha, size_t iterations,
+    PyBlitzArrayObject* frames, PyBlitzArrayObject* u, PyBlitzArrayObject* v,
+    bool warm, bob::ip::optflow::Solver::Type solver, double omega,
+    double tolerance) {
+  blitz::Array<T,3>& U = *PyBlitzArrayCxx_AsBlitz<T,3>(u);
+  blitz::Array<T,3>& V = *PyBlitzArrayCxx_AsBlitz<T,3>(v);
+  switch (frames->type_num) {
+    case NPY_UINT8:
+      if (frames->ndim == 4)
+        return op.estimateSequence(alpha, iterations,
+            *PyBlitzArrayCxx_AsBlitz<uint8_t,4>(frames),
+            U, V, warm, solver, omega, tolerance);
+      return op.estimateSequence(alpha, iterations,
+          *PyBlitzArrayCxx_AsBlitz<uint8_t,3>(frames),
+          U, V, warm, solver, omega, tolerance);
+    case NPY_UINT16:
+      return op.estimateSequence(alpha, iterations,
+          *PyBlitzArrayCxx_AsBlitz<uint16_t,3>(frames),
+          U, V, warm, solver, omega, tolerance);
+    default:
+      return op.estimateSequence(alpha, iterations,
+          *PyBlitzArrayCxx_AsBlitz<T,3>(frames),
+          U, V, warm, solver, omega, tolerance);
+  }
+}
+
+static auto s_estimate_sequence = bob::extension::FunctionDoc(
+    "estimate_sequence",
+    "Estimates the optical flows along a whole sequence of frames. The "
+    "frames are stacked along the first dimension of ``frames``, and "
+    "slice ``k`` of the outputs is set to the flow of frames ``k`` and ``k+1``, as "
+    ":py:meth:`estimate` would return it. The loop over the frames runs "
+    "without returning to Python, and the frames are read in place."
+    )
+    .add_prototype("alpha, iterations, frames, [u, v], [warm], [solver], [omega]", "u, v")
+    .add_prototype("alpha, iterations, frames, u, v, warm, solver, omega, tolerance", "u, v, n")
+    .add_parameter("alpha", "float", "The weighting factor between brightness constness and the field smoothness, as in :py:meth:`estimate`")
+    .add_parameter("iterations", "int", "Number of iterations (or cycles) to run for each flow")
+    .add_parameter("frames", "array-like (3D float, uint8 or uint16, or 4D uint8)", "The frames of the sequence, with shape ``(n, height, width)`` for gray images, or ``(n, 3, height, width)`` or ``(n, height, width, 3)`` for RGB images")
+    .add_parameter("u, v", "array (3D, float)", "The estimated flows in the horizontal and vertical directions (respectively) will be output in these variables, with shape ``(n-1, height, width)``. If you don't provide them, they will be allocated internally and returned. Their contents are ignored.")
+    .add_parameter("warm", "bool", "If ``True`` (the default), each flow starts from the previous one, which usually converges faster on a video. Otherwise, all flows start from zero and are independent, so they are estimated in parallel, one per thread (see :py:attr:`threads`).")
+    .add_parameter("solver, omega, tolerance", "str, float, float", "As in :py:meth:`estimate`")
+    .add_return("u, v", "array (3D, float)", "The estimated flows in the horizontal and vertical directions (respectively).")
+    .add_return("n", "int", "The total number of iterations that were run, only returned if ``tolerance`` is given."
+    )
+    ;
+
+static PyObject* PyBobIpOptflowVanillaHornAndSchunck_estimate_sequence
+(PyBobIpOptflowVanillaHornAndSchunckObject* self, PyObject* args, PyObject* kwds) {
+
+  static const char* const_kwlist[] = {
+    "alpha",
+    "iterations",
+    "frames",
+    "u",
+    "v",
+    "warm",
+    "solver",
+    "omega",
+    "tolerance",
+    0
+    };
+  static char** kwlist = const_cast<char**>(const_kwlist);
+
+  double alpha;
+  Py_ssize_t iterations;
+  PyBlitzArrayObject* frames = 0;
+  PyBlitzArrayObject* u = 0;
+  PyBlitzArrayObject* v = 0;
+  PyObject* warm = Py_True;
+  bob::ip::optflow::Solver::Type solver = bob::ip::optflow::Solver::Jacobi;
+  double omega = 0.;
+  PyObject* tolerance = 0;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "dnO&|O&O&OO&dO", kwlist,
+        &alpha, &iterations,
+        &PyBobIpOptflowImage_Converter, &frames,
+        &PyBlitzArray_OutputConverter, &u,
+        &PyBlitzArray_OutputConverter, &v,
+        &warm,
+        &PyBobIpOptflowSolver_Converter, &solver,
+        &omega, &tolerance
+        )) return 0;
+
+  //protects acquired resources through this scope
+  auto frames_ = make_safe(frames);
+  auto u_ = make_xsafe(u);
+  auto v_ = make_xsafe(v);
+
+  if (!PyBobIpOptflowStack_Check(frames, self->type_num)) {
+    PyErr_Format(PyExc_TypeError, "`%s' only supports 3D %s, uint8 or uint16 arrays, or 4D uint8 RGB arrays, for input array `frames'", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(self->type_num));
     return 0;
   }
+
+  Py_ssize_t height = PyBobIpOptflowVanillaHornAndSchunck_shape(self)(0);
+  Py_ssize_t width = PyBobIpOptflowVanillaHornAndSchunck_shape(self)(1);
+
+  if (!PyBobIpOptflowStack_Matches(frames, height, width)) {
+    PyErr_Format(PyExc_RuntimeError, "`%s' only supports stacks of arrays with shape (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d), or (3, %" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d) and (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d, 3) for RGB images, for input array `frames'", Py_TYPE(self)->tp_name, height, width, height, width, height, width);
+    return 0;
+  }
+
+  Py_ssize_t flows = frames->shape[0] - 1;
+  if (flows < 1) {
+    PyErr_Format(PyExc_RuntimeError, "`%s' requires at least 2 frames in input array `frames', but you provided %" PY_FORMAT_SIZE_T "d", Py_TYPE(self)->tp_name, frames->shape[0]);
+    return 0;
+  }
+
+  int warm_ = PyObject_IsTrue(warm);
+  if (warm_ < 0) return 0;
+
+  if (solver == bob::ip::optflow::Solver::SOR && omega >= 2.) {
+    PyErr_Format(PyExc_ValueError, "`%s' requires the relaxation factor `omega' to be smaller than 2, but you provided %g", Py_TYPE(self)->tp_name, omega);
+    return 0;
+  }
+
+  double tol = 0.;
+  if (tolerance) {
+    tol = PyFloat_AsDouble(tolerance);
+    if (PyErr_Occurred()) return 0;
+    if (tol < 0.) {
+      PyErr_Format(PyExc_ValueError, "`%s' requires the `tolerance' to be zero or positive, but you provided %g", Py_TYPE(self)->tp_name, tol);
+      return 0;
+    }
+  }
+
+  if ((u && !v) || (v && !u)) {
+    PyErr_Format(PyExc_RuntimeError, "`%s' requires either both `u' and `v' or none", Py_TYPE(self)->tp_name);
+    return 0;
+  }
+
+  if (u) { //&& v
+
+    if (u->type_num != self->type_num || u->ndim != 3 ||
+        v->type_num != self->type_num || v->ndim != 3) {
+      PyErr_Format(PyExc_TypeError, "`%s' only supports 3D %s arrays for output arrays `u' and `v'", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(self->type_num));
+      return 0;
+    }
+
+    if (u->shape[0] != flows || u->shape[1] != height || u->shape[2] != width ||
+        v->shape[0] != flows || v->shape[1] != height || v->shape[2] != width) {
+      PyErr_Format(PyExc_RuntimeError, "`%s' only supports arrays with shape (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d) for output arrays `u' and `v'", Py_TYPE(self)->tp_name, flows, height, width);
+      return 0;
+    }
+
+  }
+  else { //allocates u and v
+
+    Py_ssize_t shape[3] = {flows, height, width};
+
+    u = (PyBlitzArrayObject*)PyBlitzArray_SimpleNew(self->type_num,
+        3, shape);
+    if (!u) return 0;
+    u_ = make_safe(u);
+
+    v = (PyBlitzArrayObject*)PyBlitzArray_SimpleNew(self->type_num,
+        3, shape);
+    if (!v) return 0;
+    v_ = make_safe(v);
+
+  }
+
+  size_t n = 0;
+  //runs without the GIL, so that other Python threads may run meanwhile
+  std::string failure;
+  bool failed = false;
+  ++self->busy;
+  Py_BEGIN_ALLOW_THREADS
+  try {
+    if (self->cxx32)
+      n = PyBobIpOptflowVanillaHornAndSchunck_estimate_sequence_as(*self->cxx32, alpha, iterations,
+          frames, u, v, warm_, solver, omega, tol);
+    else
+      n = PyBobIpOptflowVanillaHornAndSchunck_estimate_sequence_as(*self->cxx, alpha, iterations,
+          frames, u, v, warm_, solver, omega, tol);
+  }
+  catch (std::exception& e) {
+    failure = e.what();
+    failed = true;
+  }
   catch (...) {
-    PyErr_Format(PyExc_RuntimeError, "%s cannot estimate flow: unknown exception caught", Py_TYPE(self)->tp_name);
+    failed = true;
+  }
+  Py_END_ALLOW_THREADS
+  --self->busy;
+
+  if (failed) {
+    if (failure.empty()) PyErr_Format(PyExc_RuntimeError, "%s cannot estimate flows: unknown exception caught", Py_TYPE(self)->tp_name);
+    else PyErr_SetString(PyExc_RuntimeError, failure.c_str());
     return 0;
   }
 
+  if (tolerance) {
+    return Py_BuildValue("(NNn)",
+      PyBlitzArray_NUMPY_WRAP(Py_BuildValue("O", u)),
+      PyBlitzArray_NUMPY_WRAP(Py_BuildValue("O", v)),
+      static_cast<Py_ssize_t>(n)
+      );
+  }
+
   return Py_BuildValue("(NN)",
     PyBlitzArray_NUMPY_WRAP(Py_BuildValue("O", u)),
     PyBlitzArray_NUMPY_WRAP(Py_BuildValue("O", v))
@@ -381,9 +1110,10 @@ static auto s_eval_ec2 = bob::extension::FunctionDoc(
     "eval_ec2",
     "Calculates the square of the smoothness error (:math:`E_c^2`) by using the formula described in the paper: :math:`E_c^2 = (\\bar{u} - u)^2 + (\\bar{v} - v)^2`. Sets the input matrix with the discrete values."
     )
-    .add_prototype("u, v", "error")
-    .add_parameter("u, v", "array-like (2D, float64)", "The estimated flows in the horizontal and vertical directions (respectively), which should have dimensions matching those of this functor.")
-    .add_return("error", "array (2D, float)", "The square of the smoothness error."
+    .add_prototype("u, v, [out]", "error")
+    .add_parameter("u, v", "array-like (2D, float)", "The estimated flows in the horizontal and vertical directions (respectively), which should have dimensions matching those of this functor.")
+    .add_parameter("out", "array (2D, float)", "If given, the error is written in this array, which should have dimensions matching those of this functor. Otherwise, a new array is returned, which this object recycles once you drop it.")
+    .add_return("error", "array (2D, float)", "The square of the smoothness error, i.e. ``out`` if it was given."
     )
     ;
 
@@ -393,34 +1123,38 @@ static PyObject* PyBobIpOptflowVanillaHornAndSchunck_eval_ec2
   static const char* const_kwlist[] = {
     "u",
     "v",
+    "out",
     0
     };
   static char** kwlist = const_cast<char**>(const_kwlist);
 
   PyBlitzArrayObject* u = 0;
   PyBlitzArrayObject* v = 0;
+  PyBlitzArrayObject* error = 0;
 
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&O&", kwlist,
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&O&|O&", kwlist,
         &PyBlitzArray_Converter, &u,
-        &PyBlitzArray_Converter, &v
+        &PyBlitzArray_Converter, &v,
+        &PyBlitzArray_OutputConverter, &error
         )) return 0;
 
   //protects acquired resources through this scope
   auto u_ = make_safe(u);
   auto v_ = make_safe(v);
+  auto error_ = make_xsafe(error);
 
-  if (u->type_num != NPY_FLOAT64 || u->ndim != 2) {
-    PyErr_Format(PyExc_TypeError, "`%s' only supports 2D 64-bit float arrays for (optional) input array `u'", Py_TYPE(self)->tp_name);
+  if (u->type_num != self->type_num || u->ndim != 2) {
+    PyErr_Format(PyExc_TypeError, "`%s' only supports 2D %s arrays for (optional) input array `u'", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(self->type_num));
     return 0;
   }
 
-  if (v->type_num != NPY_FLOAT64 || v->ndim != 2) {
-    PyErr_Format(PyExc_TypeError, "`%s' only supports 2D 64-bit float arrays for input array `v'", Py_TYPE(self)->tp_name);
+  if (v->type_num != self->type_num || v->ndim != 2) {
+    PyErr_Format(PyExc_TypeError, "`%s' only supports 2D %s arrays for input array `v'", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(self->type_num));
     return 0;
   }
 
-  Py_ssize_t height = self->cxx->getShape()(0);
-  Py_ssize_t width = self->cxx->getShape()(1);
+  Py_ssize_t height = PyBobIpOptflowVanillaHornAndSchunck_shape(self)(0);
+  Py_ssize_t width = PyBobIpOptflowVanillaHornAndSchunck_shape(self)(1);
 
   if (u->shape[0] != height || u->shape[1] != width) {
     PyErr_Format(PyExc_RuntimeError, "`%s' only supports arrays with shape (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d) for input array `u', but `u''s shape is (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d)", Py_TYPE(self)->tp_name, height, width, u->shape[0], u->shape[1]);
@@ -432,25 +1166,61 @@ static PyObject* PyBobIpOptflowVanillaHornAndSchunck_eval_ec2
     return 0;
   }
 
-  //allocates the error return
-  auto error = (PyBlitzArrayObject*)PyBlitzArray_SimpleNew(NPY_FLOAT64,
-      u->ndim, u->shape);
-  auto error_ = make_safe(error);
+  if (error) {
+
+    if (error->type_num != self->type_num || error->ndim != 2) {
+      PyErr_Format(PyExc_TypeError, "`%s' only supports 2D %s arrays for (optional) output array `out'", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(self->type_num));
+      return 0;
+    }
+
+    if (error->shape[0] != height || error->shape[1] != width) {
+      PyErr_Format(PyExc_RuntimeError, "`%s' only supports arrays with shape (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d) for output array `out', but `out''s shape is (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d)", Py_TYPE(self)->tp_name, height, width, error->shape[0], error->shape[1]);
+      return 0;
+    }
+
+  }
+  else { //allocates the error return
+    error = PyBobIpOptflowArray_Recycle(&self->recycled, self->type_num,
+        u->ndim, u->shape);
+    if (!error) return 0;
+    error_ = make_safe(error);
+  }
 
   /** all basic checks are done, can call the functor now **/
+  //runs without the GIL, so that other Python threads may run meanwhile
+  std::string failure;
+  bool failed = false;
+  ++self->busy;
+  Py_BEGIN_ALLOW_THREADS
   try {
-    self->cxx->evalEc2(
-        *PyBlitzArrayCxx_AsBlitz<double,2>(u),
-        *PyBlitzArrayCxx_AsBlitz<double,2>(v),
-        *PyBlitzArrayCxx_AsBlitz<double,2>(error)
-        );
+    if (self->cxx32) {
+      self->cxx32->evalEc2(
+          *PyBlitzArrayCxx_AsBlitz<float,2>(u),
+          *PyBlitzArrayCxx_AsBlitz<float,2>(v),
+          *PyBlitzArrayCxx_AsBlitz<float,2>(error)
+          );
+    }
+    else {
+      self->cxx->evalEc2(
+          *PyBlitzArrayCxx_AsBlitz<double,2>(u),
+          *PyBlitzArrayCxx_AsBlitz<double,2>(v),
+          *PyBlitzArrayCxx_AsBlitz<double,2>(error)
+          );
+    }
   }
   catch (std::exception& e) {
-    PyErr_SetString(PyExc_RuntimeError, e.what());
-    return 0;
+    failure = e.what();
+    failed = true;
   }
   catch (...) {
-    PyErr_Format(PyExc_RuntimeError, "%s cannot calculate smoothness error: unknown exception caught", Py_TYPE(self)->tp_name);
+    failed = true;
+  }
+  Py_END_ALLOW_THREADS
+  --self->busy;
+
+  if (failed) {
+    if (failure.empty()) PyErr_Format(PyExc_RuntimeError, "%s cannot calculate smoothness error: unknown exception caught", Py_TYPE(self)->tp_name);
+    else PyErr_SetString(PyExc_RuntimeError, failure.c_str());
     return 0;
   }
 
@@ -463,11 +1233,12 @@ static auto s_eval_eb = bob::extension::FunctionDoc(
     "eval_eb",
     "Calculates the brightness error (:math:`E_b`) as defined in the paper: :math:`E_b = (E_x u + E_y v + E_t)`"
     )
-    .add_prototype("image1, image2, u, v", "error")
-    .add_parameter("image1, image2", "array-like (2D, float64)",
+    .add_prototype("image1, image2, u, v, [out]", "error")
+    .add_parameter("image1, image2", "array-like (2D, float)",
       "Sequence of images the flow was estimated with")
-    .add_parameter("u, v", "array-like (2D, float64)", "The estimated flows in the horizontal and vertical directions (respectively), which should have dimensions matching those of this functor.")
-    .add_return("error", "array (2D, float)", "The evaluated brightness error."
+    .add_parameter("u, v", "array-like (2D, float)", "The estimated flows in the horizontal and vertical directions (respectively), which should have dimensions matching those of this functor.")
+    .add_parameter("out", "array (2D, float)", "If given, the error is written in this array, which should have dimensions matching those of this functor. Otherwise, a new array is returned, which this object recycles once you drop it.")
+    .add_return("error", "array (2D, float)", "The evaluated brightness error, i.e. ``out`` if it was given."
     )
     ;
 
@@ -479,6 +1250,7 @@ static PyObject* PyBobIpOptflowVanillaHornAndSchunck_eval_eb
     "image2",
     "u",
     "v",
+    "out",
     0
     };
   static char** kwlist = const_cast<char**>(const_kwlist);
@@ -487,12 +1259,14 @@ static PyObject* PyBobIpOptflowVanillaHornAndSchunck_eval_eb
   PyBlitzArrayObject* image2 = 0;
   PyBlitzArrayObject* u = 0;
   PyBlitzArrayObject* v = 0;
+  PyBlitzArrayObject* error = 0;
 
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&O&O&O&", kwlist,
-        &PyBlitzArray_Converter, &image1,
-        &PyBlitzArray_Converter, &image2,
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&O&O&O&|O&", kwlist,
+        &PyBobIpOptflowImage_Converter, &image1,
+        &PyBobIpOptflowImage_Converter, &image2,
         &PyBlitzArray_Converter, &u,
-        &PyBlitzArray_Converter, &v
+        &PyBlitzArray_Converter, &v,
+        &PyBlitzArray_OutputConverter, &error
         )) return 0;
 
   //protects acquired resources through this scope
@@ -500,20 +1274,21 @@ static PyObject* PyBobIpOptflowVanillaHornAndSchunck_eval_eb
   auto image2_ = make_safe(image2);
   auto u_ = make_safe(u);
   auto v_ = make_safe(v);
+  auto error_ = make_xsafe(error);
 
-  if (image1->type_num != NPY_FLOAT64 || image1->ndim != 2) {
-    PyErr_Format(PyExc_TypeError, "`%s' only supports 2D 64-bit float arrays for input array `image1'", Py_TYPE(self)->tp_name);
+  if (image1->type_num != self->type_num || image1->ndim != 2) {
+    PyErr_Format(PyExc_TypeError, "`%s' only supports 2D %s arrays for input array `image1'", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(self->type_num));
     return 0;
   }
 
-  if (image2->type_num != NPY_FLOAT64 || image2->ndim != 2) {
-    PyErr_Format(PyExc_TypeError, "`%s' only supports 2D 64-bit float arrays for input array `image2'", Py_TYPE(self)->tp_name);
+  if (image2->type_num != self->type_num || image2->ndim != 2) {
+    PyErr_Format(PyExc_TypeError, "`%s' only supports 2D %s arrays for input array `image2'", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(self->type_num));
     return 0;
   }
 
   //check all input image dimensions are consistent
-  Py_ssize_t height = self->cxx->getShape()(0);
-  Py_ssize_t width = self->cxx->getShape()(1);
+  Py_ssize_t height = PyBobIpOptflowVanillaHornAndSchunck_shape(self)(0);
+  Py_ssize_t width = PyBobIpOptflowVanillaHornAndSchunck_shape(self)(1);
 
   if (image1->shape[0] != height || image1->shape[1] != width) {
     PyErr_Format(PyExc_RuntimeError, "`%s' only supports arrays with shape (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d) for input array `image1', but `image1''s shape is (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d)", Py_TYPE(self)->tp_name, height, width, image1->shape[0], image1->shape[1]);
@@ -525,13 +1300,13 @@ static PyObject* PyBobIpOptflowVanillaHornAndSchunck_eval_eb
     return 0;
   }
 
-  if (u->type_num != NPY_FLOAT64 || u->ndim != 2) {
-    PyErr_Format(PyExc_TypeError, "`%s' only supports 2D 64-bit float arrays for (optional) input array `u'", Py_TYPE(self)->tp_name);
+  if (u->type_num != self->type_num || u->ndim != 2) {
+    PyErr_Format(PyExc_TypeError, "`%s' only supports 2D %s arrays for (optional) input array `u'", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(self->type_num));
     return 0;
   }
 
-  if (v->type_num != NPY_FLOAT64 || v->ndim != 2) {
-    PyErr_Format(PyExc_TypeError, "`%s' only supports 2D 64-bit float arrays for input array `v'", Py_TYPE(self)->tp_name);
+  if (v->type_num != self->type_num || v->ndim != 2) {
+    PyErr_Format(PyExc_TypeError, "`%s' only supports 2D %s arrays for input array `v'", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(self->type_num));
     return 0;
   }
 
@@ -545,27 +1320,65 @@ static PyObject* PyBobIpOptflowVanillaHornAndSchunck_eval_eb
     return 0;
   }
 
-  //allocates the error return
-  auto error = (PyBlitzArrayObject*)PyBlitzArray_SimpleNew(NPY_FLOAT64,
-      u->ndim, u->shape);
-  auto error_ = make_safe(error);
+  if (error) {
+
+    if (error->type_num != self->type_num || error->ndim != 2) {
+      PyErr_Format(PyExc_TypeError, "`%s' only supports 2D %s arrays for (optional) output array `out'", Py_TYPE(self)->tp_name, PyBlitzArray_TypenumAsString(self->type_num));
+      return 0;
+    }
+
+    if (error->shape[0] != height || error->shape[1] != width) {
+      PyErr_Format(PyExc_RuntimeError, "`%s' only supports arrays with shape (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d) for output array `out', but `out''s shape is (%" PY_FORMAT_SIZE_T "d, %" PY_FORMAT_SIZE_T "d)", Py_TYPE(self)->tp_name, height, width, error->shape[0], error->shape[1]);
+      return 0;
+    }
+
+  }
+  else { //allocates the error return
+    error = PyBobIpOptflowArray_Recycle(&self->recycled, self->type_num,
+        u->ndim, u->shape);
+    if (!error) return 0;
+    error_ = make_safe(error);
+  }
 
   /** all basic checks are done, can call the functor now **/
+  //runs without the GIL, so that other Python threads may run meanwhile
+  std::string failure;
+  bool failed = false;
+  ++self->busy;
+  Py_BEGIN_ALLOW_THREADS
   try {
-    self->cxx->evalEb(
-        *PyBlitzArrayCxx_AsBlitz<double,2>(image1),
-        *PyBlitzArrayCxx_AsBlitz<double,2>(image2),
-        *PyBlitzArrayCxx_AsBlitz<double,2>(u),
-        *PyBlitzArrayCxx_AsBlitz<double,2>(v),
-        *PyBlitzArrayCxx_AsBlitz<double,2>(error)
-        );
+    if (self->cxx32) {
+      self->cxx32->evalEb(
+          *PyBlitzArrayCxx_AsBlitz<float,2>(image1),
+          *PyBlitzArrayCxx_AsBlitz<float,2>(image2),
+          *PyBlitzArrayCxx_AsBlitz<float,2>(u),
+          *PyBlitzArrayCxx_AsBlitz<float,2>(v),
+          *PyBlitzArrayCxx_AsBlitz<float,2>(error)
+          );
+    }
+    else {
+      self->cxx->evalEb(
+          *PyBlitzArrayCxx_AsBlitz<double,2>(image1),
+          *PyBlitzArrayCxx_AsBlitz<double,2>(image2),
+          *PyBlitzArrayCxx_AsBlitz<double,2>(u),
+          *PyBlitzArrayCxx_AsBlitz<double,2>(v),
+          *PyBlitzArrayCxx_AsBlitz<double,2>(error)
+          );
+    }
   }
   catch (std::exception& e) {
-    PyErr_SetString(PyExc_RuntimeError, e.what());
-    return 0;
+    failure = e.what();
+    failed = true;
   }
   catch (...) {
-    PyErr_Format(PyExc_RuntimeError, "%s cannot estimate brightness error: unknown exception caught", Py_TYPE(self)->tp_name);
+    failed = true;
+  }
+  Py_END_ALLOW_THREADS
+  --self->busy;
+
+  if (failed) {
+    if (failure.empty()) PyErr_Format(PyExc_RuntimeError, "%s cannot estimate brightness error: unknown exception caught", Py_TYPE(self)->tp_name);
+    else PyErr_SetString(PyExc_RuntimeError, failure.c_str());
     return 0;
   }
 
@@ -581,6 +1394,24 @@ static PyMethodDef PyBobIpOptflowVanillaHornAndSchunck_methods[] = {
     METH_VARARGS|METH_KEYWORDS,
     s_estimate.doc()
   },
+  {
+    s_estimate_async.name(),
+    (PyCFunction)PyBobIpOptflowVanillaHornAndSchunck_estimate_async,
+    METH_VARARGS|METH_KEYWORDS,
+    s_estimate_async.doc()
+  },
+  {
+    s_estimate_awaitable.name(),
+    (PyCFunction)PyBobIpOptflowVanillaHornAndSchunck_estimate_awaitable,
+    METH_VARARGS|METH_KEYWORDS,
+    s_estimate_awaitable.doc()
+  },
+  {
+    s_estimate_sequence.name(),
+    (PyCFunction)PyBobIpOptflowVanillaHornAndSchunck_estimate_sequence,
+    METH_VARARGS|METH_KEYWORDS,
+    s_estimate_sequence.doc()
+  },
   {
     s_eval_ec2.name(),
     (PyCFunction)PyBobIpOptflowVanillaHornAndSchunck_eval_ec2,
@@ -603,7 +1434,11 @@ static PyObject* PyBobIpOptflowVanillaHornAndSchunck_new
   PyBobIpOptflowVanillaHornAndSchunckObject* self =
     (PyBobIpOptflowVanillaHornAndSchunckObject*)type->tp_alloc(type, 0);
 
+  self->type_num = NPY_FLOAT64;
   self->cxx = 0;
+  self->cxx32 = 0;
+  self->busy = 0;
+  self->recycled = 0;
 
   return reinterpret_cast<PyObject*>(self);
 
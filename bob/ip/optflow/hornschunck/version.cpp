@@ -9,7 +9,6 @@
 #include <bob.blitz/config.h>
 #include <bob.blitz/cleanup.h>
 #include <bob.core/config.h>
-#include <bob.sp/config.h>
 
 static PyObject* build_version_dictionary() {
 
@@ -24,7 +23,6 @@ static PyObject* build_version_dictionary() {
   if (!dict_steal(retval, "NumPy", numpy_version())) return 0;
   if (!dict_steal(retval, "bob.blitz", bob_blitz_version())) return 0;
   if (!dict_steal(retval, "bob.core", bob_core_version())) return 0;
-  if (!dict_steal(retval, "bob.sp", bob_sp_version())) return 0;
 
   return Py_BuildValue("O", retval);
 }
@@ -6,7 +6,7 @@
 """Bindings for optical flow from Horn & Schunck
 """
 
-bob_packages = ['bob.core', 'bob.sp']
+bob_packages = ['bob.core']
 
 from setuptools import setup, find_packages, dist
 dist.Distribution(dict(setup_requires=['bob.extension', 'bob.blitz'] + bob_packages))
@@ -47,6 +47,10 @@ setup(
 
       Extension("bob.ip.optflow.hornschunck._library",
         [
+          "bob/ip/optflow/hornschunck/ThreadPool.cpp",
+          "bob/ip/optflow/hornschunck/TaskQueue.cpp",
+          "bob/ip/optflow/hornschunck/Simd.cpp",
+          "bob/ip/optflow/hornschunck/Multigrid.cpp",
           "bob/ip/optflow/hornschunck/SpatioTemporalGradient.cpp",
           "bob/ip/optflow/hornschunck/HornAndSchunckFlow.cpp",
           "bob/ip/optflow/hornschunck/forward.cpp",
@@ -57,6 +61,11 @@ setup(
         ],
         bob_packages = bob_packages,
         version = version,
+        # -Wno-psabi: the SIMD helpers pass wide vectors by value, but are
+        # always inlined into kernels compiled for the matching instruction
+        # set (see Simd.h), so the ABI notes GCC emits for them are moot
+        extra_compile_args = ['-pthread', '-ffp-contract=off', '-Wno-psabi'],
+        extra_link_args = ['-pthread'],
       ),
     ],
 